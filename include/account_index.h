@@ -0,0 +1,23 @@
+// include/account_index.h
+#ifndef ACCOUNT_INDEX_H
+#define ACCOUNT_INDEX_H
+
+#include "common.h"
+
+// --- Account Number Index ---
+// In-memory map from Account.accountNumber to the account's ID and record
+// number, rebuilt from the account shards when the server starts. The
+// record number is a hint: the compactor may have moved the account since,
+// so a lookup re-reads and confirms the record. Accounts another process
+// added (a worker, or bulk_import) are picked up by a catch-up scan the
+// first time a lookup misses after a shard's header has moved on. All
+// functions are thread-safe.
+int account_index_init();
+void account_index_put(const Account* account, int record_num);
+void account_index_remove(const char* accountNumber);
+
+// Reads the account with this number into 'account'. Returns its record
+// number, or -1 with errno ENOENT (no such account) or ETIMEDOUT (busy).
+int account_index_find(const char* accountNumber, Account* account);
+
+#endif // ACCOUNT_INDEX_H
@@ -14,18 +14,57 @@
 #include <errno.h>      // For errno
 #include <sys/types.h>  // For lseek
 #include <pthread.h>    // For threads
+#include <time.h>       // For time_t (transaction timestamps)
 
 // --- Project-Specific Definitions ---
 #define PORT 8080
 #define MAX_BUFFER 1024
 
 // --- File Paths ---
-#define USER_FILE "data/users.dat"
+#define USER_FILE "data/users.dat" // UserAuth records; profiles live in USER_PROFILE_FILE
+#define USER_PROFILE_FILE "data/user_profiles.dat"
 #define ACCOUNT_FILE "data/accounts.dat"
 #define LOAN_FILE "data/loans.dat"
 #define FEEDBACK_FILE "data/feedback.dat"
 #define TRANSACTION_FILE "data/transactions.dat"
 #define TRANSFER_LOG_FILE "data/transfer_log.dat" // <-- THIS WAS THE MISSING LINE
+#define TRANSACTION_INDEX_FILE "data/transactions.idx"
+#define TRANSACTION_BLOCK_FILE "data/transactions.blk"        // Sealed history, compressed
+#define TRANSACTION_BLOCK_INDEX_FILE "data/transactions.bix"  // One TxnBlockEntry per sealed block
+#define SHARD_CONFIG_FILE "data/shards.dat"
+
+// --- Data File Header ---
+// Every record file (users, profiles, accounts, loans, feedback and
+// transactions) starts with one DAT_HEADER_SIZE page, so record n lives at
+// DAT_HEADER_SIZE + n * recordSize (see record_offset). The header is
+// rewritten under the file's append lock whenever records are added. A new,
+// empty file gets its header with its first record.
+#define DAT_HEADER_SIZE 4096
+#define DAT_MAGIC 0x4b4e4142u // "BANK"
+#define DAT_FORMAT_VERSION 1
+
+typedef struct {
+    unsigned int magic;
+    int version;      // DAT_FORMAT_VERSION when written
+    int recordSize;   // sizeof the record struct the file holds
+    int liveCount;    // Records in use
+    int nextId;       // One past the highest ID written (profiles: user IDs)
+    int freeHead;     // First free record slot, or -1
+} DatHeader;
+
+// --- Free Slots ---
+// Removing a user or account tombstones its slot in users.dat (with the
+// profile beside it) or its account shard: the ID field becomes
+// FREE_SLOT_ID and the next int links the file's free list, which starts at
+// DatHeader.freeHead and ends at -1. New records fill free slots before the
+// file grows, and the server's compactor moves live records down into them
+// and truncates the tail. IDs are never reused.
+#define FREE_SLOT_ID -1
+
+typedef struct {
+    int id;       // FREE_SLOT_ID
+    int nextFree; // Next free record slot, or -1
+} FreeSlot;
 
 // --- Data Structures ---
 typedef enum {
@@ -47,6 +86,26 @@ typedef struct {
     char address[256];
 } User;
 
+// --- User Store (hot/cold split) ---
+// users.dat holds only what logins and ID lookups read (UserAuth, 64 bytes);
+// the rest of each user sits in user_profiles.dat at the same record number.
+// User is the joined view handlers work with (see read_user_record).
+typedef struct {
+    int userId;
+    char password[50];
+    UserRole role;
+    int isActive;
+} UserAuth;
+
+typedef struct {
+    int userId;
+    char firstName[50];
+    char lastName[50];
+    char phone[15];
+    char email[100];
+    char address[256];
+} UserProfile;
+
 typedef struct {
     int accountId;
     int ownerUserId;
@@ -70,8 +129,32 @@ typedef struct {
     double amount;
     double newBalance;
     char otherPartyAccountNumber[20]; 
+    time_t timestamp; // Seconds since the epoch; never decreases along the file
 } Transaction;
 
+// --- Sparse Time Index over transactions.dat ---
+// One entry every TXN_INDEX_STRIDE records, so a date-range scan can
+// binary-search to its starting record instead of reading from byte zero.
+#define TXN_INDEX_STRIDE 1024
+
+typedef struct {
+    time_t timestamp;
+    int recordNum;
+} TxnIndexEntry;
+
+// --- Sealed History Blocks ---
+// Once history is old enough, each run of TXN_BLOCK_ROWS records is packed
+// into transactions.blk and its rows are punched out of transactions.dat,
+// which keeps its size and record numbering. Block k holds records
+// k * TXN_BLOCK_ROWS onwards, so it lines up with time index entry k.
+#define TXN_BLOCK_ROWS TXN_INDEX_STRIDE
+
+typedef struct {
+    off_t offset;   // Where the block starts in transactions.blk
+    int length;     // Encoded bytes
+    int rowCount;   // Always TXN_BLOCK_ROWS
+} TxnBlockEntry;
+
 typedef enum {
     PENDING,
     PROCESSING,
@@ -99,7 +182,10 @@ typedef struct {
 // --- ADDED: New Structs for Write-Ahead Log ---
 typedef enum {
     LOG_START,
-    LOG_COMMIT
+    LOG_COMMIT,
+    LOG_PREPARED, // Participant side of a cross-shard transfer
+    LOG_ABORT,    // The group is closed: undone by its writer, or by recovery
+    LOG_UNDO      // An account the group writes on its own shard, and its balance before
 } LogStatus;
 
 typedef struct {
@@ -111,4 +197,31 @@ typedef struct {
 } TransferLog;
 // --- END ADDED ---
 
+// --- Account Shards ---
+// Accounts may be split by ID range across data/accounts.<k>.dat, each shard
+// with its own data/transfer_log.<k>.dat. Account IDs 1..idRange go to shard
+// 0, the next idRange to shard 1, and so on, wrapping around. Without
+// SHARD_CONFIG_FILE there is one shard kept in ACCOUNT_FILE and
+// TRANSFER_LOG_FILE, which is the layout ./admin_util creates.
+#define MAX_ACCOUNT_SHARDS 64
+#define DEFAULT_SHARD_ID_RANGE 1000
+
+typedef struct {
+    int shardCount;
+    int idRange;
+} ShardConfig;
+
+// --- Batch (Payroll) Transfers ---
+// A batch is logged as one TransferLog group whose toAccountId is
+// BATCH_TRANSFER_TARGET and whose amount is the total debit. Like a single
+// transfer, its START is followed by a LOG_UNDO for every account it writes
+// on the sender's shard, so recovery puts back exactly what landed.
+#define BATCH_TRANSFER_TARGET 0
+#define MAX_BATCH_CREDITS 10000
+
+typedef struct {
+    int toAccountId;
+    double amount;
+} BatchCredit;
+
 #endif // COMMON_H
\ No newline at end of file
@@ -6,5 +6,6 @@
 
 // --- Main Client Handler (The "Router") ---
 void* handle_client(void* client_socket_ptr);
+void* handle_handed_off_client(void* client_ptr); // Takes a malloc'd HandedOffClient
 
 #endif // CONTROLLER_H
\ No newline at end of file
@@ -0,0 +1,32 @@
+// include/coroutine.h
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include "common.h"
+
+// --- Session Threads (coroutines) ---
+// Each client dialogue runs as a coroutine on one of a few session threads
+// instead of owning an OS thread. The handlers stay straight-line code:
+// when read_client_input (or a reply) would block, the session's socket is
+// armed in its thread's epoll set and the coroutine yields; the thread runs
+// whichever other sessions are ready and resumes this one once its client
+// has typed. A session always resumes on the thread it started on.
+//
+// A waiting session costs its small stack (only the pages it has touched)
+// and its socket. Handlers still block their thread on disk I/O and on lock
+// waits, which the lock timeout bounds, so an idle dialogue never holds a
+// thread but a busy one briefly does.
+#define DEFAULT_SESSION_THREADS 4
+#define MAX_SESSION_THREADS 64
+#define COROUTINE_STACK_SIZE (256 * 1024)
+
+// Starts 'count' session threads in this process; 0 keeps one thread per
+// client. Call after fork(), since threads do not survive it.
+int start_session_threads(int count);
+int session_thread_count();
+
+// Runs run(arg) as a session serving 'client_socket', which is made
+// non-blocking. Without session threads it gets its own detached thread.
+int spawn_session(int client_socket, void* (*run)(void*), void* arg);
+
+#endif // COROUTINE_H
@@ -0,0 +1,35 @@
+// include/customer_search.h
+#ifndef CUSTOMER_SEARCH_H
+#define CUSTOMER_SEARCH_H
+
+#include "common.h"
+
+// --- Customer Search Index ---
+// In-memory trigram index over every customer's full name, phone and email,
+// rebuilt from the user store when the server starts and kept current by
+// handle_add_user, handle_modify_user_details and user removal. Customers
+// bulk_import adds are picked up by a catch-up pass on the next search.
+// All functions are thread-safe.
+#define CUSTOMER_SEARCH_MIN_QUERY 3 // One trigram
+#define CUSTOMER_SEARCH_MAX_RESULTS 20
+
+typedef struct {
+    int userId;
+    int score; // 3 = a whole field matches, 2 = a field starts with it, 1 = contains it
+    char firstName[50];
+    char lastName[50];
+    char phone[15];
+    char email[100];
+} CustomerMatch;
+
+int customer_search_init();
+void customer_search_put(const User* user); // Adds, updates, or drops a non-customer
+void customer_search_remove(int userId);
+
+// Case-insensitive substring search. Fills 'out' with the best 'max'
+// matches, best first (ties by user ID), and sets *total to the number of
+// customers matching. Returns how many were copied, or -1 if the query is
+// shorter than CUSTOMER_SEARCH_MIN_QUERY or memory runs out.
+int customer_search(const char* query, CustomerMatch* out, int max, int* total);
+
+#endif // CUSTOMER_SEARCH_H
@@ -0,0 +1,32 @@
+// include/feedback_index.h
+#ifndef FEEDBACK_INDEX_H
+#define FEEDBACK_INDEX_H
+
+#include "common.h"
+
+// --- Feedback Indexes ---
+// In-memory views of feedback.dat, rebuilt when the server starts: a FIFO
+// of unreviewed entries for managers, and each customer's entries for the
+// status screen. Both hold record numbers; readers pread the records they
+// need. All functions are thread-safe.
+typedef struct {
+    int feedbackId;
+    int recordNum;  // Position in feedback.dat
+    int userId;
+} FeedbackRef;
+
+int feedback_index_init();
+void feedback_index_add(const Feedback* feedback, int record_num);
+
+// --- Unreviewed Queue ---
+int feedback_queue_peek(FeedbackRef* out, int max);
+int feedback_queue_size();
+int feedback_queue_find(int feedbackId);
+void feedback_queue_remove(int feedbackId);
+
+// --- Per-User Index ---
+// Copies a user's feedback record numbers, oldest first, into a malloc'd
+// array the caller frees. Returns the count, or -1 if out of memory.
+int feedback_records_of(int userId, int** out);
+
+#endif // FEEDBACK_INDEX_H
@@ -0,0 +1,30 @@
+// include/hashmap.h
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include "common.h"
+
+// --- Integer Hash Map (open addressing, linear probing) ---
+// Maps an int key to a long value. Not thread-safe: callers that share
+// a map between threads must guard it with their own mutex.
+typedef struct {
+    int* keys;
+    long* values;
+    unsigned char* used;
+    size_t capacity; // Always a power of two
+    size_t count;
+} IntMap;
+
+int intmap_init(IntMap* map, size_t initial_capacity);
+void intmap_free(IntMap* map);
+void intmap_clear(IntMap* map);
+
+int intmap_put(IntMap* map, int key, long value);
+int intmap_get(const IntMap* map, int key, long* value);
+int intmap_remove(IntMap* map, int key);
+
+// Returns the slot index of the next used entry at or after 'pos', or -1.
+// Iterate with: for (long i = intmap_next(m, 0); i != -1; i = intmap_next(m, i + 1))
+long intmap_next(const IntMap* map, size_t pos);
+
+#endif // HASHMAP_H
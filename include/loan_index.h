@@ -0,0 +1,48 @@
+// include/loan_index.h
+#ifndef LOAN_INDEX_H
+#define LOAN_INDEX_H
+
+#include "common.h"
+
+// --- Pending-Loan Work Queue ---
+// In-memory FIFO of PENDING, unassigned loans in application order, rebuilt
+// from loans.dat when the server starts. All functions are thread-safe.
+typedef struct {
+    int loanId;
+    int recordNum;  // Position in loans.dat
+    int userId;
+    double amount;
+} PendingLoan;
+
+int loan_queue_init();
+void loan_queue_push(const Loan* loan, int record_num);
+int loan_queue_peek(PendingLoan* out, int max);
+int loan_queue_size();
+
+// Removes 'loanId' from the queue so no one else can take it. Returns 1 and
+// fills 'out' on success, 0 if it is not queued (never pending, or already
+// claimed). A claimer that fails to commit must loan_queue_release() it.
+int loan_queue_claim(int loanId, PendingLoan* out);
+void loan_queue_release(const PendingLoan* loan);
+
+// --- Workload-Aware Assignment ---
+// Keeps an inbox of open (PENDING or PROCESSING) loans per employee and
+// routes pending loans to the active employee with the smallest inbox.
+// Rebuilt from disk at server start.
+typedef struct {
+    int loanId;
+    int recordNum;  // Position in loans.dat
+} InboxEntry;
+
+int workload_init();
+void workload_set_employee(int employeeId, int can_receive);
+void workload_loan_closed(int employeeId, int loanId);
+int workload_of(int employeeId);
+
+int inbox_snapshot(int employeeId, InboxEntry** out);
+int inbox_find(int employeeId, int loanId);
+
+int assign_claimed_loan(const PendingLoan* claimed, int employeeId);
+int assign_all_pending_loans(int* remaining);
+
+#endif // LOAN_INDEX_H
@@ -4,17 +4,110 @@
 
 #include "common.h"
 
+// --- Record Access (lock-free reads, seqlock-published writes) ---
+void init_record_locks();
+int read_user_auth(int record_num, UserAuth* auth);
+int read_user_record(int record_num, User* user); // Auth and profile, joined
+int read_account_record(int accountId, int record_num, Account* account);
+int write_user_record(int fd, int record_num, const User* user);
+int write_account_record(int fd, int record_num, const Account* account);
+
+// --- Lookups by ID ---
+// Record numbers from the find functions are hints: a record can move to a
+// reused or compacted slot at any time. These return the record number of
+// a record confirmed to carry the ID, or -1 with errno ENOENT (no such ID)
+// or ETIMEDOUT (busy). The lock_ variants hold its write lock on 'fd' on
+// success; release it with set_record_lock(..., F_UNLCK).
+int read_user_by_id(int userId, User* user);
+int read_account_by_id(int accountId, Account* account);
+int lock_user_by_id(int fd, int userId, User* user);
+int lock_account_by_id(int fd, int accountId, Account* account);
+
+// --- Data File Headers ---
+// See DatHeader in common.h. The offline tools and ./server refuse to run
+// until every record file has one (./migrate_data add-headers).
+typedef struct {
+    char path[64];
+    size_t recordSize;
+} DataFile;
+#define MAX_DATA_FILES (MAX_ACCOUNT_SHARDS + 5)
+#define DAT_HEADERS_NEEDED_MESSAGE "ERROR: Some data files have no header page. Run ./migrate_data add-headers first.\n"
+
+int read_dat_header(int fd, DatHeader* header); // 0, or -1 if missing or not a header
+void init_dat_header(DatHeader* header, size_t record_size); // Empty file, next ID 1
+// Appends 'count' records and updates the header's live count, and its next
+// ID if 'next_id' is higher. The caller holds the file's append lock and
+// opened it without O_APPEND. Returns the first new record number, or -1.
+int append_records(int fd, const char* path, const void* records, size_t record_size, int count, int next_id);
+int list_data_files(DataFile* files); // Every record file of the current layout
+int data_files_need_headers();
+int live_record_count(const char* path); // From the header: O(1)
+
+// --- User Store ---
+// 'fd' is always users.dat. Writers lock its record (sizeof(UserAuth)) or,
+// to append, the whole file; that lock covers the profile too.
+// append_user_records returns the first new record number, or -1.
+int append_user_records(int fd, const User* users, int count);
+void split_user(const User* user, UserAuth* auth, UserProfile* profile);
+void join_user(const UserAuth* auth, const UserProfile* profile, User* user);
+int user_store_needs_split(); // 1 while users.dat still holds whole User records
+#define USER_SPLIT_NEEDED_MESSAGE "ERROR: users.dat still holds whole user records. Run ./migrate_data split-users first.\n"
+
+// --- Free Slots and Compaction ---
+// See FreeSlot in common.h. The caller holds the whole-file write lock on
+// users.dat or the account's shard. insert_ functions fill a free slot or
+// append; they return the record number, or -1.
+int remove_user_record(int fd, int record_num);
+int remove_account_record(int fd, int accountId, int record_num);
+int insert_user_record(int fd, const User* user);
+int insert_account_record(int fd, const Account* account);
+// Moves live records into free slots and truncates the freed tail of the
+// user store and every account shard, a batch at a time under each file's
+// lock. Returns the slots reclaimed, or -1 on an error.
+#define DEFAULT_COMPACT_INTERVAL_S 300
+int compact_record_files();
+
+// --- Account Shards ---
+// Account record numbers are positions within the account's shard file.
+int account_shard_count();
+int account_shard_id_range();
+int account_shard_of(int accountId);
+void account_file_path(int shard, int shard_count, char* path);
+void transfer_log_path(int shard, int shard_count, char* path);
+int open_account_shard(int shard, int flags);
+int open_account_file(int accountId, int flags);
+
+// --- Replication Hook ---
+// ./server passes every record it writes to the hook (see replication.h);
+// the offline tools never set one. Call these right after the write, while
+// still holding the lock that ordered it.
+void set_replication_hook(void (*on_write)(const char* path, off_t offset, const void* data, size_t size));
+void replicate_write(const char* path, off_t offset, const void* data, size_t size);
+void replicate_append(int fd, const char* path, const void* data, size_t size);
+void replicate_truncate(const char* path, off_t length);
+int apply_replicated_write(int fd, const char* path, off_t offset, const void* data, size_t size);
+
 // --- Record-Finding Functions ---
+// ./server calls init_id_filters() before forking its workers: it maps an
+// in-memory bitmap of user and account IDs, shared with the workers, so a
+// lookup of an ID that does not exist returns -1 without reading the file.
+// Returns 0, or -1 if the bitmaps cannot be mapped (every lookup scans).
+int init_id_filters();
 int find_user_record(int userId);
 int find_account_record_by_id(int userId);
 int find_loan_record(int loanId);
 int find_feedback_record(int feedbackId);
+int find_user_record_by_email(const char* email);
+int find_account_records(const int* accountIds, int* record_nums, int count);
 
 // --- Authentication ---
 User check_login(int userId, char* password);
 
 // --- Data Creation/Update Functions ---
 void log_transaction(int accountId, int userId, TransactionType type, double amount, double newBalance, const char* otherPartyAccount);
+int log_transactions(Transaction* txns, int count);
+int execute_transfer(int fromAccountId, int toAccountId, double amount, char* message);
+int execute_batch_transfer(int fromAccountId, const BatchCredit* credits, int count, char* message);
 
 // --- ID Generation Functions ---
 int get_next_user_id();
@@ -22,10 +115,53 @@ int get_next_loan_id();
 int get_next_feedback_id();
 int get_next_transaction_id();
 
+// --- Transaction Time Index ---
+int find_transaction_record_at(time_t from);
+int rebuild_transaction_index();
+
+// --- Snapshot Reads ---
+// Report scans copy what they need under a brief lock and format it afterwards.
+// Returns the number of matches copied into *out, or -1 with errno
+// ETIMEDOUT (the file stayed locked) or ENOMEM; never a partial list.
+typedef int (*RecordMatch)(const void* record, const void* ctx);
+int snapshot_records(const char* path, size_t record_size, RecordMatch match, const void* ctx, void** out);
+
+// Reads transactions in record order, decoding sealed blocks on the way,
+// one block's worth of rows per refill.
+typedef struct {
+    int fd;
+    int block_fd;        // transactions.blk, opened once a sealed block is read
+    int block_index_fd;  // transactions.bix, or -1 while nothing is sealed
+    int sealed;          // Sealed blocks when last checked
+    off_t offset;        // Next byte to read
+    off_t end;           // File size when the cursor was opened
+    Transaction* rows;   // TXN_BLOCK_ROWS rows
+    unsigned char* packed; // One encoded block
+    int count;
+    int next;
+} TransactionCursor;
+
+int txn_cursor_open(TransactionCursor* cursor, int start_record);
+const Transaction* txn_cursor_next(TransactionCursor* cursor);
+void txn_cursor_close(TransactionCursor* cursor);
+
+// --- Sealed History ---
+// The newest TXN_HOT_BLOCKS full blocks (and the partial one being
+// appended to) always stay as plain records.
+#define TXN_HOT_BLOCKS 4
+#define DEFAULT_SEAL_INTERVAL_S 60
+
+int sealed_transaction_blocks();
+// Decodes sealed block 'block' into rows[0..TXN_BLOCK_ROWS). Returns 0 or -1.
+int read_transaction_block(int block, Transaction* rows);
+// Packs every full block older than the hot ones. Returns the number of
+// blocks sealed, 0 if another process is sealing, or -1 on an error.
+int seal_transaction_history();
+
 // --- ADDED: Transfer Log Prototypes ---
-long get_next_transfer_id();
-void write_transfer_log(TransferLog* log_entry);
-void perform_recovery_check();
+void write_transfer_log(int shard, TransferLog* log_entry);
+void recover_shard_transfers(int shard);
+void perform_recovery_check(); // Every shard
 // --- END ADDED ---
 
 #endif // MODEL_H
\ No newline at end of file
@@ -0,0 +1,35 @@
+// include/replication.h
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include "common.h"
+
+// --- Log-Shipping Hot Standby ---
+// The primary passes every record it writes (account and user images, loan
+// and feedback records, transaction rows and transfer-log entries) to a
+// change ring, tagged with the file and byte offset it went to. A standby
+// (./server --standby DIR) attaches over REPLICATION_SOCKET, receives a live
+// copy of every data file into DIR/data, then applies the stream as it
+// arrives. Record images land at fixed offsets, so replaying one the copy
+// already holds is harmless and the copy needs no global lock.
+//
+// The standby answers read-only customer queries on STANDBY_PORT. When the
+// stream ends it tries to bind PORT: if the primary still holds it the
+// standby re-attaches, otherwise it runs crash recovery on its copy and takes
+// over as the primary. Only single-process mode feeds standbys.
+#define REPLICATION_SOCKET "data/replication.sock"
+#define STANDBY_PORT (PORT + 1)
+#define STANDBY_READ_ONLY_MESSAGE "This is a read-only standby. Use the primary (port 8080) for this.\n"
+
+// Primary side: installs the model's replication hook and accepts standbys.
+int start_replication_source();
+
+// Standby side. attach_to_primary connects and applies the base copy,
+// returning the stream's socket, or -1. follow_primary_stream applies
+// changes until the primary goes away.
+int attach_to_primary(const char* socket_path);
+void follow_primary_stream(int primary_socket);
+int standby_read_only(); // 1 until a standby is promoted
+void promote_standby();
+
+#endif // REPLICATION_H
@@ -0,0 +1,57 @@
+// include/session.h
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "common.h"
+
+// --- Active Sessions ---
+// One live connection per user. A resumed session may take over the slot
+// of a connection that has not yet noticed it dropped.
+#define MAX_SESSIONS 10000
+
+#define SESSION_OK 0
+#define SESSION_ALREADY_ACTIVE 1
+#define SESSION_SERVER_FULL 2
+
+int session_acquire(int userId, int client_socket, int take_over);
+void session_release(int userId, int client_socket);
+
+// --- Resumable Session Tokens ---
+// Issued at login and held in memory with a sliding expiry. Presenting a
+// valid token resumes straight into the role menu with the User cached at
+// login, so a reconnect touches neither the user file nor check_login.
+#define SESSION_TOKEN_LEN 32 // Hex characters (128 random bits)
+#define DEFAULT_SESSION_TTL_S 900
+
+void set_session_ttl(int seconds);
+int session_token_issue(const User* user, char* token_out);
+int session_token_resume(const char* token, User* out);
+
+// Drops a user's token so their next reconnect needs a full login. Called
+// on logout and whenever the cached User (password, role, status) changes.
+void session_token_revoke(int userId);
+void session_token_revoke_local(int userId); // Skips the revoke hook
+
+// In ./server --workers mode each worker stamps its index into the first
+// byte of the tokens it issues, so a resume that reaches another worker
+// can be handed to the one holding the token. 'on_revoke' tells the other
+// workers to drop their copy of a revoked user's token.
+void set_session_token_tag(int tag, void (*on_revoke)(int userId));
+int session_token_tag(const char* token);
+
+// --- Idle Reaper ---
+// A background thread closes connections that sit at a prompt longer than
+// the idle timeout (0 disables it). Each handler registers its socket;
+// read_client_input stamps when the session starts waiting for input, and
+// the reaper checks those stamps on a one-second timer wheel. A reaped
+// handler's read returns 0, so it cleans up like any dropped client.
+#define DEFAULT_IDLE_TIMEOUT_S 300
+
+typedef struct IdleWatch IdleWatch;
+
+int start_idle_reaper(int timeout_s);
+IdleWatch* idle_watch(int client_socket);
+void idle_unwatch(IdleWatch* watch);
+long get_reaped_count();
+
+#endif // SESSION_H
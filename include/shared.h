@@ -7,8 +7,14 @@
 // --- FIX: Add prototypes for the validation helpers ---
 int get_valid_string(int client_socket, char* dest, int max_len);
 int get_valid_email(int client_socket, char* dest, int max_len);
+int is_email_valid(const char* email);
+int is_valid_amount(const char* str);
 // --- END FIX ---
 
+// --- Transaction Table Helpers ---
+void write_transaction_header(int client_socket);
+void write_transaction_row(int client_socket, const Transaction* txn);
+
 // --- Shared Handler Functions ---
 void handle_view_my_details(int client_socket, User user);
 void handle_change_password(int client_socket, int userId);
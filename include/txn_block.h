@@ -0,0 +1,36 @@
+// include/txn_block.h
+#ifndef TXN_BLOCK_H
+#define TXN_BLOCK_H
+
+#include "common.h"
+
+// --- Sealed Transaction Blocks (codec) ---
+// A block packs up to TXN_BLOCK_ROWS consecutive transactions into bytes:
+// a TxnBlockHeader, a dictionary of the distinct counterparty account
+// numbers, then one variable-length row each. Within a row, IDs and
+// timestamps are deltas from the previous row, amounts and balances are
+// whole paise when they are exact (raw doubles otherwise), and the
+// counterparty is a dictionary index. A typical row takes 12-16 bytes
+// instead of sizeof(Transaction).
+#define TXN_BLOCK_MAGIC 0x31425854u // "TXB1"
+
+typedef struct {
+    unsigned int magic;
+    int rowCount;
+    int firstTransactionId;
+    int dictionarySize;
+    time_t firstTimestamp;
+} TxnBlockHeader;
+
+// Largest encoding of 'count' rows; size encode buffers with this.
+size_t txn_block_max_size(int count);
+
+// Encodes rows[0..count) into 'out'. Returns the bytes used, or 0 if a row
+// cannot be encoded (an unknown transaction type).
+size_t encode_txn_block(const Transaction* rows, int count, unsigned char* out);
+
+// Decodes a block into at most 'max_rows' rows (unused bytes zeroed).
+// Returns the row count, or -1 if the block is corrupt.
+int decode_txn_block(const unsigned char* data, size_t size, Transaction* rows, int max_rows);
+
+#endif // TXN_BLOCK_H
@@ -0,0 +1,47 @@
+// include/uring.h
+#ifndef URING_H
+#define URING_H
+
+#include "common.h"
+
+// --- Batched File I/O (io_uring) ---
+// Queues preads and pwrites and submits them together: one io_uring_enter()
+// per IO_RING_ENTRIES operations instead of one syscall each. Each thread
+// gets its own small ring on first use, so client threads never contend for
+// one. A linked batch runs in order and stops at the first failed or short
+// operation, cancelling the rest, which is what a WAL group needs: the
+// COMMIT at the end lands only if every record before it did.
+//
+// Without io_uring (old kernel, blocked by seccomp, or turned off with
+// set_io_uring_enabled) the same batch runs as plain pread/pwrite calls with
+// the same semantics.
+#define IO_RING_ENTRIES 64
+
+typedef struct {
+    int fd;
+    int is_write;
+    void* buf;
+    size_t len;
+    off_t offset;
+    ssize_t result; // Bytes moved, or -errno (-ECANCELED after a failed link)
+} IoOp;
+
+typedef struct {
+    IoOp* ops;
+    int count;
+    int capacity;
+} IoBatch;
+
+void io_batch_init(IoBatch* batch);
+void io_batch_free(IoBatch* batch);
+int io_batch_read(IoBatch* batch, int fd, void* buf, size_t len, off_t offset);
+int io_batch_write(IoBatch* batch, int fd, const void* buf, size_t len, off_t offset);
+
+// Runs every queued operation; 'linked' makes them a chain. Returns 0 if all
+// of them moved their full length, else -1 (see each op's result).
+int io_batch_submit(IoBatch* batch, int linked);
+
+void set_io_uring_enabled(int enabled);
+int io_uring_available(); // Probes once; 0 means batches use pread/pwrite
+
+#endif // URING_H
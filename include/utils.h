@@ -10,8 +10,41 @@ int my_strcmp(const char* s1, const char* s2);
 
 // --- FIX: Changed prototype to return int for error/disconnect checking
 int read_client_input(int client_socket, char* buffer, int size);
+int client_disconnected(); // 1 once a read on this session's client failed
+// Points read_client_input at a stamp it sets to the time a wait for input
+// starts, and back to 0 once input arrives (the idle reaper reads it).
+void track_client_idle(time_t* idle_since);
+
+// Per-session client state. Each thread has its own by default; a
+// scheduler running many sessions on one thread swaps in the session's
+// state before resuming it (NULL restores the thread's own).
+typedef struct {
+    int gone;
+    time_t* idle_since;
+} ClientIoState;
+
+void set_client_io_state(ClientIoState* state);
+
+// Called when a client socket would block (EAGAIN). It returns 0 once the
+// socket is ready for the read (for_write 0) or write (for_write 1).
+void set_client_io_wait(int (*wait)(int fd, int for_write));
+
+// --- Record Files ---
+// Byte offset of record 'record_num', and how many records fit in a file of
+// 'file_size' bytes (a torn tail does not count). Both skip the header page.
+off_t record_offset(int record_num, size_t record_size);
+int record_count(off_t file_size, size_t record_size);
 
 // --- Locking Functions ---
+// set_file_lock/set_record_lock give up after the configured timeout and
+// return -1 with errno == ETIMEDOUT; callers report "System busy".
+// Unlocking never times out.
+#define LOCK_WAIT_FOREVER 0
+#define LOCK_BUSY_MESSAGE "System busy, please try again.\n"
+
+void set_lock_timeout(int timeout_ms);
+long get_lock_timeout_count();
+int lock_range(int fd, off_t start, off_t len, int lock_type, int timeout_ms);
 int set_file_lock(int fd, int lock_type);
 int set_record_lock(int fd, int record_num, int record_size, int lock_type);
 
@@ -0,0 +1,45 @@
+// include/worker.h
+#ifndef WORKER_H
+#define WORKER_H
+
+#include "common.h"
+#include "session.h"
+
+// --- Worker Processes ---
+// ./server --workers N forks one worker per account shard. Each binds the
+// port with SO_REUSEPORT, so the kernel spreads new connections across
+// them. A customer's session runs in the worker that owns their account's
+// shard and every staff session runs in STAFF_WORKER, which keeps each
+// process's in-memory indexes authoritative for the users it serves. A
+// login that lands on the wrong worker is passed, socket and all, to the
+// owner over a datagram socketpair. The parent only supervises: a worker
+// that dies is forked again once its shard's transfers are recovered, so a
+// crash ends only that worker's sessions.
+#define STAFF_WORKER 0
+
+// A client socket passed between workers, with what the receiver needs to
+// finish the login: the authenticated user, or the token to resume.
+typedef struct {
+    int client_socket;
+    int resume;
+    User user;
+    char token[SESSION_TOKEN_LEN + 1];
+} HandedOffClient;
+
+// Forks 'count' workers that each run 'worker_main' and restarts any that
+// exit. Returns only if the workers could not be set up.
+int run_workers(int count, void (*worker_main)(int index));
+int start_worker_channel();
+int worker_index(); // -1 outside worker mode
+
+// The worker that must serve a session, or -1 if it is this process.
+int session_owner(const User* user);
+int resume_owner(const char* token);
+int hand_off_client(int owner, const HandedOffClient* client);
+
+// Keep the staff worker's queues current. Outside worker mode, and in the
+// staff worker itself, these update the local indexes directly.
+void publish_loan(const Loan* loan, int record_num);
+void publish_feedback(const Feedback* feedback, int record_num);
+
+#endif // WORKER_H
@@ -0,0 +1,203 @@
+// src/account_index.c
+#include "account_index.h"
+#include "model.h"
+#include "hashmap.h"
+#include "utils.h"
+
+#define ACCOUNT_NUMBER_LEN 20 // sizeof(Account.accountNumber)
+
+// --- Index Storage ---
+// 'by_hash' maps an FNV-1a hash of the account number to the chain of
+// entries sharing that hash. covered[k] is the nextId shard k's header had
+// when it was last scanned, moved on by accounts put here in ID order; a
+// header past it means another process has added accounts since. One
+// mutex guards both.
+typedef struct NumberEntry {
+    char accountNumber[ACCOUNT_NUMBER_LEN];
+    int accountId;
+    int recordNum; // Where the account was when indexed
+    struct NumberEntry* next;
+} NumberEntry;
+
+static IntMap by_hash;
+static int covered[MAX_ACCOUNT_SHARDS];
+static int index_ready = 0;
+static pthread_mutex_t index_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// --- Internal Helpers (caller holds index_mutex) ---
+
+static int ensure_ready() {
+    if (index_ready) return 0;
+    if (intmap_init(&by_hash, 64) == -1) return -1;
+    index_ready = 1;
+    return 0;
+}
+
+static int hash_number(const char* number) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < ACCOUNT_NUMBER_LEN && number[i] != '\0'; i++) {
+        hash = (hash ^ (unsigned char)number[i]) * 16777619u;
+    }
+    return (int)hash;
+}
+
+static int same_number(const char* a, const char* b) {
+    return strncmp(a, b, ACCOUNT_NUMBER_LEN) == 0;
+}
+
+static NumberEntry* find_entry(const char* number) {
+    long head;
+    if (!intmap_get(&by_hash, hash_number(number), &head)) return NULL;
+    for (NumberEntry* entry = (NumberEntry*)head; entry != NULL; entry = entry->next) {
+        if (same_number(entry->accountNumber, number)) return entry;
+    }
+    return NULL;
+}
+
+static int put_entry(const Account* account, int record_num) {
+    NumberEntry* entry = find_entry(account->accountNumber);
+    if (entry == NULL) {
+        int key = hash_number(account->accountNumber);
+        long head = 0;
+        entry = (NumberEntry*)malloc(sizeof(NumberEntry));
+        if (entry == NULL) return -1;
+        memcpy(entry->accountNumber, account->accountNumber, ACCOUNT_NUMBER_LEN);
+        intmap_get(&by_hash, key, &head);
+        entry->next = (NumberEntry*)head;
+        if (intmap_put(&by_hash, key, (long)entry) == -1) { free(entry); return -1; }
+    }
+    entry->accountId = account->accountId;
+    entry->recordNum = record_num;
+    return 0;
+}
+
+static void remove_entry(const char* number) {
+    int key = hash_number(number);
+    long head;
+    if (!intmap_get(&by_hash, key, &head)) return;
+    NumberEntry* prev = NULL;
+    for (NumberEntry* entry = (NumberEntry*)head; entry != NULL; prev = entry, entry = entry->next) {
+        if (!same_number(entry->accountNumber, number)) continue;
+        if (prev != NULL) prev->next = entry->next;
+        else if (entry->next != NULL) intmap_put(&by_hash, key, (long)entry->next);
+        else intmap_remove(&by_hash, key);
+        free(entry);
+        return;
+    }
+}
+
+static void clear_index() {
+    for (long i = intmap_next(&by_hash, 0); i != -1; i = intmap_next(&by_hash, i + 1)) {
+        NumberEntry* entry = (NumberEntry*)by_hash.values[i];
+        while (entry != NULL) {
+            NumberEntry* next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+    intmap_clear(&by_hash);
+    memset(covered, 0, sizeof(covered));
+}
+
+// Indexes every live account in the shard. The whole-file read lock keeps
+// the compactor from moving an account past the scan. Returns 0, or -1 if
+// the shard is busy or memory runs out.
+static int scan_shard(int shard) {
+    int fd = open_account_shard(shard, O_RDONLY);
+    if (fd == -1) return 0; // No accounts yet
+    if (set_file_lock(fd, F_RDLCK) == -1) { close(fd); return -1; }
+    int status = 0;
+    DatHeader header;
+    if (read_dat_header(fd, &header) == 0) {
+        Account batch[64];
+        int record_num = 0;
+        ssize_t got;
+        while (status == 0 && (got = pread(fd, batch, sizeof(batch), record_offset(record_num, sizeof(Account)))) >= (ssize_t)sizeof(Account)) {
+            int n = got / sizeof(Account);
+            for (int i = 0; i < n && status == 0; i++) {
+                if (batch[i].accountId != FREE_SLOT_ID) status = put_entry(&batch[i], record_num + i);
+            }
+            record_num += n;
+        }
+        if (status == 0 && header.nextId > covered[shard]) covered[shard] = header.nextId;
+    }
+    set_file_lock(fd, F_UNLCK);
+    close(fd);
+    return status;
+}
+
+// Rescans the shards whose headers show accounts this index has not seen.
+// Returns how many were rescanned.
+static int catch_up() {
+    int scanned = 0;
+    for (int shard = 0; shard < account_shard_count(); shard++) {
+        DatHeader header;
+        int fd = open_account_shard(shard, O_RDONLY);
+        if (fd == -1) continue;
+        int stale = read_dat_header(fd, &header) == 0 && header.nextId > covered[shard];
+        close(fd);
+        if (stale && scan_shard(shard) == 0) scanned++;
+    }
+    return scanned;
+}
+
+// --- Public Functions ---
+
+int account_index_init() {
+    pthread_mutex_lock(&index_mutex);
+    int status = ensure_ready();
+    if (status == 0) {
+        clear_index();
+        for (int shard = 0; shard < account_shard_count() && status == 0; shard++) {
+            status = scan_shard(shard);
+        }
+    }
+    pthread_mutex_unlock(&index_mutex);
+    return status;
+}
+
+// Called once a new account is written, or found at a new record.
+void account_index_put(const Account* account, int record_num) {
+    pthread_mutex_lock(&index_mutex);
+    if (ensure_ready() == -1 || put_entry(account, record_num) == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Out of memory indexing an account number.\n");
+    } else {
+        int shard = account_shard_of(account->accountId);
+        if (covered[shard] == account->accountId) covered[shard] = account->accountId + 1;
+    }
+    pthread_mutex_unlock(&index_mutex);
+}
+
+void account_index_remove(const char* accountNumber) {
+    pthread_mutex_lock(&index_mutex);
+    if (index_ready) remove_entry(accountNumber);
+    pthread_mutex_unlock(&index_mutex);
+}
+
+int account_index_find(const char* accountNumber, Account* account) {
+    int accountId = -1, record_num = -1;
+    pthread_mutex_lock(&index_mutex);
+    if (ensure_ready() == 0) {
+        NumberEntry* entry = find_entry(accountNumber);
+        if (entry == NULL && catch_up() > 0) entry = find_entry(accountNumber);
+        if (entry != NULL) {
+            accountId = entry->accountId;
+            record_num = entry->recordNum;
+        }
+    }
+    pthread_mutex_unlock(&index_mutex);
+    if (accountId == -1) { errno = ENOENT; return -1; }
+
+    // The hint holds unless the compactor moved the account or it was removed
+    if (read_account_record(accountId, record_num, account) == 0 && account->accountId == accountId &&
+        same_number(account->accountNumber, accountNumber)) return record_num;
+    record_num = read_account_by_id(accountId, account);
+    if (record_num != -1 && same_number(account->accountNumber, accountNumber)) {
+        account_index_put(account, record_num);
+        return record_num;
+    }
+    if (record_num == -1 && errno == ETIMEDOUT) return -1;
+    account_index_remove(accountNumber);
+    errno = ENOENT;
+    return -1;
+}
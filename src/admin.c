@@ -3,6 +3,101 @@
 #include "model.h"
 #include "utils.h"
 #include "shared.h" // For shared functions
+#include "session.h"
+#include "account_index.h"
+#include "customer_search.h"
+
+// --- Private Admin Handlers ---
+
+// Loans that still need the user: their own open applications, or those
+// assigned to them as an employee.
+static int is_open_loan_of(const void* record, const void* ctx) {
+    const Loan* loan = (const Loan*)record;
+    int userId = *(const int*)ctx;
+    if (loan->status != PENDING && loan->status != PROCESSING) return 0;
+    return loan->userId == userId || loan->assignedToEmployeeId == userId;
+}
+
+// Tombstones the user's account, if they have one. Returns 0, or -1 after
+// telling the admin why it could not be removed.
+static int remove_account_of(int client_socket, int userId) {
+    char buffer[160];
+    int fd_acct = open_account_file(userId, O_RDWR);
+    if (fd_acct == -1) return 0; // The shard has no accounts yet
+    if (set_file_lock(fd_acct, F_WRLCK) == -1) {
+        write_string(client_socket, LOCK_BUSY_MESSAGE); close(fd_acct); return -1;
+    }
+
+    // Nothing moves while the whole file is locked
+    int status = 0;
+    Account account;
+    int rec_num = find_account_record_by_id(userId);
+    if (rec_num != -1 && (pread(fd_acct, &account, sizeof(Account), record_offset(rec_num, sizeof(Account))) != sizeof(Account) || account.accountId != userId)) {
+        write_string(client_socket, "Error reading account record.\n");
+        status = -1;
+    } else if (rec_num != -1 && (account.balance > 0.005 || account.balance < -0.005)) {
+        sprintf(buffer, "Account %s still holds ₹%.2f. It must be empty before the user is removed.\n", account.accountNumber, account.balance);
+        write_string(client_socket, buffer);
+        status = -1;
+    } else if (rec_num != -1 && remove_account_record(fd_acct, userId, rec_num) == -1) {
+        write_string(STDOUT_FILENO, "FATAL: Failed to remove account record.\n");
+        write_string(client_socket, "Error removing the account.\n");
+        status = -1;
+    } else if (rec_num != -1) {
+        account_index_remove(account.accountNumber);
+    }
+    set_file_lock(fd_acct, F_UNLCK);
+    close(fd_acct);
+    return status;
+}
+
+// Only a deactivated user with no money and no open loans can be removed.
+// Their slots are reused by new records; their ID never is.
+static void handle_remove_user(int client_socket, int adminId) {
+    char buffer[MAX_BUFFER];
+    write_string(client_socket, "Enter User ID to remove: ");
+    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) return;
+    int target_user_id = atoi(buffer);
+    if (target_user_id <= 0) { write_string(client_socket, "Invalid User ID.\n"); return; }
+    if (target_user_id == adminId) { write_string(client_socket, "You cannot remove yourself.\n"); return; }
+
+    Loan* loans;
+    int open_loans = snapshot_records(LOAN_FILE, sizeof(Loan), is_open_loan_of, &target_user_id, (void**)&loans);
+    free(loans);
+    if (open_loans == -1) { write_string(client_socket, errno == ENOMEM ? "Error: Out of memory.\n" : LOCK_BUSY_MESSAGE); return; }
+    if (open_loans > 0) {
+        sprintf(buffer, "This user still has %d open loan(s). They must be processed first.\n", open_loans);
+        write_string(client_socket, buffer);
+        return;
+    }
+
+    // The whole user file, since its free list changes; the account file
+    // is locked inside it, as when a user is added.
+    int fd_user = open(USER_FILE, O_RDWR);
+    if (fd_user == -1) { write_string(client_socket, "Error accessing user data.\n"); return; }
+    if (set_file_lock(fd_user, F_WRLCK) == -1) {
+        write_string(client_socket, LOCK_BUSY_MESSAGE); close(fd_user); return;
+    }
+    User user;
+    int user_rec_num = find_user_record(target_user_id);
+    if (user_rec_num == -1 || read_user_record(user_rec_num, &user) != 0 || user.userId != target_user_id) {
+        write_string(client_socket, "User not found.\n");
+    } else if (user.isActive) {
+        write_string(client_socket, "Deactivate this user first (option 3).\n");
+    } else if (remove_account_of(client_socket, target_user_id) == 0) {
+        if (remove_user_record(fd_user, user_rec_num) == -1) {
+            write_string(STDOUT_FILENO, "FATAL: Failed to remove user record.\n");
+            write_string(client_socket, "Error removing the user.\n");
+        } else {
+            session_token_revoke(target_user_id);
+            customer_search_remove(target_user_id);
+            sprintf(buffer, "User %d removed.\n", target_user_id);
+            write_string(client_socket, buffer);
+        }
+    }
+    set_file_lock(fd_user, F_UNLCK);
+    close(fd_user);
+}
 
 // --- Public Admin Menu ---
 
@@ -22,7 +117,8 @@ void admin_menu(int client_socket, User user) {
         write_string(client_socket, "3. Activate/Deactivate Any User & Account\n"); 
         write_string(client_socket, "4. View My Personal Details\n");
         write_string(client_socket, "5. Change My Password\n");
-        write_string(client_socket, "6. Logout\n");
+        write_string(client_socket, "6. Remove Deactivated User\n");
+        write_string(client_socket, "7. Logout\n");
         write_string(client_socket, "+---------------------------------------+\n");
         write_string(client_socket, "Enter your choice: ");
         
@@ -54,7 +150,8 @@ void admin_menu(int client_socket, User user) {
             case 3: handle_set_account_status(client_socket, 1); break;
             case 4: handle_view_my_details(client_socket, user); break;
             case 5: handle_change_password(client_socket, user.userId); break;
-            case 6: write_string(client_socket, "Logging out. Goodbye!\n"); return;
+            case 6: handle_remove_user(client_socket, user.userId); break;
+            case 7: write_string(client_socket, "Logging out. Goodbye!\n"); return;
             default: write_string(client_socket, "Invalid choice.\n");
         }
     }
@@ -7,16 +7,21 @@ int main() {
     int fd_user, fd_account;
 
     // --- Create Files (Truncate them to empty) ---
-    fd_user = open(USER_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    fd_user = open(USER_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
     if (fd_user == -1) { perror("Error opening user file"); return 1; }
+    open(USER_PROFILE_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
     
-    fd_account = open(ACCOUNT_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    fd_account = open(ACCOUNT_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
     if (fd_account == -1) { perror("Error opening account file"); return 1; }
     
     open(LOAN_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
     open(FEEDBACK_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
     open(TRANSACTION_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    open(TRANSACTION_INDEX_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    unlink(TRANSACTION_BLOCK_FILE); // Nothing is sealed yet
+    unlink(TRANSACTION_BLOCK_INDEX_FILE);
     open(TRANSFER_LOG_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644); // This will now work
+    unlink(SHARD_CONFIG_FILE); // Fresh data is unsharded; see ./migrate_data shard-accounts
 
     
     // ... (rest of the file is unchanged) ...
@@ -33,7 +38,7 @@ int main() {
     strcpy(admin1.phone, "1111111111");
     strcpy(admin1.email, "admin1@bank.com");
     strcpy(admin1.address, "1 Admin Road");
-    write(fd_user, &admin1, sizeof(User));
+    append_user_records(fd_user, &admin1, 1);
     write_string(STDOUT_FILENO, "Admin user 1 created (ID: 1, Pass: admin123)\n");
 
     // --- User 2: Customer 1 ---
@@ -47,7 +52,7 @@ int main() {
     strcpy(customer1.phone, "2222222222");
     strcpy(customer1.email, "cust1@gmail.com");
     strcpy(customer1.address, "1 Customer Road");
-    write(fd_user, &customer1, sizeof(User));
+    append_user_records(fd_user, &customer1, 1);
     write_string(STDOUT_FILENO, "Customer user 1 created (ID: 2, Pass: cust123)\n");
     
     // --- User 3: Employee 1 ---
@@ -61,7 +66,7 @@ int main() {
     strcpy(employee1.phone, "3333333333");
     strcpy(employee1.email, "emp1@bank.com");
     strcpy(employee1.address, "1 Employee Road");
-    write(fd_user, &employee1, sizeof(User));
+    append_user_records(fd_user, &employee1, 1);
     write_string(STDOUT_FILENO, "Employee user 1 created (ID: 3, Pass: emp123)\n");
 
     // --- User 4: Manager 1 ---
@@ -75,7 +80,7 @@ int main() {
     strcpy(manager1.phone, "4444444444");
     strcpy(manager1.email, "man1@bank.com");
     strcpy(manager1.address, "1 Manager Road");
-    write(fd_user, &manager1, sizeof(User));
+    append_user_records(fd_user, &manager1, 1);
     write_string(STDOUT_FILENO, "Manager user 1 created (ID: 4, Pass: man123)\n");
 
     // --- User 5: Administrator 2 ---
@@ -89,7 +94,7 @@ int main() {
     strcpy(admin2.phone, "5555555555");
     strcpy(admin2.email, "admin2@bank.com");
     strcpy(admin2.address, "2 Admin Road");
-    write(fd_user, &admin2, sizeof(User));
+    append_user_records(fd_user, &admin2, 1);
     write_string(STDOUT_FILENO, "Admin user 2 created (ID: 5, Pass: admin456)\n");
 
     // --- User 6: Customer 2 ---
@@ -103,7 +108,7 @@ int main() {
     strcpy(customer2.phone, "6666666666");
     strcpy(customer2.email, "cust2@gmail.com");
     strcpy(customer2.address, "2 Customer Road");
-    write(fd_user, &customer2, sizeof(User));
+    append_user_records(fd_user, &customer2, 1);
     write_string(STDOUT_FILENO, "Customer user 2 created (ID: 6, Pass: cust456)\n");
     
     // --- User 7: Employee 2 ---
@@ -117,7 +122,7 @@ int main() {
     strcpy(employee2.phone, "7777777777");
     strcpy(employee2.email, "emp2@bank.com");
     strcpy(employee2.address, "2 Employee Road");
-    write(fd_user, &employee2, sizeof(User));
+    append_user_records(fd_user, &employee2, 1);
     write_string(STDOUT_FILENO, "Employee user 2 created (ID: 7, Pass: emp456)\n");
 
     // --- User 8: Manager 2 ---
@@ -131,7 +136,7 @@ int main() {
     strcpy(manager2.phone, "8888888888");
     strcpy(manager2.email, "man2@bank.com");
     strcpy(manager2.address, "2 Manager Road");
-    write(fd_user, &manager2, sizeof(User));
+    append_user_records(fd_user, &manager2, 1);
     write_string(STDOUT_FILENO, "Manager user 2 created (ID: 8, Pass: man456)\n");
     
     close(fd_user);
@@ -143,7 +148,7 @@ int main() {
     strcpy(cust_account1.accountNumber, "SB-2"); 
     cust_account1.balance = 5000.00; 
     cust_account1.isActive = 1;
-    write(fd_account, &cust_account1, sizeof(Account));
+    append_records(fd_account, ACCOUNT_FILE, &cust_account1, sizeof(Account), 1, cust_account1.accountId + 1);
     
     // --- Account for Customer 2 (ID 6) ---
     Account cust_account2;
@@ -152,7 +157,7 @@ int main() {
     strcpy(cust_account2.accountNumber, "SB-6");
     cust_account2.balance = 10000.00; 
     cust_account2.isActive = 1;
-    write(fd_account, &cust_account2, sizeof(Account));
+    append_records(fd_account, ACCOUNT_FILE, &cust_account2, sizeof(Account), 1, cust_account2.accountId + 1);
 
     write_string(STDOUT_FILENO, "Customer accounts created (SB-2, SB-6)\n");
     
@@ -0,0 +1,570 @@
+// src/bulk_import.c
+// Offline bulk importer: loads users (with their accounts) and deposits
+// from a CSV file using parallel validation and batched appends.
+//
+// Row formats ('#' starts a comment line, fields may be "double quoted"):
+//   user,<role>,<password>,<firstName>,<lastName>,<phone>,<email>,<address>[,<openingDeposit>]
+//   deposit,<userId>,<amount>
+// <role> is CUSTOMER, EMPLOYEE, MANAGER or 0/1/2. Customers get an SB-<id> account.
+#include "common.h"
+#include "utils.h"
+#include "model.h"
+#include "shared.h"
+#include "hashmap.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <strings.h>
+#include <time.h>
+
+#define IMPORT_CHUNK_ROWS 262144
+#define IMPORT_WRITE_BATCH 4096
+#define MAX_IMPORT_THREADS 64
+#define MAX_IMPORT_FIELDS 10
+#define MAX_FIELD_LEN 300
+#define MAX_REPORTED_ERRORS 100
+
+typedef enum {
+    ROW_EMPTY,
+    ROW_USER,
+    ROW_DEPOSIT,
+    ROW_INVALID
+} RowKind;
+
+typedef struct {
+    RowKind kind;
+    long line;
+    const char* error;
+    User user;
+    double amount;    // Opening deposit (ROW_USER) or deposit amount (ROW_DEPOSIT)
+    int targetUserId; // ROW_DEPOSIT only
+} ImportRow;
+
+typedef struct {
+    const char* start;
+    size_t length;
+} LineRef;
+
+typedef struct {
+    const LineRef* lines;
+    ImportRow* rows;
+    long first_line_no;
+    int begin;
+    int end;
+} ParseTask;
+
+// --- Email Uniqueness Set ---
+typedef struct {
+    char** emails;
+    size_t capacity;
+    size_t count;
+} EmailSet;
+
+static unsigned long hash_email(const char* email) {
+    unsigned long h = 1469598103934665603UL; // FNV-1a
+    for (; *email; email++) {
+        h ^= (unsigned char)*email;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+static int emailset_init(EmailSet* set) {
+    set->capacity = 1024;
+    set->count = 0;
+    set->emails = (char**)calloc(set->capacity, sizeof(char*));
+    return set->emails == NULL ? -1 : 0;
+}
+
+// Returns 1 if added, 0 if already present, -1 on allocation failure
+static int emailset_add(EmailSet* set, const char* email) {
+    if ((set->count + 1) * 10 > set->capacity * 7) {
+        EmailSet bigger;
+        bigger.capacity = set->capacity * 2;
+        bigger.count = 0;
+        bigger.emails = (char**)calloc(bigger.capacity, sizeof(char*));
+        if (bigger.emails == NULL) return -1;
+        for (size_t i = 0; i < set->capacity; i++) {
+            if (set->emails[i] == NULL) continue;
+            size_t j = hash_email(set->emails[i]) & (bigger.capacity - 1);
+            while (bigger.emails[j] != NULL) j = (j + 1) & (bigger.capacity - 1);
+            bigger.emails[j] = set->emails[i];
+            bigger.count++;
+        }
+        free(set->emails);
+        *set = bigger;
+    }
+    size_t mask = set->capacity - 1;
+    size_t i = hash_email(email) & mask;
+    while (set->emails[i] != NULL) {
+        if (my_strcmp(set->emails[i], email) == 0) return 0;
+        i = (i + 1) & mask;
+    }
+    set->emails[i] = strdup(email);
+    if (set->emails[i] == NULL) return -1;
+    set->count++;
+    return 1;
+}
+
+static void emailset_free(EmailSet* set) {
+    for (size_t i = 0; i < set->capacity; i++) free(set->emails[i]);
+    free(set->emails);
+}
+
+// --- Parsing & Validation (runs on worker threads) ---
+
+// Splits one CSV line into fields. Returns the field count or -1 if a field
+// is longer than MAX_FIELD_LEN - 1.
+static int split_csv(const char* line, size_t length, char fields[][MAX_FIELD_LEN]) {
+    int count = 0;
+    size_t i = 0;
+    while (count < MAX_IMPORT_FIELDS) {
+        int quoted = (i < length && line[i] == '"');
+        if (quoted) i++;
+        int n = 0;
+        while (i < length) {
+            char c = line[i];
+            if (quoted && c == '"') {
+                if (i + 1 < length && line[i + 1] == '"') { i++; } // Escaped quote
+                else { quoted = 0; i++; continue; }
+            } else if (!quoted && c == ',') {
+                break;
+            }
+            if (n >= MAX_FIELD_LEN - 1) return -1;
+            fields[count][n++] = c;
+            i++;
+        }
+        fields[count][n] = '\0';
+        count++;
+        if (i >= length) break;
+        i++; // Skip the comma
+    }
+    return count;
+}
+
+static int parse_role(const char* field, UserRole* role) {
+    if (strcasecmp(field, "CUSTOMER") == 0 || my_strcmp(field, "0") == 0) { *role = CUSTOMER; return 0; }
+    if (strcasecmp(field, "EMPLOYEE") == 0 || my_strcmp(field, "1") == 0) { *role = EMPLOYEE; return 0; }
+    if (strcasecmp(field, "MANAGER") == 0 || my_strcmp(field, "2") == 0) { *role = MANAGER; return 0; }
+    return -1;
+}
+
+// Same limits as the interactive prompts in handle_add_user
+static const char* copy_field(char* dest, const char* field, size_t max_len, const char* too_long_error) {
+    if (field[0] == '\0') return "empty field";
+    if (strlen(field) >= max_len) return too_long_error;
+    strcpy(dest, field);
+    return NULL;
+}
+
+static void parse_row(const LineRef* ref, ImportRow* row) {
+    char fields[MAX_IMPORT_FIELDS][MAX_FIELD_LEN];
+    size_t length = ref->length;
+    if (length > 0 && ref->start[length - 1] == '\r') length--;
+
+    row->error = NULL;
+    if (length == 0 || ref->start[0] == '#') { row->kind = ROW_EMPTY; return; }
+
+    int count = split_csv(ref->start, length, fields);
+    row->kind = ROW_INVALID;
+    if (count == -1) { row->error = "field too long"; return; }
+
+    if (my_strcmp(fields[0], "user") == 0) {
+        if (count != 8 && count != 9) { row->error = "user rows need 8 or 9 fields"; return; }
+        User* user = &row->user;
+        memset(user, 0, sizeof(User));
+        if (parse_role(fields[1], &user->role) == -1) { row->error = "role must be CUSTOMER, EMPLOYEE or MANAGER"; return; }
+        user->isActive = 1;
+        if ((row->error = copy_field(user->password, fields[2], 50, "password too long")) != NULL) return;
+        if ((row->error = copy_field(user->firstName, fields[3], 50, "first name too long")) != NULL) return;
+        if ((row->error = copy_field(user->lastName, fields[4], 50, "last name too long")) != NULL) return;
+        if ((row->error = copy_field(user->phone, fields[5], 15, "phone too long")) != NULL) return;
+        if ((row->error = copy_field(user->email, fields[6], 100, "email too long")) != NULL) return;
+        if ((row->error = copy_field(user->address, fields[7], 256, "address too long")) != NULL) return;
+        if (!is_email_valid(user->email)) { row->error = "invalid email format"; return; }
+
+        row->amount = 0.0;
+        if (count == 9 && fields[8][0] != '\0') {
+            if (!is_valid_amount(fields[8])) { row->error = "invalid opening deposit"; return; }
+            row->amount = atof(fields[8]);
+            if (row->amount > 0.0 && user->role != CUSTOMER) { row->error = "only customers can have an opening deposit"; return; }
+        }
+        row->kind = ROW_USER;
+    } else if (my_strcmp(fields[0], "deposit") == 0) {
+        if (count != 3) { row->error = "deposit rows need 3 fields"; return; }
+        row->targetUserId = atoi(fields[1]);
+        if (row->targetUserId <= 0) { row->error = "invalid user ID"; return; }
+        if (!is_valid_amount(fields[2])) { row->error = "invalid amount"; return; }
+        row->amount = atof(fields[2]);
+        if (row->amount <= 0.01) { row->error = "amount must be positive"; return; }
+        row->kind = ROW_DEPOSIT;
+    } else {
+        row->error = "unknown row type (expected 'user' or 'deposit')";
+    }
+}
+
+static void* parse_worker(void* arg) {
+    ParseTask* task = (ParseTask*)arg;
+    for (int i = task->begin; i < task->end; i++) {
+        task->rows[i].line = task->first_line_no + i;
+        parse_row(&task->lines[i], &task->rows[i]);
+    }
+    return NULL;
+}
+
+// --- Import State ---
+typedef struct {
+    int fd_user;          // Held with a whole-file write lock for the entire import
+    int next_user_id;
+    EmailSet emails;
+    long users_added;
+    long deposits_applied;
+    long rejected;
+    Transaction* txns;    // Batched transaction rows for the current chunk
+    int txn_count;
+} ImportState;
+
+static void report_error(ImportState* state, ImportRow* row, const char* error) {
+    char buffer[256];
+    row->kind = ROW_INVALID;
+    state->rejected++;
+    if (state->rejected <= MAX_REPORTED_ERRORS) {
+        sprintf(buffer, "Line %ld: %s\n", row->line, error);
+        write_string(STDOUT_FILENO, buffer);
+    } else if (state->rejected == MAX_REPORTED_ERRORS + 1) {
+        write_string(STDOUT_FILENO, "(further errors suppressed)\n");
+    }
+}
+
+// Ledger rows go out only once the account writes they describe are on
+// disk, so a failed import never leaves rows for balances it did not apply.
+static int flush_transactions(ImportState* state) {
+    if (state->txn_count == 0) return 0;
+    int status = log_transactions(state->txns, state->txn_count);
+    state->txn_count = 0;
+    if (status == -1) write_string(STDOUT_FILENO, "FATAL: Failed to write imported transactions to disk.\n");
+    return status;
+}
+
+// The caller flushes before the buffer holds IMPORT_WRITE_BATCH rows.
+static Transaction* next_transaction(ImportState* state) {
+    Transaction* txn = &state->txns[state->txn_count++];
+    memset(txn, 0, sizeof(Transaction));
+    return txn;
+}
+
+// --- Account Shard Files ---
+
+// Opens and write-locks every shard's account file. Returns 0, or -1 with
+// any files already opened closed again.
+static int open_account_shards(int* fds, int flags) {
+    for (int shard = 0; shard < account_shard_count(); shard++) {
+        fds[shard] = open_account_shard(shard, flags);
+        if (fds[shard] == -1) {
+            perror("open account file");
+            while (--shard >= 0) close(fds[shard]);
+            return -1;
+        }
+        set_file_lock(fds[shard], F_WRLCK);
+    }
+    return 0;
+}
+
+static void close_account_shards(int* fds) {
+    for (int shard = 0; shard < account_shard_count(); shard++) {
+        set_file_lock(fds[shard], F_UNLCK);
+        close(fds[shard]);
+    }
+}
+
+// Appends new accounts, each to its own shard's file, with one write
+// per shard. 'scratch' holds as many accounts as 'batch'.
+static int append_accounts(const int* fds, const Account* batch, int count, Account* scratch) {
+    for (int shard = 0; shard < account_shard_count(); shard++) {
+        int n = 0, next_id = 0;
+        for (int i = 0; i < count; i++) {
+            if (account_shard_of(batch[i].accountId) != shard) continue;
+            scratch[n++] = batch[i];
+            if (batch[i].accountId >= next_id) next_id = batch[i].accountId + 1;
+        }
+        char path[64];
+        account_file_path(shard, account_shard_count(), path);
+        if (n > 0 && append_records(fds[shard], path, scratch, sizeof(Account), n, next_id) == -1) return -1;
+    }
+    return 0;
+}
+
+// --- Phase 1: Users and their accounts ---
+static int apply_users(ImportState* state, ImportRow* rows, int count) {
+    User* user_batch = (User*)malloc(IMPORT_WRITE_BATCH * sizeof(User));
+    Account* account_batch = (Account*)malloc(IMPORT_WRITE_BATCH * sizeof(Account));
+    Account* shard_batch = (Account*)malloc(IMPORT_WRITE_BATCH * sizeof(Account));
+    if (user_batch == NULL || account_batch == NULL || shard_batch == NULL) {
+        free(user_batch); free(account_batch); free(shard_batch); return -1;
+    }
+
+    int fd_accts[MAX_ACCOUNT_SHARDS];
+    if (open_account_shards(fd_accts, O_RDWR | O_CREAT) == -1) {
+        free(user_batch); free(account_batch); free(shard_batch); return -1;
+    }
+
+    int status = 0;
+    int users_pending = 0, accounts_pending = 0;
+    for (int i = 0; i <= count && status == 0; i++) {
+        int flush = (i == count) || users_pending == IMPORT_WRITE_BATCH || accounts_pending == IMPORT_WRITE_BATCH;
+        if (flush) {
+            if (users_pending > 0 && append_user_records(state->fd_user, user_batch, users_pending) == -1) {
+                write_string(STDOUT_FILENO, "FATAL: Failed to write imported users to disk.\n");
+                status = -1;
+            }
+            if (accounts_pending > 0 && append_accounts(fd_accts, account_batch, accounts_pending, shard_batch) == -1) {
+                write_string(STDOUT_FILENO, "FATAL: Failed to write imported accounts to disk.\n");
+                status = -1;
+            }
+            // At most one opening deposit per pending account, so this never overflows
+            if (status == 0 && flush_transactions(state) == -1) status = -1;
+            users_pending = 0;
+            accounts_pending = 0;
+        }
+        if (i == count || rows[i].kind != ROW_USER) continue;
+
+        int added = emailset_add(&state->emails, rows[i].user.email);
+        if (added == -1) { status = -1; break; }
+        if (added == 0) { report_error(state, &rows[i], "email is already in use"); continue; }
+
+        User* user = &user_batch[users_pending++];
+        *user = rows[i].user;
+        user->userId = state->next_user_id++;
+        state->users_added++;
+
+        if (user->role == CUSTOMER) {
+            Account* account = &account_batch[accounts_pending++];
+            memset(account, 0, sizeof(Account));
+            account->accountId = user->userId;
+            account->ownerUserId = user->userId;
+            account->balance = rows[i].amount;
+            account->isActive = 1;
+            sprintf(account->accountNumber, "SB-%d", user->userId);
+
+            if (rows[i].amount > 0.0) {
+                Transaction* txn = next_transaction(state);
+                txn->accountId = account->accountId;
+                txn->userId = user->userId;
+                txn->type = DEPOSIT;
+                txn->amount = rows[i].amount;
+                txn->newBalance = rows[i].amount;
+                strcpy(txn->otherPartyAccountNumber, "---");
+            }
+        }
+    }
+
+    close_account_shards(fd_accts);
+    free(user_batch);
+    free(account_batch);
+    free(shard_batch);
+    return status;
+}
+
+// --- Phase 2: Deposits into existing accounts ---
+#define ACCOUNT_LOADED 1
+#define ACCOUNT_CHANGED 2 // Balance not yet written back
+
+static int write_changed_accounts(const int* fds, const int* ids, const int* recs, const Account* accounts, unsigned char* loaded, int distinct) {
+    for (int s = 0; s < distinct; s++) {
+        if (loaded[s] != ACCOUNT_CHANGED) continue;
+        int fd = fds[account_shard_of(ids[s])];
+        if (pwrite(fd, &accounts[s], sizeof(Account), record_offset(recs[s], sizeof(Account))) != sizeof(Account)) {
+            write_string(STDOUT_FILENO, "FATAL: Failed to write imported deposit to disk.\n");
+            return -1;
+        }
+        loaded[s] = ACCOUNT_LOADED;
+    }
+    return 0;
+}
+
+static int apply_deposits(ImportState* state, ImportRow* rows, int count) {
+    IntMap slot_of;  // userId -> index into ids/recs/accounts
+    int distinct = 0;
+    int* ids = (int*)malloc(count * sizeof(int));
+    if (ids == NULL || intmap_init(&slot_of, 1024) == -1) { free(ids); return -1; }
+    for (int i = 0; i < count; i++) {
+        if (rows[i].kind != ROW_DEPOSIT || intmap_get(&slot_of, rows[i].targetUserId, NULL)) continue;
+        intmap_put(&slot_of, rows[i].targetUserId, distinct);
+        ids[distinct++] = rows[i].targetUserId;
+    }
+    if (distinct == 0) { free(ids); intmap_free(&slot_of); return 0; }
+
+    int* recs = (int*)malloc(distinct * sizeof(int));
+    Account* accounts = (Account*)malloc(distinct * sizeof(Account));
+    unsigned char* loaded = (unsigned char*)calloc(distinct, 1); // 0, ACCOUNT_LOADED or ACCOUNT_CHANGED
+    int status = -1;
+    if (recs == NULL || accounts == NULL || loaded == NULL) goto done;
+    // Locked before the lookup, so the server's compactor cannot move them
+    int fd_accts[MAX_ACCOUNT_SHARDS];
+    if (open_account_shards(fd_accts, O_RDWR) == -1) goto done;
+    if (find_account_records(ids, recs, distinct) == -1) { close_account_shards(fd_accts); goto done; }
+
+    status = 0;
+    for (int i = 0; i < count && status == 0; i++) {
+        if (rows[i].kind != ROW_DEPOSIT) continue;
+        if (state->txn_count == IMPORT_WRITE_BATCH) {
+            status = write_changed_accounts(fd_accts, ids, recs, accounts, loaded, distinct);
+            if (status == 0) status = flush_transactions(state);
+        }
+        long slot;
+        intmap_get(&slot_of, rows[i].targetUserId, &slot);
+        if (recs[slot] == -1) { report_error(state, &rows[i], "account not found"); continue; }
+
+        Account* account = &accounts[slot];
+        if (!loaded[slot]) {
+            int fd = fd_accts[account_shard_of(ids[slot])];
+            if (pread(fd, account, sizeof(Account), record_offset(recs[slot], sizeof(Account))) != sizeof(Account)) {
+                report_error(state, &rows[i], "could not read account");
+                recs[slot] = -1;
+                continue;
+            }
+            loaded[slot] = ACCOUNT_LOADED;
+        }
+        if (!account->isActive) { report_error(state, &rows[i], "account is deactivated"); continue; }
+
+        account->balance += rows[i].amount;
+        loaded[slot] = ACCOUNT_CHANGED;
+        state->deposits_applied++;
+
+        Transaction* txn = next_transaction(state);
+        txn->accountId = account->accountId;
+        txn->userId = account->ownerUserId;
+        txn->type = DEPOSIT;
+        txn->amount = rows[i].amount;
+        txn->newBalance = account->balance;
+        strcpy(txn->otherPartyAccountNumber, "---");
+    }
+
+    if (status == 0) status = write_changed_accounts(fd_accts, ids, recs, accounts, loaded, distinct);
+    if (status == 0) status = flush_transactions(state);
+    close_account_shards(fd_accts);
+
+done:
+    free(ids); free(recs); free(accounts); free(loaded);
+    intmap_free(&slot_of);
+    return status;
+}
+
+// --- Main ---
+
+int main(int argc, char* argv[]) {
+    char buffer[256];
+    if (argc < 2) {
+        write_string(STDOUT_FILENO, "Usage: ./bulk_import <file.csv> [threads]\n");
+        return 1;
+    }
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 2) thread_count = atoi(argv[2]);
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > MAX_IMPORT_THREADS) thread_count = MAX_IMPORT_THREADS;
+    if (user_store_needs_split()) {
+        write_string(STDOUT_FILENO, USER_SPLIT_NEEDED_MESSAGE);
+        return 1;
+    }
+    if (data_files_need_headers()) {
+        write_string(STDOUT_FILENO, DAT_HEADERS_NEEDED_MESSAGE);
+        return 1;
+    }
+
+    int fd_csv = open(argv[1], O_RDONLY);
+    if (fd_csv == -1) { perror("open CSV file"); return 1; }
+    struct stat st;
+    if (fstat(fd_csv, &st) == -1) { perror("fstat CSV file"); return 1; }
+    if (st.st_size == 0) { write_string(STDOUT_FILENO, "CSV file is empty.\n"); return 0; }
+    const char* csv = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd_csv, 0);
+    if (csv == MAP_FAILED) { perror("mmap CSV file"); return 1; }
+    madvise((void*)csv, st.st_size, MADV_SEQUENTIAL);
+
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    // --- Take the user file for the whole import, like handle_add_user does ---
+    ImportState state;
+    memset(&state, 0, sizeof(state));
+    state.fd_user = open(USER_FILE, O_RDWR | O_CREAT, 0644);
+    if (state.fd_user == -1) { perror("open user file"); return 1; }
+    set_file_lock(state.fd_user, F_WRLCK);
+
+    if (emailset_init(&state.emails) == -1) { write_string(STDOUT_FILENO, "Out of memory.\n"); return 1; }
+    state.next_user_id = get_next_user_id();
+    int fd_profile = open(USER_PROFILE_FILE, O_RDONLY);
+    if (fd_profile != -1) {
+        // Only profiles with an auth record are users; see append_user_records
+        long user_count = record_count(lseek(state.fd_user, 0, SEEK_END), sizeof(UserAuth));
+        UserProfile existing;
+        lseek(fd_profile, DAT_HEADER_SIZE, SEEK_SET);
+        for (long i = 0; i < user_count && read(fd_profile, &existing, sizeof(UserProfile)) == sizeof(UserProfile); i++) {
+            emailset_add(&state.emails, existing.email);
+        }
+        close(fd_profile);
+    }
+
+    LineRef* lines = (LineRef*)malloc(IMPORT_CHUNK_ROWS * sizeof(LineRef));
+    ImportRow* rows = (ImportRow*)malloc(IMPORT_CHUNK_ROWS * sizeof(ImportRow));
+    state.txns = (Transaction*)malloc(IMPORT_WRITE_BATCH * sizeof(Transaction));
+    if (lines == NULL || rows == NULL || state.txns == NULL) { write_string(STDOUT_FILENO, "Out of memory.\n"); return 1; }
+
+    const char* cursor = csv;
+    const char* csv_end = csv + st.st_size;
+    long line_no = 1;
+    int status = 0;
+    while (cursor < csv_end && status == 0) {
+        // --- Split the next chunk into lines ---
+        int count = 0;
+        while (cursor < csv_end && count < IMPORT_CHUNK_ROWS) {
+            const char* newline = memchr(cursor, '\n', csv_end - cursor);
+            const char* line_end = newline ? newline : csv_end;
+            lines[count].start = cursor;
+            lines[count].length = line_end - cursor;
+            count++;
+            cursor = newline ? newline + 1 : csv_end;
+        }
+
+        // --- Validate the chunk in parallel ---
+        ParseTask tasks[MAX_IMPORT_THREADS];
+        pthread_t threads[MAX_IMPORT_THREADS];
+        int created[MAX_IMPORT_THREADS] = {0};
+        int per_thread = (count + thread_count - 1) / thread_count;
+        for (long t = 0; t < thread_count; t++) {
+            tasks[t].lines = lines;
+            tasks[t].rows = rows;
+            tasks[t].first_line_no = line_no;
+            tasks[t].begin = t * per_thread;
+            tasks[t].end = (t + 1) * per_thread < count ? (t + 1) * per_thread : count;
+            if (tasks[t].begin >= tasks[t].end) break;
+            if (pthread_create(&threads[t], NULL, parse_worker, &tasks[t]) == 0) created[t] = 1;
+            else parse_worker(&tasks[t]); // Fall back to validating inline
+        }
+        for (long t = 0; t < thread_count; t++) {
+            if (created[t]) pthread_join(threads[t], NULL);
+        }
+        for (int i = 0; i < count; i++) {
+            if (rows[i].kind == ROW_INVALID) report_error(&state, &rows[i], rows[i].error);
+        }
+
+        // --- Apply the chunk with batched appends ---
+        if (apply_users(&state, rows, count) == -1) status = -1;
+        if (status == 0 && apply_deposits(&state, rows, count) == -1) status = -1;
+        line_no += count;
+    }
+
+    set_file_lock(state.fd_user, F_UNLCK);
+    close(state.fd_user);
+    munmap((void*)csv, st.st_size);
+    close(fd_csv);
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    sprintf(buffer, "\nImported %ld users and %ld deposits (%ld rows rejected) in %.2fs using %ld threads.\n",
+        state.users_added, state.deposits_applied, state.rejected, seconds, thread_count);
+    write_string(STDOUT_FILENO, buffer);
+    if (status == -1) write_string(STDOUT_FILENO, "Import stopped early because of a write error.\n");
+
+    free(lines); free(rows); free(state.txns);
+    emailset_free(&state.emails);
+    return (status == -1) ? 1 : (state.rejected > 0 ? 2 : 0);
+}
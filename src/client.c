@@ -2,8 +2,9 @@
 #include "common.h"
 #include "utils.h"  // --- ADDED: To find write_string ---
 
-int main() {
+int main(int argc, char* argv[]) {
     int sock = 0;
+    int port = (argc > 1) ? atoi(argv[1]) : PORT; // e.g. ./client 8081 for a read-only standby
     struct sockaddr_in serv_addr;
     char buffer[MAX_BUFFER] = {0};
 
@@ -13,7 +14,7 @@ int main() {
     }
 
     serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(PORT);
+    serv_addr.sin_port = htons(port);
 
     if (inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr) <= 0) {
         write_string(STDOUT_FILENO, "\nInvalid address/ Address not supported \n");
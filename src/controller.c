@@ -2,6 +2,9 @@
 #include "controller.h"
 #include "model.h"  
 #include "utils.h"  
+#include "session.h"
+#include "worker.h"
+#include "replication.h"
 
 // --- Include all the new role-specific controllers ---
 #include "admin.h"
@@ -9,51 +12,22 @@
 #include "employee.h"
 #include "customer.h"
 
-// --- Session Management Globals ---
-#define MAX_SESSIONS 10000 
-int activeUserIds[MAX_SESSIONS];
-int activeUserCount = 0;
-pthread_mutex_t sessionMutex = PTHREAD_MUTEX_INITIALIZER;
-
-
-// --- Main Client Handler (The "Router") ---
-void* handle_client(void* client_socket_ptr) {
-    int client_socket = *(int*)client_socket_ptr;
-    free(client_socket_ptr);
-
+// --- Password Login ---
+// Prompts for ID and password and checks them against the selected role.
+// Returns the user, or one with userId <= 0 after telling the client why.
+static User password_login(int client_socket, int roleChoice) {
     char buffer[MAX_BUFFER];
-    User user;
-    user.userId = -1; 
-    int roleChoice = 0;
-    int loginSuccess = 0; 
-
-    write_string(client_socket, "\n\n        🏦  Welcome to the Bank  🏦\n");
-    write_string(client_socket, "-----------------------------------------\n");
-    write_string(client_socket, "   Please select your role to log in:\n");
-    write_string(client_socket, "-----------------------------------------\n");
-    write_string(client_socket, "   1. Administrator\n");
-    write_string(client_socket, "   2. Manager\n");
-    write_string(client_socket, "   3. Employee\n");
-    write_string(client_socket, "   4. Customer\n");
-    write_string(client_socket, "-----------------------------------------\n");
-
-    while(1) {
-        
-        write_string(client_socket, "Enter choice (1-4): ");
-        read_client_input(client_socket, buffer, MAX_BUFFER);
-        roleChoice = atoi(buffer);
-        if (roleChoice >= 1 && roleChoice <= 4) break;
-        else write_string(client_socket, "Invalid choice. Please try again.\n");
-    }
-
     int userIdInput;
     char password[50];
+    User user;
+    user.userId = 0;
     write_string(client_socket, "Enter User ID: ");
-    read_client_input(client_socket, buffer, MAX_BUFFER);
+    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) return user;
     userIdInput = atoi(buffer);
     write_string(client_socket, "Enter Password: ");
-    read_client_input(client_socket, buffer, MAX_BUFFER);
-    strcpy(password, buffer);
+    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) return user;
+    strncpy(password, buffer, sizeof(password) - 1);
+    password[sizeof(password) - 1] = '\0';
 
     // --- Authentication (from model.c) ---
     user = check_login(userIdInput, password);
@@ -74,7 +48,7 @@ void* handle_client(void* client_socket_ptr) {
             case 1: selectedRole = ADMINISTRATOR; break;
             case 2: selectedRole = MANAGER; break;
             case 3: selectedRole = EMPLOYEE; break;
-            case 4: selectedRole = CUSTOMER; break;
+            default: selectedRole = CUSTOMER; break;
         }
 
         if (user.role != selectedRole) {
@@ -83,37 +57,49 @@ void* handle_client(void* client_socket_ptr) {
             user.userId = 0; // Invalidate user
         }
     } 
+    return user;
+}
 
-    // --- Session Management ---
-    if (user.userId > 0) {
-        pthread_mutex_lock(&sessionMutex);
-        int alreadyLoggedIn = 0;
-        for (int i = 0; i < activeUserCount; i++) {
-            if (activeUserIds[i] == user.userId) {
-                alreadyLoggedIn = 1;
-                break;
-            }
-        }
+// --- Session Management ---
+// Claims the user's session slot, runs their menu, then releases it. Shared
+// by direct logins and clients handed over by another worker.
+static void run_session(int client_socket, User user, int resumed) {
+    char buffer[MAX_BUFFER];
+    int loginSuccess = 0;
+
+    if (user.userId > 0 && user.role != CUSTOMER && standby_read_only()) {
+        write_string(STDOUT_FILENO, "Login refused: staff on a read-only standby.\n");
+        write_string(client_socket, STANDBY_READ_ONLY_MESSAGE);
+        user.userId = 0;
+    }
 
-        if (alreadyLoggedIn) {
-            pthread_mutex_unlock(&sessionMutex);
+    if (user.userId > 0) {
+        // A resume takes over a slot still held by the dropped connection
+        int session = session_acquire(user.userId, client_socket, resumed);
+        if (session == SESSION_ALREADY_ACTIVE) {
             write_string(STDOUT_FILENO, "Login failed: User already logged in.\n");
             write_string(client_socket, "ERROR: This user is already logged in elsewhere.\n");
             user.userId = 0; 
-        } else if (activeUserCount >= MAX_SESSIONS) {
-            pthread_mutex_unlock(&sessionMutex);
+        } else if (session == SESSION_SERVER_FULL) {
             write_string(STDOUT_FILENO, "Login failed: Server full.\n");
             write_string(client_socket, "ERROR: Server is currently full. Please try again later.\n");
             user.userId = 0; 
         } else {
             // --- Success ---
-            activeUserIds[activeUserCount] = user.userId;
-            activeUserCount++;
-            pthread_mutex_unlock(&sessionMutex);
             loginSuccess = 1; 
 
-            write_string(STDOUT_FILENO, "Login success, session added.\n");
-            write_string(client_socket, "Login Successful!\n"); 
+            if (resumed) {
+                write_string(STDOUT_FILENO, "Session resumed from token.\n");
+                write_string(client_socket, "Login Successful! (session resumed)\n");
+            } else {
+                char token[SESSION_TOKEN_LEN + 1];
+                write_string(STDOUT_FILENO, "Login success, session added.\n");
+                write_string(client_socket, "Login Successful!\n"); 
+                if (session_token_issue(&user, token) == 0) {
+                    sprintf(buffer, "Session token: %s\n(If you get disconnected, choose 5 and enter it to resume.)\n", token);
+                    write_string(client_socket, buffer);
+                }
+            }
 
             // --- ROUTING LOGIC ---
             // Route the client to the correct menu
@@ -128,19 +114,115 @@ void* handle_client(void* client_socket_ptr) {
 
     // --- Cleanup ---
     if (loginSuccess == 1) {
-        pthread_mutex_lock(&sessionMutex);
-        for (int i = 0; i < activeUserCount; i++) {
-            if (activeUserIds[i] == user.userId) {
-                activeUserIds[i] = activeUserIds[activeUserCount - 1];
-                activeUserCount--;
-                write_string(STDOUT_FILENO, "Session removed.\n");
-                break;
-            }
+        session_release(user.userId, client_socket);
+        // Only a dropped connection keeps its token; logging out ends it
+        if (!client_disconnected()) session_token_revoke(user.userId);
+    }
+}
+
+// In worker mode, passes a login to the worker that owns the session.
+// Returns 1 if the client was handed off and this thread is done with it,
+// 0 if this worker owns the session, or -1 (client told) if the hand-off failed.
+static int hand_off_if_foreign(int client_socket, int owner, const User* user, const char* token) {
+    if (owner == -1) return 0;
+    HandedOffClient client;
+    memset(&client, 0, sizeof(client));
+    client.client_socket = client_socket;
+    if (token != NULL) {
+        client.resume = 1;
+        memcpy(client.token, token, SESSION_TOKEN_LEN); // resume_owner checked the length
+    } else {
+        client.user = *user;
+    }
+    if (hand_off_client(owner, &client) == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Could not hand a client to its worker.\n");
+        write_string(client_socket, "ERROR: Server is currently full. Please try again later.\n");
+        return -1;
+    }
+    return 1;
+}
+
+// --- Main Client Handler (The "Router") ---
+void* handle_client(void* client_socket_ptr) {
+    int client_socket = *(int*)client_socket_ptr;
+    free(client_socket_ptr);
+
+    char buffer[MAX_BUFFER];
+    User user;
+    user.userId = -1; 
+    int roleChoice = 0;
+    int resumed = 0;
+    int handed_off = 0;
+    IdleWatch* idle = idle_watch(client_socket);
+
+    write_string(client_socket, "\n\n        🏦  Welcome to the Bank  🏦\n");
+    write_string(client_socket, "-----------------------------------------\n");
+    write_string(client_socket, "   Please select your role to log in:\n");
+    write_string(client_socket, "-----------------------------------------\n");
+    write_string(client_socket, "   1. Administrator\n");
+    write_string(client_socket, "   2. Manager\n");
+    write_string(client_socket, "   3. Employee\n");
+    write_string(client_socket, "   4. Customer\n");
+    write_string(client_socket, "   5. Resume Session (token)\n");
+    write_string(client_socket, "-----------------------------------------\n");
+
+    while(1) {
+        
+        write_string(client_socket, "Enter choice (1-5): ");
+        if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) break; // Disconnected
+        roleChoice = atoi(buffer);
+        if (roleChoice >= 1 && roleChoice <= 5) break;
+        else write_string(client_socket, "Invalid choice. Please try again.\n");
+    }
+
+    if (client_disconnected()) {
+        // Nothing to log in; fall through to cleanup
+    } else if (roleChoice == 5) {
+        // --- Resume: the token table alone vouches for the user ---
+        write_string(client_socket, "Enter session token: ");
+        if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) {
+            user.userId = 0;
+        } else if ((handed_off = hand_off_if_foreign(client_socket, resume_owner(buffer), NULL, buffer)) != 0) {
+            user.userId = 0;
+        } else if (session_token_resume(buffer, &user)) {
+            resumed = 1;
+        } else {
+            write_string(STDOUT_FILENO, "Resume failed (unknown or expired token)\n");
+            write_string(client_socket, "Session expired or invalid. Please log in again.\n");
+            user.userId = 0;
+        }
+    } else {
+        user = password_login(client_socket, roleChoice);
+        if (user.userId > 0 && (handed_off = hand_off_if_foreign(client_socket, session_owner(&user), &user, NULL)) != 0) {
+            user.userId = 0;
         }
-        pthread_mutex_unlock(&sessionMutex);
     }
 
+    run_session(client_socket, user, resumed);
+
+    idle_unwatch(idle);
     close(client_socket);
+    write_string(STDOUT_FILENO, handed_off == 1 ? "Client handed to its worker.\n" : "Client session ended.\n");
+    return NULL;
+}
+
+// Entry point for a client another worker passed to this one.
+void* handle_handed_off_client(void* client_ptr) {
+    HandedOffClient client = *(HandedOffClient*)client_ptr;
+    free(client_ptr);
+    IdleWatch* idle = idle_watch(client.client_socket);
+
+    if (!client.resume) {
+        run_session(client.client_socket, client.user, 0);
+    } else if (session_token_resume(client.token, &client.user)) {
+        run_session(client.client_socket, client.user, 1);
+    } else {
+        write_string(STDOUT_FILENO, "Resume failed (unknown or expired token)\n");
+        write_string(client.client_socket, "Session expired or invalid. Please log in again.\n");
+    }
+
+    idle_unwatch(idle);
+    close(client.client_socket);
     write_string(STDOUT_FILENO, "Client session ended.\n");
     return NULL;
-}
\ No newline at end of file
+}
@@ -0,0 +1,215 @@
+// src/coroutine.c
+#include "coroutine.h"
+#include "utils.h"
+#include <ucontext.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+typedef struct SessionThread SessionThread;
+
+typedef struct Coroutine {
+    ucontext_t context;
+    void* stack;
+    void* (*run)(void*);
+    void* arg;
+    int finished;
+    int armed_fd;         // Socket this coroutine has in its thread's epoll set, or -1
+    ClientIoState io;     // Swapped in while the coroutine runs
+    SessionThread* thread;
+    struct Coroutine* next; // Thread's incoming list
+} Coroutine;
+
+struct SessionThread {
+    int epoll_fd;
+    int wake_fd;          // eventfd: new sessions are waiting in 'incoming'
+    pthread_mutex_t incoming_mutex;
+    Coroutine* incoming;
+    ucontext_t scheduler;
+    long sessions;        // Live coroutines; read by spawn_session to balance
+};
+
+static SessionThread threads[MAX_SESSION_THREADS];
+static int thread_count = 0;
+static __thread Coroutine* current = NULL;
+
+// --- Coroutine Stacks ---
+// Stacks are reserved, not committed: a session pays only for the pages it
+// touches. A PROT_NONE page below each turns an overflow into a crash
+// instead of silent corruption of a neighbour.
+
+static long page_size() {
+    return sysconf(_SC_PAGESIZE);
+}
+
+static void* alloc_stack() {
+    size_t guard = page_size();
+    char* base = (char*)mmap(NULL, COROUTINE_STACK_SIZE + guard, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED) return NULL;
+    mprotect(base, guard, PROT_NONE);
+    return base + guard;
+}
+
+static void free_stack(void* stack) {
+    size_t guard = page_size();
+    munmap((char*)stack - guard, COROUTINE_STACK_SIZE + guard);
+}
+
+static void free_coroutine(Coroutine* co) {
+    free_stack(co->stack);
+    free(co);
+}
+
+// --- Scheduling ---
+
+static void coroutine_main() {
+    Coroutine* co = current;
+    co->run(co->arg);
+    co->finished = 1;
+    // Returning switches to uc_link, the thread's scheduler
+}
+
+static void resume(SessionThread* self, Coroutine* co) {
+    current = co;
+    set_client_io_state(&co->io);
+    swapcontext(&self->scheduler, &co->context);
+    set_client_io_state(NULL);
+    current = NULL;
+    if (co->finished) {
+        // The handler closed its socket, which dropped it from the epoll set
+        free_coroutine(co);
+        __atomic_sub_fetch(&self->sessions, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// The client I/O hook: parks the running coroutine until 'fd' is ready.
+// Outside a coroutine it simply blocks in poll().
+static int wait_for_client(int fd, int for_write) {
+    Coroutine* co = current;
+    if (co == NULL) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = for_write ? POLLOUT : POLLIN;
+        return (poll(&pfd, 1, -1) == -1 && errno != EINTR) ? -1 : 0;
+    }
+
+    // One-shot, so a readiness event resumes the coroutine exactly once
+    struct epoll_event event;
+    event.events = (for_write ? EPOLLOUT : EPOLLIN) | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.ptr = co;
+    int op = (co->armed_fd == fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(co->thread->epoll_fd, op, fd, &event) == -1) {
+        if (op == EPOLL_CTL_MOD || errno != EEXIST) return -1;
+        if (epoll_ctl(co->thread->epoll_fd, EPOLL_CTL_MOD, fd, &event) == -1) return -1;
+    }
+    co->armed_fd = fd;
+    swapcontext(&co->context, &co->thread->scheduler);
+    return 0;
+}
+
+static void* session_thread_loop(void* arg) {
+    SessionThread* self = (SessionThread*)arg;
+    struct epoll_event events[64];
+    while (1) {
+        int ready = epoll_wait(self->epoll_fd, events, 64, -1);
+        if (ready == -1) {
+            if (errno != EINTR) perror("epoll_wait");
+            continue;
+        }
+        for (int i = 0; i < ready; i++) {
+            if (events[i].data.ptr != NULL) {
+                resume(self, (Coroutine*)events[i].data.ptr);
+                continue;
+            }
+            uint64_t wakeups;
+            if (read(self->wake_fd, &wakeups, sizeof(wakeups)) == -1 && errno != EAGAIN) perror("read eventfd");
+            pthread_mutex_lock(&self->incoming_mutex);
+            Coroutine* co = self->incoming;
+            self->incoming = NULL;
+            pthread_mutex_unlock(&self->incoming_mutex);
+            while (co != NULL) {
+                Coroutine* next = co->next;
+                resume(self, co);
+                co = next;
+            }
+        }
+    }
+    return NULL;
+}
+
+// --- Public Functions ---
+
+int start_session_threads(int count) {
+    if (count > MAX_SESSION_THREADS) count = MAX_SESSION_THREADS;
+    for (int i = 0; i < count; i++) {
+        SessionThread* thread = &threads[i];
+        pthread_t thread_id;
+        struct epoll_event event;
+        thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        thread->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (thread->epoll_fd == -1 || thread->wake_fd == -1) {
+            perror("session thread setup"); return -1;
+        }
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, thread->wake_fd, &event) == -1) {
+            perror("epoll_ctl wake_fd"); return -1;
+        }
+        pthread_mutex_init(&thread->incoming_mutex, NULL);
+        thread->incoming = NULL;
+        thread->sessions = 0;
+        if (pthread_create(&thread_id, NULL, session_thread_loop, thread) != 0) {
+            perror("pthread_create session thread"); return -1;
+        }
+        pthread_detach(thread_id);
+        thread_count = i + 1;
+    }
+    if (thread_count > 0) set_client_io_wait(wait_for_client);
+    return 0;
+}
+
+int session_thread_count() {
+    return thread_count;
+}
+
+int spawn_session(int client_socket, void* (*run)(void*), void* arg) {
+    if (thread_count == 0) {
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, NULL, run, arg) != 0) return -1;
+        pthread_detach(thread_id);
+        return 0;
+    }
+
+    Coroutine* co = (Coroutine*)calloc(1, sizeof(Coroutine));
+    if (co == NULL) return -1;
+    if ((co->stack = alloc_stack()) == NULL) { free(co); return -1; }
+    int flags = fcntl(client_socket, F_GETFL);
+    if (flags == -1 || fcntl(client_socket, F_SETFL, flags | O_NONBLOCK) == -1) {
+        free_coroutine(co); return -1;
+    }
+
+    // The least-loaded thread takes it, and keeps it for the whole session
+    SessionThread* thread = &threads[0];
+    for (int i = 1; i < thread_count; i++) {
+        if (__atomic_load_n(&threads[i].sessions, __ATOMIC_RELAXED) < __atomic_load_n(&thread->sessions, __ATOMIC_RELAXED)) thread = &threads[i];
+    }
+    co->run = run;
+    co->arg = arg;
+    co->armed_fd = -1;
+    co->thread = thread;
+    getcontext(&co->context);
+    co->context.uc_stack.ss_sp = co->stack;
+    co->context.uc_stack.ss_size = COROUTINE_STACK_SIZE;
+    co->context.uc_link = &thread->scheduler;
+    makecontext(&co->context, coroutine_main, 0);
+    __atomic_add_fetch(&thread->sessions, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&thread->incoming_mutex);
+    co->next = thread->incoming;
+    thread->incoming = co;
+    pthread_mutex_unlock(&thread->incoming_mutex);
+    uint64_t one = 1;
+    if (write(thread->wake_fd, &one, sizeof(one)) == -1) perror("write eventfd");
+    return 0;
+}
@@ -3,131 +3,122 @@
 #include "model.h"
 #include "utils.h"
 #include "shared.h" // For shared functions
-
-// --- FIX: NEW VALIDATION HELPER ---
-static int is_valid_amount(const char *str)
-{
-    int dots = 0;
-    if (my_strcmp(str, "") == 0)
-        return 0; // Empty
-    for (int i = 0; str[i] != '\0'; i++)
-    {
-        if (str[i] == '.')
-        {
-            dots++;
-        }
-        else if (str[i] < '0' || str[i] > '9')
-        {
-            return 0; // Not a digit
-        }
-        if (dots > 1)
-            return 0; // More than one dot
-    }
-    return 1;
-}
+#include "feedback_index.h"
+#include "account_index.h"
+#include "worker.h" // Loans and feedback reach the staff worker's queues
+#include "replication.h"
 
 // --- Private Customer Handlers ---
 
 static void handle_view_transaction_history(int client_socket, int userId)
 {
-    int fd = open(TRANSACTION_FILE, O_RDONLY);
-    if (fd == -1)
+    TransactionCursor cursor;
+    if (txn_cursor_open(&cursor, 0) == -1)
     {
-        write_string(client_socket, "No transactions found.\n");
+        write_string(client_socket, errno == ETIMEDOUT ? LOCK_BUSY_MESSAGE : "No transactions found.\n");
         return;
     }
 
-    set_file_lock(fd, F_RDLCK);
-    Transaction txn;
-    char buffer[256];
+    const Transaction *txn;
     int found = 0;
 
     write_string(client_socket, "\n--- Transaction History ---\n");
-    sprintf(buffer, "%-7s | %-15s | %-12s | %-15s | %-15s\n",
-            "TXN ID", "TYPE", "RECIVER ACC", "AMOUNT", "BALANCE");
-    write_string(client_socket, buffer);
-    write_string(client_socket, "--------------------------------------------------------------------------\n");
+    write_transaction_header(client_socket);
 
-    while (read(fd, &txn, sizeof(Transaction)) == sizeof(Transaction))
+    while ((txn = txn_cursor_next(&cursor)) != NULL)
     {
-        if (txn.accountId == userId)
+        if (txn->accountId == userId)
         {
             found = 1;
-            char type_str[16], other_user_str[20], amount_str[16], balance_str[16];
-            switch (txn.type)
-            {
-            case DEPOSIT:
-                strcpy(type_str, "CREDITED");
-                strcpy(other_user_str, "---");
-                sprintf(amount_str, "₹%.2f", txn.amount);
-                break;
-            case WITHDRAWAL:
-                strcpy(type_str, "DEBITED");
-                strcpy(other_user_str, "---");
-                sprintf(amount_str, "₹%.2f", txn.amount);
-                break;
-            case TRANSFER_OUT:
-                strcpy(type_str, "DEBITED");
-                sprintf(other_user_str, "%s", txn.otherPartyAccountNumber);
-                sprintf(amount_str, "₹%.2f", txn.amount);
-                break;
-            case TRANSFER_IN:
-                strcpy(type_str, "CREDITED");
-                sprintf(other_user_str, "%s", txn.otherPartyAccountNumber);
-                sprintf(amount_str, "₹%.2f", txn.amount);
-                break;
-            default:
-                strcpy(type_str, "UNKNOWN");
-                strcpy(other_user_str, "---");
-                sprintf(amount_str, "₹%.2f", txn.amount);
-            }
-            sprintf(balance_str, "₹%.2f", txn.newBalance);
-            sprintf(buffer, "%-7d | %-15s | %-12s | %-15s | %-15s\n",
-                    txn.transactionId, type_str, other_user_str, amount_str, balance_str);
-            write_string(client_socket, buffer);
+            write_transaction_row(client_socket, txn);
         }
     }
-    set_file_lock(fd, F_UNLCK);
-    close(fd);
+    txn_cursor_close(&cursor);
     if (!found)
     {
         write_string(client_socket, "No transactions found for this account.\n");
     }
 }
 
-static void handle_view_balance(int client_socket, int userId)
+// Parses YYYY-MM-DD as local midnight. Returns -1 on bad input.
+static time_t parse_date(const char *str)
 {
-    int record_num = find_account_record_by_id(userId);
-    if (record_num == -1)
+    int year, month, day;
+    char extra;
+    if (sscanf(str, "%4d-%2d-%2d%c", &year, &month, &day, &extra) != 3)
+        return -1;
+    if (month < 1 || month > 12 || day < 1 || day > 31)
+        return -1;
+    struct tm tm_info;
+    memset(&tm_info, 0, sizeof(tm_info));
+    tm_info.tm_year = year - 1900;
+    tm_info.tm_mon = month - 1;
+    tm_info.tm_mday = day;
+    tm_info.tm_isdst = -1;
+    return mktime(&tm_info);
+}
+
+static void handle_view_statement(int client_socket, int userId)
+{
+    char buffer[MAX_BUFFER];
+    write_string(client_socket, "Enter start date (YYYY-MM-DD): ");
+    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0)
+        return;
+    time_t from = parse_date(buffer);
+    write_string(client_socket, "Enter end date (YYYY-MM-DD): ");
+    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0)
+        return;
+    time_t to = parse_date(buffer);
+    if (from == -1 || to == -1 || to < from)
     {
-        write_string(client_socket, "Error: Account not found.\n");
+        write_string(client_socket, "Invalid date range.\n");
         return;
     }
-    int fd = open(ACCOUNT_FILE, O_RDONLY);
-    if (fd == -1)
+    to += 24 * 60 * 60 - 1; // End date is inclusive
+
+    // Jump straight to the first indexed block that can contain 'from'
+    TransactionCursor cursor;
+    if (txn_cursor_open(&cursor, find_transaction_record_at(from)) == -1)
     {
-        write_string(client_socket, "Error: Could not access account data.\n");
+        write_string(client_socket, errno == ETIMEDOUT ? LOCK_BUSY_MESSAGE : "No transactions found.\n");
         return;
     }
 
-    set_record_lock(fd, record_num, sizeof(Account), F_RDLCK);
-    lseek(fd, record_num * sizeof(Account), SEEK_SET);
-    Account account;
+    const Transaction *txn;
+    int found = 0;
 
-    // --- FIX: Check read() failure ---
-    if (read(fd, &account, sizeof(Account)) != sizeof(Account))
+    write_string(client_socket, "\n--- Account Statement ---\n");
+    write_transaction_header(client_socket);
+    while ((txn = txn_cursor_next(&cursor)) != NULL)
     {
-        write_string(client_socket, "Error: Could not read account data.\n");
+        if (txn->timestamp > to)
+            break; // Timestamps never decrease, so nothing later can match
+        if (txn->accountId == userId && txn->timestamp >= from)
+        {
+            found = 1;
+            write_transaction_row(client_socket, txn);
+        }
     }
-    else
+    txn_cursor_close(&cursor);
+    if (!found)
     {
-        char buffer[100];
-        sprintf(buffer, "Balance for account %s: ₹%.2f\n", account.accountNumber, account.balance);
-        write_string(client_socket, buffer);
+        write_string(client_socket, "No transactions found in this date range.\n");
     }
+}
 
-    set_record_lock(fd, record_num, sizeof(Account), F_UNLCK);
-    close(fd);
+static void handle_view_balance(int client_socket, int userId)
+{
+    // Optimistic read: never waits behind a deposit or transfer on this account
+    Account account;
+    if (read_account_by_id(userId, &account) == -1)
+    {
+        write_string(client_socket, errno == ENOENT ? "Error: Account not found.\n" : "Error: Could not read account data.\n");
+        return;
+    }
+
+    char buffer[100];
+    sprintf(buffer, "Balance for account %s: ₹%.2f\n", account.accountNumber, account.balance);
+    write_string(client_socket, buffer);
 }
 
 static void handle_deposit(int client_socket, int userId)
@@ -151,37 +142,26 @@ static void handle_deposit(int client_socket, int userId)
         return;
     }
 
-    int record_num = find_account_record_by_id(userId);
-    if (record_num == -1)
-    {
-        write_string(client_socket, "Error: Account not found.\n");
-        return;
-    }
-    int fd = open(ACCOUNT_FILE, O_RDWR);
+    int fd = open_account_file(userId, O_RDWR);
     if (fd == -1)
     {
         write_string(client_socket, "Error: Could not access account data.\n");
         return;
     }
 
-    set_record_lock(fd, record_num, sizeof(Account), F_WRLCK);
     Account account;
-    lseek(fd, record_num * sizeof(Account), SEEK_SET);
-
-    // --- FIX: Check read() failure ---
-    if (read(fd, &account, sizeof(Account)) != sizeof(Account))
+    int record_num = lock_account_by_id(fd, userId, &account);
+    if (record_num == -1)
     {
-        write_string(client_socket, "Error: Could not read account data.\n");
-        set_record_lock(fd, record_num, sizeof(Account), F_UNLCK);
+        write_string(client_socket, errno == ENOENT ? "Error: Account not found.\n" : LOCK_BUSY_MESSAGE);
         close(fd);
         return;
     }
 
     account.balance += amount;
-    lseek(fd, record_num * sizeof(Account), SEEK_SET);
 
     // --- FIX: Check write() failure ---
-    if (write(fd, &account, sizeof(Account)) != sizeof(Account))
+    if (write_account_record(fd, record_num, &account) != 0)
     {
         write_string(STDOUT_FILENO, "FATAL: Failed to write deposit to disk.\n");
     }
@@ -215,39 +195,32 @@ static void handle_withdraw(int client_socket, int userId)
         return;
     }
 
-    int record_num = find_account_record_by_id(userId);
-    if (record_num == -1)
-    {
-        write_string(client_socket, "Error: Account not found.\n");
-        return;
-    }
-    int fd = open(ACCOUNT_FILE, O_RDWR);
+    int fd = open_account_file(userId, O_RDWR);
     if (fd == -1)
     {
         write_string(client_socket, "Error: Could not access account data.\n");
         return;
     }
 
-    set_record_lock(fd, record_num, sizeof(Account), F_WRLCK);
     Account account;
-    lseek(fd, record_num * sizeof(Account), SEEK_SET);
-
-    // --- FIX: Check read() failure ---
-    if (read(fd, &account, sizeof(Account)) != sizeof(Account))
+    int record_num = lock_account_by_id(fd, userId, &account);
+    if (record_num == -1)
     {
-        write_string(client_socket, "Error: Could not read account data.\n");
+        write_string(client_socket, errno == ENOENT ? "Error: Account not found.\n" : LOCK_BUSY_MESSAGE);
+        close(fd);
+        return;
     }
-    else if (amount > account.balance)
+
+    if (amount > account.balance)
     {
         write_string(client_socket, "Insufficient funds.\n");
     }
     else
     {
         account.balance -= amount;
-        lseek(fd, record_num * sizeof(Account), SEEK_SET);
 
         // --- FIX: Check write() failure ---
-        if (write(fd, &account, sizeof(Account)) != sizeof(Account))
+        if (write_account_record(fd, record_num, &account) != 0)
         {
             write_string(STDOUT_FILENO, "FATAL: Failed to write withdrawal to disk.\n");
         }
@@ -262,6 +235,20 @@ static void handle_withdraw(int client_socket, int userId)
     close(fd);
 }
 
+// Prompts for a transfer amount. Returns 0, or -1 after telling the
+// customer what was wrong with it.
+static int read_transfer_amount(int client_socket, char* buffer, double* amount) {
+    write_string(client_socket, "Enter amount to transfer: ");
+    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) return -1;
+    if (!is_valid_amount(buffer)) {
+        write_string(client_socket, "Invalid amount. Please enter numbers only.\n");
+        return -1;
+    }
+    *amount = atof(buffer);
+    if (*amount <= 0.01) { write_string(client_socket, "Amount must be positive.\n"); return -1; }
+    return 0;
+}
+
 // --- MODIFIED: handle_transfer_funds ---
 static void handle_transfer_funds(int client_socket, int senderUserId) {
     char buffer[MAX_BUFFER];
@@ -274,122 +261,124 @@ static void handle_transfer_funds(int client_socket, int senderUserId) {
     int receiverUserId = atoi(receiver_user_id_str);
     if(receiverUserId <= 0) { write_string(client_socket, "Invalid User ID.\n"); return; }
 
-    write_string(client_socket, "Enter amount to transfer: ");
-    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) return;
-    if (!is_valid_amount(buffer)) {
-        write_string(client_socket, "Invalid amount. Please enter numbers only.\n");
-        return;
-    }
-    amount = atof(buffer);
-    if (amount <= 0.01) { write_string(client_socket, "Amount must be positive.\n"); return; }
-
-    int sender_rec_num = find_account_record_by_id(senderUserId);
-    int receiver_rec_num = find_account_record_by_id(receiverUserId);
+    if (read_transfer_amount(client_socket, buffer, &amount) == -1) return;
 
-    if (sender_rec_num == -1) {
-        write_string(client_socket, "Error: Your account could not be found.\n"); return;
-    }
-    if (receiver_rec_num == -1) {
-        write_string(client_socket, "Error: Recipient User ID not found.\n"); return;
-    }
-    if (sender_rec_num == receiver_rec_num) {
-        write_string(client_socket, "Cannot transfer funds to your own account.\n"); return;
-    }
+    // Locking, the WAL group and the ledger rows live in the model, which
+    // also handles a recipient on another account shard
+    execute_transfer(senderUserId, receiverUserId, amount, buffer);
+    write_string(client_socket, buffer);
+}
 
-    // --- ADDED: Log intent *before* locking ---
-    long t_id = get_next_transfer_id();
-    TransferLog log_entry;
-    log_entry.transferId = t_id;
-    log_entry.fromAccountId = senderUserId;
-    log_entry.toAccountId = receiverUserId;
-    log_entry.amount = amount;
-    log_entry.status = LOG_START;
-    write_transfer_log(&log_entry);
-    // --- END ADDED ---
+// Pays the account number customers see on balances and statements. The
+// account number index resolves it to the recipient's account ID, then the
+// transfer runs exactly as one by user ID.
+static void handle_transfer_to_account_number(int client_socket, int senderUserId) {
+    char buffer[MAX_BUFFER];
+    char account_number[20];
+    Account receiver;
+    double amount;
 
-    int fd = open(ACCOUNT_FILE, O_RDWR);
-    if (fd == -1)
-    {
-        write_string(client_socket, "Error accessing account data.\n");
+    write_string(client_socket, "Enter Account Number to transfer to (e.g. SB-12): ");
+    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) return;
+    if (buffer[0] == '\0' || strlen(buffer) >= sizeof(account_number)) {
+        write_string(client_socket, "Invalid Account Number.\n"); return;
+    }
+    strcpy(account_number, buffer);
+    if (account_index_find(account_number, &receiver) == -1) {
+        write_string(client_socket, errno == ENOENT ? "Error: Account Number not found.\n" : LOCK_BUSY_MESSAGE);
         return;
     }
 
-    int rec1 = (sender_rec_num < receiver_rec_num) ? sender_rec_num : receiver_rec_num;
-    int rec2 = (sender_rec_num > receiver_rec_num) ? sender_rec_num : receiver_rec_num;
-    set_record_lock(fd, rec1, sizeof(Account), F_WRLCK);
-    set_record_lock(fd, rec2, sizeof(Account), F_WRLCK);
+    if (read_transfer_amount(client_socket, buffer, &amount) == -1) return;
+    execute_transfer(senderUserId, receiver.accountId, amount, buffer);
+    write_string(client_socket, buffer);
+}
 
-    Account sender_account, receiver_account;
-    lseek(fd, sender_rec_num * sizeof(Account), SEEK_SET);
+// Parses "UserID Amount" pairs separated by commas and appends them to 'credits'.
+// Returns the number of pairs added, or -1 if any pair is malformed.
+static int parse_batch_entries(char *line, BatchCredit *credits, int count, int max_count)
+{
+    int added = 0;
+    char *saveptr;
+    for (char *entry = strtok_r(line, ",", &saveptr); entry != NULL; entry = strtok_r(NULL, ",", &saveptr))
+    {
+        char id_str[20], amount_str[32];
+        if (sscanf(entry, "%19s %31s", id_str, amount_str) != 2)
+            return -1;
+        int userId = atoi(id_str);
+        if (userId <= 0 || !is_valid_amount(amount_str) || atof(amount_str) <= 0.01)
+            return -1;
+        if (count + added >= max_count)
+            return -1;
+        credits[count + added].toAccountId = userId;
+        credits[count + added].amount = atof(amount_str);
+        added++;
+    }
+    return added;
+}
 
-    if (read(fd, &sender_account, sizeof(Account)) != sizeof(Account))
+static void handle_batch_transfer(int client_socket, int senderUserId)
+{
+    char buffer[MAX_BUFFER];
+    write_string(client_socket, "Enter number of recipients: ");
+    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0)
+        return;
+    int expected = atoi(buffer);
+    if (expected <= 0 || expected > MAX_BATCH_CREDITS)
     {
-        write_string(client_socket, "Error: Failed to read sender account.\n");
-        set_record_lock(fd, rec1, sizeof(Account), F_UNLCK);
-        set_record_lock(fd, rec2, sizeof(Account), F_UNLCK);
-        close(fd);
+        sprintf(buffer, "Number of recipients must be between 1 and %d.\n", MAX_BATCH_CREDITS);
+        write_string(client_socket, buffer);
         return;
     }
 
-    lseek(fd, receiver_rec_num * sizeof(Account), SEEK_SET);
-    if (read(fd, &receiver_account, sizeof(Account)) != sizeof(Account))
+    BatchCredit *credits = (BatchCredit *)malloc(expected * sizeof(BatchCredit));
+    if (credits == NULL)
     {
-        write_string(client_socket, "Error: Failed to read receiver account.\n");
-        set_record_lock(fd, rec1, sizeof(Account), F_UNLCK);
-        set_record_lock(fd, rec2, sizeof(Account), F_UNLCK);
-        close(fd);
+        write_string(client_socket, "Error: Could not start batch.\n");
         return;
     }
 
-
-    int transfer_succeeded = 0; // Flag to check if we should commit
-
-
-
-
-    if (sender_account.balance < amount)
+    int count = 0;
+    double total = 0.0;
+    while (count < expected)
     {
-        write_string(client_socket, "Insufficient funds.\n");
+        sprintf(buffer, "Recipients %d-%d of %d as 'UserID Amount', comma separated: ",
+                count + 1, expected, expected);
+        write_string(client_socket, buffer);
+        if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0)
+        {
+            free(credits);
+            return;
+        }
+        int added = parse_batch_entries(buffer, credits, count, expected);
+        if (added <= 0)
+        {
+            write_string(client_socket, "Invalid entry. Use e.g. '6 2500, 7 1800'. Try again.\n");
+            continue;
+        }
+        for (int i = count; i < count + added; i++)
+            total += credits[i].amount;
+        count += added;
     }
-    else if (!receiver_account.isActive)
-    { // --- FIX: State Validation ---
-        write_string(client_socket, "Error: The recipient's account is deactivated.\n");
+
+    sprintf(buffer, "Debit ₹%.2f to pay %d recipients. Confirm (yes/no): ", total, count);
+    write_string(client_socket, buffer);
+    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0)
+    {
+        free(credits);
+        return;
     }
-    else
+    if (my_strcmp(buffer, "yes") != 0)
     {
-        // --- MODIFIED: Perform Atomic Write ---
-        sender_account.balance -= amount;
-        lseek(fd, sender_rec_num * sizeof(Account), SEEK_SET);
-        if(write(fd, &sender_account, sizeof(Account)) != sizeof(Account)) {
-            write_string(STDOUT_FILENO, "FATAL: Transfer debit write failed.\n");
-        } else {
-            receiver_account.balance += amount;
-            lseek(fd, receiver_rec_num * sizeof(Account), SEEK_SET);
-            if(write(fd, &receiver_account, sizeof(Account)) != sizeof(Account)) {
-                write_string(STDOUT_FILENO, "FATAL: Transfer credit write failed.\n");
-            } else {
-                transfer_succeeded = 1; // Mark as success
-            }
-        }
+        write_string(client_socket, "Batch transfer cancelled.\n");
+        free(credits);
+        return;
     }
 
-    set_record_lock(fd, rec1, sizeof(Account), F_UNLCK);
-    set_record_lock(fd, rec2, sizeof(Account), F_UNLCK);
-    close(fd);
-// --- MODIFIED: Only log and notify if the commit was successful ---
-    if(transfer_succeeded) {
-        // --- ADDED: Log Commit ---
-        log_entry.status = LOG_COMMIT;
-        write_transfer_log(&log_entry);
-        // --- END ADDED ---
-
-        log_transaction(receiver_account.accountId, receiver_account.ownerUserId, TRANSFER_IN, amount, receiver_account.balance, sender_account.accountNumber);
-        log_transaction(sender_account.accountId, sender_account.ownerUserId, TRANSFER_OUT, amount, sender_account.balance, receiver_account.accountNumber);
-        write_string(client_socket, "Transfer successful.\n");
-    } else {
-        // Don't log commit, so recovery will roll it back
-        write_string(client_socket, "Transfer failed. Please check logs or try again.\n");
-    }
+    char message[256];
+    execute_batch_transfer(senderUserId, credits, count, message);
+    write_string(client_socket, message);
+    free(credits);
 }
 
 static void handle_apply_loan(int client_socket, int userId)
@@ -419,27 +408,34 @@ static void handle_apply_loan(int client_socket, int userId)
     }
 
     Loan new_loan;
-    new_loan.loanId = get_next_loan_id();
     new_loan.userId = userId;
     new_loan.accountIdToDeposit = userId;
     new_loan.amount = amount;
     new_loan.status = PENDING;
     new_loan.assignedToEmployeeId = 0;
 
-    int fd_loan = open(LOAN_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    int fd_loan = open(LOAN_FILE, O_RDWR | O_CREAT, 0644);
     if (fd_loan == -1)
     {
         write_string(client_socket, "Error submitting loan application.\n");
         return;
     }
 
-    set_file_lock(fd_loan, F_WRLCK);
-    if (write(fd_loan, &new_loan, sizeof(Loan)) != sizeof(Loan))
+    if (set_file_lock(fd_loan, F_WRLCK) == -1)
+    {
+        write_string(client_socket, LOCK_BUSY_MESSAGE);
+        close(fd_loan);
+        return;
+    }
+    new_loan.loanId = get_next_loan_id(); // Under the append lock, so IDs stay unique
+    int record_num = append_records(fd_loan, LOAN_FILE, &new_loan, sizeof(Loan), 1, new_loan.loanId + 1);
+    if (record_num == -1)
     {
         write_string(client_socket, "Error saving loan application.\n");
     }
     else
     {
+        publish_loan(&new_loan, record_num);
         sprintf(buffer, "Loan application (ID: %d) submitted. Status: PENDING\n", new_loan.loanId);
         write_string(client_socket, buffer);
     }
@@ -447,53 +443,52 @@ static void handle_apply_loan(int client_socket, int userId)
     close(fd_loan);
 }
 
+static int is_loan_of(const void *record, const void *ctx)
+{
+    return ((const Loan *)record)->userId == *(const int *)ctx;
+}
+
 static void handle_view_loan_status(int client_socket, int userId)
 {
-    int fd = open(LOAN_FILE, O_RDONLY);
-    if (fd == -1)
+    char buffer[256];
+    Loan *loans;
+    int count = snapshot_records(LOAN_FILE, sizeof(Loan), is_loan_of, &userId, (void **)&loans);
+    if (count == -1)
+    {
+        write_string(client_socket, errno == ENOMEM ? "Error: Out of memory.\n" : LOCK_BUSY_MESSAGE);
+        return;
+    }
+    if (count == 0)
     {
         write_string(client_socket, "No loan applications found.\n");
         return;
     }
-    set_file_lock(fd, F_RDLCK);
-    Loan loan;
-    char buffer[256];
-    int found = 0;
     write_string(client_socket, "\n--- Your Loan Applications ---\n");
-    while (read(fd, &loan, sizeof(Loan)) == sizeof(Loan))
+    for (int i = 0; i < count; i++)
     {
-        if (loan.userId == userId)
+        char *status_str;
+        switch (loans[i].status)
         {
-            found = 1;
-            char *status_str;
-            switch (loan.status)
-            {
-            case PENDING:
-                status_str = "PENDING";
-                break;
-            case PROCESSING:
-                status_str = "PROCESSING";
-                break;
-            case APPROVED:
-                status_str = "APPROVED";
-                break;
-            case REJECTED:
-                status_str = "REJECTED";
-                break;
-            default:
-                status_str = "UNKNOWN";
-            }
-            sprintf(buffer, "Loan ID: %d | Amount: ₹%.2f | Status: %s\n",
-                    loan.loanId, loan.amount, status_str);
-            write_string(client_socket, buffer);
+        case PENDING:
+            status_str = "PENDING";
+            break;
+        case PROCESSING:
+            status_str = "PROCESSING";
+            break;
+        case APPROVED:
+            status_str = "APPROVED";
+            break;
+        case REJECTED:
+            status_str = "REJECTED";
+            break;
+        default:
+            status_str = "UNKNOWN";
         }
+        sprintf(buffer, "Loan ID: %d | Amount: ₹%.2f | Status: %s\n",
+                loans[i].loanId, loans[i].amount, status_str);
+        write_string(client_socket, buffer);
     }
-    set_file_lock(fd, F_UNLCK);
-    close(fd);
-    if (!found)
-    {
-        write_string(client_socket, "No loan applications found.\n");
-    }
+    free(loans);
 }
 
 static void handle_add_feedback(int client_socket, int userId)
@@ -506,62 +501,83 @@ static void handle_add_feedback(int client_socket, int userId)
         return;
 
     Feedback new_feedback;
-    new_feedback.feedbackId = get_next_feedback_id();
     new_feedback.userId = userId;
     strncpy(new_feedback.feedbackText, buffer, 255);
     new_feedback.feedbackText[255] = '\0';
     new_feedback.isReviewed = 0;
 
-    int fd = open(FEEDBACK_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    int fd = open(FEEDBACK_FILE, O_RDWR | O_CREAT, 0644);
     if (fd == -1)
     {
         write_string(client_socket, "Error submitting feedback.\n");
         return;
     }
 
-    set_file_lock(fd, F_WRLCK);
-    if (write(fd, &new_feedback, sizeof(Feedback)) != sizeof(Feedback))
+    if (set_file_lock(fd, F_WRLCK) == -1)
+    {
+        write_string(client_socket, LOCK_BUSY_MESSAGE);
+        close(fd);
+        return;
+    }
+    new_feedback.feedbackId = get_next_feedback_id(); // Under the append lock, so IDs stay unique
+    int record_num = append_records(fd, FEEDBACK_FILE, &new_feedback, sizeof(Feedback), 1, new_feedback.feedbackId + 1);
+    if (record_num == -1)
     {
         write_string(client_socket, "Error saving feedback.\n");
     }
     else
     {
+        publish_feedback(&new_feedback, record_num);
         write_string(client_socket, "Feedback submitted successfully. Thank you!\n");
     }
     set_file_lock(fd, F_UNLCK);
     close(fd);
 }
 
+// The per-user index lists this customer's records, so only those are read
 static void handle_view_feedback_status(int client_socket, int userId)
 {
+    char buffer[512];
+    int *records;
+    int count = feedback_records_of(userId, &records);
+    if (count == -1)
+    {
+        write_string(client_socket, "Error loading feedback history.\n");
+        return;
+    }
+    if (count == 0)
+    {
+        write_string(client_socket, "No feedback history found.\n");
+        return;
+    }
     int fd = open(FEEDBACK_FILE, O_RDONLY);
     if (fd == -1)
     {
-        write_string(client_socket, "No feedback history found.\n");
+        write_string(client_socket, "Error accessing feedback data.\n");
+        free(records);
         return;
     }
-    set_file_lock(fd, F_RDLCK);
-    Feedback feedback;
-    char buffer[512];
-    int found = 0;
     write_string(client_socket, "\n--- Your Feedback History ---\n");
-    while (read(fd, &feedback, sizeof(Feedback)) == sizeof(Feedback))
-    {
-        if (feedback.userId == userId)
-        {
-            found = 1;
-            char *status_str = (feedback.isReviewed) ? "Reviewed" : "Pending Review";
-            sprintf(buffer, "ID: %d | Status: %s | Feedback: %.50s...\n",
-                    feedback.feedbackId, status_str, feedback.feedbackText);
-            write_string(client_socket, buffer);
-        }
+    for (int i = 0; i < count; i++)
+    {
+        Feedback feedback;
+        if (pread(fd, &feedback, sizeof(Feedback), record_offset(records[i], sizeof(Feedback))) != sizeof(Feedback) ||
+            feedback.userId != userId)
+            continue;
+        char *status_str = (feedback.isReviewed) ? "Reviewed" : "Pending Review";
+        sprintf(buffer, "ID: %d | Status: %s | Feedback: %.50s...\n",
+                feedback.feedbackId, status_str, feedback.feedbackText);
+        write_string(client_socket, buffer);
     }
-    set_file_lock(fd, F_UNLCK);
     close(fd);
-    if (!found)
-    {
-        write_string(client_socket, "No feedback history found.\n");
-    }
+    free(records);
+}
+
+// A read-only standby serves only the choices that change nothing and need
+// no in-memory index.
+static int is_read_only_choice(int choice)
+{
+    return choice == 1 || choice == 5 || choice == 7 || choice == 8 || choice == 13 || choice == 15;
 }
 
 // --- Public Customer Menu ---
@@ -578,6 +594,8 @@ void customer_menu(int client_socket, User user)
         write_string(client_socket, "       🏦  Customer Dashboard  🏦\n");
         write_string(client_socket, "+---------------------------------------+\n");
         write_string(client_socket, welcome_msg);
+        if (standby_read_only())
+            write_string(client_socket, "    (Read-only standby: options 1, 5, 7, 8, 13, 15)\n");
         write_string(client_socket, "-----------------------------------------\n");
 
         write_string(client_socket, " 1. View Balance\n");
@@ -591,7 +609,10 @@ void customer_menu(int client_socket, User user)
         write_string(client_socket, " 9. Add Feedback\n");
         write_string(client_socket, " 10. View Feedback Status\n");
         write_string(client_socket, " 11. Change Password\n");
-        write_string(client_socket, " 12. Logout\n");
+        write_string(client_socket, " 12. Batch Transfer (Payroll)\n");
+        write_string(client_socket, " 13. View Statement (Date Range)\n");
+        write_string(client_socket, " 14. Transfer to Account Number\n");
+        write_string(client_socket, " 15. Logout\n");
         write_string(client_socket, "+---------------------------------------+\n");
         write_string(client_socket, "Enter your choice: ");
 
@@ -610,6 +631,11 @@ void customer_menu(int client_socket, User user)
         // --- END FIX ---
 
         int choice = atoi(buffer);
+        if (standby_read_only() && !is_read_only_choice(choice))
+        {
+            write_string(client_socket, STANDBY_READ_ONLY_MESSAGE);
+            continue;
+        }
         switch (choice)
         {
         case 1:
@@ -646,6 +672,15 @@ void customer_menu(int client_socket, User user)
             handle_change_password(client_socket, user.userId);
             break;
         case 12:
+            handle_batch_transfer(client_socket, user.userId);
+            break;
+        case 13:
+            handle_view_statement(client_socket, user.userId);
+            break;
+        case 14:
+            handle_transfer_to_account_number(client_socket, user.userId);
+            break;
+        case 15:
             write_string(client_socket, "Logging out. Goodbye!\n");
             return;
         default:
@@ -0,0 +1,372 @@
+// src/customer_search.c
+#include "customer_search.h"
+#include "model.h"
+#include "hashmap.h"
+#include "utils.h"
+
+#define NAME_LEN 50   // sizeof(User.firstName)
+#define PHONE_LEN 15  // sizeof(User.phone)
+#define EMAIL_LEN 100 // sizeof(User.email)
+#define MAX_DOC_TRIGRAMS (2 * NAME_LEN + PHONE_LEN + EMAIL_LEN)
+#define LOAD_BATCH 256
+
+// --- Index Storage ---
+// 'docs' maps userId -> CustomerDoc*, the searchable fields as entered,
+// packed end to end so a million customers cost tens of megabytes.
+// 'postings' maps a trigram of lower-cased bytes (packed into an int) to
+// the sorted IDs of the customers whose full name ("first last"), phone or
+// email contains it. A query's candidates are the intersection of its
+// trigrams' lists; each is then checked against the fields themselves,
+// since trigrams say nothing about order. One mutex guards everything.
+// 'covered' is the users.dat nextId the index has seen, as in
+// account_index.c.
+typedef struct {
+    int userId;
+    char text[]; // "first\0last\0phone\0email\0"
+} CustomerDoc;
+
+enum { FIRST_NAME, LAST_NAME, PHONE, EMAIL, DOC_FIELDS };
+
+typedef struct {
+    int* ids;
+    int count;
+    int capacity;
+} Posting;
+
+static IntMap docs;
+static IntMap postings;
+static int covered = 0;
+static int loading = 0; // Postings are appended unsorted, then sorted once
+static int index_ready = 0;
+static pthread_mutex_t index_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// --- Text Helpers ---
+
+static unsigned char lower(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static int trigram_at(const char* text) {
+    return (lower(text[0]) << 16) | (lower(text[1]) << 8) | lower(text[2]);
+}
+
+// Appends the trigrams of 'text' to 'out'. Returns the new count.
+static int add_trigrams(const char* text, int* out, int count) {
+    int length = strlen(text);
+    for (int i = 0; i + 3 <= length; i++) out[count++] = trigram_at(text + i);
+    return count;
+}
+
+static int compare_int(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static void doc_fields(const CustomerDoc* doc, const char** fields) {
+    const char* next = doc->text;
+    for (int f = 0; f < DOC_FIELDS; f++) {
+        fields[f] = next;
+        next += strlen(next) + 1;
+    }
+}
+
+// The distinct trigrams of a customer's searchable fields, sorted.
+static int doc_trigrams(const CustomerDoc* doc, int* out) {
+    const char* fields[DOC_FIELDS];
+    char full_name[2 * NAME_LEN];
+    doc_fields(doc, fields);
+    sprintf(full_name, "%s %s", fields[FIRST_NAME], fields[LAST_NAME]);
+    int count = add_trigrams(full_name, out, 0);
+    count = add_trigrams(fields[PHONE], out, count);
+    count = add_trigrams(fields[EMAIL], out, count);
+    qsort(out, count, sizeof(int), compare_int);
+    int distinct = 0;
+    for (int i = 0; i < count; i++) {
+        if (distinct == 0 || out[distinct - 1] != out[i]) out[distinct++] = out[i];
+    }
+    return distinct;
+}
+
+// 3 if 'field' equals 'query', 2 if it starts with it, 1 if it contains
+// it, else 0. 'query' is already lower-cased.
+static int field_score(const char* field, const char* query, int query_length) {
+    int length = strlen(field);
+    for (int start = 0; start + query_length <= length; start++) {
+        int i = 0;
+        while (i < query_length && lower(field[start + i]) == (unsigned char)query[i]) i++;
+        if (i < query_length) continue;
+        if (start > 0) return 1;
+        return length == query_length ? 3 : 2;
+    }
+    return 0;
+}
+
+static int doc_score(const CustomerDoc* doc, const char* query, int query_length) {
+    const char* fields[DOC_FIELDS];
+    char full_name[2 * NAME_LEN];
+    doc_fields(doc, fields);
+    sprintf(full_name, "%s %s", fields[FIRST_NAME], fields[LAST_NAME]);
+    int best = field_score(full_name, query, query_length);
+    for (int f = 0; f < DOC_FIELDS && best < 3; f++) {
+        int score = field_score(fields[f], query, query_length);
+        if (score > best) best = score;
+    }
+    return best;
+}
+
+// --- Internal Helpers (caller holds index_mutex) ---
+
+static int ensure_ready() {
+    if (index_ready) return 0;
+    if (intmap_init(&docs, 1024) == -1) return -1;
+    if (intmap_init(&postings, 4096) == -1) { intmap_free(&docs); return -1; }
+    index_ready = 1;
+    return 0;
+}
+
+static int find_id(const Posting* posting, int userId) {
+    int low = 0, high = posting->count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (posting->ids[mid] < userId) low = mid + 1; else high = mid;
+    }
+    return low;
+}
+
+static int posting_add(int trigram, int userId) {
+    long value;
+    Posting* posting;
+    if (intmap_get(&postings, trigram, &value)) {
+        posting = (Posting*)value;
+    } else {
+        posting = (Posting*)calloc(1, sizeof(Posting));
+        if (posting == NULL) return -1;
+        if (intmap_put(&postings, trigram, (long)posting) == -1) { free(posting); return -1; }
+    }
+    if (posting->count == posting->capacity) {
+        int bigger_capacity = posting->capacity == 0 ? 4 : posting->capacity * 2;
+        int* bigger = (int*)realloc(posting->ids, bigger_capacity * sizeof(int));
+        if (bigger == NULL) return -1;
+        posting->ids = bigger;
+        posting->capacity = bigger_capacity;
+    }
+    // New customers have the highest IDs, so this is almost always an append
+    int at = loading ? posting->count : find_id(posting, userId);
+    if (at < posting->count && posting->ids[at] == userId) return 0;
+    memmove(&posting->ids[at + 1], &posting->ids[at], (posting->count - at) * sizeof(int));
+    posting->ids[at] = userId;
+    posting->count++;
+    return 0;
+}
+
+static void posting_remove(int trigram, int userId) {
+    long value;
+    if (!intmap_get(&postings, trigram, &value)) return;
+    Posting* posting = (Posting*)value;
+    int at = find_id(posting, userId);
+    if (at == posting->count || posting->ids[at] != userId) return;
+    memmove(&posting->ids[at], &posting->ids[at + 1], (posting->count - at - 1) * sizeof(int));
+    if (--posting->count == 0) {
+        intmap_remove(&postings, trigram);
+        free(posting->ids);
+        free(posting);
+    }
+}
+
+static void remove_doc(int userId) {
+    long value;
+    int trigrams[MAX_DOC_TRIGRAMS];
+    if (!intmap_get(&docs, userId, &value)) return;
+    CustomerDoc* doc = (CustomerDoc*)value;
+    int count = doc_trigrams(doc, trigrams);
+    for (int i = 0; i < count; i++) posting_remove(trigrams[i], userId);
+    intmap_remove(&docs, userId);
+    free(doc);
+}
+
+static int put_doc(const User* user) {
+    int trigrams[MAX_DOC_TRIGRAMS];
+    remove_doc(user->userId);
+    if (user->role != CUSTOMER) return 0;
+    const char* fields[DOC_FIELDS] = { user->firstName, user->lastName, user->phone, user->email };
+    size_t lengths[DOC_FIELDS] = {
+        strnlen(user->firstName, NAME_LEN - 1), strnlen(user->lastName, NAME_LEN - 1),
+        strnlen(user->phone, PHONE_LEN - 1), strnlen(user->email, EMAIL_LEN - 1)
+    };
+    CustomerDoc* doc = (CustomerDoc*)malloc(sizeof(CustomerDoc) + lengths[0] + lengths[1] + lengths[2] + lengths[3] + DOC_FIELDS);
+    if (doc == NULL) return -1;
+    doc->userId = user->userId;
+    char* next = doc->text;
+    for (int f = 0; f < DOC_FIELDS; f++) {
+        memcpy(next, fields[f], lengths[f]);
+        next[lengths[f]] = '\0';
+        next += lengths[f] + 1;
+    }
+    if (intmap_put(&docs, doc->userId, (long)doc) == -1) { free(doc); return -1; }
+    int count = doc_trigrams(doc, trigrams);
+    for (int i = 0; i < count; i++) {
+        if (posting_add(trigrams[i], doc->userId) == -1) return -1;
+    }
+    return 0;
+}
+
+static void clear_index() {
+    for (long i = intmap_next(&docs, 0); i != -1; i = intmap_next(&docs, i + 1)) free((void*)docs.values[i]);
+    for (long i = intmap_next(&postings, 0); i != -1; i = intmap_next(&postings, i + 1)) {
+        Posting* posting = (Posting*)postings.values[i];
+        free(posting->ids);
+        free(posting);
+    }
+    intmap_clear(&docs);
+    intmap_clear(&postings);
+    covered = 0;
+}
+
+// Indexes the customers with IDs from 'covered' on, reading both halves of
+// the user store a batch at a time. The whole-file read lock keeps the
+// compactor from moving a user past the scan. Returns 0 or -1.
+static int load_new_users() {
+    int fd = open(USER_FILE, O_RDONLY);
+    int fd_profile = open(USER_PROFILE_FILE, O_RDONLY);
+    if (fd == -1 || fd_profile == -1) {
+        if (fd != -1) close(fd);
+        if (fd_profile != -1) close(fd_profile);
+        return 0; // No users yet
+    }
+    UserAuth* auths = (UserAuth*)malloc(LOAD_BATCH * sizeof(UserAuth));
+    UserProfile* profiles = (UserProfile*)malloc(LOAD_BATCH * sizeof(UserProfile));
+    int status = (auths == NULL || profiles == NULL) ? -1 : set_file_lock(fd, F_RDLCK);
+    int locked = (status == 0);
+    DatHeader header;
+    if (status == 0 && read_dat_header(fd, &header) == 0 && header.nextId > covered) {
+        int start = covered, record_num = 0;
+        ssize_t got;
+        loading = (start == 0);
+        while (status == 0 && (got = pread(fd, auths, LOAD_BATCH * sizeof(UserAuth), record_offset(record_num, sizeof(UserAuth)))) >= (ssize_t)sizeof(UserAuth)) {
+            int n = got / sizeof(UserAuth);
+            if (pread(fd_profile, profiles, n * sizeof(UserProfile), record_offset(record_num, sizeof(UserProfile))) != (ssize_t)(n * sizeof(UserProfile))) break;
+            for (int i = 0; i < n && status == 0; i++) {
+                if (auths[i].userId < start || auths[i].role != CUSTOMER) continue; // Tombstones too
+                User user;
+                join_user(&auths[i], &profiles[i], &user);
+                status = put_doc(&user);
+            }
+            record_num += n;
+        }
+        if (loading) {
+            for (long i = intmap_next(&postings, 0); i != -1; i = intmap_next(&postings, i + 1)) {
+                Posting* posting = (Posting*)postings.values[i];
+                qsort(posting->ids, posting->count, sizeof(int), compare_int);
+                int* fitted = (int*)realloc(posting->ids, posting->count * sizeof(int));
+                if (fitted != NULL) { posting->ids = fitted; posting->capacity = posting->count; }
+            }
+            loading = 0;
+        }
+        if (status == 0) covered = header.nextId;
+    }
+    if (locked) set_file_lock(fd, F_UNLCK);
+    free(auths);
+    free(profiles);
+    close(fd);
+    close(fd_profile);
+    return status;
+}
+
+// Catches up with users another process added, once per change of the
+// users.dat header.
+static void catch_up() {
+    DatHeader header;
+    int fd = open(USER_FILE, O_RDONLY);
+    if (fd == -1) return;
+    int stale = read_dat_header(fd, &header) == 0 && header.nextId > covered;
+    close(fd);
+    if (stale && load_new_users() == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Could not catch the customer search index up.\n");
+    }
+}
+
+// --- Public Functions ---
+
+int customer_search_init() {
+    pthread_mutex_lock(&index_mutex);
+    int status = ensure_ready();
+    if (status == 0) {
+        clear_index();
+        status = load_new_users();
+    }
+    pthread_mutex_unlock(&index_mutex);
+    return status;
+}
+
+// Called once the user record is written.
+void customer_search_put(const User* user) {
+    pthread_mutex_lock(&index_mutex);
+    if (ensure_ready() == -1 || put_doc(user) == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Out of memory indexing a customer for search.\n");
+    } else if (covered == user->userId) {
+        covered = user->userId + 1;
+    }
+    pthread_mutex_unlock(&index_mutex);
+}
+
+void customer_search_remove(int userId) {
+    pthread_mutex_lock(&index_mutex);
+    if (index_ready) remove_doc(userId);
+    pthread_mutex_unlock(&index_mutex);
+}
+
+int customer_search(const char* query, CustomerMatch* out, int max, int* total) {
+    char lowered[EMAIL_LEN];
+    int length = strlen(query);
+    if (length < CUSTOMER_SEARCH_MIN_QUERY || length >= EMAIL_LEN) return -1;
+    for (int i = 0; i <= length; i++) lowered[i] = lower(query[i]);
+    int trigrams[EMAIL_LEN];
+    int trigram_count = add_trigrams(lowered, trigrams, 0);
+
+    pthread_mutex_lock(&index_mutex);
+    if (ensure_ready() == -1) { pthread_mutex_unlock(&index_mutex); return -1; }
+    catch_up();
+
+    // Candidates come from the shortest list; the others are probed
+    Posting* lists[EMAIL_LEN];
+    int shortest = 0, found = 0;
+    *total = 0;
+    for (int t = 0; t < trigram_count; t++) {
+        long value;
+        if (!intmap_get(&postings, trigrams[t], &value)) { trigram_count = 0; break; }
+        lists[t] = (Posting*)value;
+        if (lists[t]->count < lists[shortest]->count) shortest = t;
+    }
+    for (int c = 0; trigram_count > 0 && c < lists[shortest]->count; c++) {
+        int userId = lists[shortest]->ids[c];
+        int in_all = 1;
+        for (int t = 0; t < trigram_count && in_all; t++) {
+            int at = find_id(lists[t], userId);
+            in_all = at < lists[t]->count && lists[t]->ids[at] == userId;
+        }
+        long value;
+        if (!in_all || !intmap_get(&docs, userId, &value)) continue;
+        const CustomerDoc* doc = (const CustomerDoc*)value;
+        int score = doc_score(doc, lowered, length);
+        if (score == 0) continue;
+        (*total)++;
+
+        // Keep the best 'max', best first; IDs arrive in ascending order,
+        // so an equal score never displaces an earlier match
+        int at = found;
+        while (at > 0 && out[at - 1].score < score) at--;
+        if (at >= max) continue;
+        if (found < max) found++;
+        memmove(&out[at + 1], &out[at], (found - at - 1) * sizeof(CustomerMatch));
+        const char* fields[DOC_FIELDS];
+        doc_fields(doc, fields);
+        out[at].userId = doc->userId;
+        out[at].score = score;
+        strcpy(out[at].firstName, fields[FIRST_NAME]);
+        strcpy(out[at].lastName, fields[LAST_NAME]);
+        strcpy(out[at].phone, fields[PHONE]);
+        strcpy(out[at].email, fields[EMAIL]);
+    }
+    pthread_mutex_unlock(&index_mutex);
+    return found;
+}
@@ -3,10 +3,11 @@
 #include "model.h"
 #include "utils.h"
 #include "shared.h" // For shared functions
+#include "loan_index.h"
+#include "customer_search.h"
 
 // --- Private Employee Handlers ---
 
-// --- FIX: This is duplicated from customer.c, but required by this module ---
 static void handle_view_customer_transactions(int client_socket) {
     char buffer[MAX_BUFFER];
     write_string(client_socket, "Enter Customer User ID: ");
@@ -20,59 +21,25 @@ static void handle_view_customer_transactions(int client_socket) {
         write_string(client_socket, "Account not found for that User ID.\n"); return;
     }
     
-    // --- Start of duplicated logic ---
-    int fd = open(TRANSACTION_FILE, O_RDONLY);
-    if (fd == -1) { write_string(client_socket, "No transactions found.\n"); return; }
+    TransactionCursor cursor;
+    if (txn_cursor_open(&cursor, 0) == -1) {
+        write_string(client_socket, errno == ETIMEDOUT ? LOCK_BUSY_MESSAGE : "No transactions found.\n"); return;
+    }
 
-    set_file_lock(fd, F_RDLCK);
-    Transaction txn;
+    const Transaction* txn;
     int found = 0;
     
     write_string(client_socket, "\n--- Transaction History ---\n");
-    sprintf(buffer, "%-7s | %-15s | %-12s | %-15s | %-15s\n", 
-            "TXN ID", "TYPE", "RECIVER ACC", "AMOUNT", "BALANCE");
-    write_string(client_socket, buffer);
-    write_string(client_socket, "--------------------------------------------------------------------------\n");
+    write_transaction_header(client_socket);
 
-    while (read(fd, &txn, sizeof(Transaction)) == sizeof(Transaction)) {
-        if (txn.accountId == user_id) { 
+    while ((txn = txn_cursor_next(&cursor)) != NULL) {
+        if (txn->accountId == user_id) { 
             found = 1;
-            char type_str[16], other_user_str[20], amount_str[16], balance_str[16];
-            switch(txn.type) {
-                case DEPOSIT: 
-                    strcpy(type_str, "CREDITED"); 
-                    strcpy(other_user_str, "---");
-                    sprintf(amount_str, "₹%.2f", txn.amount);
-                    break;
-                case WITHDRAWAL: 
-                    strcpy(type_str, "DEBITED");
-                    strcpy(other_user_str, "---");
-                    sprintf(amount_str, "₹%.2f", txn.amount);
-                    break;
-                case TRANSFER_OUT: 
-                    strcpy(type_str, "DEBITED");
-                    sprintf(other_user_str, "%s", txn.otherPartyAccountNumber);
-                    sprintf(amount_str, "₹%.2f", txn.amount);
-                    break;
-                case TRANSFER_IN: 
-                    strcpy(type_str, "CREDITED"); 
-                    sprintf(other_user_str, "%s", txn.otherPartyAccountNumber);
-                    sprintf(amount_str, "₹%.2f", txn.amount);
-                    break;
-                default: 
-                    strcpy(type_str, "UNKNOWN");
-                    strcpy(other_user_str, "---");
-                    sprintf(amount_str, "₹%.2f", txn.amount);
-            }
-            sprintf(balance_str, "₹%.2f", txn.newBalance);
-            sprintf(buffer, "%-7d | %-15s | %-12s | %-15s | %-15s\n",
-                txn.transactionId, type_str, other_user_str, amount_str, balance_str);
-            write_string(client_socket, buffer);
+            write_transaction_row(client_socket, txn);
         }
     }
-    set_file_lock(fd, F_UNLCK); close(fd);
+    txn_cursor_close(&cursor);
     if (!found) { write_string(client_socket, "No transactions found for this account.\n"); }
-    // --- End of duplicated logic ---
 }
 
 static void handle_process_loan(int client_socket, int employeeId) {
@@ -82,104 +49,152 @@ static void handle_process_loan(int client_socket, int employeeId) {
     int loanId = atoi(buffer);
     if(loanId <= 0) { write_string(client_socket, "Invalid Loan ID.\n"); return; }
     
-    int rec_num = find_loan_record(loanId);
+    // The inbox answers for the employee's own loans; anything else needs the
+    // full scan only to tell "not found" from "not yours".
+    int rec_num = inbox_find(employeeId, loanId);
+    if (rec_num == -1) rec_num = find_loan_record(loanId);
     if (rec_num == -1) { write_string(client_socket, "Loan ID not found.\n"); return; }
     
     int fd = open(LOAN_FILE, O_RDWR);
     if (fd == -1) { write_string(client_socket, "Error accessing loan data.\n"); return; }
     
-    set_record_lock(fd, rec_num, sizeof(Loan), F_WRLCK);
-    lseek(fd, rec_num * sizeof(Loan), SEEK_SET);
-    Loan loan;
+    // --- Step 1: Validate and ask for the decision without holding a lock ---
+    Loan original;
+    if (pread(fd, &original, sizeof(Loan), record_offset(rec_num, sizeof(Loan))) != sizeof(Loan)) {
+        write_string(client_socket, "Error reading loan data.\n"); close(fd); return;
+    }
+    if (original.assignedToEmployeeId != employeeId) {
+        write_string(client_socket, "This loan is not assigned to you.\n"); close(fd); return;
+    }
+    if (original.status != PENDING && original.status != PROCESSING) {
+        write_string(client_socket, "This loan has already been processed.\n"); close(fd); return;
+    }
+
+    write_string(client_socket, "Choose action: 1 = Approve, 2 = Reject: ");
+    if(read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) { close(fd); return; }
+    int choice = atoi(buffer);
+    if (choice != 1 && choice != 2) {
+        write_string(client_socket, "Invalid choice. No action taken.\n"); close(fd); return;
+    }
 
-    // --- FIX: Check read() failure ---
-    if (read(fd, &loan, sizeof(Loan)) != sizeof(Loan)) {
+    // --- Step 2: Lock, confirm the loan is unchanged, then commit ---
+    if (set_record_lock(fd, rec_num, sizeof(Loan), F_WRLCK) == -1) {
+        write_string(client_socket, LOCK_BUSY_MESSAGE); close(fd); return;
+    }
+    Loan loan;
+    if (pread(fd, &loan, sizeof(Loan), record_offset(rec_num, sizeof(Loan))) != sizeof(Loan)) {
         write_string(client_socket, "Error reading loan data.\n");
-    } else if (loan.assignedToEmployeeId != employeeId) {
-        write_string(client_socket, "This loan is not assigned to you.\n");
-    } else if (loan.status != PENDING && loan.status != PROCESSING) {
-        write_string(client_socket, "This loan has already been processed.\n");
-    } else {
-        write_string(client_socket, "Choose action: 1 = Approve, 2 = Reject: ");
-        if(read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) {
-            set_record_lock(fd, rec_num, sizeof(Loan), F_UNLCK); close(fd); return;
+    } else if (memcmp(&loan, &original, sizeof(Loan)) != 0) {
+        write_string(client_socket, "This loan was changed while you were deciding. No action taken; please try again.\n");
+    } else if (choice == 2) {
+        loan.status = REJECTED;
+        if (pwrite(fd, &loan, sizeof(Loan), record_offset(rec_num, sizeof(Loan))) != sizeof(Loan)) {
+            write_string(STDOUT_FILENO, "FATAL: Failed to write loan status.\n");
+        } else {
+            replicate_write(LOAN_FILE, record_offset(rec_num, sizeof(Loan)), &loan, sizeof(Loan));
+            workload_loan_closed(employeeId, loanId);
+            write_string(client_socket, "Loan rejected.\n");
         }
-        int choice = atoi(buffer);
-        if (choice == 1) {
-            loan.status = APPROVED;
-            int account_rec_num = find_account_record_by_id(loan.accountIdToDeposit);
-            if (account_rec_num == -1) {
-                write_string(client_socket, "Loan approved, but customer account not found!\n");
+    } else {
+        loan.status = APPROVED;
+        Account account;
+        int fd_acct = open_account_file(loan.accountIdToDeposit, O_RDWR);
+        int account_rec_num = (fd_acct == -1) ? -1 : lock_account_by_id(fd_acct, loan.accountIdToDeposit, &account);
+        if (fd_acct == -1) {
+            write_string(client_socket, "Error opening account file.\n");
+        } else if (account_rec_num == -1 && errno == ENOENT) {
+            write_string(client_socket, "Loan approved, but customer account not found!\n");
+        } else if (account_rec_num == -1) {
+            write_string(client_socket, LOCK_BUSY_MESSAGE);
+            loan.status = original.status; // Leave the loan open for another try
+        } else {
+            account.balance += loan.amount;
+            if (write_account_record(fd_acct, account_rec_num, &account) == 0) {
+                log_transaction(account.accountId, account.ownerUserId, DEPOSIT, loan.amount, account.balance, "LOAN_CREDIT");
+                write_string(client_socket, "Loan approved. Amount credited to customer account.\n");
             } else {
-                int fd_acct = open(ACCOUNT_FILE, O_RDWR);
-                if(fd_acct == -1) { write_string(client_socket, "Error opening account file.\n"); }
-                else {
-                    set_record_lock(fd_acct, account_rec_num, sizeof(Account), F_WRLCK);
-                    Account account;
-                    lseek(fd_acct, account_rec_num * sizeof(Account), SEEK_SET);
-                    
-                    if (read(fd_acct, &account, sizeof(Account)) == sizeof(Account)) {
-                        account.balance += loan.amount;
-                        lseek(fd_acct, account_rec_num * sizeof(Account), SEEK_SET);
-                        if(write(fd_acct, &account, sizeof(Account)) == sizeof(Account)) {
-                            log_transaction(account.accountId, account.ownerUserId, DEPOSIT, loan.amount, account.balance, "LOAN_CREDIT");
-                            write_string(client_socket, "Loan approved. Amount credited to customer account.\n");
-                        } else {
-                            write_string(STDOUT_FILENO, "FATAL: Failed to write loan deposit.\n");
-                        }
-                    } else {
-                        write_string(client_socket, "Error reading customer account.\n");
-                    }
-                    set_record_lock(fd_acct, account_rec_num, sizeof(Account), F_UNLCK);
-                    close(fd_acct);
-                }
+                write_string(STDOUT_FILENO, "FATAL: Failed to write loan deposit.\n");
             }
-        } else if (choice == 2) {
-            loan.status = REJECTED;
-            write_string(client_socket, "Loan rejected.\n");
-        } else {
-            write_string(client_socket, "Invalid choice. No action taken.\n");
+            set_record_lock(fd_acct, account_rec_num, sizeof(Account), F_UNLCK);
         }
-        lseek(fd, rec_num * sizeof(Loan), SEEK_SET);
-        if(write(fd, &loan, sizeof(Loan)) != sizeof(Loan)) {
-            write_string(STDOUT_FILENO, "FATAL: Failed to write loan status.\n");
+        if (fd_acct != -1) close(fd_acct);
+        if (loan.status == APPROVED) {
+            if (pwrite(fd, &loan, sizeof(Loan), record_offset(rec_num, sizeof(Loan))) != sizeof(Loan)) {
+                write_string(STDOUT_FILENO, "FATAL: Failed to write loan status.\n");
+            } else {
+                replicate_write(LOAN_FILE, record_offset(rec_num, sizeof(Loan)), &loan, sizeof(Loan));
+                workload_loan_closed(employeeId, loanId);
+            }
         }
     }
     set_record_lock(fd, rec_num, sizeof(Loan), F_UNLCK);
     close(fd);
 }
 
+// Reads each loan in the employee's inbox by record number, so the cost
+// tracks their own queue rather than every loan in the bank.
 static void handle_view_assigned_loans(int client_socket, int employeeId) {
-    int fd = open(LOAN_FILE, O_RDONLY);
-    if (fd == -1) {
-        write_string(client_socket, "No loans found.\n");
-        return;
-    }
-
-    set_file_lock(fd, F_RDLCK);
-    Loan loan;
     char buffer[256];
-    int found = 0;
-    
+    InboxEntry* inbox;
+    int count = inbox_snapshot(employeeId, &inbox);
+    if (count == -1) { write_string(client_socket, "Error loading assigned loans.\n"); return; }
+
+    int fd = count > 0 ? open(LOAN_FILE, O_RDONLY) : -1;
+    if (count > 0 && fd == -1) { write_string(client_socket, "Error accessing loan data.\n"); free(inbox); return; }
+
+    int shown = 0;
     write_string(client_socket, "\n--- Your Assigned Loans ---\n");
-    lseek(fd, 0, SEEK_SET); 
-    while (read(fd, &loan, sizeof(Loan)) == sizeof(Loan)) {
-        if (loan.assignedToEmployeeId == employeeId && (loan.status == PENDING || loan.status == PROCESSING)) {
-            found = 1;
-            char* status_str = (loan.status == PENDING) ? "PENDING" : "PROCESSING";
-            sprintf(buffer, "Loan ID: %d | Customer ID: %d | Amount: ₹%.2f | Status: %s\n",
-                loan.loanId, loan.userId, loan.amount, status_str);
-            write_string(client_socket, buffer);
-        }
+    for (int i = 0; i < count; i++) {
+        Loan loan;
+        if (pread(fd, &loan, sizeof(Loan), record_offset(inbox[i].recordNum, sizeof(Loan))) != sizeof(Loan)) continue;
+        // Skip a loan closed between the inbox copy and this read
+        if (loan.loanId != inbox[i].loanId || loan.assignedToEmployeeId != employeeId) continue;
+        if (loan.status != PENDING && loan.status != PROCESSING) continue;
+        char* status_str = (loan.status == PENDING) ? "PENDING" : "PROCESSING";
+        sprintf(buffer, "Loan ID: %d | Customer ID: %d | Amount: ₹%.2f | Status: %s\n",
+            loan.loanId, loan.userId, loan.amount, status_str);
+        write_string(client_socket, buffer);
+        shown++;
     }
-    set_file_lock(fd, F_UNLCK);
-    close(fd);
+    if (fd != -1) close(fd);
+    free(inbox);
 
-    if (!found) {
+    if (shown == 0) {
         write_string(client_socket, "No assigned loans found.\n");
     }
 }
 
+// Finds customers by any part of their name, phone or email, e.g. the
+// first digits of a phone number, from the in-memory search index.
+static void handle_search_customers(int client_socket) {
+    char buffer[MAX_BUFFER];
+    sprintf(buffer, "Enter part of a name, phone or email (at least %d characters): ", CUSTOMER_SEARCH_MIN_QUERY);
+    write_string(client_socket, buffer);
+    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) return;
+    if (strlen(buffer) < CUSTOMER_SEARCH_MIN_QUERY) {
+        write_string(client_socket, "Search text too short.\n"); return;
+    }
+
+    CustomerMatch* matches = (CustomerMatch*)malloc(CUSTOMER_SEARCH_MAX_RESULTS * sizeof(CustomerMatch));
+    if (matches == NULL) { write_string(client_socket, "Error: Out of memory.\n"); return; }
+    int total = 0;
+    int shown = customer_search(buffer, matches, CUSTOMER_SEARCH_MAX_RESULTS, &total);
+    if (shown == -1) {
+        write_string(client_socket, "Search text too long.\n");
+    } else if (shown == 0) {
+        write_string(client_socket, "No matching customers.\n");
+    } else {
+        sprintf(buffer, "\n--- %d of %d matching customer(s) ---\n", shown, total);
+        write_string(client_socket, buffer);
+        for (int i = 0; i < shown; i++) {
+            sprintf(buffer, "User ID: %d | %s %s | Phone: %s | Email: %s\n",
+                matches[i].userId, matches[i].firstName, matches[i].lastName, matches[i].phone, matches[i].email);
+            write_string(client_socket, buffer);
+        }
+    }
+    free(matches);
+}
+
 // --- Public Employee Menu ---
 
 void employee_menu(int client_socket, User user) {
@@ -201,7 +216,8 @@ void employee_menu(int client_socket, User user) {
         write_string(client_socket, "5. Process Loan Application\n");
         write_string(client_socket, "6. View My Personal Details\n");
         write_string(client_socket, "7. Change My Password\n");
-        write_string(client_socket, "8. Logout\n");
+        write_string(client_socket, "8. Search Customers\n");
+        write_string(client_socket, "9. Logout\n");
         write_string(client_socket, "+---------------------------------------+\n");
         write_string(client_socket, "Enter your choice: ");
 
@@ -226,7 +242,8 @@ void employee_menu(int client_socket, User user) {
             case 5: handle_process_loan(client_socket, user.userId); break;
             case 6: handle_view_my_details(client_socket, user); break;
             case 7: handle_change_password(client_socket, user.userId); break;
-            case 8: write_string(client_socket, "Logging out. Goodbye!\n"); return;
+            case 8: handle_search_customers(client_socket); break;
+            case 9: write_string(client_socket, "Logging out. Goodbye!\n"); return;
             default: write_string(client_socket, "Invalid choice.\n");
         }
     }
@@ -0,0 +1,194 @@
+// src/feedback_index.c
+#include "feedback_index.h"
+#include "hashmap.h"
+#include "utils.h"
+
+// --- Index Storage ---
+// The unreviewed queue is a doubly linked list in submission order, with
+// 'queued' mapping feedbackId -> node so a review unlinks it in O(1).
+// 'by_user' maps userId -> UserFeedback*, the record numbers of every
+// entry that user submitted. One mutex guards both.
+typedef struct FeedbackNode {
+    FeedbackRef ref;
+    struct FeedbackNode* prev;
+    struct FeedbackNode* next;
+} FeedbackNode;
+
+typedef struct {
+    int* records;
+    int count;
+    int capacity;
+} UserFeedback;
+
+static FeedbackNode* head = NULL;
+static FeedbackNode* tail = NULL;
+static IntMap queued;
+static IntMap by_user;
+static int index_ready = 0;
+static pthread_mutex_t index_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// --- Internal Helpers (caller holds index_mutex) ---
+
+static int ensure_ready() {
+    if (index_ready) return 0;
+    if (intmap_init(&queued, 64) == -1) return -1;
+    if (intmap_init(&by_user, 64) == -1) { intmap_free(&queued); return -1; }
+    index_ready = 1;
+    return 0;
+}
+
+static int enqueue(const FeedbackRef* ref) {
+    if (intmap_get(&queued, ref->feedbackId, NULL)) return 0; // Already queued
+    FeedbackNode* node = (FeedbackNode*)malloc(sizeof(FeedbackNode));
+    if (node == NULL) return -1;
+    node->ref = *ref;
+    node->next = NULL;
+    node->prev = tail;
+    if (tail != NULL) tail->next = node; else head = node;
+    tail = node;
+    if (intmap_put(&queued, ref->feedbackId, (long)node) == -1) return -1;
+    return 0;
+}
+
+static void unlink_node(FeedbackNode* node) {
+    if (node->prev != NULL) node->prev->next = node->next; else head = node->next;
+    if (node->next != NULL) node->next->prev = node->prev; else tail = node->prev;
+    intmap_remove(&queued, node->ref.feedbackId);
+    free(node);
+}
+
+static int add_for_user(int userId, int record_num) {
+    long entry_ptr;
+    UserFeedback* entry;
+    if (intmap_get(&by_user, userId, &entry_ptr)) {
+        entry = (UserFeedback*)entry_ptr;
+    } else {
+        entry = (UserFeedback*)calloc(1, sizeof(UserFeedback));
+        if (entry == NULL) return -1;
+        if (intmap_put(&by_user, userId, (long)entry) == -1) { free(entry); return -1; }
+    }
+    if (entry->count == entry->capacity) {
+        int bigger_capacity = entry->capacity == 0 ? 4 : entry->capacity * 2;
+        int* bigger = (int*)realloc(entry->records, bigger_capacity * sizeof(int));
+        if (bigger == NULL) return -1;
+        entry->records = bigger;
+        entry->capacity = bigger_capacity;
+    }
+    entry->records[entry->count++] = record_num;
+    return 0;
+}
+
+static int index_record(const Feedback* feedback, int record_num) {
+    if (add_for_user(feedback->userId, record_num) == -1) return -1;
+    if (feedback->isReviewed) return 0;
+    FeedbackRef ref;
+    ref.feedbackId = feedback->feedbackId;
+    ref.recordNum = record_num;
+    ref.userId = feedback->userId;
+    return enqueue(&ref);
+}
+
+static void clear_index() {
+    while (head != NULL) unlink_node(head);
+    for (long i = intmap_next(&by_user, 0); i != -1; i = intmap_next(&by_user, i + 1)) {
+        UserFeedback* entry = (UserFeedback*)by_user.values[i];
+        free(entry->records);
+        free(entry);
+    }
+    intmap_clear(&by_user);
+}
+
+// --- Public Functions ---
+
+// Scans feedback.dat once, indexing every entry by user and queueing the
+// unreviewed ones.
+int feedback_index_init() {
+    pthread_mutex_lock(&index_mutex);
+    int status = ensure_ready();
+    if (status == 0) {
+        clear_index();
+        int fd = open(FEEDBACK_FILE, O_RDONLY);
+        if (fd != -1) {
+            set_file_lock(fd, F_RDLCK);
+            lseek(fd, DAT_HEADER_SIZE, SEEK_SET);
+            Feedback batch[64];
+            int record_num = 0;
+            ssize_t got;
+            while (status == 0 && (got = read(fd, batch, sizeof(batch))) >= (ssize_t)sizeof(Feedback)) {
+                int n = got / sizeof(Feedback);
+                for (int i = 0; i < n && status == 0; i++) {
+                    status = index_record(&batch[i], record_num + i);
+                }
+                record_num += n;
+            }
+            set_file_lock(fd, F_UNLCK);
+            close(fd);
+        }
+    }
+    pthread_mutex_unlock(&index_mutex);
+    return status;
+}
+
+// Called by handle_add_feedback after the record is written.
+void feedback_index_add(const Feedback* feedback, int record_num) {
+    pthread_mutex_lock(&index_mutex);
+    if (ensure_ready() == -1 || index_record(feedback, record_num) == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Out of memory indexing feedback.\n");
+    }
+    pthread_mutex_unlock(&index_mutex);
+}
+
+// Copies up to 'max' of the oldest unreviewed entries into 'out'. Returns the count.
+int feedback_queue_peek(FeedbackRef* out, int max) {
+    int count = 0;
+    pthread_mutex_lock(&index_mutex);
+    for (FeedbackNode* node = head; node != NULL && count < max; node = node->next) {
+        out[count++] = node->ref;
+    }
+    pthread_mutex_unlock(&index_mutex);
+    return count;
+}
+
+int feedback_queue_size() {
+    pthread_mutex_lock(&index_mutex);
+    int size = index_ready ? (int)queued.count : 0;
+    pthread_mutex_unlock(&index_mutex);
+    return size;
+}
+
+// Returns the record number of an unreviewed entry, or -1 if it is not queued.
+int feedback_queue_find(int feedbackId) {
+    long node_ptr;
+    int record_num = -1;
+    pthread_mutex_lock(&index_mutex);
+    if (index_ready && intmap_get(&queued, feedbackId, &node_ptr)) {
+        record_num = ((FeedbackNode*)node_ptr)->ref.recordNum;
+    }
+    pthread_mutex_unlock(&index_mutex);
+    return record_num;
+}
+
+// Drains an entry once a manager has marked it reviewed.
+void feedback_queue_remove(int feedbackId) {
+    long node_ptr;
+    pthread_mutex_lock(&index_mutex);
+    if (index_ready && intmap_get(&queued, feedbackId, &node_ptr)) {
+        unlink_node((FeedbackNode*)node_ptr);
+    }
+    pthread_mutex_unlock(&index_mutex);
+}
+
+int feedback_records_of(int userId, int** out) {
+    long entry_ptr;
+    int count = 0;
+    *out = NULL;
+    pthread_mutex_lock(&index_mutex);
+    if (index_ready && intmap_get(&by_user, userId, &entry_ptr)) {
+        UserFeedback* entry = (UserFeedback*)entry_ptr;
+        *out = (int*)malloc(entry->count * sizeof(int));
+        count = (*out == NULL) ? -1 : entry->count;
+        if (*out != NULL) memcpy(*out, entry->records, count * sizeof(int));
+    }
+    pthread_mutex_unlock(&index_mutex);
+    return count;
+}
@@ -0,0 +1,125 @@
+// src/hashmap.c
+#include "hashmap.h"
+
+// --- Internal Helpers ---
+
+static size_t hash_int(int key) {
+    // Knuth multiplicative hash; keys are mostly small sequential IDs
+    return (size_t)((unsigned int)key * 2654435761u);
+}
+
+static int alloc_table(IntMap* map, size_t capacity) {
+    map->keys = (int*)calloc(capacity, sizeof(int));
+    map->values = (long*)calloc(capacity, sizeof(long));
+    map->used = (unsigned char*)calloc(capacity, sizeof(unsigned char));
+    if (map->keys == NULL || map->values == NULL || map->used == NULL) {
+        free(map->keys); free(map->values); free(map->used);
+        map->keys = NULL; map->values = NULL; map->used = NULL;
+        return -1;
+    }
+    map->capacity = capacity;
+    map->count = 0;
+    return 0;
+}
+
+static int grow(IntMap* map) {
+    IntMap bigger;
+    if (alloc_table(&bigger, map->capacity * 2) == -1) return -1;
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->used[i]) intmap_put(&bigger, map->keys[i], map->values[i]);
+    }
+    intmap_free(map);
+    *map = bigger;
+    return 0;
+}
+
+// --- Public Functions ---
+
+int intmap_init(IntMap* map, size_t initial_capacity) {
+    size_t capacity = 16;
+    while (capacity < initial_capacity * 2) capacity <<= 1;
+    return alloc_table(map, capacity);
+}
+
+void intmap_free(IntMap* map) {
+    free(map->keys);
+    free(map->values);
+    free(map->used);
+    map->keys = NULL; map->values = NULL; map->used = NULL;
+    map->capacity = 0;
+    map->count = 0;
+}
+
+void intmap_clear(IntMap* map) {
+    memset(map->used, 0, map->capacity);
+    map->count = 0;
+}
+
+int intmap_put(IntMap* map, int key, long value) {
+    // Keep the load factor under 0.7
+    if ((map->count + 1) * 10 > map->capacity * 7) {
+        if (grow(map) == -1) return -1;
+    }
+    size_t mask = map->capacity - 1;
+    size_t i = hash_int(key) & mask;
+    while (map->used[i]) {
+        if (map->keys[i] == key) {
+            map->values[i] = value;
+            return 0;
+        }
+        i = (i + 1) & mask;
+    }
+    map->used[i] = 1;
+    map->keys[i] = key;
+    map->values[i] = value;
+    map->count++;
+    return 0;
+}
+
+int intmap_get(const IntMap* map, int key, long* value) {
+    if (map->capacity == 0) return 0;
+    size_t mask = map->capacity - 1;
+    size_t i = hash_int(key) & mask;
+    while (map->used[i]) {
+        if (map->keys[i] == key) {
+            if (value != NULL) *value = map->values[i];
+            return 1;
+        }
+        i = (i + 1) & mask;
+    }
+    return 0;
+}
+
+int intmap_remove(IntMap* map, int key) {
+    if (map->capacity == 0) return 0;
+    size_t mask = map->capacity - 1;
+    size_t i = hash_int(key) & mask;
+    while (map->used[i] && map->keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+    if (!map->used[i]) return 0;
+
+    // Backward-shift deletion keeps probe chains intact without tombstones
+    size_t hole = i;
+    size_t j = (i + 1) & mask;
+    while (map->used[j]) {
+        size_t home = hash_int(map->keys[j]) & mask;
+        int movable = (hole <= j) ? (home <= hole || home > j) : (home <= hole && home > j);
+        if (movable) {
+            map->keys[hole] = map->keys[j];
+            map->values[hole] = map->values[j];
+            hole = j;
+        }
+        j = (j + 1) & mask;
+    }
+    map->used[hole] = 0;
+    map->count--;
+    return 1;
+}
+
+long intmap_next(const IntMap* map, size_t pos) {
+    for (size_t i = pos; i < map->capacity; i++) {
+        if (map->used[i]) return (long)i;
+    }
+    return -1;
+}
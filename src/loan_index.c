@@ -0,0 +1,502 @@
+// src/loan_index.c
+#include "loan_index.h"
+#include "hashmap.h"
+#include "utils.h"
+#include "model.h" // Loan claims are replicated to standbys
+
+// --- Queue Storage ---
+// A doubly linked list keeps FIFO order; 'by_id' maps loanId -> node so a
+// claim unlinks its node in O(1) instead of walking the list.
+typedef struct QueueNode {
+    PendingLoan loan;
+    struct QueueNode* prev;
+    struct QueueNode* next;
+} QueueNode;
+
+static QueueNode* head = NULL;
+static QueueNode* tail = NULL;
+static IntMap by_id;
+static int by_id_ready = 0;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// --- Internal Helpers (caller holds queue_mutex) ---
+
+static int link_node(const PendingLoan* loan, int at_front) {
+    if (!by_id_ready) {
+        if (intmap_init(&by_id, 64) == -1) return -1;
+        by_id_ready = 1;
+    }
+    if (intmap_get(&by_id, loan->loanId, NULL)) return 0; // Already queued
+    QueueNode* node = (QueueNode*)malloc(sizeof(QueueNode));
+    if (node == NULL) return -1;
+    node->loan = *loan;
+    if (at_front) {
+        node->prev = NULL;
+        node->next = head;
+        if (head != NULL) head->prev = node; else tail = node;
+        head = node;
+    } else {
+        node->next = NULL;
+        node->prev = tail;
+        if (tail != NULL) tail->next = node; else head = node;
+        tail = node;
+    }
+    if (intmap_put(&by_id, loan->loanId, (long)node) == -1) return -1;
+    return 0;
+}
+
+static void unlink_node(QueueNode* node) {
+    if (node->prev != NULL) node->prev->next = node->next; else head = node->next;
+    if (node->next != NULL) node->next->prev = node->prev; else tail = node->prev;
+    intmap_remove(&by_id, node->loan.loanId);
+    free(node);
+}
+
+static void to_pending(const Loan* loan, int record_num, PendingLoan* out) {
+    out->loanId = loan->loanId;
+    out->recordNum = record_num;
+    out->userId = loan->userId;
+    out->amount = loan->amount;
+}
+
+// --- Public Functions ---
+
+// Scans loans.dat once and queues every unassigned PENDING loan.
+int loan_queue_init() {
+    pthread_mutex_lock(&queue_mutex);
+    while (head != NULL) unlink_node(head);
+
+    int status = 0;
+    int fd = open(LOAN_FILE, O_RDONLY);
+    if (fd != -1) {
+        set_file_lock(fd, F_RDLCK);
+        lseek(fd, DAT_HEADER_SIZE, SEEK_SET);
+        Loan loans[256];
+        int record_num = 0;
+        ssize_t got;
+        while (status == 0 && (got = read(fd, loans, sizeof(loans))) >= (ssize_t)sizeof(Loan)) {
+            int n = got / sizeof(Loan);
+            for (int i = 0; i < n && status == 0; i++) {
+                if (loans[i].status == PENDING && loans[i].assignedToEmployeeId == 0) {
+                    PendingLoan pending;
+                    to_pending(&loans[i], record_num + i, &pending);
+                    status = link_node(&pending, 0);
+                }
+            }
+            record_num += n;
+        }
+        set_file_lock(fd, F_UNLCK);
+        close(fd);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    return status;
+}
+
+void loan_queue_push(const Loan* loan, int record_num) {
+    PendingLoan pending;
+    to_pending(loan, record_num, &pending);
+    pthread_mutex_lock(&queue_mutex);
+    if (link_node(&pending, 0) == -1) write_string(STDOUT_FILENO, "ERROR: Out of memory queueing loan.\n");
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+// Copies up to 'max' of the oldest pending loans into 'out'. Returns the count.
+int loan_queue_peek(PendingLoan* out, int max) {
+    int count = 0;
+    pthread_mutex_lock(&queue_mutex);
+    for (QueueNode* node = head; node != NULL && count < max; node = node->next) {
+        out[count++] = node->loan;
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    return count;
+}
+
+int loan_queue_size() {
+    pthread_mutex_lock(&queue_mutex);
+    int size = by_id_ready ? (int)by_id.count : 0;
+    pthread_mutex_unlock(&queue_mutex);
+    return size;
+}
+
+int loan_queue_claim(int loanId, PendingLoan* out) {
+    long node_ptr;
+    int claimed = 0;
+    pthread_mutex_lock(&queue_mutex);
+    if (by_id_ready && intmap_get(&by_id, loanId, &node_ptr)) {
+        QueueNode* node = (QueueNode*)node_ptr;
+        *out = node->loan;
+        unlink_node(node);
+        claimed = 1;
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    return claimed;
+}
+
+// Puts a claimed loan back at the front, since it was the oldest when taken.
+void loan_queue_release(const PendingLoan* loan) {
+    pthread_mutex_lock(&queue_mutex);
+    if (link_node(loan, 1) == -1) write_string(STDOUT_FILENO, "ERROR: Out of memory requeueing loan.\n");
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+// --- Workload-Aware Assignment ---
+// Every employee with open loans has an inbox: the loans assigned to them
+// that are still PENDING or PROCESSING, in assignment order. An inbox's
+// size is that employee's load. Active employees also sit in a binary
+// min-heap ordered by load, ties broken by lower ID, so the least-loaded
+// employee is always at the root. 'heap_pos' tracks each employee's slot
+// so a load change can re-sift one entry in O(log E). Inactive employees
+// keep their inbox but are kept out of the heap.
+typedef struct {
+    int employeeId;
+    int load;
+} Workload;
+
+typedef struct {
+    InboxEntry* entries;
+    int count;
+    int capacity;
+} Inbox;
+
+static Workload* heap = NULL;
+static int heap_size = 0;
+static int heap_capacity = 0;
+static IntMap heap_pos;
+static IntMap inboxes;  // employeeId -> Inbox*
+static int workload_ready = 0;
+static pthread_mutex_t workload_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// --- Heap Helpers (caller holds workload_mutex) ---
+
+static int heap_less(const Workload* a, const Workload* b) {
+    return a->load < b->load || (a->load == b->load && a->employeeId < b->employeeId);
+}
+
+static void heap_place(int index, Workload entry) {
+    heap[index] = entry;
+    intmap_put(&heap_pos, entry.employeeId, index);
+}
+
+static void sift_up(int index) {
+    Workload entry = heap[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!heap_less(&entry, &heap[parent])) break;
+        heap_place(index, heap[parent]);
+        index = parent;
+    }
+    heap_place(index, entry);
+}
+
+static void sift_down(int index) {
+    Workload entry = heap[index];
+    while (1) {
+        int child = 2 * index + 1;
+        if (child >= heap_size) break;
+        if (child + 1 < heap_size && heap_less(&heap[child + 1], &heap[child])) child++;
+        if (!heap_less(&heap[child], &entry)) break;
+        heap_place(index, heap[child]);
+        index = child;
+    }
+    heap_place(index, entry);
+}
+
+static int ensure_workload_ready() {
+    if (workload_ready) return 0;
+    if (intmap_init(&heap_pos, 16) == -1) return -1;
+    if (intmap_init(&inboxes, 16) == -1) { intmap_free(&heap_pos); return -1; }
+    workload_ready = 1;
+    return 0;
+}
+
+static int heap_insert(int employeeId, int load) {
+    if (heap_size == heap_capacity) {
+        int bigger_capacity = heap_capacity == 0 ? 16 : heap_capacity * 2;
+        Workload* bigger = (Workload*)realloc(heap, bigger_capacity * sizeof(Workload));
+        if (bigger == NULL) return -1;
+        heap = bigger;
+        heap_capacity = bigger_capacity;
+    }
+    heap[heap_size].employeeId = employeeId;
+    heap[heap_size].load = load;
+    heap_size++;
+    sift_up(heap_size - 1);
+    return 0;
+}
+
+static void heap_delete(int index) {
+    intmap_remove(&heap_pos, heap[index].employeeId);
+    heap_size--;
+    if (index == heap_size) return;
+    heap[index] = heap[heap_size];
+    intmap_put(&heap_pos, heap[index].employeeId, index);
+    if (index > 0 && heap_less(&heap[index], &heap[(index - 1) / 2])) sift_up(index);
+    else sift_down(index);
+}
+
+// --- Inbox Helpers (caller holds workload_mutex) ---
+
+static Inbox* find_inbox(int employeeId) {
+    long inbox_ptr;
+    return intmap_get(&inboxes, employeeId, &inbox_ptr) ? (Inbox*)inbox_ptr : NULL;
+}
+
+static int load_of(int employeeId) {
+    Inbox* inbox = find_inbox(employeeId);
+    return inbox == NULL ? 0 : inbox->count;
+}
+
+// Re-sifts an employee's heap entry after their inbox grew or shrank.
+static void refresh_load(int employeeId, int grew) {
+    long index;
+    if (intmap_get(&heap_pos, employeeId, &index)) {
+        heap[index].load = load_of(employeeId);
+        if (grew) sift_down(index); else sift_up(index);
+    }
+}
+
+static int inbox_add(int employeeId, int loanId, int recordNum) {
+    Inbox* inbox = find_inbox(employeeId);
+    if (inbox == NULL) {
+        inbox = (Inbox*)calloc(1, sizeof(Inbox));
+        if (inbox == NULL) return -1;
+        if (intmap_put(&inboxes, employeeId, (long)inbox) == -1) { free(inbox); return -1; }
+    }
+    if (inbox->count == inbox->capacity) {
+        int bigger_capacity = inbox->capacity == 0 ? 8 : inbox->capacity * 2;
+        InboxEntry* bigger = (InboxEntry*)realloc(inbox->entries, bigger_capacity * sizeof(InboxEntry));
+        if (bigger == NULL) return -1;
+        inbox->entries = bigger;
+        inbox->capacity = bigger_capacity;
+    }
+    inbox->entries[inbox->count].loanId = loanId;
+    inbox->entries[inbox->count].recordNum = recordNum;
+    inbox->count++;
+    refresh_load(employeeId, 1);
+    return 0;
+}
+
+// Shifts the tail down so the inbox stays in assignment order. Costs
+// O(own queue), which is the bound the inbox view already pays.
+static void inbox_remove(int employeeId, int loanId) {
+    Inbox* inbox = find_inbox(employeeId);
+    if (inbox == NULL) return;
+    for (int i = 0; i < inbox->count; i++) {
+        if (inbox->entries[i].loanId == loanId) {
+            memmove(&inbox->entries[i], &inbox->entries[i + 1], (inbox->count - i - 1) * sizeof(InboxEntry));
+            inbox->count--;
+            refresh_load(employeeId, 0);
+            return;
+        }
+    }
+}
+
+static void free_inboxes() {
+    for (long i = intmap_next(&inboxes, 0); i != -1; i = intmap_next(&inboxes, i + 1)) {
+        Inbox* inbox = (Inbox*)inboxes.values[i];
+        free(inbox->entries);
+        free(inbox);
+    }
+    intmap_clear(&inboxes);
+}
+
+// --- Public Functions ---
+
+// Seeds the pool with every active employee and fills their inboxes with
+// the open loans assigned to them.
+int workload_init() {
+    pthread_mutex_lock(&workload_mutex);
+    int status = ensure_workload_ready();
+    if (status == 0) {
+        heap_size = 0;
+        intmap_clear(&heap_pos);
+        free_inboxes();
+
+        int fd = open(LOAN_FILE, O_RDONLY);
+        if (fd != -1) {
+            Loan loans[256];
+            int record_num = 0;
+            ssize_t got;
+            set_file_lock(fd, F_RDLCK);
+            lseek(fd, DAT_HEADER_SIZE, SEEK_SET);
+            while (status == 0 && (got = read(fd, loans, sizeof(loans))) >= (ssize_t)sizeof(Loan)) {
+                int n = got / sizeof(Loan);
+                for (int i = 0; i < n && status == 0; i++) {
+                    if ((loans[i].status == PENDING || loans[i].status == PROCESSING) && loans[i].assignedToEmployeeId != 0) {
+                        status = inbox_add(loans[i].assignedToEmployeeId, loans[i].loanId, record_num + i);
+                    }
+                }
+                record_num += n;
+            }
+            set_file_lock(fd, F_UNLCK);
+            close(fd);
+        }
+
+        fd = open(USER_FILE, O_RDONLY);
+        if (status == 0 && fd != -1) {
+            UserAuth users[256]; // Role and status are in the auth half
+            ssize_t got;
+            set_file_lock(fd, F_RDLCK);
+            lseek(fd, DAT_HEADER_SIZE, SEEK_SET);
+            while (status == 0 && (got = read(fd, users, sizeof(users))) >= (ssize_t)sizeof(UserAuth)) {
+                for (int i = 0; i < (int)(got / sizeof(UserAuth)) && status == 0; i++) {
+                    if (users[i].role == EMPLOYEE && users[i].isActive) {
+                        status = heap_insert(users[i].userId, load_of(users[i].userId));
+                    }
+                }
+            }
+            set_file_lock(fd, F_UNLCK);
+        }
+        if (fd != -1) close(fd);
+    }
+    pthread_mutex_unlock(&workload_mutex);
+    return status;
+}
+
+// Adds an employee to, or removes them from, the pool that receives new
+// loans. Called when an employee is created, (de)activated or changes role.
+void workload_set_employee(int employeeId, int can_receive) {
+    pthread_mutex_lock(&workload_mutex);
+    if (ensure_workload_ready() == 0) {
+        long index;
+        int present = intmap_get(&heap_pos, employeeId, &index);
+        if (can_receive && !present) {
+            if (heap_insert(employeeId, load_of(employeeId)) == -1) write_string(STDOUT_FILENO, "ERROR: Out of memory adding employee to the loan pool.\n");
+        } else if (!can_receive && present) {
+            heap_delete(index);
+        }
+    }
+    pthread_mutex_unlock(&workload_mutex);
+}
+
+void workload_loan_closed(int employeeId, int loanId) {
+    pthread_mutex_lock(&workload_mutex);
+    if (workload_ready) inbox_remove(employeeId, loanId);
+    pthread_mutex_unlock(&workload_mutex);
+}
+
+int workload_of(int employeeId) {
+    pthread_mutex_lock(&workload_mutex);
+    int load = workload_ready ? load_of(employeeId) : 0;
+    pthread_mutex_unlock(&workload_mutex);
+    return load;
+}
+
+// Copies an employee's inbox into a malloc'd array the caller frees.
+// Returns the entry count, or -1 if out of memory.
+int inbox_snapshot(int employeeId, InboxEntry** out) {
+    *out = NULL;
+    int count = 0;
+    pthread_mutex_lock(&workload_mutex);
+    Inbox* inbox = workload_ready ? find_inbox(employeeId) : NULL;
+    if (inbox != NULL && inbox->count > 0) {
+        *out = (InboxEntry*)malloc(inbox->count * sizeof(InboxEntry));
+        count = (*out == NULL) ? -1 : inbox->count;
+        if (*out != NULL) memcpy(*out, inbox->entries, count * sizeof(InboxEntry));
+    }
+    pthread_mutex_unlock(&workload_mutex);
+    return count;
+}
+
+// Returns the loans.dat record of 'loanId' if it is in the employee's
+// inbox, or -1.
+int inbox_find(int employeeId, int loanId) {
+    int record_num = -1;
+    pthread_mutex_lock(&workload_mutex);
+    Inbox* inbox = workload_ready ? find_inbox(employeeId) : NULL;
+    for (int i = 0; inbox != NULL && i < inbox->count; i++) {
+        if (inbox->entries[i].loanId == loanId) { record_num = inbox->entries[i].recordNum; break; }
+    }
+    pthread_mutex_unlock(&workload_mutex);
+    return record_num;
+}
+
+// Picks the least-loaded active employee and puts the loan in their inbox
+// in one step, so concurrent pickers spread out. Returns -1 if no employee
+// can receive loans.
+static int pick_and_open(const PendingLoan* claimed) {
+    int employeeId = -1;
+    pthread_mutex_lock(&workload_mutex);
+    if (workload_ready && heap_size > 0) {
+        employeeId = heap[0].employeeId;
+        if (inbox_add(employeeId, claimed->loanId, claimed->recordNum) == -1) employeeId = -1;
+    }
+    pthread_mutex_unlock(&workload_mutex);
+    return employeeId;
+}
+
+static int open_for(const PendingLoan* claimed, int employeeId) {
+    pthread_mutex_lock(&workload_mutex);
+    int status = ensure_workload_ready();
+    if (status == 0) status = inbox_add(employeeId, claimed->loanId, claimed->recordNum);
+    pthread_mutex_unlock(&workload_mutex);
+    return status;
+}
+
+// --- Assigning Loans ---
+
+// Marks a claimed loan as PROCESSING for 'employeeId'. The caller has
+// already put the loan in the employee's inbox; on failure the loan goes
+// back to the queue and leaves the inbox. Returns 1 if assigned, 0 if the
+// loan turned out not to be pending, -1 on a busy lock or I/O error.
+static int commit_assignment(int fd, const PendingLoan* claimed, int employeeId) {
+    off_t offset = record_offset(claimed->recordNum, sizeof(Loan));
+    if (set_record_lock(fd, claimed->recordNum, sizeof(Loan), F_WRLCK) == -1) {
+        loan_queue_release(claimed);
+        workload_loan_closed(employeeId, claimed->loanId);
+        return -1;
+    }
+    Loan loan;
+    int result;
+    if (pread(fd, &loan, sizeof(Loan), offset) != sizeof(Loan) || loan.loanId != claimed->loanId) {
+        result = -1;
+    } else if (loan.assignedToEmployeeId != 0 || loan.status != PENDING) {
+        result = 0; // Not pending after all; keep it out of the queue
+    } else {
+        loan.assignedToEmployeeId = employeeId;
+        loan.status = PROCESSING;
+        result = pwrite(fd, &loan, sizeof(Loan), offset) == sizeof(Loan) ? 1 : -1;
+        if (result == 1) replicate_write(LOAN_FILE, offset, &loan, sizeof(Loan));
+    }
+    set_record_lock(fd, claimed->recordNum, sizeof(Loan), F_UNLCK);
+    if (result == -1) loan_queue_release(claimed);
+    if (result != 1) workload_loan_closed(employeeId, claimed->loanId);
+    return result;
+}
+
+// Assigns one claimed loan to a specific employee (manual assignment).
+int assign_claimed_loan(const PendingLoan* claimed, int employeeId) {
+    int fd = open(LOAN_FILE, O_RDWR);
+    if (fd == -1 || open_for(claimed, employeeId) == -1) {
+        if (fd != -1) close(fd);
+        loan_queue_release(claimed);
+        return -1;
+    }
+    int result = commit_assignment(fd, claimed, employeeId);
+    close(fd);
+    return result;
+}
+
+// Drains the pending queue in FIFO order, giving each loan to whoever is
+// least loaded at that moment. Stops early (leaving the rest queued) if
+// no employee is available or a loan record stays busy. Returns the
+// number of loans assigned, and sets *remaining to what is still queued.
+int assign_all_pending_loans(int* remaining) {
+    int assigned = 0;
+    int fd = open(LOAN_FILE, O_RDWR);
+    if (fd != -1) {
+        PendingLoan claimed;
+        PendingLoan next;
+        while (loan_queue_peek(&next, 1) == 1) {
+            if (!loan_queue_claim(next.loanId, &claimed)) continue; // Another manager took it
+            int employeeId = pick_and_open(&claimed);
+            if (employeeId == -1) { loan_queue_release(&claimed); break; }
+            int result = commit_assignment(fd, &claimed, employeeId);
+            if (result == -1) break;
+            assigned += result;
+        }
+        close(fd);
+    }
+    *remaining = loan_queue_size();
+    return assigned;
+}
@@ -3,133 +3,159 @@
 #include "model.h"
 #include "utils.h"
 #include "shared.h" // For shared functions
+#include "loan_index.h"
+#include "feedback_index.h"
+
+#define LOAN_QUEUE_PAGE 20
+#define FEEDBACK_QUEUE_PAGE 20
 
 // --- Private Manager Handlers ---
 
 static void handle_assign_loan(int client_socket) {
-    int fd = open(LOAN_FILE, O_RDWR);
-    if (fd == -1) {
-        write_string(client_socket, "No loans found.\n");
-        return;
-    }
-
-    set_file_lock(fd, F_RDLCK);
-    Loan loan;
     char buffer[256];
-    int found = 0;
-    
+    // The work queue lists the oldest pending loans without touching loans.dat
+    PendingLoan pending[LOAN_QUEUE_PAGE];
+    int count = loan_queue_peek(pending, LOAN_QUEUE_PAGE);
+
     write_string(client_socket, "\n--- Unassigned Loans (Status: PENDING) ---\n");
-    lseek(fd, 0, SEEK_SET); 
-    while (read(fd, &loan, sizeof(Loan)) == sizeof(Loan)) {
-        if (loan.assignedToEmployeeId == 0 && loan.status == PENDING) {
-            found = 1;
-            sprintf(buffer, "Loan ID: %d | Customer ID: %d | Amount: ₹%.2f\n",
-                loan.loanId, loan.userId, loan.amount);
-            write_string(client_socket, buffer);
-        }
+    for (int i = 0; i < count; i++) {
+        sprintf(buffer, "Loan ID: %d | Customer ID: %d | Amount: ₹%.2f\n",
+            pending[i].loanId, pending[i].userId, pending[i].amount);
+        write_string(client_socket, buffer);
     }
-    set_file_lock(fd, F_UNLCK);
 
-    if (!found) {
+    if (count == 0) {
         write_string(client_socket, "No unassigned loans found.\n");
-        close(fd);
         return;
     }
+    int queued = loan_queue_size();
+    if (queued > count) {
+        sprintf(buffer, "...and %d more (oldest shown first).\n", queued - count);
+        write_string(client_socket, buffer);
+    }
 
     write_string(client_socket, "Enter Loan ID to assign: ");
-    if(read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) { close(fd); return; }
+    if(read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) return;
     int loanId = atoi(buffer);
-    if(loanId <= 0) { write_string(client_socket, "Invalid Loan ID.\n"); close(fd); return; }
+    if(loanId <= 0) { write_string(client_socket, "Invalid Loan ID.\n"); return; }
 
     write_string(client_socket, "Enter Employee ID to assign to: ");
-    if(read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) { close(fd); return; }
+    if(read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) return;
     int employeeId = atoi(buffer);
-    if(employeeId <= 0) { write_string(client_socket, "Invalid Employee ID.\n"); close(fd); return; }
+    if(employeeId <= 0) { write_string(client_socket, "Invalid Employee ID.\n"); return; }
 
     // --- FIX: Check if Employee ID is valid ---
-    int emp_rec_num = find_user_record(employeeId);
-    if (emp_rec_num == -1) {
+    User employee;
+    if (read_user_by_id(employeeId, &employee) == -1) {
         write_string(client_socket, "Employee not found.\n");
-        close(fd);
         return;
     }
-    // (You could also add a check here to ensure the user.role is EMPLOYEE)
+    if (employee.role != EMPLOYEE || !employee.isActive) {
+        write_string(client_socket, "That user is not an active employee.\n");
+        return;
+    }
 
-    int loan_rec_num = find_loan_record(loanId);
-    if (loan_rec_num == -1) {
-        write_string(client_socket, "Loan not found.\n");
-        close(fd);
+    // Claiming removes the loan from the queue, so a second manager picking
+    // the same ID is refused here rather than racing us to the record.
+    PendingLoan claimed;
+    if (!loan_queue_claim(loanId, &claimed)) {
+        write_string(client_socket, "Loan cannot be assigned (already assigned or processed).\n");
         return;
     }
 
-    set_record_lock(fd, loan_rec_num, sizeof(Loan), F_WRLCK);
-    lseek(fd, loan_rec_num * sizeof(Loan), SEEK_SET);
-    
-    // --- FIX: Check read() failure ---
-    if (read(fd, &loan, sizeof(Loan)) != sizeof(Loan)) {
-         write_string(client_socket, "Error reading loan record.\n");
-    } else if (loan.assignedToEmployeeId != 0 || loan.status != PENDING) {
-         write_string(client_socket, "Loan cannot be assigned (already assigned or processed).\n");
+    int result = assign_claimed_loan(&claimed, employeeId);
+    if (result == 1) {
+        sprintf(buffer, "Loan assigned successfully. Employee %d now has %d open loan(s).\n",
+            employeeId, workload_of(employeeId));
+        write_string(client_socket, buffer);
+    } else if (result == 0) {
+        write_string(client_socket, "Loan cannot be assigned (already assigned or processed).\n");
     } else {
-        loan.assignedToEmployeeId = employeeId;
-        loan.status = PROCESSING; 
-        lseek(fd, loan_rec_num * sizeof(Loan), SEEK_SET);
-        // --- FIX: Check write() failure ---
-        if(write(fd, &loan, sizeof(Loan)) != sizeof(Loan)) {
-            write_string(STDOUT_FILENO, "FATAL: Failed to assign loan.\n");
-        } else {
-            write_string(client_socket, "Loan assigned successfully.\n");
-        }
+        write_string(client_socket, LOCK_BUSY_MESSAGE);
     }
+}
 
-    set_record_lock(fd, loan_rec_num, sizeof(Loan), F_UNLCK);
-    close(fd);
+static void handle_assign_all_pending(int client_socket) {
+    char buffer[256];
+    int queued = loan_queue_size();
+    if (queued == 0) {
+        write_string(client_socket, "No unassigned loans found.\n");
+        return;
+    }
+    sprintf(buffer, "Assign all %d pending loans to the least-loaded employees? (yes/no): ", queued);
+    write_string(client_socket, buffer);
+    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) return;
+    if (my_strcmp(buffer, "yes") != 0) {
+        write_string(client_socket, "Cancelled.\n");
+        return;
+    }
+
+    int remaining;
+    int assigned = assign_all_pending_loans(&remaining);
+    sprintf(buffer, "Assigned %d loan(s). %d still pending.\n", assigned, remaining);
+    write_string(client_socket, buffer);
+    if (remaining > 0) {
+        write_string(client_socket, "Some loans were left pending: no active employees, or a loan record was busy.\n");
+    }
 }
 
 static void handle_review_feedback(int client_socket) {
+    char buffer[512];
     int fd = open(FEEDBACK_FILE, O_RDWR);
     if (fd == -1) {
-        write_string(client_socket, "No feedback found.\n");
+        write_string(client_socket, "Error accessing feedback data.\n");
         return;
     }
 
-    set_file_lock(fd, F_RDLCK);
-    Feedback feedback;
-    char buffer[512];
-    int found = 0;
-    
+    // The unreviewed queue names the oldest entries; only those records are read
+    FeedbackRef pending[FEEDBACK_QUEUE_PAGE];
+    int count = feedback_queue_peek(pending, FEEDBACK_QUEUE_PAGE);
+
     write_string(client_socket, "\n--- Unreviewed Feedback ---\n");
-    lseek(fd, 0, SEEK_SET); 
-    while (read(fd, &feedback, sizeof(Feedback)) == sizeof(Feedback)) {
-        if (feedback.isReviewed == 0) {
-            found = 1;
-            sprintf(buffer, "ID: %d | User: %d | Feedback: %.100s...\n",
-                feedback.feedbackId, feedback.userId, feedback.feedbackText);
-            write_string(client_socket, buffer);
-        }
+    int shown = 0;
+    for (int i = 0; i < count; i++) {
+        Feedback entry;
+        if (pread(fd, &entry, sizeof(Feedback), record_offset(pending[i].recordNum, sizeof(Feedback))) != sizeof(Feedback)) continue;
+        if (entry.feedbackId != pending[i].feedbackId || entry.isReviewed) continue;
+        sprintf(buffer, "ID: %d | User: %d | Feedback: %.100s...\n",
+            entry.feedbackId, entry.userId, entry.feedbackText);
+        write_string(client_socket, buffer);
+        shown++;
     }
-    set_file_lock(fd, F_UNLCK);
 
-    if (!found) {
+    if (shown == 0) {
         write_string(client_socket, "No unreviewed feedback found.\n");
         close(fd);
         return;
     }
+    int queued = feedback_queue_size();
+    if (queued > count) {
+        sprintf(buffer, "...and %d more (oldest shown first).\n", queued - count);
+        write_string(client_socket, buffer);
+    }
+
+    Feedback feedback;
 
     write_string(client_socket, "Enter Feedback ID to mark as reviewed: ");
     if(read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) { close(fd); return; }
     int feedbackId = atoi(buffer);
     if(feedbackId <= 0) { write_string(client_socket, "Invalid ID.\n"); close(fd); return; }
 
-    int rec_num = find_feedback_record(feedbackId);
+    // Only reviewed or unknown IDs fall back to the scan, to pick the message
+    int rec_num = feedback_queue_find(feedbackId);
+    if (rec_num == -1) rec_num = find_feedback_record(feedbackId);
     if (rec_num == -1) {
         write_string(client_socket, "Feedback ID not found.\n");
         close(fd);
         return;
     }
 
-    set_record_lock(fd, rec_num, sizeof(Feedback), F_WRLCK);
-    lseek(fd, rec_num * sizeof(Feedback), SEEK_SET);
+    if (set_record_lock(fd, rec_num, sizeof(Feedback), F_WRLCK) == -1) {
+        write_string(client_socket, LOCK_BUSY_MESSAGE);
+        close(fd);
+        return;
+    }
+    lseek(fd, record_offset(rec_num, sizeof(Feedback)), SEEK_SET);
     
     // --- FIX: Check read() failure ---
     if (read(fd, &feedback, sizeof(Feedback)) != sizeof(Feedback)) {
@@ -138,11 +164,13 @@ static void handle_review_feedback(int client_socket) {
         write_string(client_socket, "Feedback already marked as reviewed.\n");
     } else {
         feedback.isReviewed = 1; 
-        lseek(fd, rec_num * sizeof(Feedback), SEEK_SET);
+        lseek(fd, record_offset(rec_num, sizeof(Feedback)), SEEK_SET);
         // --- FIX: Check write() failure ---
         if(write(fd, &feedback, sizeof(Feedback)) != sizeof(Feedback)) {
             write_string(STDOUT_FILENO, "FATAL: Failed to write feedback review.\n");
         } else {
+            replicate_write(FEEDBACK_FILE, record_offset(rec_num, sizeof(Feedback)), &feedback, sizeof(Feedback));
+            feedback_queue_remove(feedbackId);
             write_string(client_socket, "Feedback marked as reviewed.\n");
         }
     }
@@ -170,7 +198,8 @@ void manager_menu(int client_socket, User user) {
         write_string(client_socket, "3. Review Customer Feedback\n");
         write_string(client_socket, "4. View My Personal Details\n");
         write_string(client_socket, "5. Change My Password\n");
-        write_string(client_socket, "6. Logout\n");
+        write_string(client_socket, "6. Auto-Assign All Pending Loans\n");
+        write_string(client_socket, "7. Logout\n");
         write_string(client_socket, "+---------------------------------------+\n");
         write_string(client_socket, "Enter your choice: ");
         
@@ -193,7 +222,8 @@ void manager_menu(int client_socket, User user) {
             case 3: handle_review_feedback(client_socket); break;
             case 4: handle_view_my_details(client_socket, user); break;
             case 5: handle_change_password(client_socket, user.userId); break;
-            case 6: write_string(client_socket, "Logging out. Goodbye!\n"); return;
+            case 6: handle_assign_all_pending(client_socket); break;
+            case 7: write_string(client_socket, "Logging out. Goodbye!\n"); return;
             default: write_string(client_socket, "Invalid choice.\n");
         }
     }
@@ -0,0 +1,451 @@
+// src/migrate_data.c
+// Offline data-file migrations. Run with the server stopped:
+//   ./migrate_data <step> [argument]
+// Each step detects whether the file is still in its old layout, so running
+// a step twice is harmless. The original file is kept as <file>.bak.
+// Steps that rewrite a file write it in the current layout, header page
+// included; add-headers brings every other record file up to date.
+#include "common.h"
+#include "utils.h"
+#include "model.h"
+#include <sys/stat.h>
+
+#define MIGRATE_BATCH 4096
+
+// --- Legacy Layouts ---
+
+// transactions.dat before timestamps were added
+typedef struct {
+    int transactionId;
+    int accountId;
+    int userId;
+    TransactionType type;
+    double amount;
+    double newBalance;
+    char otherPartyAccountNumber[20];
+} TransactionV1;
+
+// --- Helpers ---
+
+// IDs in transactions.dat are always consecutive, so reading the first and
+// last record under a candidate layout tells us whether that layout fits.
+static int txn_layout_fits(int fd, off_t size, size_t record_size) {
+    if (size % record_size != 0) return 0;
+    long count = size / record_size;
+    int first_id, last_id;
+    if (pread(fd, &first_id, sizeof(int), 0) != sizeof(int)) return 0;
+    if (pread(fd, &last_id, sizeof(int), (count - 1) * record_size) != sizeof(int)) return 0;
+    return last_id - first_id == count - 1;
+}
+
+// Every record struct starts with its int ID
+static int record_id(const char* record) {
+    int id;
+    memcpy(&id, record, sizeof(int));
+    return id;
+}
+
+// Writes the header page of a rewritten file whose records follow it
+static int write_header_page(int fd, size_t record_size, long live_count, int next_id) {
+    DatHeader header;
+    init_dat_header(&header, record_size);
+    header.liveCount = (int)live_count;
+    header.nextId = next_id;
+    return pwrite(fd, &header, sizeof(header), 0) == sizeof(header) ? 0 : -1;
+}
+
+// Atomically replaces 'path' with 'tmp_path', keeping the original as .bak
+static int swap_in(const char* path, const char* tmp_path) {
+    char backup[256];
+    sprintf(backup, "%s.bak", path);
+    if (rename(path, backup) == -1) { perror("rename to backup"); return -1; }
+    if (rename(tmp_path, path) == -1) { perror("rename migrated file"); return -1; }
+    return 0;
+}
+
+// --- Step: txn-timestamps ---
+
+static int migrate_txn_timestamps(const char* arg) {
+    char buffer[256];
+    int fd = open(TRANSACTION_FILE, O_RDONLY);
+    if (fd == -1) { write_string(STDOUT_FILENO, "No transaction file. Nothing to migrate.\n"); return 0; }
+    set_file_lock(fd, F_RDLCK);
+
+    struct stat st;
+    fstat(fd, &st);
+    DatHeader header;
+    if (st.st_size == 0 || read_dat_header(fd, &header) == 0) {
+        write_string(STDOUT_FILENO, "transactions.dat already has timestamps.\n");
+        set_file_lock(fd, F_UNLCK); close(fd);
+        return rebuild_transaction_index();
+    }
+    // Only the current layout is ever sealed, and sealing zeroes the first rows
+    if (sealed_transaction_blocks() > 0 || txn_layout_fits(fd, st.st_size, sizeof(Transaction))) {
+        write_string(STDOUT_FILENO, "transactions.dat already has timestamps. Run ./migrate_data add-headers next.\n");
+        set_file_lock(fd, F_UNLCK); close(fd);
+        return 0;
+    }
+    if (!txn_layout_fits(fd, st.st_size, sizeof(TransactionV1))) {
+        write_string(STDOUT_FILENO, "ERROR: transactions.dat matches neither layout. Aborting.\n");
+        set_file_lock(fd, F_UNLCK); close(fd);
+        return -1;
+    }
+
+    const char* tmp_path = TRANSACTION_FILE ".tmp";
+    int fd_out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_out == -1) { perror("open temp file"); set_file_lock(fd, F_UNLCK); close(fd); return -1; }
+    lseek(fd_out, DAT_HEADER_SIZE, SEEK_SET);
+
+    // The true time of legacy rows is unknown; the file's last write is the
+    // latest it can be, and keeps timestamps monotonic for new rows.
+    TransactionV1 old_rows[MIGRATE_BATCH];
+    Transaction new_rows[MIGRATE_BATCH];
+    long migrated = 0;
+    int next_id = 1;
+    ssize_t got;
+    int status = 0;
+    while ((got = read(fd, old_rows, sizeof(old_rows))) > 0) {
+        int n = got / sizeof(TransactionV1);
+        for (int i = 0; i < n; i++) {
+            memset(&new_rows[i], 0, sizeof(Transaction));
+            new_rows[i].transactionId = old_rows[i].transactionId;
+            new_rows[i].accountId = old_rows[i].accountId;
+            new_rows[i].userId = old_rows[i].userId;
+            new_rows[i].type = old_rows[i].type;
+            new_rows[i].amount = old_rows[i].amount;
+            new_rows[i].newBalance = old_rows[i].newBalance;
+            memcpy(new_rows[i].otherPartyAccountNumber, old_rows[i].otherPartyAccountNumber, 20);
+            new_rows[i].timestamp = st.st_mtime;
+            next_id = new_rows[i].transactionId + 1;
+        }
+        if (write(fd_out, new_rows, n * sizeof(Transaction)) != (ssize_t)(n * sizeof(Transaction))) {
+            perror("write migrated transactions");
+            status = -1;
+            break;
+        }
+        migrated += n;
+    }
+    if (status == 0 && write_header_page(fd_out, sizeof(Transaction), migrated, next_id) == -1) { perror("write header"); status = -1; }
+    if (status == 0 && fsync(fd_out) == -1) { perror("fsync"); status = -1; }
+    close(fd_out);
+    set_file_lock(fd, F_UNLCK);
+    close(fd);
+
+    if (status == 0) status = swap_in(TRANSACTION_FILE, tmp_path);
+    if (status == 0) status = rebuild_transaction_index();
+    if (status == 0) {
+        sprintf(buffer, "Migrated %ld transactions and rebuilt the time index.\n", migrated);
+        write_string(STDOUT_FILENO, buffer);
+    }
+    return status;
+}
+
+// --- Step: shard-accounts <N> ---
+// Spreads the accounts over N shard files by ID range; N = 1 folds them back
+// into accounts.dat. Open transfers are settled first and the transfer logs
+// archived, since each transfer ID encodes its shard under the old count.
+static int migrate_shard_accounts(const char* arg) {
+    char buffer[256];
+    int target = (arg != NULL) ? atoi(arg) : 0;
+    if (target < 1 || target > MAX_ACCOUNT_SHARDS) {
+        sprintf(buffer, "Usage: ./migrate_data shard-accounts <N>, with N from 1 to %d.\n", MAX_ACCOUNT_SHARDS);
+        write_string(STDOUT_FILENO, buffer);
+        return -1;
+    }
+    if (data_files_need_headers()) {
+        write_string(STDOUT_FILENO, DAT_HEADERS_NEEDED_MESSAGE);
+        return -1;
+    }
+    int current = account_shard_count();
+    int id_range = account_shard_id_range();
+    if (target == current) {
+        sprintf(buffer, "Accounts are already in %d shard(s).\n", current);
+        write_string(STDOUT_FILENO, buffer);
+        return 0;
+    }
+    perform_recovery_check();
+
+    // --- Read every account from the current layout ---
+    Account* accounts = NULL;
+    int count = 0, capacity = 0;
+    for (int shard = 0; shard < current; shard++) {
+        int fd = open_account_shard(shard, O_RDONLY);
+        if (fd == -1) continue; // A shard nobody has been assigned to yet
+        set_file_lock(fd, F_RDLCK);
+        lseek(fd, DAT_HEADER_SIZE, SEEK_SET);
+        Account account;
+        while (read(fd, &account, sizeof(Account)) == sizeof(Account)) {
+            if (account.accountId == FREE_SLOT_ID) continue; // Removed; the new shards leave it out
+            if (count == capacity) {
+                capacity = capacity == 0 ? 1024 : capacity * 2;
+                Account* bigger = (Account*)realloc(accounts, capacity * sizeof(Account));
+                if (bigger == NULL) {
+                    write_string(STDOUT_FILENO, "ERROR: Out of memory.\n");
+                    free(accounts); set_file_lock(fd, F_UNLCK); close(fd);
+                    return -1;
+                }
+                accounts = bigger;
+            }
+            accounts[count++] = account;
+        }
+        set_file_lock(fd, F_UNLCK);
+        close(fd);
+    }
+
+    // --- Write the new shard files beside the old ones ---
+    char path[64], tmp_path[80];
+    for (int shard = 0; shard < target; shard++) {
+        account_file_path(shard, target, path);
+        sprintf(tmp_path, "%s.tmp", path);
+        int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) { perror("open temp file"); free(accounts); return -1; }
+        int status = 0, moved = 0, next_id = 1;
+        lseek(fd, DAT_HEADER_SIZE, SEEK_SET);
+        for (int i = 0; i < count && status == 0; i++) {
+            if (((accounts[i].accountId - 1) / id_range) % target != shard) continue;
+            if (write(fd, &accounts[i], sizeof(Account)) != sizeof(Account)) { perror("write account"); status = -1; }
+            if (accounts[i].accountId >= next_id) next_id = accounts[i].accountId + 1;
+            moved++;
+        }
+        // A shard left empty stays an empty file, which gets its header on first use
+        if (status == 0 && moved > 0 && write_header_page(fd, sizeof(Account), moved, next_id) == -1) { perror("write header"); status = -1; }
+        if (status == 0 && fsync(fd) == -1) { perror("fsync"); status = -1; }
+        close(fd);
+        if (status == -1) { free(accounts); return -1; }
+    }
+    free(accounts);
+
+    // --- Swap: archive the old files, then move the new ones in ---
+    char backup[80];
+    for (int shard = 0; shard < current; shard++) {
+        account_file_path(shard, current, path);
+        sprintf(backup, "%s.bak", path);
+        if (rename(path, backup) == -1 && errno != ENOENT) { perror("rename account file"); return -1; }
+        transfer_log_path(shard, current, path);
+        sprintf(backup, "%s.bak", path);
+        if (rename(path, backup) == -1 && errno != ENOENT) { perror("rename transfer log"); return -1; }
+    }
+    for (int shard = 0; shard < target; shard++) {
+        account_file_path(shard, target, path);
+        sprintf(tmp_path, "%s.tmp", path);
+        if (rename(tmp_path, path) == -1) { perror("rename migrated file"); return -1; }
+    }
+
+    if (target == 1) {
+        if (unlink(SHARD_CONFIG_FILE) == -1 && errno != ENOENT) { perror("unlink shard config"); return -1; }
+    } else {
+        ShardConfig config;
+        config.shardCount = target;
+        config.idRange = id_range;
+        int fd = open(SHARD_CONFIG_FILE ".tmp", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1 || write(fd, &config, sizeof(ShardConfig)) != sizeof(ShardConfig) || fsync(fd) == -1) {
+            perror("write shard config");
+            if (fd != -1) close(fd);
+            return -1;
+        }
+        close(fd);
+        if (rename(SHARD_CONFIG_FILE ".tmp", SHARD_CONFIG_FILE) == -1) { perror("rename shard config"); return -1; }
+    }
+
+    sprintf(buffer, "Moved %d accounts into %d shard(s), IDs in blocks of %d. Old files kept as .bak.\n", count, target, id_range);
+    write_string(STDOUT_FILENO, buffer);
+    return 0;
+}
+
+// --- Step: split-users ---
+// Splits each whole User record into its UserAuth (users.dat) and its
+// UserProfile (user_profiles.dat). The profile file is moved in first, so
+// an interrupted run leaves users.dat in the old layout and can be rerun.
+static int migrate_split_users(const char* arg) {
+    char buffer[256];
+    if (!user_store_needs_split()) {
+        write_string(STDOUT_FILENO, "users.dat is already split from user_profiles.dat.\n");
+        return 0;
+    }
+    int fd = open(USER_FILE, O_RDONLY);
+    if (fd == -1) { perror("open user file"); return -1; }
+    set_file_lock(fd, F_RDLCK);
+    struct stat st;
+    fstat(fd, &st);
+    if (st.st_size % sizeof(User) != 0) {
+        write_string(STDOUT_FILENO, "ERROR: users.dat is not a whole number of user records. Aborting.\n");
+        set_file_lock(fd, F_UNLCK); close(fd);
+        return -1;
+    }
+
+    const char* auth_tmp = USER_FILE ".tmp";
+    const char* profile_tmp = USER_PROFILE_FILE ".tmp";
+    int fd_auth = open(auth_tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int fd_profile = open(profile_tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    User* users = (User*)malloc(MIGRATE_BATCH * sizeof(User));
+    UserAuth* auths = (UserAuth*)malloc(MIGRATE_BATCH * sizeof(UserAuth));
+    UserProfile* profiles = (UserProfile*)malloc(MIGRATE_BATCH * sizeof(UserProfile));
+    int status = (fd_auth == -1 || fd_profile == -1 || users == NULL || auths == NULL || profiles == NULL) ? -1 : 0;
+    if (status == -1) write_string(STDOUT_FILENO, "ERROR: Could not set up the split files.\n");
+
+    long migrated = 0;
+    int next_id = 1;
+    ssize_t got;
+    if (status == 0) {
+        lseek(fd_auth, DAT_HEADER_SIZE, SEEK_SET);
+        lseek(fd_profile, DAT_HEADER_SIZE, SEEK_SET);
+    }
+    while (status == 0 && (got = read(fd, users, MIGRATE_BATCH * sizeof(User))) > 0) {
+        int n = got / sizeof(User);
+        for (int i = 0; i < n; i++) {
+            split_user(&users[i], &auths[i], &profiles[i]);
+            if (users[i].userId >= next_id) next_id = users[i].userId + 1;
+        }
+        if (write(fd_auth, auths, n * sizeof(UserAuth)) != (ssize_t)(n * sizeof(UserAuth)) ||
+            write(fd_profile, profiles, n * sizeof(UserProfile)) != (ssize_t)(n * sizeof(UserProfile))) {
+            perror("write split users");
+            status = -1;
+        }
+        migrated += n;
+    }
+    if (status == 0 && migrated > 0 &&
+        (write_header_page(fd_auth, sizeof(UserAuth), migrated, next_id) == -1 ||
+         write_header_page(fd_profile, sizeof(UserProfile), migrated, next_id) == -1)) { perror("write header"); status = -1; }
+    if (status == 0 && (fsync(fd_auth) == -1 || fsync(fd_profile) == -1)) { perror("fsync"); status = -1; }
+    if (fd_auth != -1) close(fd_auth);
+    if (fd_profile != -1) close(fd_profile);
+    free(users); free(auths); free(profiles);
+    set_file_lock(fd, F_UNLCK);
+    close(fd);
+
+    if (status == 0 && rename(profile_tmp, USER_PROFILE_FILE) == -1) { perror("rename profile file"); status = -1; }
+    if (status == 0) status = swap_in(USER_FILE, auth_tmp);
+    if (status == 0) {
+        sprintf(buffer, "Split %ld users into users.dat (%d bytes each) and user_profiles.dat. Old file kept as users.dat.bak.\n", migrated, (int)sizeof(UserAuth));
+        write_string(STDOUT_FILENO, buffer);
+    }
+    return status;
+}
+
+// --- Step: add-headers ---
+// Copies each headerless record file behind a header page; record numbers,
+// and so the time index and sealed blocks, stay as they were. All-zero runs
+// (history punched out by sealing) are not written, so they stay holes.
+
+static int all_zero(const char* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] != 0) return 0;
+    }
+    return 1;
+}
+
+// Returns 1 if a header was added, 0 if none was needed, -1 on an error
+static int add_header(DataFile file) {
+    char buffer[256];
+    int fd = open(file.path, O_RDONLY);
+    if (fd == -1) return 0; // Created with its header on first write
+    set_file_lock(fd, F_RDLCK);
+    DatHeader header;
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size == 0 || read_dat_header(fd, &header) == 0) {
+        set_file_lock(fd, F_UNLCK); close(fd);
+        return 0;
+    }
+
+    char tmp_path[80];
+    sprintf(tmp_path, "%s.tmp", file.path);
+    size_t chunk_size = MIGRATE_BATCH * file.recordSize;
+    char* chunk = (char*)malloc(chunk_size);
+    int fd_out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int status = (chunk == NULL || fd_out == -1) ? -1 : 0;
+    if (status == -1) perror("set up header copy");
+
+    int next_id = 1;
+    off_t offset = 0;
+    while (status == 0 && offset < size) {
+        ssize_t got = pread(fd, chunk, chunk_size, offset);
+        if (got <= 0) { perror("read data file"); status = -1; break; }
+        for (ssize_t i = 0; i + (ssize_t)file.recordSize <= got; i += file.recordSize) {
+            int id = record_id(chunk + i);
+            if (id >= next_id) next_id = id + 1;
+        }
+        if (!all_zero(chunk, got) && pwrite(fd_out, chunk, got, DAT_HEADER_SIZE + offset) != got) {
+            perror("write data file"); status = -1;
+        }
+        offset += got;
+    }
+    if (status == 0 && (write_header_page(fd_out, file.recordSize, size / file.recordSize, next_id) == -1 ||
+                        ftruncate(fd_out, DAT_HEADER_SIZE + size) == -1 || fsync(fd_out) == -1)) {
+        perror("finish header copy"); status = -1;
+    }
+    if (fd_out != -1) close(fd_out);
+    free(chunk);
+    set_file_lock(fd, F_UNLCK);
+    close(fd);
+
+    if (status == 0) status = swap_in(file.path, tmp_path);
+    if (status == 0) {
+        sprintf(buffer, "Added a header to %s (%ld records).\n", file.path, (long)(size / file.recordSize));
+        write_string(STDOUT_FILENO, buffer);
+    }
+    return status == 0 ? 1 : -1;
+}
+
+static int migrate_add_headers(const char* arg) {
+    // The older steps must go first: a header would fix the wrong record size
+    if (user_store_needs_split()) {
+        write_string(STDOUT_FILENO, USER_SPLIT_NEEDED_MESSAGE);
+        return -1;
+    }
+    int fd = open(TRANSACTION_FILE, O_RDONLY);
+    if (fd != -1) {
+        DatHeader header;
+        off_t size = lseek(fd, 0, SEEK_END);
+        int current = size == 0 || read_dat_header(fd, &header) == 0 || sealed_transaction_blocks() > 0 ||
+                      txn_layout_fits(fd, size, sizeof(Transaction));
+        close(fd);
+        if (!current) {
+            write_string(STDOUT_FILENO, "ERROR: transactions.dat has no timestamps. Run ./migrate_data txn-timestamps first.\n");
+            return -1;
+        }
+    }
+
+    DataFile files[MAX_DATA_FILES];
+    int count = list_data_files(files), added = 0;
+    for (int i = 0; i < count; i++) {
+        int result = add_header(files[i]);
+        if (result == -1) return -1;
+        added += result;
+    }
+    if (added == 0) write_string(STDOUT_FILENO, "Every data file already has a header.\n");
+    return 0;
+}
+
+// --- Step Table ---
+
+typedef struct {
+    const char* name;
+    const char* description;
+    int (*run)(const char* arg);
+} MigrationStep;
+
+static const MigrationStep steps[] = {
+    { "txn-timestamps", "Add timestamps to transactions.dat and build transactions.idx", migrate_txn_timestamps },
+    { "shard-accounts", "<N>: split accounts into N shard files for ./server --workers N", migrate_shard_accounts },
+    { "split-users", "Split users.dat into login records and user_profiles.dat", migrate_split_users },
+    { "add-headers", "Put a header page (counts, next ID) in front of every record file", migrate_add_headers },
+};
+
+int main(int argc, char* argv[]) {
+    int step_count = sizeof(steps) / sizeof(steps[0]);
+    if (argc == 2 || argc == 3) {
+        for (int i = 0; i < step_count; i++) {
+            if (my_strcmp(argv[1], steps[i].name) == 0) {
+                return steps[i].run(argc == 3 ? argv[2] : NULL) == 0 ? 0 : 1;
+            }
+        }
+    }
+
+    write_string(STDOUT_FILENO, "Usage: ./migrate_data <step> [argument]\nSteps:\n");
+    for (int i = 0; i < step_count; i++) {
+        char line[256];
+        sprintf(line, "  %-16s %s\n", steps[i].name, steps[i].description);
+        write_string(STDOUT_FILENO, line);
+    }
+    return 1;
+}
@@ -1,307 +1,2338 @@
 // src/model.c
+#define _GNU_SOURCE // For fallocate() (punching sealed history out of transactions.dat)
 #include "common.h" // <-- This is required
 #include "model.h"
 #include "utils.h" 
+#include "hashmap.h"
+#include "uring.h"
+#include "txn_block.h"
+#include <sched.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// --- Optimistic Record Access (seqlocks) ---
+// Readers of user and account records take no fcntl lock. Each record maps
+// to a stripe whose sequence number is odd while a writer is mid-write; a
+// reader retries whenever the sequence was odd or changed across its
+// pread(), so it never observes a torn record and never waits behind a
+// record lock held for a whole deposit or transfer.
+//
+// The stripes live in a shared mapping so the worker processes of
+// ./server --workers publish to each other's readers. Their writer mutexes
+// are process-shared and robust: when a worker dies mid-write, the next
+// writer, or a reader that finds the stripe stuck odd, closes the sequence.
+#define SEQLOCK_STRIPES 1024
+#define SEQLOCK_STUCK_SPINS 1024 // Odd this long: check for a dead writer
+
+typedef struct {
+    unsigned int sequence;
+    pthread_mutex_t writer;
+} RecordSeqlock;
+
+static RecordSeqlock* user_seqlocks = NULL;
+static RecordSeqlock* account_seqlocks = NULL;
+// One more per file, odd while the compactor is moving that file's records:
+// users.dat first, then each account shard.
+#define LAYOUT_SEQLOCKS (1 + MAX_ACCOUNT_SHARDS)
+static RecordSeqlock* layout_seqlocks = NULL;
+static pthread_once_t seqlock_once = PTHREAD_ONCE_INIT;
+
+static void init_seqlocks() {
+    int count = 2 * SEQLOCK_STRIPES + LAYOUT_SEQLOCKS;
+    RecordSeqlock* tables = (RecordSeqlock*)mmap(NULL, count * sizeof(RecordSeqlock), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (tables == MAP_FAILED) {
+        perror("mmap seqlocks"); exit(EXIT_FAILURE);
+    }
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_init(&tables[i].writer, &attr);
+    }
+    pthread_mutexattr_destroy(&attr);
+    user_seqlocks = tables;
+    account_seqlocks = tables + SEQLOCK_STRIPES;
+    layout_seqlocks = tables + 2 * SEQLOCK_STRIPES;
+}
+
+// Must run before ./server forks its workers so they share one mapping.
+void init_record_locks() {
+    pthread_once(&seqlock_once, init_seqlocks);
+}
+
+// Takes a stripe's writer mutex. If it is free or its owner died, a write
+// left half-done is closed first so readers stop waiting on it. With
+// 'try_only' it never blocks and returns -1 if a live writer holds it.
+static int acquire_writer(RecordSeqlock* lock, int try_only) {
+    int rc = try_only ? pthread_mutex_trylock(&lock->writer) : pthread_mutex_lock(&lock->writer);
+    if (rc == EOWNERDEAD) {
+        pthread_mutex_consistent(&lock->writer);
+        rc = 0;
+    }
+    if (rc != 0) return -1;
+    if (__atomic_load_n(&lock->sequence, __ATOMIC_RELAXED) & 1) {
+        __atomic_add_fetch(&lock->sequence, 1, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+static RecordSeqlock* shard_stripe(int shard, int record_num) {
+    init_record_locks();
+    return &account_seqlocks[(record_num + shard * 257) % SEQLOCK_STRIPES];
+}
+
+static RecordSeqlock* account_stripe(int accountId, int record_num) {
+    return shard_stripe(account_shard_of(accountId), record_num);
+}
+
+static RecordSeqlock* user_stripe(int record_num) {
+    init_record_locks();
+    return &user_seqlocks[record_num % SEQLOCK_STRIPES];
+}
+
+static RecordSeqlock* user_layout() {
+    init_record_locks();
+    return &layout_seqlocks[0];
+}
+
+static RecordSeqlock* shard_layout(int shard) {
+    init_record_locks();
+    return &layout_seqlocks[1 + shard];
+}
+
+// Shared read-only descriptors: pread() is thread-safe, so lock-free readers
+// reuse one descriptor per file instead of an open()/close() per lookup.
+static int user_read_fd = -1;
+static int profile_fd = -1; // Read-write: profiles are written through it too
+static int account_read_fds[MAX_ACCOUNT_SHARDS]; // Set to -1 with the shard layout
+static pthread_mutex_t read_fd_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int shared_fd(int* slot, const char* path, int flags) {
+    int fd = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (fd != -1) return fd;
+    pthread_mutex_lock(&read_fd_mutex);
+    if (*slot == -1) {
+        fd = open(path, flags, 0644);
+        if (fd != -1) __atomic_store_n(slot, fd, __ATOMIC_RELEASE);
+    }
+    fd = *slot;
+    pthread_mutex_unlock(&read_fd_mutex);
+    return fd;
+}
+
+static int shared_read_fd(int* slot, const char* path) {
+    return shared_fd(slot, path, O_RDONLY);
+}
+
+static int shared_profile_fd() {
+    return shared_fd(&profile_fd, USER_PROFILE_FILE, O_RDWR | O_CREAT);
+}
+
+// A record can span files (a user's auth and profile halves); one stripe
+// covers all of its parts, so readers see them change together.
+typedef struct {
+    int fd;
+    void* buf;
+    size_t size;
+} RecordPart;
+
+// Waits out any writer in progress and returns the (even) sequence to
+// compare against with seqlock_unchanged once the read is done.
+static unsigned int seqlock_read_begin(RecordSeqlock* lock) {
+    int spins = 0;
+    while (1) {
+        unsigned int before = __atomic_load_n(&lock->sequence, __ATOMIC_ACQUIRE);
+        if (!(before & 1)) return before;
+        if (++spins % SEQLOCK_STUCK_SPINS == 0 && acquire_writer(lock, 1) == 0) {
+            pthread_mutex_unlock(&lock->writer);
+        }
+        sched_yield();
+    }
+}
+
+static int seqlock_unchanged(RecordSeqlock* lock, unsigned int before) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&lock->sequence, __ATOMIC_RELAXED) == before;
+}
+
+static int seqlock_read_parts(RecordSeqlock* lock, int record_num, const RecordPart* parts, int count) {
+    while (1) {
+        unsigned int before = seqlock_read_begin(lock);
+        int complete = 1;
+        for (int i = 0; i < count; i++) {
+            if (pread(parts[i].fd, parts[i].buf, parts[i].size, record_offset(record_num, parts[i].size)) != (ssize_t)parts[i].size) complete = 0;
+        }
+        if (seqlock_unchanged(lock, before)) {
+            return complete ? 0 : -1;
+        }
+    }
+}
+
+static int seqlock_write_parts(RecordSeqlock* lock, int record_num, const RecordPart* parts, int count) {
+    int complete = 1;
+    acquire_writer(lock, 0);
+    __atomic_add_fetch(&lock->sequence, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < count; i++) {
+        if (pwrite(parts[i].fd, parts[i].buf, parts[i].size, record_offset(record_num, parts[i].size)) != (ssize_t)parts[i].size) complete = 0;
+    }
+    __atomic_add_fetch(&lock->sequence, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lock->writer);
+    return complete ? 0 : -1;
+}
+
+static int seqlock_read(RecordSeqlock* lock, int fd, int record_num, void* out, size_t size) {
+    RecordPart part = { fd, out, size };
+    return seqlock_read_parts(lock, record_num, &part, 1);
+}
+
+static int seqlock_write(RecordSeqlock* lock, int fd, int record_num, const void* data, size_t size) {
+    RecordPart part = { fd, (void*)data, size };
+    return seqlock_write_parts(lock, record_num, &part, 1);
+}
+
+// --- Account Shards ---
+static ShardConfig shard_config = { 1, DEFAULT_SHARD_ID_RANGE };
+static pthread_once_t shard_once = PTHREAD_ONCE_INIT;
+
+static void load_shard_config() {
+    for (int i = 0; i < MAX_ACCOUNT_SHARDS; i++) account_read_fds[i] = -1;
+    int fd = open(SHARD_CONFIG_FILE, O_RDONLY);
+    if (fd == -1) return; // Unsharded layout
+    ShardConfig config;
+    if (read(fd, &config, sizeof(ShardConfig)) == sizeof(ShardConfig) &&
+        config.shardCount >= 1 && config.shardCount <= MAX_ACCOUNT_SHARDS && config.idRange >= 1) {
+        shard_config = config;
+    } else {
+        write_string(STDOUT_FILENO, "WARNING: " SHARD_CONFIG_FILE " is invalid; using one account shard.\n");
+    }
+    close(fd);
+}
+
+int account_shard_count() {
+    pthread_once(&shard_once, load_shard_config);
+    return shard_config.shardCount;
+}
+
+int account_shard_id_range() {
+    pthread_once(&shard_once, load_shard_config);
+    return shard_config.idRange;
+}
+
+int account_shard_of(int accountId) {
+    pthread_once(&shard_once, load_shard_config);
+    if (accountId < 1) return 0;
+    return ((accountId - 1) / shard_config.idRange) % shard_config.shardCount;
+}
+
+// Paths of one shard's files under a layout of 'shard_count' shards; a
+// single shard keeps the original file names. 'path' holds 64 bytes.
+void account_file_path(int shard, int shard_count, char* path) {
+    if (shard_count <= 1) strcpy(path, ACCOUNT_FILE);
+    else sprintf(path, "data/accounts.%d.dat", shard);
+}
+
+void transfer_log_path(int shard, int shard_count, char* path) {
+    if (shard_count <= 1) strcpy(path, TRANSFER_LOG_FILE);
+    else sprintf(path, "data/transfer_log.%d.dat", shard);
+}
+
+// Opens the account file of one shard, or of the shard holding 'accountId'.
+// Record numbers returned by the find functions are positions in that file.
+int open_account_shard(int shard, int flags) {
+    char path[64];
+    account_file_path(shard, account_shard_count(), path);
+    return open(path, flags, 0644);
+}
+
+int open_account_file(int accountId, int flags) {
+    return open_account_shard(account_shard_of(accountId), flags);
+}
+
+static int account_read_fd(int shard) {
+    char path[64];
+    account_shard_count(); // Loads the layout and resets the descriptor slots
+    account_file_path(shard, shard_config.shardCount, path);
+    return shared_read_fd(&account_read_fds[shard], path);
+}
+
+// --- Replication Hook ---
+static void (*replication_hook)(const char* path, off_t offset, const void* data, size_t size) = NULL;
+
+void set_replication_hook(void (*on_write)(const char* path, off_t offset, const void* data, size_t size)) {
+    __atomic_store_n(&replication_hook, on_write, __ATOMIC_RELEASE);
+}
+
+static int replicating() {
+    return __atomic_load_n(&replication_hook, __ATOMIC_ACQUIRE) != NULL;
+}
+
+void replicate_write(const char* path, off_t offset, const void* data, size_t size) {
+    void (*hook)(const char*, off_t, const void*, size_t) = __atomic_load_n(&replication_hook, __ATOMIC_ACQUIRE);
+    if (hook != NULL) hook(path, offset, data, size);
+}
+
+// For a write() just made through an O_APPEND descriptor, whose offset now
+// sits at the end of the record.
+void replicate_append(int fd, const char* path, const void* data, size_t size) {
+    if (!replicating()) return;
+    replicate_write(path, lseek(fd, 0, SEEK_CUR) - (off_t)size, data, size);
+}
+
+// The compactor's truncations travel as writes of no bytes at the new length.
+void replicate_truncate(const char* path, off_t length) {
+    replicate_write(path, length, "", 0);
+}
+
+static int account_file_shard(const char* path) {
+    char shard_path[64];
+    int shard_count = account_shard_count();
+    for (int shard = 0; shard < shard_count; shard++) {
+        account_file_path(shard, shard_count, shard_path);
+        if (my_strcmp(path, shard_path) == 0) return shard;
+    }
+    return -1;
+}
+
+// A standby applies the primary's writes through the same seqlocks, so its
+// read-only sessions never see a user or account record half-written.
+// Header writes land below DAT_HEADER_SIZE and go straight to the file.
+int apply_replicated_write(int fd, const char* path, off_t offset, const void* data, size_t size) {
+    if (size == 0) return ftruncate(fd, offset);
+    int shard = account_file_shard(path);
+    int whole = offset >= DAT_HEADER_SIZE && (offset - DAT_HEADER_SIZE) % size == 0;
+    int record_num = whole ? (int)((offset - DAT_HEADER_SIZE) / size) : -1;
+    if (whole && size == sizeof(UserAuth) && my_strcmp(path, USER_FILE) == 0) {
+        return seqlock_write(user_stripe(record_num), fd, record_num, data, size);
+    }
+    if (whole && size == sizeof(UserProfile) && my_strcmp(path, USER_PROFILE_FILE) == 0) {
+        return seqlock_write(user_stripe(record_num), fd, record_num, data, size);
+    }
+    if (whole && size == sizeof(Account) && shard != -1) { // By shard: a tombstone has no account ID
+        return seqlock_write(shard_stripe(shard, record_num), fd, record_num, data, size);
+    }
+    return pwrite(fd, data, size, offset) == (ssize_t)size ? 0 : -1;
+}
+
+// --- Record Access ---
+
+int read_user_auth(int record_num, UserAuth* auth) {
+    int fd = shared_read_fd(&user_read_fd, USER_FILE);
+    if (fd == -1) return -1;
+    return seqlock_read(user_stripe(record_num), fd, record_num, auth, sizeof(UserAuth));
+}
+
+int read_user_record(int record_num, User* user) {
+    UserAuth auth;
+    UserProfile profile;
+    int auth_fd = shared_read_fd(&user_read_fd, USER_FILE);
+    int fd = shared_profile_fd();
+    if (auth_fd == -1 || fd == -1) return -1;
+    RecordPart parts[2] = { { auth_fd, &auth, sizeof(UserAuth) }, { fd, &profile, sizeof(UserProfile) } };
+    if (seqlock_read_parts(user_stripe(record_num), record_num, parts, 2) != 0) return -1;
+    join_user(&auth, &profile, user);
+    return 0;
+}
+
+int read_account_record(int accountId, int record_num, Account* account) {
+    int fd = account_read_fd(account_shard_of(accountId));
+    if (fd == -1) return -1;
+    return seqlock_read(account_stripe(accountId, record_num), fd, record_num, account, sizeof(Account));
+}
+
+// Both halves of one user slot, published together.
+static int put_user_slot(int fd, int record_num, const UserAuth* auth, const UserProfile* profile) {
+    int fd_profile = shared_profile_fd();
+    if (fd_profile == -1) return -1;
+    RecordPart parts[2] = { { fd, (void*)auth, sizeof(UserAuth) }, { fd_profile, (void*)profile, sizeof(UserProfile) } };
+    if (seqlock_write_parts(user_stripe(record_num), record_num, parts, 2) != 0) return -1;
+    replicate_write(USER_FILE, record_offset(record_num, sizeof(UserAuth)), auth, sizeof(UserAuth));
+    replicate_write(USER_PROFILE_FILE, record_offset(record_num, sizeof(UserProfile)), profile, sizeof(UserProfile));
+    return 0;
+}
+
+// Account slots are striped by shard, not account ID: a free slot has none.
+static int put_account_slot(int fd, int shard, int record_num, const Account* account) {
+    if (seqlock_write(shard_stripe(shard, record_num), fd, record_num, account, sizeof(Account)) != 0) return -1;
+    if (replicating()) {
+        char path[64];
+        account_file_path(shard, account_shard_count(), path);
+        replicate_write(path, record_offset(record_num, sizeof(Account)), account, sizeof(Account));
+    }
+    return 0;
+}
+
+// Writers still serialise with each other through the fcntl record lock,
+// which the caller holds on 'fd'; these only publish the write to readers.
+int write_user_record(int fd, int record_num, const User* user) {
+    UserAuth auth;
+    UserProfile profile;
+    split_user(user, &auth, &profile);
+    return put_user_slot(fd, record_num, &auth, &profile);
+}
+
+// 'fd' is the account's shard file (see open_account_file).
+int write_account_record(int fd, int record_num, const Account* account) {
+    return put_account_slot(fd, account_shard_of(account->accountId), record_num, account);
+}
+
+// --- Data File Headers ---
+
+int read_dat_header(int fd, DatHeader* header) {
+    if (pread(fd, header, sizeof(DatHeader), 0) != sizeof(DatHeader) || header->magic != DAT_MAGIC) return -1;
+    return 0;
+}
+
+void init_dat_header(DatHeader* header, size_t record_size) {
+    memset(header, 0, sizeof(DatHeader));
+    header->magic = DAT_MAGIC;
+    header->version = DAT_FORMAT_VERSION;
+    header->recordSize = (int)record_size;
+    header->nextId = 1;
+    header->freeHead = -1;
+}
+
+static int write_dat_header(int fd, const char* path, const DatHeader* header) {
+    if (pwrite(fd, header, sizeof(DatHeader), 0) != sizeof(DatHeader)) return -1;
+    replicate_write(path, 0, header, sizeof(DatHeader));
+    return 0;
+}
+
+// Writes 'count' records from record 'first' on, past the current end. The
+// header goes first: a crash in between can leave an ID unused or the live
+// count high, but never hands out an ID twice.
+static int put_records(int fd, const char* path, int first, const void* records, size_t record_size, int count, int next_id) {
+    DatHeader header;
+    if (lseek(fd, 0, SEEK_END) == 0) init_dat_header(&header, record_size);
+    else if (read_dat_header(fd, &header) == -1 || header.recordSize != (int)record_size) return -1;
+    header.liveCount += count;
+    if (next_id > header.nextId) header.nextId = next_id;
+    if (write_dat_header(fd, path, &header) == -1) return -1;
+
+    ssize_t bytes = (ssize_t)count * record_size;
+    if (pwrite(fd, records, bytes, record_offset(first, record_size)) != bytes) return -1;
+    replicate_write(path, record_offset(first, record_size), records, bytes);
+    return 0;
+}
+
+int append_records(int fd, const char* path, const void* records, size_t record_size, int count, int next_id) {
+    int first = record_count(lseek(fd, 0, SEEK_END), record_size); // Over a torn tail, if any
+    return put_records(fd, path, first, records, record_size, count, next_id) == 0 ? first : -1;
+}
+
+int list_data_files(DataFile* files) {
+    int count = 0;
+    strcpy(files[count].path, USER_FILE); files[count++].recordSize = sizeof(UserAuth);
+    strcpy(files[count].path, USER_PROFILE_FILE); files[count++].recordSize = sizeof(UserProfile);
+    for (int shard = 0; shard < account_shard_count(); shard++) {
+        account_file_path(shard, account_shard_count(), files[count].path);
+        files[count++].recordSize = sizeof(Account);
+    }
+    strcpy(files[count].path, LOAN_FILE); files[count++].recordSize = sizeof(Loan);
+    strcpy(files[count].path, FEEDBACK_FILE); files[count++].recordSize = sizeof(Feedback);
+    strcpy(files[count].path, TRANSACTION_FILE); files[count++].recordSize = sizeof(Transaction);
+    return count;
+}
+
+// Missing and empty files are fine: they get a header with their first record.
+int data_files_need_headers() {
+    DataFile files[MAX_DATA_FILES];
+    int count = list_data_files(files);
+    for (int i = 0; i < count; i++) {
+        int fd = open(files[i].path, O_RDONLY);
+        if (fd == -1) continue;
+        DatHeader header;
+        int bad = lseek(fd, 0, SEEK_END) > 0 &&
+                  (read_dat_header(fd, &header) == -1 || header.version != DAT_FORMAT_VERSION ||
+                   header.recordSize != (int)files[i].recordSize);
+        close(fd);
+        if (bad) return 1;
+    }
+    return 0;
+}
+
+int live_record_count(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return 0;
+    DatHeader header;
+    int count = read_dat_header(fd, &header) == 0 ? header.liveCount : 0;
+    close(fd);
+    return count;
+}
+
+// --- User Store ---
+
+void split_user(const User* user, UserAuth* auth, UserProfile* profile) {
+    memset(auth, 0, sizeof(UserAuth));
+    memset(profile, 0, sizeof(UserProfile));
+    auth->userId = user->userId;
+    memcpy(auth->password, user->password, sizeof(auth->password));
+    auth->role = user->role;
+    auth->isActive = user->isActive;
+    profile->userId = user->userId;
+    memcpy(profile->firstName, user->firstName, sizeof(profile->firstName));
+    memcpy(profile->lastName, user->lastName, sizeof(profile->lastName));
+    memcpy(profile->phone, user->phone, sizeof(profile->phone));
+    memcpy(profile->email, user->email, sizeof(profile->email));
+    memcpy(profile->address, user->address, sizeof(profile->address));
+}
+
+// Zeroes padding too, so two joins of the same halves compare equal.
+void join_user(const UserAuth* auth, const UserProfile* profile, User* user) {
+    memset(user, 0, sizeof(User));
+    user->userId = auth->userId;
+    memcpy(user->password, auth->password, sizeof(user->password));
+    user->role = auth->role;
+    user->isActive = auth->isActive;
+    memcpy(user->firstName, profile->firstName, sizeof(user->firstName));
+    memcpy(user->lastName, profile->lastName, sizeof(user->lastName));
+    memcpy(user->phone, profile->phone, sizeof(user->phone));
+    memcpy(user->email, profile->email, sizeof(user->email));
+    memcpy(user->address, profile->address, sizeof(user->address));
+}
+
+// The profiles go first: a reader that finds a new auth record can always
+// read its profile. A crash in between leaves only an unused profile tail,
+// which the next append overwrites.
+int append_user_records(int fd, const User* users, int count) {
+    int fd_profile = shared_profile_fd();
+    if (fd_profile == -1) return -1;
+    UserAuth* auths = (UserAuth*)malloc(count * sizeof(UserAuth));
+    UserProfile* profiles = (UserProfile*)malloc(count * sizeof(UserProfile));
+    if (auths == NULL || profiles == NULL) { free(auths); free(profiles); return -1; }
+    int next_id = 0;
+    for (int i = 0; i < count; i++) {
+        split_user(&users[i], &auths[i], &profiles[i]);
+        if (users[i].userId >= next_id) next_id = users[i].userId + 1;
+    }
+
+    int first = record_count(lseek(fd, 0, SEEK_END), sizeof(UserAuth));
+    int status = -1;
+    if (put_records(fd_profile, USER_PROFILE_FILE, first, profiles, sizeof(UserProfile), count, next_id) == 0 &&
+        put_records(fd, USER_FILE, first, auths, sizeof(UserAuth), count, next_id) == 0) {
+        status = first;
+    }
+    free(auths);
+    free(profiles);
+    return status;
+}
+
+// Split means the profile file exists and covers every auth record. A file
+// of whole User records is always far longer than its profile count allows.
+int user_store_needs_split() {
+    struct stat auth_st, profile_st;
+    if (stat(USER_FILE, &auth_st) == -1 || auth_st.st_size == 0) return 0;
+    if (stat(USER_PROFILE_FILE, &profile_st) == -1) return 1;
+    return record_count(auth_st.st_size, sizeof(UserAuth)) > record_count(profile_st.st_size, sizeof(UserProfile));
+}
+
+#define SCAN_BATCH 256 // Records per pread in the lock-free scans
+
+// --- ID Filters ---
+// A failed login or a transfer to a mistyped ID used to end in a full scan
+// that found nothing. Each store (users, and accounts across every shard)
+// keeps a bitmap of the IDs it may hold, so such misses are answered from
+// memory. IDs are dense and never reused, which makes one bit per ID an
+// exact Bloom filter: no hash collisions, and a removal clears its bit. A
+// set bit is still only a "maybe"; the scan decides.
+//
+// Every ID below a store's 'covered' mark has its bit set. The server's
+// own inserts set their bit and move the mark on; an ID at or past the mark
+// (from bulk_import, or replicated to a standby) is checked against the
+// file header's nextId and, if it may exist, a catch-up scan adds the
+// file's IDs. The bitmaps are in a shared mapping made before the workers
+// fork, like the seqlocks. Processes that never call init_id_filters()
+// (the offline tools) always scan.
+#define ID_FILTER_LIMIT (1 << 28) // IDs at or above this always scan
+
+typedef struct {
+    pthread_mutex_t catch_up; // One catch-up scan at a time
+    int user_covered;
+    int shard_covered[MAX_ACCOUNT_SHARDS];
+} IdFilterState;
+
+static IdFilterState* id_filter = NULL;
+static unsigned char* user_id_bits = NULL;
+static unsigned char* account_id_bits = NULL;
+
+static void set_id_bit(unsigned char* bits, int id) {
+    if (id_filter == NULL || id <= 0 || id >= ID_FILTER_LIMIT) return;
+    __atomic_fetch_or(&bits[id >> 3], (unsigned char)(1 << (id & 7)), __ATOMIC_RELEASE);
+}
+
+static void clear_id_bit(unsigned char* bits, int id) {
+    if (id_filter == NULL || id <= 0 || id >= ID_FILTER_LIMIT) return;
+    __atomic_fetch_and(&bits[id >> 3], (unsigned char)~(1 << (id & 7)), __ATOMIC_RELEASE);
+}
+
+static void raise_covered(int* covered, int next_id) {
+    int seen = __atomic_load_n(covered, __ATOMIC_ACQUIRE);
+    while (seen < next_id && !__atomic_compare_exchange_n(covered, &seen, next_id, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+// After an insert: the mark only moves past IDs it has seen in order, so
+// one written by another process in between still forces a catch-up.
+static void note_inserted_id(unsigned char* bits, int* covered, int id) {
+    set_id_bit(bits, id);
+    if (id_filter == NULL) return;
+    int expected = id;
+    __atomic_compare_exchange_n(covered, &expected, id + 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+// Sets the bit of every ID in the file, then raises 'covered' to the
+// nextId its header had before the scan. Records the compactor moves
+// behind the scan are picked up by scanning again.
+static void catch_up_ids(int fd, size_t record_size, RecordSeqlock* layout, unsigned char* bits, int* covered) {
+    unsigned char batch[SCAN_BATCH * sizeof(UserAuth)]; // The larger of the two records
+    DatHeader header;
+    int rc = pthread_mutex_lock(&id_filter->catch_up);
+    if (rc == EOWNERDEAD) pthread_mutex_consistent(&id_filter->catch_up);
+    else if (rc != 0) return;
+    if (read_dat_header(fd, &header) == 0 && header.nextId > __atomic_load_n(covered, __ATOMIC_ACQUIRE)) {
+        unsigned int before;
+        do {
+            before = seqlock_read_begin(layout);
+            int record_num = 0;
+            ssize_t got;
+            while ((got = pread(fd, batch, SCAN_BATCH * record_size, record_offset(record_num, record_size))) >= (ssize_t)record_size) {
+                int n = got / record_size;
+                for (int i = 0; i < n; i++) {
+                    int id;
+                    memcpy(&id, batch + i * record_size, sizeof(int)); // userId / accountId lead both records
+                    set_id_bit(bits, id);
+                }
+                record_num += n;
+            }
+        } while (!seqlock_unchanged(layout, before));
+        raise_covered(covered, header.nextId);
+    }
+    pthread_mutex_unlock(&id_filter->catch_up);
+}
+
+// Returns 1 if the file certainly holds no record with this ID, 0 if a
+// scan has to decide.
+static int id_absent(int fd, size_t record_size, RecordSeqlock* layout, unsigned char* bits, int* covered, int id) {
+    if (id <= 0) return 1; // Also keeps lookups off tombstones (FREE_SLOT_ID)
+    if (id_filter == NULL || id >= ID_FILTER_LIMIT) return 0;
+    if (id >= __atomic_load_n(covered, __ATOMIC_ACQUIRE)) {
+        DatHeader header;
+        if (read_dat_header(fd, &header) == -1) return 0;
+        if (id >= header.nextId) return 1;
+        catch_up_ids(fd, record_size, layout, bits, covered);
+        if (id >= __atomic_load_n(covered, __ATOMIC_ACQUIRE)) return 0;
+    }
+    return !((__atomic_load_n(&bits[id >> 3], __ATOMIC_ACQUIRE) >> (id & 7)) & 1);
+}
+
+static int user_id_absent(int fd, int userId) {
+    return id_absent(fd, sizeof(UserAuth), user_layout(), user_id_bits, id_filter ? &id_filter->user_covered : NULL, userId);
+}
+
+static int account_id_absent(int fd, int shard, int accountId) {
+    return id_absent(fd, sizeof(Account), shard_layout(shard), account_id_bits, id_filter ? &id_filter->shard_covered[shard] : NULL, accountId);
+}
+
+static void* map_shared(size_t size, int flags) {
+    void* area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | flags, -1, 0);
+    return area == MAP_FAILED ? NULL : area;
+}
+
+int init_id_filters() {
+    if (id_filter != NULL) return 0;
+    IdFilterState* state = (IdFilterState*)map_shared(sizeof(IdFilterState), 0);
+    // Pages are only backed once an ID in them is set
+    unsigned char* users = (unsigned char*)map_shared(ID_FILTER_LIMIT / 8, MAP_NORESERVE);
+    unsigned char* accounts = (unsigned char*)map_shared(ID_FILTER_LIMIT / 8, MAP_NORESERVE);
+    if (state == NULL || users == NULL || accounts == NULL) {
+        if (state != NULL) munmap(state, sizeof(IdFilterState));
+        if (users != NULL) munmap(users, ID_FILTER_LIMIT / 8);
+        if (accounts != NULL) munmap(accounts, ID_FILTER_LIMIT / 8);
+        return -1;
+    }
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&state->catch_up, &attr);
+    pthread_mutexattr_destroy(&attr);
+    user_id_bits = users;
+    account_id_bits = accounts;
+    id_filter = state;
+
+    int fd = shared_read_fd(&user_read_fd, USER_FILE);
+    if (fd != -1) catch_up_ids(fd, sizeof(UserAuth), user_layout(), user_id_bits, &id_filter->user_covered);
+    for (int shard = 0; shard < account_shard_count(); shard++) {
+        if ((fd = account_read_fd(shard)) != -1) catch_up_ids(fd, sizeof(Account), shard_layout(shard), account_id_bits, &id_filter->shard_covered[shard]);
+    }
+    return 0;
+}
 
 // --- Record-Finding Functions ---
+
+// The user and account scans read in batches without taking a file lock.
+// Slot reuse and compaction change which record sits where, so a hit is
+// only a hint that callers confirm by ID (see the lookups below), and a
+// miss counts only if the compactor left the file alone during the scan.
+static int scan_user_ids(int fd, int userId) {
+    UserAuth users[SCAN_BATCH];
+    int record_num = 0;
+    ssize_t got;
+    while ((got = pread(fd, users, sizeof(users), record_offset(record_num, sizeof(UserAuth)))) >= (ssize_t)sizeof(UserAuth)) {
+        int n = got / sizeof(UserAuth);
+        for (int i = 0; i < n; i++) {
+            if (users[i].userId == userId) return record_num + i;
+        }
+        record_num += n;
+    }
+    return -1;
+}
+
 int find_user_record(int userId) {
-    int fd = open(USER_FILE, O_RDONLY);
+    int fd = shared_read_fd(&user_read_fd, USER_FILE);
     if (fd == -1) { perror("open user file"); return -1; }
-    set_file_lock(fd, F_RDLCK);
-    User user;
+    if (user_id_absent(fd, userId)) return -1;
+    while (1) {
+        unsigned int before = seqlock_read_begin(user_layout());
+        int record_num = scan_user_ids(fd, userId);
+        if (record_num != -1 || seqlock_unchanged(user_layout(), before)) return record_num;
+    }
+}
+
+static int scan_account_ids(int fd, int accountId) {
+    Account accounts[SCAN_BATCH];
     int record_num = 0;
-    while (read(fd, &user, sizeof(User)) == sizeof(User)) {
-        if (user.userId == userId) {
-            set_file_lock(fd, F_UNLCK); close(fd); return record_num;
+    ssize_t got;
+    while ((got = pread(fd, accounts, sizeof(accounts), record_offset(record_num, sizeof(Account)))) >= (ssize_t)sizeof(Account)) {
+        int n = got / sizeof(Account);
+        for (int i = 0; i < n; i++) {
+            if (accounts[i].accountId == accountId) return record_num + i;
         }
-        record_num++;
+        record_num += n;
     }
-    set_file_lock(fd, F_UNLCK); close(fd);
     return -1;
 }
 
+// Only the shard that can hold the ID is scanned.
 int find_account_record_by_id(int userId) {
-    int fd = open(ACCOUNT_FILE, O_RDONLY);
+    int shard = account_shard_of(userId);
+    int fd = account_read_fd(shard);
     if (fd == -1) { perror("open account file"); return -1; }
-    set_file_lock(fd, F_RDLCK);
-    Account account;
-    int record_num = 0;
-    while (read(fd, &account, sizeof(Account)) == sizeof(Account)) {
-        if (account.accountId == userId) {
-            set_file_lock(fd, F_UNLCK); close(fd); return record_num;
-        }
-        record_num++;
+    if (account_id_absent(fd, shard, userId)) return -1;
+    while (1) {
+        unsigned int before = seqlock_read_begin(shard_layout(shard));
+        int record_num = scan_account_ids(fd, userId);
+        if (record_num != -1 || seqlock_unchanged(shard_layout(shard), before)) return record_num;
     }
-    set_file_lock(fd, F_UNLCK); close(fd);
-    return -1;
 }
 
+// Loans and feedback are never moved or removed; callers re-read the
+// record under its own lock before acting on it.
 int find_loan_record(int loanId) {
     int fd = open(LOAN_FILE, O_RDONLY);
     if (fd == -1) { perror("open loan file"); return -1; }
-    set_file_lock(fd, F_RDLCK);
     Loan loan;
     int record_num = 0;
+    lseek(fd, DAT_HEADER_SIZE, SEEK_SET);
     while (read(fd, &loan, sizeof(Loan)) == sizeof(Loan)) {
         if (loan.loanId == loanId) {
-            set_file_lock(fd, F_UNLCK); close(fd); return record_num;
+            close(fd); return record_num;
         }
         record_num++;
     }
-    set_file_lock(fd, F_UNLCK); close(fd);
+    close(fd);
     return -1;
 }
 
 int find_feedback_record(int feedbackId) {
     int fd = open(FEEDBACK_FILE, O_RDONLY);
     if (fd == -1) { perror("open feedback file"); return -1; }
-    set_file_lock(fd, F_RDLCK);
     Feedback feedback;
     int record_num = 0;
+    lseek(fd, DAT_HEADER_SIZE, SEEK_SET);
     while (read(fd, &feedback, sizeof(Feedback)) == sizeof(Feedback)) {
         if (feedback.feedbackId == feedbackId) {
-            set_file_lock(fd, F_UNLCK); close(fd); return record_num;
+            close(fd); return record_num;
         }
         record_num++;
     }
-    set_file_lock(fd, F_UNLCK); close(fd);
-    return -1;
+    close(fd);
+    return -1;
+}
+
+static int scan_user_emails(int auth_fd, int fd, const char* email, UserProfile* profiles) {
+    // Profiles past the last auth record belong to an append that never finished
+    int user_count = record_count(lseek(auth_fd, 0, SEEK_END), sizeof(UserAuth));
+    int record_num = 0, found = -1;
+    ssize_t got;
+    while (found == -1 && record_num < user_count && (got = pread(fd, profiles, SCAN_BATCH * sizeof(UserProfile), record_offset(record_num, sizeof(UserProfile)))) >= (ssize_t)sizeof(UserProfile)) {
+        int n = got / sizeof(UserProfile);
+        for (int i = 0; i < n && record_num + i < user_count && found == -1; i++) {
+            if (my_strcmp(profiles[i].email, email) == 0) found = record_num + i;
+        }
+        record_num += n;
+    }
+    return found;
+}
+
+// Returns the record number of the user with this email, or -1. Lock-free,
+// so it is safe to call while holding a lock on the user file.
+int find_user_record_by_email(const char* email) {
+    int auth_fd = shared_read_fd(&user_read_fd, USER_FILE);
+    int fd = shared_profile_fd();
+    if (auth_fd == -1 || fd == -1) { return -1; }
+    UserProfile* profiles = (UserProfile*)malloc(SCAN_BATCH * sizeof(UserProfile)); // Too big for a session's stack
+    if (profiles == NULL) return -1;
+    int found;
+    while (1) {
+        unsigned int before = seqlock_read_begin(user_layout());
+        found = scan_user_emails(auth_fd, fd, email, profiles);
+        if (found != -1 || seqlock_unchanged(user_layout(), before)) break;
+    }
+    free(profiles);
+    return found;
+}
+
+static int missing_in_shard(IntMap* wanted, const int* accountIds, int count, int shard) {
+    for (int i = 0; i < count; i++) {
+        long rec;
+        if (intmap_get(wanted, accountIds[i], &rec) && rec == -1 && account_shard_of(accountIds[i]) == shard) return 1;
+    }
+    return 0;
+}
+
+// Resolves many account IDs with a single pass over each shard file that
+// holds one of them. record_nums[i] is set to -1 for IDs that do not exist;
+// those the ID filter rules out are never looked for. Returns the number of
+// IDs found, or -1 on error.
+int find_account_records(const int* accountIds, int* record_nums, int count) {
+    IntMap wanted;
+    char needed[MAX_ACCOUNT_SHARDS] = { 0 };
+    if (intmap_init(&wanted, count) == -1) return -1;
+    for (int i = 0; i < count; i++) {
+        int shard = account_shard_of(accountIds[i]);
+        int fd = account_read_fd(shard);
+        if (fd != -1 && account_id_absent(fd, shard, accountIds[i])) continue;
+        intmap_put(&wanted, accountIds[i], -1);
+        needed[shard] = 1;
+    }
+
+    for (int shard = 0; shard < account_shard_count(); shard++) {
+        if (!needed[shard]) continue;
+        int fd = account_read_fd(shard);
+        if (fd == -1) { perror("open account file"); intmap_free(&wanted); return -1; }
+        Account accounts[SCAN_BATCH];
+        unsigned int before;
+        do {
+            before = seqlock_read_begin(shard_layout(shard));
+            int record_num = 0;
+            ssize_t got;
+            while ((got = pread(fd, accounts, sizeof(accounts), record_offset(record_num, sizeof(Account)))) >= (ssize_t)sizeof(Account)) {
+                int n = got / sizeof(Account);
+                for (int i = 0; i < n; i++) {
+                    if (intmap_get(&wanted, accounts[i].accountId, NULL)) {
+                        intmap_put(&wanted, accounts[i].accountId, record_num + i);
+                    }
+                }
+                record_num += n;
+            }
+        } while (!seqlock_unchanged(shard_layout(shard), before) && missing_in_shard(&wanted, accountIds, count, shard));
+    }
+
+    int found = 0;
+    for (int i = 0; i < count; i++) {
+        long rec = -1;
+        intmap_get(&wanted, accountIds[i], &rec);
+        record_nums[i] = (int)rec;
+        if (rec != -1) found++;
+    }
+    intmap_free(&wanted);
+    return found;
+}
+
+// --- Lookups by ID ---
+// Each confirms the found record still carries the ID once it is read, or
+// once its write lock is held, and looks again if the record has moved.
+#define MOVED_RECORD_RETRIES 8
+
+int read_user_by_id(int userId, User* user) {
+    for (int attempt = 0; attempt < MOVED_RECORD_RETRIES; attempt++) {
+        int record_num = find_user_record(userId);
+        if (record_num == -1) { errno = ENOENT; return -1; }
+        if (read_user_record(record_num, user) == 0 && user->userId == userId) return record_num;
+    }
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+int read_account_by_id(int accountId, Account* account) {
+    for (int attempt = 0; attempt < MOVED_RECORD_RETRIES; attempt++) {
+        int record_num = find_account_record_by_id(accountId);
+        if (record_num == -1) { errno = ENOENT; return -1; }
+        if (read_account_record(accountId, record_num, account) == 0 && account->accountId == accountId) return record_num;
+    }
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+int lock_user_by_id(int fd, int userId, User* user) {
+    for (int attempt = 0; attempt < MOVED_RECORD_RETRIES; attempt++) {
+        int record_num = find_user_record(userId);
+        if (record_num == -1) { errno = ENOENT; return -1; }
+        if (set_record_lock(fd, record_num, sizeof(UserAuth), F_WRLCK) == -1) return -1;
+        if (read_user_record(record_num, user) == 0 && user->userId == userId) return record_num;
+        set_record_lock(fd, record_num, sizeof(UserAuth), F_UNLCK);
+    }
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+int lock_account_by_id(int fd, int accountId, Account* account) {
+    for (int attempt = 0; attempt < MOVED_RECORD_RETRIES; attempt++) {
+        int record_num = find_account_record_by_id(accountId);
+        if (record_num == -1) { errno = ENOENT; return -1; }
+        if (set_record_lock(fd, record_num, sizeof(Account), F_WRLCK) == -1) return -1;
+        if (pread(fd, account, sizeof(Account), record_offset(record_num, sizeof(Account))) == sizeof(Account) &&
+            account->accountId == accountId) return record_num;
+        set_record_lock(fd, record_num, sizeof(Account), F_UNLCK);
+    }
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+// --- Free Slots ---
+// The callers below hold the file's whole-file write lock (users.dat's
+// covers the profile file too). users.dat keeps the free list for both user
+// files; the profile header only tracks the live count.
+
+static void make_free_slot(void* record, size_t record_size, int next_free) {
+    FreeSlot slot = { FREE_SLOT_ID, next_free };
+    memset(record, 0, record_size);
+    memcpy(record, &slot, sizeof(slot));
+}
+
+static int adjust_live_count(int fd, const char* path, int delta, int next_id) {
+    DatHeader header;
+    if (read_dat_header(fd, &header) == -1) return -1;
+    header.liveCount += delta;
+    if (next_id > header.nextId) header.nextId = next_id;
+    return write_dat_header(fd, path, &header);
+}
+
+// Pops the head of a file's free list for one more live record. Returns
+// the slot, or -1 if the list is empty. A head that is not a tombstone
+// drops the list; the compactor still finds the slots it held.
+static int take_free_slot(int fd, const char* path, size_t record_size, int next_id) {
+    DatHeader header;
+    FreeSlot slot;
+    if (read_dat_header(fd, &header) == -1 || header.freeHead == -1) return -1;
+    int record_num = header.freeHead;
+    int valid = pread(fd, &slot, sizeof(slot), record_offset(record_num, record_size)) == sizeof(slot) && slot.id == FREE_SLOT_ID;
+    header.freeHead = valid ? slot.nextFree : -1;
+    if (valid) {
+        header.liveCount++;
+        if (next_id > header.nextId) header.nextId = next_id;
+    }
+    if (write_dat_header(fd, path, &header) == -1 || !valid) return -1;
+    return record_num;
+}
+
+// The tombstone is written before the header lists it, so a crash in
+// between leaks the slot to the compactor rather than listing a live record.
+int remove_user_record(int fd, int record_num) {
+    int fd_profile = shared_profile_fd();
+    DatHeader header;
+    UserAuth auth;
+    UserProfile profile;
+    int userId;
+    if (fd_profile == -1 || read_dat_header(fd, &header) == -1) return -1;
+    if (pread(fd, &userId, sizeof(int), record_offset(record_num, sizeof(UserAuth))) != sizeof(int)) return -1;
+    make_free_slot(&auth, sizeof(UserAuth), header.freeHead);
+    make_free_slot(&profile, sizeof(UserProfile), header.freeHead);
+    if (put_user_slot(fd, record_num, &auth, &profile) != 0) return -1;
+    clear_id_bit(user_id_bits, userId);
+    header.liveCount--;
+    header.freeHead = record_num;
+    if (adjust_live_count(fd_profile, USER_PROFILE_FILE, -1, 0) == -1) return -1;
+    return write_dat_header(fd, USER_FILE, &header);
+}
+
+int remove_account_record(int fd, int accountId, int record_num) {
+    char path[64];
+    int shard = account_shard_of(accountId);
+    DatHeader header;
+    Account tombstone;
+    account_file_path(shard, account_shard_count(), path);
+    if (read_dat_header(fd, &header) == -1) return -1;
+    make_free_slot(&tombstone, sizeof(Account), header.freeHead);
+    if (put_account_slot(fd, shard, record_num, &tombstone) != 0) return -1;
+    clear_id_bit(account_id_bits, accountId);
+    header.liveCount--;
+    header.freeHead = record_num;
+    return write_dat_header(fd, path, &header);
+}
+
+int insert_user_record(int fd, const User* user) {
+    int fd_profile = shared_profile_fd();
+    if (fd_profile == -1) return -1;
+    int record_num = take_free_slot(fd, USER_FILE, sizeof(UserAuth), user->userId + 1);
+    if (record_num == -1) {
+        record_num = append_user_records(fd, user, 1);
+    } else if (adjust_live_count(fd_profile, USER_PROFILE_FILE, 1, user->userId + 1) == -1 ||
+               write_user_record(fd, record_num, user) != 0) {
+        record_num = -1;
+    }
+    if (record_num != -1 && id_filter != NULL) note_inserted_id(user_id_bits, &id_filter->user_covered, user->userId);
+    return record_num;
+}
+
+int insert_account_record(int fd, const Account* account) {
+    char path[64];
+    int shard = account_shard_of(account->accountId);
+    account_file_path(shard, account_shard_count(), path);
+    int record_num = take_free_slot(fd, path, sizeof(Account), account->accountId + 1);
+    if (record_num == -1) {
+        record_num = append_records(fd, path, account, sizeof(Account), 1, account->accountId + 1);
+    } else if (write_account_record(fd, record_num, account) != 0) {
+        record_num = -1;
+    }
+    if (record_num != -1 && id_filter != NULL) note_inserted_id(account_id_bits, &id_filter->shard_covered[shard], account->accountId);
+    return record_num;
+}
+
+// --- Compaction ---
+// A run takes every tombstone in a file off its free list at once (so new
+// records stop filling them), then, COMPACT_BATCH moves per hold of the
+// whole-file lock, copies the last live record into the lowest hole,
+// tombstones where it was and truncates the dead tail. The file's layout
+// sequence is odd during each batch, which tells a lock-free scan that
+// missed a record to look again. Slots freed while a run is under way go
+// on the new list and wait for the next run, as do claimed holes a run
+// stops short of (its scan finds every tombstone).
+#define COMPACT_BATCH 64
+
+typedef struct {
+    int fd;
+    int shard;            // -1 for the user store
+    const char* path;
+    size_t record_size;
+    RecordSeqlock* layout;
+} CompactTarget;
+
+static int record_id_at(const CompactTarget* target, int record_num) {
+    int id;
+    if (pread(target->fd, &id, sizeof(id), record_offset(record_num, target->record_size)) != sizeof(id)) return FREE_SLOT_ID;
+    return id;
+}
+
+static int move_record(const CompactTarget* target, int from, int to) {
+    if (target->shard == -1) {
+        User user;
+        UserAuth auth;
+        UserProfile profile;
+        if (read_user_record(from, &user) != 0 || write_user_record(target->fd, to, &user) != 0) return -1;
+        make_free_slot(&auth, sizeof(UserAuth), -1);
+        make_free_slot(&profile, sizeof(UserProfile), -1);
+        return put_user_slot(target->fd, from, &auth, &profile);
+    }
+    Account account;
+    if (pread(target->fd, &account, sizeof(Account), record_offset(from, sizeof(Account))) != sizeof(Account) ||
+        put_account_slot(target->fd, target->shard, to, &account) != 0) return -1;
+    make_free_slot(&account, sizeof(Account), -1);
+    return put_account_slot(target->fd, target->shard, from, &account);
+}
+
+static int truncate_records(const CompactTarget* target, int count) {
+    if (ftruncate(target->fd, record_offset(count, target->record_size)) == -1) return -1;
+    replicate_truncate(target->path, record_offset(count, target->record_size));
+    if (target->shard != -1) return 0;
+    int fd_profile = shared_profile_fd();
+    if (fd_profile == -1 || ftruncate(fd_profile, record_offset(count, sizeof(UserProfile))) == -1) return -1;
+    replicate_truncate(USER_PROFILE_FILE, record_offset(count, sizeof(UserProfile)));
+    return 0;
+}
+
+// Collects the file's tombstones in ascending order and empties its free
+// list. Returns the count (0 if there is nothing to reclaim), or -1.
+static int claim_free_slots(const CompactTarget* target, int** holes) {
+    DatHeader header;
+    *holes = NULL;
+    if (read_dat_header(target->fd, &header) == -1) return 0; // Still empty
+    int end = record_count(lseek(target->fd, 0, SEEK_END), target->record_size);
+    if (header.freeHead == -1 && end <= header.liveCount) return 0;
+
+    char* batch = (char*)malloc(SCAN_BATCH * target->record_size);
+    int count = 0, capacity = 0;
+    if (batch == NULL) return -1;
+    for (int first = 0; first < end; first += SCAN_BATCH) {
+        int n = end - first < SCAN_BATCH ? end - first : SCAN_BATCH;
+        if (pread(target->fd, batch, n * target->record_size, record_offset(first, target->record_size)) != (ssize_t)(n * target->record_size)) {
+            free(batch); free(*holes); *holes = NULL; return -1;
+        }
+        for (int i = 0; i < n; i++) {
+            int id;
+            memcpy(&id, batch + i * target->record_size, sizeof(id));
+            if (id != FREE_SLOT_ID) continue;
+            if (count == capacity) {
+                capacity = capacity == 0 ? SCAN_BATCH : capacity * 2;
+                int* bigger = (int*)realloc(*holes, capacity * sizeof(int));
+                if (bigger == NULL) { free(batch); free(*holes); *holes = NULL; return -1; }
+                *holes = bigger;
+            }
+            (*holes)[count++] = first + i;
+        }
+    }
+    free(batch);
+    header.freeHead = -1;
+    if (write_dat_header(target->fd, target->path, &header) == -1) { free(*holes); *holes = NULL; return -1; }
+    return count;
+}
+
+// Returns the slots reclaimed from one file, or -1 on an error. A file
+// whose lock stays busy is left for the next run.
+static int compact_file(const CompactTarget* target) {
+    if (set_file_lock(target->fd, F_WRLCK) == -1) return 0;
+    int* holes;
+    int hole_count = claim_free_slots(target, &holes);
+    int next = 0, reclaimed = 0, locked = 1;
+    int status = hole_count == -1 ? -1 : 0;
+
+    while (status == 0 && next < hole_count) {
+        if (!locked && set_file_lock(target->fd, F_WRLCK) == -1) break; // The rest waits for the next run
+        locked = 1;
+        acquire_writer(target->layout, 0);
+        __atomic_add_fetch(&target->layout->sequence, 1, __ATOMIC_RELEASE);
+        int end = record_count(lseek(target->fd, 0, SEEK_END), target->record_size);
+        int start = end;
+        for (int moved = 0; moved < COMPACT_BATCH; moved++) {
+            while (hole_count > next && holes[hole_count - 1] == end - 1) { hole_count--; end--; } // Dead tail
+            if (next == hole_count) break;
+            if (record_id_at(target, end - 1) == FREE_SLOT_ID) { hole_count = next; break; } // Freed since the claim
+            if (move_record(target, end - 1, holes[next]) != 0) { status = -1; break; }
+            next++;
+            end--;
+        }
+        if (end < start) {
+            if (truncate_records(target, end) == -1) status = -1;
+            else reclaimed += start - end;
+        }
+        __atomic_add_fetch(&target->layout->sequence, 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&target->layout->writer);
+        set_file_lock(target->fd, F_UNLCK);
+        locked = 0;
+    }
+    if (locked) set_file_lock(target->fd, F_UNLCK);
+    free(holes);
+    return status == -1 ? -1 : reclaimed;
+}
+
+int compact_record_files() {
+    CompactTarget target;
+    char path[64];
+    int reclaimed = 0, status = 0;
+
+    target.fd = open(USER_FILE, O_RDWR);
+    if (target.fd != -1) {
+        target.shard = -1;
+        target.path = USER_FILE;
+        target.record_size = sizeof(UserAuth);
+        target.layout = user_layout();
+        int freed = compact_file(&target);
+        if (freed == -1) status = -1; else reclaimed += freed;
+        close(target.fd);
+    }
+    for (int shard = 0; shard < account_shard_count(); shard++) {
+        account_file_path(shard, account_shard_count(), path);
+        target.fd = open(path, O_RDWR);
+        if (target.fd == -1) continue;
+        target.shard = shard;
+        target.path = path;
+        target.record_size = sizeof(Account);
+        target.layout = shard_layout(shard);
+        int freed = compact_file(&target);
+        if (freed == -1) status = -1; else reclaimed += freed;
+        close(target.fd);
+    }
+    return status == -1 ? -1 : reclaimed;
 }
 
 // --- Login Function ---
+// Only the 64-byte auth half is scanned and checked; the profile is read
+// once, for a login that succeeds.
 User check_login(int userId, char* password) {
     User user_to_find;
     user_to_find.userId = 0; 
-    int record_num = find_user_record(userId);
-    if (record_num == -1) { return user_to_find; }
-
-    int fd = open(USER_FILE, O_RDONLY);
-    if (fd == -1) { user_to_find.userId = -1; return user_to_find; }
-
-    set_record_lock(fd, record_num, sizeof(User), F_RDLCK);
-    lseek(fd, record_num * sizeof(User), SEEK_SET);
-    
-    User user;
-    if (read(fd, &user, sizeof(User)) == sizeof(User)) {
-        if (user.userId == userId && my_strcmp(user.password, password) == 0) {
-            if (user.isActive) {
-                user_to_find = user;
-            } else {
-                user_to_find.userId = -2;
-            }
+    UserAuth auth;
+    int record_num = -1;
+    for (int attempt = 0; attempt < MOVED_RECORD_RETRIES && record_num == -1; attempt++) {
+        record_num = find_user_record(userId);
+        if (record_num == -1) { return user_to_find; }
+        if (read_user_auth(record_num, &auth) != 0 || auth.userId != userId) record_num = -1; // Moved
+    }
+
+    if (record_num != -1 && my_strcmp(auth.password, password) == 0) {
+        if (!auth.isActive) {
+            user_to_find.userId = -2;
+        } else if (read_user_record(record_num, &user_to_find) != 0 || user_to_find.userId != userId) {
+            user_to_find.userId = 0;
         }
     }
-    set_record_lock(fd, record_num, sizeof(User), F_UNLCK);
-    close(fd);
     return user_to_find;
 }
 
 // --- Transaction Functions ---
 void log_transaction(int accountId, int userId, TransactionType type, double amount, double newBalance, const char* otherPartyAccount) {
-    int fd = open(TRANSACTION_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
-    if (fd == -1) { perror("Could not open transaction file"); return; }
-
-    set_file_lock(fd, F_WRLCK);
-
     Transaction txn;
-    txn.transactionId = get_next_transaction_id();
     txn.accountId = accountId;
     txn.userId = userId;
     txn.type = type;
     txn.amount = amount;
     txn.newBalance = newBalance;
     strcpy(txn.otherPartyAccountNumber, otherPartyAccount);
+    log_transactions(&txn, 1);
+}
+
+// Appends index entries for any of the 'count' records starting at
+// 'first_record' that fall on a TXN_INDEX_STRIDE boundary. The caller
+// holds the transaction file's write lock, which also guards the index.
+static void append_transaction_index(const Transaction* txns, int first_record, int count) {
+    int fd = -1;
+    int offset = (TXN_INDEX_STRIDE - first_record % TXN_INDEX_STRIDE) % TXN_INDEX_STRIDE;
+    for (int i = offset; i < count; i += TXN_INDEX_STRIDE) {
+        if (fd == -1) {
+            fd = open(TRANSACTION_INDEX_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (fd == -1) { perror("Could not open transaction index"); return; }
+        }
+        TxnIndexEntry entry;
+        entry.timestamp = txns[i].timestamp;
+        entry.recordNum = first_record + i;
+        if (write(fd, &entry, sizeof(TxnIndexEntry)) != sizeof(TxnIndexEntry)) {
+            perror("Could not write transaction index");
+        } else {
+            replicate_append(fd, TRANSACTION_INDEX_FILE, &entry, sizeof(TxnIndexEntry));
+        }
+    }
+    if (fd != -1) close(fd);
+}
+
+// Appends several transactions with one lock and one write.
+// Transaction IDs and timestamps are assigned here, in array order.
+int log_transactions(Transaction* txns, int count) {
+    int fd = open(TRANSACTION_FILE, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) { perror("Could not open transaction file"); return -1; }
+
+    // Callers have already changed a balance; the ledger row must follow it,
+    // so this append waits for the lock however long it takes.
+    lock_range(fd, 0, 0, F_WRLCK, LOCK_WAIT_FOREVER);
+
+    // The header supplies the next ID and the last record the clock floor,
+    // which keeps timestamps monotonic even if the system clock steps backwards.
+    DatHeader header;
+    int next_id = read_dat_header(fd, &header) == 0 ? header.nextId : 1;
+    time_t now = time(NULL);
+    int first_record = record_count(lseek(fd, 0, SEEK_END), sizeof(Transaction));
+    Transaction last_txn;
+    if (first_record > 0 &&
+        pread(fd, &last_txn, sizeof(Transaction), record_offset(first_record - 1, sizeof(Transaction))) == sizeof(Transaction)) {
+        if (last_txn.timestamp > now) now = last_txn.timestamp;
+    }
+    for (int i = 0; i < count; i++) {
+        txns[i].transactionId = next_id + i;
+        txns[i].timestamp = now;
+    }
 
-    write(fd, &txn, sizeof(Transaction));
+    int status = 0;
+    if (append_records(fd, TRANSACTION_FILE, txns, sizeof(Transaction), count, next_id + count) == -1) {
+        perror("Could not write transactions");
+        status = -1;
+    } else {
+        append_transaction_index(txns, first_record, count);
+    }
     set_file_lock(fd, F_UNLCK);
     close(fd);
+    return status;
 }
 
 // --- ID Generation Functions ---
-int get_next_user_id() {
-    int fd = open(USER_FILE, O_RDONLY);
+// IDs come from the file header. These read without locking; to keep IDs
+// unique, call them while holding the file's append lock.
+static int next_id_of(const char* path) {
+    int fd = open(path, O_RDONLY);
     if (fd == -1) { return 1; }
+    DatHeader header;
+    int next_id = read_dat_header(fd, &header) == 0 ? header.nextId : 1;
+    close(fd);
+    return next_id;
+}
 
-    set_file_lock(fd, F_RDLCK);
-    if (lseek(fd, -sizeof(User), SEEK_END) == -1) {
-        set_file_lock(fd, F_UNLCK); close(fd); return 1;
-    }
-    User last_user;
-    if (read(fd, &last_user, sizeof(User)) == sizeof(User)) {
-        set_file_lock(fd, F_UNLCK); close(fd);
-        return last_user.userId + 1;
-    }
-    set_file_lock(fd, F_UNLCK); close(fd);
-    return 1;
+int get_next_user_id() {
+    return next_id_of(USER_FILE);
 }
 
 int get_next_loan_id() {
-    int fd = open(LOAN_FILE, O_RDONLY);
-    if (fd == -1) { return 1; } 
+    return next_id_of(LOAN_FILE);
+}
+
+int get_next_feedback_id() {
+    return next_id_of(FEEDBACK_FILE);
+}
+
+int get_next_transaction_id() {
+    return next_id_of(TRANSACTION_FILE);
+}
+
+// --- Sealed Block Access ---
 
-    set_file_lock(fd, F_RDLCK);
-    if (lseek(fd, -sizeof(Loan), SEEK_END) == -1) {
-        set_file_lock(fd, F_UNLCK); close(fd); return 1;
+static int block_count(int block_index_fd) {
+    off_t size = lseek(block_index_fd, 0, SEEK_END);
+    return size < 0 ? 0 : (int)(size / sizeof(TxnBlockEntry));
+}
+
+static int load_block(int block_index_fd, int block_fd, int block, unsigned char* packed, Transaction* rows) {
+    TxnBlockEntry entry;
+    if (pread(block_index_fd, &entry, sizeof(entry), (off_t)block * sizeof(entry)) != sizeof(entry)) return -1;
+    if (entry.length <= 0 || (size_t)entry.length > txn_block_max_size(TXN_BLOCK_ROWS)) return -1;
+    if (pread(block_fd, packed, entry.length, entry.offset) != entry.length) return -1;
+    return decode_txn_block(packed, entry.length, rows, TXN_BLOCK_ROWS) == TXN_BLOCK_ROWS ? 0 : -1;
+}
+
+// --- Transaction Time Index ---
+
+// Returns the record number a scan for transactions at or after 'from'
+// should start at. Records before it are all strictly older than 'from'.
+int find_transaction_record_at(time_t from) {
+    int fd = open(TRANSACTION_INDEX_FILE, O_RDONLY);
+    if (fd == -1) { return 0; }
+
+    // No lock: entries are appended whole (under the transaction file's lock)
+    // and read with pread, so any prefix is a valid index. An entry still
+    // being appended is past 'size' or ignored as a torn tail.
+    off_t size = lseek(fd, 0, SEEK_END);
+    int low = 0, high = size / sizeof(TxnIndexEntry) - 1, start = 0;
+    TxnIndexEntry entry;
+    // Find the last entry strictly older than 'from'
+    while (low <= high) {
+        int mid = low + (high - low) / 2;
+        if (pread(fd, &entry, sizeof(TxnIndexEntry), mid * sizeof(TxnIndexEntry)) != sizeof(TxnIndexEntry)) break;
+        if (entry.timestamp < from) {
+            start = entry.recordNum;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
     }
-    Loan last_loan;
-    if (read(fd, &last_loan, sizeof(Loan)) == sizeof(Loan)) {
-        set_file_lock(fd, F_UNLCK); close(fd);
-        return last_loan.loanId + 1;
+    close(fd);
+    return start;
+}
+
+// Repositions an open cursor; the next call reads from 'record'.
+static void txn_cursor_seek(TransactionCursor* cursor, int record) {
+    cursor->offset = record_offset(record, sizeof(Transaction));
+    cursor->count = 0;
+    cursor->next = 0;
+}
+
+// Regenerates transactions.idx from transactions.dat (used after migrations).
+int rebuild_transaction_index() {
+    TransactionCursor cursor;
+    if (txn_cursor_open(&cursor, 0) == -1) { return -1; }
+    int fd_idx = open(TRANSACTION_INDEX_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_idx == -1) { txn_cursor_close(&cursor); return -1; }
+
+    const Transaction* txn;
+    int status = 0;
+    for (int record_num = 0; ; record_num += TXN_INDEX_STRIDE) {
+        txn_cursor_seek(&cursor, record_num);
+        if ((txn = txn_cursor_next(&cursor)) == NULL) break;
+        TxnIndexEntry entry;
+        entry.timestamp = txn->timestamp;
+        entry.recordNum = record_num;
+        if (write(fd_idx, &entry, sizeof(TxnIndexEntry)) != sizeof(TxnIndexEntry)) { status = -1; break; }
     }
-    set_file_lock(fd, F_UNLCK); close(fd);
-    return 1; 
+    close(fd_idx);
+    txn_cursor_close(&cursor);
+    return status;
 }
 
-int get_next_feedback_id() {
-    int fd = open(FEEDBACK_FILE, O_RDONLY);
-    if (fd == -1) { return 1; } 
+// --- Snapshot Reads ---
+
+// Copies every record accepted by 'match' into a malloc'd array. The file is
+// read-locked only while it is copied into memory, so the caller can format
+// and send the rows to a slow client without stalling writers. Returns the
+// number of rows stored in *out (0, with *out NULL, if the file is missing),
+// or -1 with *out NULL and errno ETIMEDOUT (the lock was not free in time)
+// or ENOMEM; a partial list is never returned.
+int snapshot_records(const char* path, size_t record_size, RecordMatch match, const void* ctx, void** out) {
+    *out = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) { return 0; }
+
+    char* batch = (char*)malloc(SCAN_BATCH * record_size);
+    if (batch == NULL) { close(fd); errno = ENOMEM; return -1; }
+    if (set_file_lock(fd, F_RDLCK) == -1) { free(batch); close(fd); return -1; }
+
+    char* rows = NULL;
+    int count = 0, capacity = 0;
+    off_t offset = DAT_HEADER_SIZE;
+    ssize_t got;
+    while ((got = pread(fd, batch, SCAN_BATCH * record_size, offset)) >= (ssize_t)record_size) {
+        int n = got / record_size;
+        for (int i = 0; i < n; i++) {
+            const char* record = batch + i * record_size;
+            if (!match(record, ctx)) continue;
+            if (count == capacity) {
+                int bigger_capacity = capacity == 0 ? 64 : capacity * 2;
+                char* bigger = (char*)realloc(rows, bigger_capacity * record_size);
+                if (bigger == NULL) {
+                    // A short list would read as a complete one
+                    set_file_lock(fd, F_UNLCK);
+                    close(fd);
+                    free(batch);
+                    free(rows);
+                    errno = ENOMEM;
+                    return -1;
+                }
+                rows = bigger;
+                capacity = bigger_capacity;
+            }
+            memcpy(rows + count * record_size, record, record_size);
+            count++;
+        }
+        offset += n * record_size;
+    }
+    set_file_lock(fd, F_UNLCK);
+    close(fd);
+    free(batch);
+
+    *out = rows;
+    return count;
+}
 
-    set_file_lock(fd, F_RDLCK);
-    if (lseek(fd, -sizeof(Feedback), SEEK_END) == -1) {
-        set_file_lock(fd, F_UNLCK); close(fd); return 1;
+// transactions.dat is append-only and rows below its size never change, so a
+// cursor only needs the lock long enough to see where the last complete
+// append ended. Everything after that is read lock-free.
+// Returns -1 if there is no transaction file, or -1 with errno == ETIMEDOUT
+// if an append held the lock for too long.
+int txn_cursor_open(TransactionCursor* cursor, int start_record) {
+    cursor->rows = NULL;
+    cursor->packed = NULL;
+    cursor->block_fd = -1;
+    cursor->block_index_fd = -1;
+    cursor->fd = open(TRANSACTION_FILE, O_RDONLY);
+    if (cursor->fd == -1) { return -1; }
+    if (set_file_lock(cursor->fd, F_RDLCK) == -1) {
+        close(cursor->fd);
+        cursor->fd = -1;
+        errno = ETIMEDOUT;
+        return -1;
     }
-    Feedback last_feedback;
-    if (read(fd, &last_feedback, sizeof(Feedback)) == sizeof(Feedback)) {
-        set_file_lock(fd, F_UNLCK); close(fd);
-        return last_feedback.feedbackId + 1;
+    cursor->end = lseek(cursor->fd, 0, SEEK_END);
+    set_file_lock(cursor->fd, F_UNLCK);
+    cursor->rows = (Transaction*)malloc(TXN_BLOCK_ROWS * sizeof(Transaction));
+    if (cursor->rows == NULL) {
+        close(cursor->fd);
+        cursor->fd = -1;
+        return -1;
     }
-    set_file_lock(fd, F_UNLCK); close(fd);
-    return 1; 
+    cursor->block_index_fd = open(TRANSACTION_BLOCK_INDEX_FILE, O_RDONLY);
+    cursor->sealed = cursor->block_index_fd == -1 ? 0 : block_count(cursor->block_index_fd);
+    cursor->offset = record_offset(start_record, sizeof(Transaction));
+    cursor->count = 0;
+    cursor->next = 0;
+    return 0;
 }
 
-int get_next_transaction_id() {
-    int fd = open(TRANSACTION_FILE, O_RDONLY);
-    if (fd == -1) { return 1; } 
+static int cursor_load_sealed(TransactionCursor* cursor, int block) {
+    if (cursor->packed == NULL && (cursor->packed = (unsigned char*)malloc(txn_block_max_size(TXN_BLOCK_ROWS))) == NULL) return -1;
+    if (cursor->block_fd == -1 && (cursor->block_fd = open(TRANSACTION_BLOCK_FILE, O_RDONLY)) == -1) return -1;
+    return load_block(cursor->block_index_fd, cursor->block_fd, block, cursor->packed, cursor->rows);
+}
+
+// A sealer lists a block before punching its rows out of transactions.dat,
+// so a cursor that reads zeroed rows finds their block by looking again.
+static void cursor_refresh_sealed(TransactionCursor* cursor) {
+    if (cursor->block_index_fd == -1) cursor->block_index_fd = open(TRANSACTION_BLOCK_INDEX_FILE, O_RDONLY);
+    if (cursor->block_index_fd != -1) cursor->sealed = block_count(cursor->block_index_fd);
+}
+
+// Each refill covers the rest of one block: a sealed block is decoded
+// whole, a plain one is read with a single pread().
+const Transaction* txn_cursor_next(TransactionCursor* cursor) {
+    if (cursor->next == cursor->count) {
+        if (cursor->end - cursor->offset < (off_t)sizeof(Transaction)) { return NULL; }
+        int record = record_count(cursor->offset, sizeof(Transaction));
+        int block = record / TXN_BLOCK_ROWS;
+        int first = block * TXN_BLOCK_ROWS;
+        int last = record_count(cursor->end, sizeof(Transaction));
+        if (last > first + TXN_BLOCK_ROWS) last = first + TXN_BLOCK_ROWS;
 
-    set_file_lock(fd, F_RDLCK);
-    if (lseek(fd, -sizeof(Transaction), SEEK_END) == -1) {
-        set_file_lock(fd, F_UNLCK); close(fd); return 1;
+        if (block >= cursor->sealed || cursor_load_sealed(cursor, block) == -1) {
+            ssize_t got = pread(cursor->fd, cursor->rows + (record - first), (last - record) * sizeof(Transaction), cursor->offset);
+            if (got < (ssize_t)sizeof(Transaction)) { return NULL; }
+            last = record + got / sizeof(Transaction);
+            int punched = 0;
+            for (int i = record - first; i < last - first && !punched; i++) {
+                if (cursor->rows[i].transactionId == 0) punched = 1;
+            }
+            if (punched && block >= cursor->sealed) {
+                cursor_refresh_sealed(cursor);
+                if (block < cursor->sealed && cursor_load_sealed(cursor, block) == -1) { return NULL; }
+            }
+        }
+        cursor->count = last - first;
+        cursor->next = record - first;
+        cursor->offset = record_offset(last, sizeof(Transaction));
     }
-    Transaction last_txn;
-    if (read(fd, &last_txn, sizeof(Transaction)) == sizeof(Transaction)) {
-        set_file_lock(fd, F_UNLCK); close(fd);
-        return last_txn.transactionId + 1;
+    return &cursor->rows[cursor->next++];
+}
+
+void txn_cursor_close(TransactionCursor* cursor) {
+    if (cursor->fd != -1) close(cursor->fd);
+    if (cursor->block_fd != -1) close(cursor->block_fd);
+    if (cursor->block_index_fd != -1) close(cursor->block_index_fd);
+    free(cursor->rows);
+    free(cursor->packed);
+    cursor->fd = -1;
+    cursor->block_fd = -1;
+    cursor->block_index_fd = -1;
+    cursor->rows = NULL;
+    cursor->packed = NULL;
+}
+
+// --- Sealed History ---
+
+int sealed_transaction_blocks() {
+    int fd = open(TRANSACTION_BLOCK_INDEX_FILE, O_RDONLY);
+    if (fd == -1) { return 0; }
+    int count = block_count(fd);
+    close(fd);
+    return count;
+}
+
+int read_transaction_block(int block, Transaction* rows) {
+    int index_fd = open(TRANSACTION_BLOCK_INDEX_FILE, O_RDONLY);
+    int block_fd = open(TRANSACTION_BLOCK_FILE, O_RDONLY);
+    unsigned char* packed = (unsigned char*)malloc(txn_block_max_size(TXN_BLOCK_ROWS));
+    int status = (index_fd == -1 || block_fd == -1 || packed == NULL) ? -1
+               : load_block(index_fd, block_fd, block, packed, rows);
+    if (index_fd != -1) close(index_fd);
+    if (block_fd != -1) close(block_fd);
+    free(packed);
+    return status;
+}
+
+static int same_amount(double a, double b) {
+    return a == b || (a != a && b != b);
+}
+
+// Field by field: bytes after a string's terminator are not kept.
+static int same_transactions(const Transaction* a, const Transaction* b, int count) {
+    for (int i = 0; i < count; i++) {
+        if (a[i].transactionId != b[i].transactionId || a[i].accountId != b[i].accountId ||
+            a[i].userId != b[i].userId || a[i].type != b[i].type || a[i].timestamp != b[i].timestamp ||
+            !same_amount(a[i].amount, b[i].amount) || !same_amount(a[i].newBalance, b[i].newBalance) ||
+            strncmp(a[i].otherPartyAccountNumber, b[i].otherPartyAccountNumber, sizeof(a[i].otherPartyAccountNumber)) != 0) return 0;
     }
-    set_file_lock(fd, F_UNLCK); close(fd);
-    return 1; 
+    return 1;
 }
 
-// --- ADDED: Atomicity & Recovery Functions ---
+// Each block is appended to transactions.blk, then the new entries are
+// appended to transactions.bix: a block counts as sealed only once it is
+// listed there, so a crash part-way leaves unlisted bytes that the next
+// pass overwrites. Only then are the rows punched out of transactions.dat.
+// Nothing is sealed unless it decodes back to exactly the rows it replaces.
+int seal_transaction_history() {
+    char message[120];
+    int index_fd = open(TRANSACTION_BLOCK_INDEX_FILE, O_RDWR | O_CREAT, 0644);
+    if (index_fd == -1) { perror("Could not open transaction block index"); return -1; }
+    // One sealer at a time, across worker processes too
+    if (set_file_lock(index_fd, F_WRLCK) == -1) { close(index_fd); return 0; }
+
+    int status = -1;
+    int txn_fd = open(TRANSACTION_FILE, O_RDWR);
+    int block_fd = open(TRANSACTION_BLOCK_FILE, O_RDWR | O_CREAT, 0644);
+    Transaction* rows = (Transaction*)malloc(TXN_BLOCK_ROWS * sizeof(Transaction));
+    Transaction* check = (Transaction*)malloc(TXN_BLOCK_ROWS * sizeof(Transaction));
+    unsigned char* packed = (unsigned char*)malloc(txn_block_max_size(TXN_BLOCK_ROWS));
+    TxnBlockEntry* entries = NULL;
+    if (txn_fd == -1 || block_fd == -1 || rows == NULL || check == NULL || packed == NULL) goto done;
+    if (set_file_lock(txn_fd, F_RDLCK) == -1) { status = 0; goto done; }
+    off_t end = lseek(txn_fd, 0, SEEK_END);
+    set_file_lock(txn_fd, F_UNLCK);
+
+    int sealed = block_count(index_fd);
+    int target = record_count(end, sizeof(Transaction)) / TXN_BLOCK_ROWS - TXN_HOT_BLOCKS;
+    off_t block_end = 0;
+    TxnBlockEntry last;
+    if (sealed > 0) {
+        if (pread(index_fd, &last, sizeof(last), (off_t)(sealed - 1) * sizeof(last)) != sizeof(last)) goto done;
+        block_end = last.offset + last.length;
+    }
+    if (target > sealed && (entries = (TxnBlockEntry*)malloc((target - sealed) * sizeof(TxnBlockEntry))) == NULL) goto done;
 
-long get_next_transfer_id() {
-    int fd = open(TRANSFER_LOG_FILE, O_RDONLY);
-    if (fd == -1) { return 1; } 
+    size_t block_bytes = TXN_BLOCK_ROWS * sizeof(Transaction);
+    int count = 0;
+    for (int block = sealed; block < target; block++) {
+        if (pread(txn_fd, rows, block_bytes, record_offset(block * TXN_BLOCK_ROWS, sizeof(Transaction))) != (ssize_t)block_bytes) break;
+        size_t length = rows[0].transactionId == 0 ? 0 : encode_txn_block(rows, TXN_BLOCK_ROWS, packed);
+        if (length == 0 || decode_txn_block(packed, length, check, TXN_BLOCK_ROWS) != TXN_BLOCK_ROWS ||
+            !same_transactions(rows, check, TXN_BLOCK_ROWS)) {
+            sprintf(message, "ERROR: Transaction block %d cannot be sealed; it stays in transactions.dat.\n", block);
+            write_string(STDOUT_FILENO, message);
+            break;
+        }
+        if (pwrite(block_fd, packed, length, block_end) != (ssize_t)length) { perror("Could not write transaction block"); break; }
+        replicate_write(TRANSACTION_BLOCK_FILE, block_end, packed, length);
+        entries[count].offset = block_end;
+        entries[count].length = length;
+        entries[count].rowCount = TXN_BLOCK_ROWS;
+        block_end += length;
+        count++;
+    }
 
-    set_file_lock(fd, F_RDLCK);
-    if (lseek(fd, -sizeof(TransferLog), SEEK_END) == -1) {
-        set_file_lock(fd, F_UNLCK); close(fd); return 1;
+    if (count > 0) {
+        size_t entry_bytes = count * sizeof(TxnBlockEntry);
+        if (fsync(block_fd) == -1 ||
+            pwrite(index_fd, entries, entry_bytes, (off_t)sealed * sizeof(TxnBlockEntry)) != (ssize_t)entry_bytes ||
+            fsync(index_fd) == -1) {
+            perror("Could not list sealed transaction blocks");
+            goto done;
+        }
+        replicate_write(TRANSACTION_BLOCK_INDEX_FILE, (off_t)sealed * sizeof(TxnBlockEntry), entries, entry_bytes);
     }
-    TransferLog last_log;
-    if (read(fd, &last_log, sizeof(TransferLog)) == sizeof(TransferLog)) {
-        set_file_lock(fd, F_UNLCK); close(fd);
-        return last_log.transferId + 1;
+    // The whole sealed prefix (never the header), so space a crash left
+    // behind is freed too. The file keeps its size, so record numbers never move.
+    if (sealed + count > 0 &&
+        fallocate(txn_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, DAT_HEADER_SIZE, (off_t)(sealed + count) * block_bytes) == -1 &&
+        errno != EOPNOTSUPP) {
+        perror("Could not free sealed transactions");
     }
-    set_file_lock(fd, F_UNLCK); close(fd);
-    return 1; 
+    status = count;
+
+done:
+    if (status == -1 && txn_fd == -1) perror("Could not open transaction file");
+    free(entries);
+    free(packed);
+    free(check);
+    free(rows);
+    if (block_fd != -1) close(block_fd);
+    if (txn_fd != -1) close(txn_fd);
+    set_file_lock(index_fd, F_UNLCK);
+    close(index_fd);
+    return status;
+}
+
+// --- ADDED: Atomicity & Recovery Functions ---
+// Each shard's transfer log holds the groups that shard coordinated: a START
+// written once the transfer is known to apply, then a COMMIT, or an ABORT
+// once recovery has refunded the sender. A credit into another shard's
+// account is a two-phase commit over the same records: a PREPARED goes into
+// the recipient shard's log before the sender is debited, the coordinator's
+// COMMIT is the decision, and the participant writes its own COMMIT once the
+// credit is applied. Shard k hands out transfer IDs congruent to k modulo
+// the shard count, so an ID names its coordinator in every log.
+
+// The last START in a log carries its shard's highest ID. The caller holds
+// the log's append lock.
+static long next_transfer_id(int fd, int shard) {
+    int shard_count = account_shard_count();
+    TransferLog batch[SCAN_BATCH];
+    off_t end = lseek(fd, 0, SEEK_END);
+    end -= end % sizeof(TransferLog); // Ignore a torn tail
+    while (end > 0) {
+        off_t start = end > (off_t)sizeof(batch) ? end - (off_t)sizeof(batch) : 0;
+        if (pread(fd, batch, end - start, start) != end - start) break;
+        for (int i = (end - start) / sizeof(TransferLog) - 1; i >= 0; i--) {
+            if (batch[i].status == LOG_START) return batch[i].transferId + shard_count;
+        }
+        end = start;
+    }
+    return shard + shard_count;
 }
 
-void write_transfer_log(TransferLog* log_entry) {
-    int fd = open(TRANSFER_LOG_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
+// Opens a shard's log and takes its append lock, or returns -1.
+static int lock_transfer_log(int shard, char* path) {
+    transfer_log_path(shard, account_shard_count(), path);
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
     if (fd == -1) {
         perror("FATAL: Failed to open transfer log");
-        return;
+        return -1;
     }
-    set_file_lock(fd, F_WRLCK);
-    if (write(fd, log_entry, sizeof(TransferLog)) != sizeof(TransferLog)) {
+    // A COMMIT for money already moved must never be dropped
+    lock_range(fd, 0, 0, F_WRLCK, LOCK_WAIT_FOREVER);
+    return fd;
+}
+
+static void unlock_transfer_log(int fd) {
+    set_file_lock(fd, F_UNLCK);
+    close(fd);
+}
+
+// Appends entries to one shard's log with a single write. A START with
+// transferId 0 is given the next ID under the append lock, and so is every
+// entry after it, so concurrent transfers never share one.
+static void append_transfer_log(int shard, TransferLog* entries, int count) {
+    char path[64];
+    int fd = lock_transfer_log(shard, path);
+    if (fd == -1) return;
+    if (entries[0].transferId == 0) {
+        long transferId = next_transfer_id(fd, shard);
+        for (int i = 0; i < count; i++) entries[i].transferId = transferId;
+    }
+    size_t size = count * sizeof(TransferLog);
+    if (write(fd, entries, size) != (ssize_t)size) {
         perror("FATAL: Failed to write to transfer log");
+    } else {
+        replicate_append(fd, path, entries, size);
+    }
+    unlock_transfer_log(fd);
+}
+
+void write_transfer_log(int shard, TransferLog* log_entry) {
+    append_transfer_log(shard, log_entry, 1);
+}
+
+// One LOG_UNDO for each slot in 'slots', carrying the balance it had before
+// the group. They follow the START in the same write.
+static void fill_undo_entries(TransferLog* out, const TransferLog* start, const Account* before, const int* slots, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = *start;
+        out[i].status = LOG_UNDO;
+        out[i].toAccountId = before[slots[i]].accountId;
+        out[i].amount = before[slots[i]].balance;
+    }
+}
+
+// Copies a whole transfer log into a malloc'd array. Returns the entry
+// count, -1 if the log does not exist, or -2 if it could not be read.
+static int load_transfer_log(int shard, TransferLog** out) {
+    char path[64];
+    transfer_log_path(shard, account_shard_count(), path);
+    *out = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+
+    lock_range(fd, 0, 0, F_RDLCK, LOCK_WAIT_FOREVER);
+    int count = lseek(fd, 0, SEEK_END) / sizeof(TransferLog);
+    TransferLog* entries = (TransferLog*)malloc((count > 0 ? count : 1) * sizeof(TransferLog));
+    if (entries == NULL || pread(fd, entries, count * sizeof(TransferLog), 0) != (ssize_t)(count * sizeof(TransferLog))) {
+        free(entries);
+        entries = NULL;
+        count = -2;
     }
     set_file_lock(fd, F_UNLCK);
     close(fd);
+    *out = entries;
+    return count;
 }
 
-void perform_recovery_check() {
-    int log_fd = open(TRANSFER_LOG_FILE, O_RDONLY);
-    if (log_fd == -1) {
-        write_string(STDOUT_FILENO, "No transfer log found. Skipping recovery.\n");
+// Opens an account's shard and write-locks its record, waiting as long as
+// it takes and re-checking the ID in case the record moved. Returns the
+// record number with *acct_fd open, or -1.
+static int lock_account_for_recovery(int accountId, int* acct_fd, Account* account) {
+    *acct_fd = open_account_file(accountId, O_RDWR);
+    if (*acct_fd == -1) {
+        write_string(STDOUT_FILENO, "FATAL: Cannot open account file for recovery.\n");
+        return -1;
+    }
+    int rec_num;
+    while ((rec_num = find_account_record_by_id(accountId)) != -1) {
+        lock_range(*acct_fd, record_offset(rec_num, sizeof(Account)), sizeof(Account), F_WRLCK, LOCK_WAIT_FOREVER);
+        if (pread(*acct_fd, account, sizeof(Account), record_offset(rec_num, sizeof(Account))) == sizeof(Account) &&
+            account->accountId == accountId) break;
+        set_record_lock(*acct_fd, rec_num, sizeof(Account), F_UNLCK);
+    }
+    if (rec_num == -1) close(*acct_fd);
+    return rec_num;
+}
+
+// Puts back the balance a LOG_UNDO recorded. The group's ledger rows were
+// never written, so none is added; a balance that already matches means
+// the group's write never landed.
+static int recover_account_balance(int accountId, double balance) {
+    int acct_fd, status = 0;
+    Account account;
+    int rec_num = lock_account_for_recovery(accountId, &acct_fd, &account);
+    if (rec_num == -1) return -1;
+    if (account.balance != balance) {
+        account.balance = balance;
+        if (write_account_record(acct_fd, rec_num, &account) != 0) {
+            write_string(STDOUT_FILENO, "FATAL: Could not write rollback.\n");
+            status = -1;
+        }
+    }
+    set_record_lock(acct_fd, rec_num, sizeof(Account), F_UNLCK);
+    close(acct_fd);
+    return status;
+}
+
+// Adds 'amount' to an account under its record lock and logs the ledger
+// row: finishes a cross-shard credit, or refunds the sender of a group
+// logged before LOG_UNDO existed.
+static int recover_account_delta(int accountId, double amount, TransactionType type, const char* other_party) {
+    int acct_fd, status = -1;
+    Account account;
+    int rec_num = lock_account_for_recovery(accountId, &acct_fd, &account);
+    if (rec_num == -1) return -1;
+    account.balance += amount;
+    if (write_account_record(acct_fd, rec_num, &account) != 0) {
+        write_string(STDOUT_FILENO, "FATAL: Could not write rollback.\n");
+    } else {
+        log_transaction(account.accountId, account.ownerUserId, type, amount, account.balance, other_party);
+        status = 0;
+    }
+    set_record_lock(acct_fd, rec_num, sizeof(Account), F_UNLCK);
+    close(acct_fd);
+    return status;
+}
+
+// Orders participant records by (transfer, recipient), each PREPARED
+// ahead of the COMMIT or ABORT that closed it.
+static int compare_participant(const void* a, const void* b) {
+    const TransferLog* x = (const TransferLog*)a;
+    const TransferLog* y = (const TransferLog*)b;
+    if (x->transferId != y->transferId) return (x->transferId > y->transferId) - (x->transferId < y->transferId);
+    if (x->toAccountId != y->toAccountId) return (x->toAccountId > y->toAccountId) - (x->toAccountId < y->toAccountId);
+    return (x->status != LOG_PREPARED) - (y->status != LOG_PREPARED);
+}
+
+// Settles every transfer 'shard' coordinated. Call it only while no process
+// is running transfers for that shard: at startup, or when the worker that
+// owns the shard is restarted after a crash. An open group's accounts get
+// the balances its LOG_UNDO entries recorded, so a deposit another worker
+// made to one of them in between would be lost with it.
+void recover_shard_transfers(int shard) {
+    char buffer[256];
+    char prefix[32] = "";
+    int shard_count = account_shard_count();
+    if (shard_count > 1) sprintf(prefix, "Shard %d: ", shard);
+
+    TransferLog* own;
+    int own_count = load_transfer_log(shard, &own);
+    if (own_count < 0) {
+        sprintf(buffer, own_count == -1 ? "%sNo transfer log found. Skipping recovery.\n" : "%sERROR: Could not read the transfer log.\n", prefix);
+        write_string(STDOUT_FILENO, buffer);
         return;
     }
-    
-    set_file_lock(log_fd, F_RDLCK);
 
-    #define MAX_PENDING_TXS 1000
-    TransferLog pending[MAX_PENDING_TXS];
-    int pending_count = 0;
-    TransferLog entry;
+    // --- Step 1: The outcome of every group this shard coordinated ---
+    IntMap outcome; // transferId -> LOG_START (still open), LOG_COMMIT or LOG_ABORT
+    if (intmap_init(&outcome, own_count + 1) == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Out of memory during recovery.\n");
+        free(own);
+        return;
+    }
+    for (int i = 0; i < own_count; i++) {
+        if (own[i].transferId % shard_count != shard || own[i].status == LOG_PREPARED || own[i].status == LOG_UNDO) continue;
+        intmap_put(&outcome, (int)own[i].transferId, own[i].status);
+    }
+
+    // --- Step 2: Settle our open credits in the other shards' logs ---
+    // Credits follow the decision, so an undecided group never applied one.
+    int completed = 0, released = 0;
+    for (int p = 0; p < shard_count; p++) {
+        if (p == shard) continue;
+        TransferLog* entries;
+        int count = load_transfer_log(p, &entries);
+        int kept = 0;
+        for (int i = 0; i < count; i++) {
+            if (entries[i].transferId % shard_count == shard) entries[kept++] = entries[i];
+        }
+        qsort(entries, kept, sizeof(TransferLog), compare_participant);
+        for (int i = 0; i < kept; i++) {
+            TransferLog closing = entries[i];
+            if (closing.status != LOG_PREPARED) continue;
+            if (i + 1 < kept && entries[i + 1].transferId == closing.transferId &&
+                entries[i + 1].toAccountId == closing.toAccountId) continue; // Already closed
 
-    // --- Step 1: Find all incomplete transactions ---
-    while(read(log_fd, &entry, sizeof(TransferLog)) == sizeof(TransferLog)) {
-        if (entry.status == LOG_START) {
-            if(pending_count < MAX_PENDING_TXS) {
-                pending[pending_count++] = entry;
+            long decision = LOG_START;
+            intmap_get(&outcome, (int)closing.transferId, &decision);
+            if (decision == LOG_COMMIT) {
+                if (recover_account_delta(closing.toAccountId, closing.amount, TRANSFER_IN, "RECOVERY") != 0) continue;
+                closing.status = LOG_COMMIT;
+                completed++;
             } else {
-                write_string(STDOUT_FILENO, "ERROR: Too many pending transactions to recover.\n");
-                break;
-            }
-        } else if (entry.status == LOG_COMMIT) {
-            for (int i = 0; i < pending_count; i++) {
-                if (pending[i].transferId == entry.transferId) {
-                    pending[i] = pending[pending_count - 1]; // Swap with last
-                    pending_count--;
-                    break;
-                }
+                closing.status = LOG_ABORT;
+                released++;
             }
+            write_transfer_log(p, &closing);
         }
+        free(entries);
     }
-    set_file_lock(log_fd, F_UNLCK);
-    close(log_fd);
 
-    // --- Step 2: Rollback any transactions still in the pending list ---
+    // --- Step 3: Undo the groups that never committed ---
+    int pending_count = 0;
+    for (long i = intmap_next(&outcome, 0); i != -1; i = intmap_next(&outcome, i + 1)) {
+        if (outcome.values[i] == LOG_START) pending_count++;
+    }
+    if (completed > 0 || released > 0) {
+        sprintf(buffer, "%sSettled %d cross-shard credits (%d completed, %d released).\n", prefix, completed + released, completed, released);
+        write_string(STDOUT_FILENO, buffer);
+    }
     if (pending_count == 0) {
-        write_string(STDOUT_FILENO, "Recovery check clean. No incomplete transfers found.\n");
-        return;
+        if (completed == 0 && released == 0) {
+            sprintf(buffer, "%sRecovery check clean. No incomplete transfers found.\n", prefix);
+            write_string(STDOUT_FILENO, buffer);
+        }
+    } else {
+        sprintf(buffer, "%sWARNING: Found %d incomplete transfers. Rolling back...\n", prefix, pending_count);
+        write_string(STDOUT_FILENO, buffer);
     }
 
-    char buffer[256];
-    sprintf(buffer, "WARNING: Found %d incomplete transfers. Rolling back...\n", pending_count);
-    write_string(STDOUT_FILENO, buffer);
+    for (int i = 0; i < own_count && pending_count > 0; i++) {
+        TransferLog* failed_tx = &own[i];
+        long state;
+        if (failed_tx->status != LOG_START || !intmap_get(&outcome, (int)failed_tx->transferId, &state) || state != LOG_START) continue;
 
-    int acct_fd = open(ACCOUNT_FILE, O_RDWR);
-    if (acct_fd == -1) {
-        write_string(STDOUT_FILENO, "FATAL: Cannot open account file for recovery.\n");
-        return;
+        // Its LOG_UNDO entries follow it in the same write. Each account gets
+        // its balance from before the group back, whether or not the write landed.
+        int undo_failed = 0, undo_count = 0;
+        for (int j = i + 1; j < own_count && own[j].transferId == failed_tx->transferId && own[j].status == LOG_UNDO; j++) {
+            if (recover_account_balance(own[j].toAccountId, own[j].amount) != 0) undo_failed = 1;
+            undo_count++;
+        }
+        if (undo_failed) continue;
+        // A group logged before LOG_UNDO existed only had its sender refunded
+        if (undo_count == 0 && recover_account_delta(failed_tx->fromAccountId, failed_tx->amount, DEPOSIT, "ROLLBACK_FAIL") != 0) continue;
+
+        // Then close the group so the next start leaves it alone
+        failed_tx->status = LOG_ABORT;
+        write_transfer_log(shard, failed_tx);
+        if (undo_count > 0) sprintf(buffer, "Rolled back transfer %ld from user %d (%d accounts restored).\n", failed_tx->transferId, failed_tx->fromAccountId, undo_count);
+        else sprintf(buffer, "Rolled back %f from user %d.\n", failed_tx->amount, failed_tx->fromAccountId);
+        write_string(STDOUT_FILENO, buffer);
     }
+    intmap_free(&outcome);
+    free(own);
+}
 
-    for (int i = 0; i < pending_count; i++) {
-        TransferLog* failed_tx = &pending[i];
-        
-        int sender_rec_num = find_account_record_by_id(failed_tx->fromAccountId);
-        if (sender_rec_num == -1) continue; 
-
-        set_record_lock(acct_fd, sender_rec_num, sizeof(Account), F_WRLCK);
-        
-        Account sender_account;
-        lseek(acct_fd, sender_rec_num * sizeof(Account), SEEK_SET);
-        if (read(acct_fd, &sender_account, sizeof(Account)) != sizeof(Account)) {
-             write_string(STDOUT_FILENO, "ERROR: Could not read account for rollback.\n");
-             set_record_lock(acct_fd, sender_rec_num, sizeof(Account), F_UNLCK);
-             continue;
-        }
-        
-        // REFUND THE MONEY
-        sender_account.balance += failed_tx->amount;
-        
-        lseek(acct_fd, sender_rec_num * sizeof(Account), SEEK_SET);
-        if (write(acct_fd, &sender_account, sizeof(Account)) != sizeof(Account)) {
-            write_string(STDOUT_FILENO, "FATAL: Could not write rollback.\n");
-        } else {
-            log_transaction(sender_account.accountId, sender_account.ownerUserId, DEPOSIT, failed_tx->amount, sender_account.balance, "ROLLBACK_FAIL");
-            
-            sprintf(buffer, "Rolled back %f from user %d.\n", failed_tx->amount, failed_tx->fromAccountId);
-            write_string(STDOUT_FILENO, buffer);
+void perform_recovery_check() {
+    for (int shard = 0; shard < account_shard_count(); shard++) {
+        recover_shard_transfers(shard);
+    }
+}
+// --- END ADDED ---
+
+// --- Single and Batch (Payroll) Transfers ---
+
+typedef struct {
+    int shard;
+    int rec;
+} LockedRecord;
+
+static int compare_locked(const void* a, const void* b) {
+    const LockedRecord* x = (const LockedRecord*)a;
+    const LockedRecord* y = (const LockedRecord*)b;
+    if (x->shard != y->shard) return (x->shard > y->shard) - (x->shard < y->shard);
+    return (x->rec > y->rec) - (x->rec < y->rec);
+}
+
+static void unlock_records(const int* fds, const LockedRecord* locked, int count) {
+    for (int i = 0; i < count; i++) {
+        set_record_lock(fds[locked[i].shard], locked[i].rec, sizeof(Account), F_UNLCK);
+    }
+}
+
+// Puts back the pre-transfer image of every slot in 'touched' after a group
+// failed part-way. The caller still holds the record locks, so no one saw
+// the half-applied balances. Returns how many could not be restored.
+static int undo_account_writes(const int* fds, const int* shards, const int* recs, const Account* before, const int* touched, int count) {
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        int slot = touched[i];
+        if (write_account_record(fds[shards[slot]], recs[slot], &before[slot]) != 0) failed++;
+    }
+    return failed;
+}
+
+static int compare_stripe(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)*(RecordSeqlock* const*)a;
+    uintptr_t y = (uintptr_t)*(RecordSeqlock* const*)b;
+    return (x > y) - (x < y);
+}
+
+// Takes several stripes' writer mutexes in address order, so two chains
+// never deadlock, and marks each one mid-write. Returns how many distinct
+// stripes are held; they are compacted to the front of 'stripes'.
+static int begin_stripe_writes(RecordSeqlock** stripes, int count) {
+    int held = 0;
+    qsort(stripes, count, sizeof(RecordSeqlock*), compare_stripe);
+    for (int i = 0; i < count; i++) {
+        if (held > 0 && stripes[held - 1] == stripes[i]) continue;
+        stripes[held++] = stripes[i];
+    }
+    for (int i = 0; i < held; i++) {
+        acquire_writer(stripes[i], 0);
+        __atomic_add_fetch(&stripes[i]->sequence, 1, __ATOMIC_RELEASE);
+    }
+    return held;
+}
+
+static void end_stripe_writes(RecordSeqlock** stripes, int held) {
+    for (int i = 0; i < held; i++) {
+        __atomic_add_fetch(&stripes[i]->sequence, 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&stripes[i]->writer);
+    }
+}
+
+// A transfer that stays on one shard goes to the kernel as a single linked
+// chain: START with a LOG_UNDO per account (one link, built in 'group'), the
+// debit, each distinct credit in 'written', then COMMIT.
+// A failed link cancels everything after it, so the COMMIT lands only if
+// every record before it did. Links that landed before the failure are not
+// undone by the kernel: if the chain breaks after its START, each account
+// link that wrote anything gets its image from 'before' back while the
+// stripes are still held, and the group is closed with an ABORT where the
+// COMMIT would have gone. The log's append lock is held throughout, so the
+// entries sit where the chain put them. Returns 0 once committed, -1 if
+// nothing was written, or -2 if the group was undone and aborted.
+static int run_transfer_chain(int shard, int fd, TransferLog* log_entry, TransferLog* group, const int* recs, const Account* accounts, const Account* before, const int* written, int written_count) {
+    char log_path[64], account_path[64];
+    RecordSeqlock** stripes = (RecordSeqlock**)malloc(written_count * sizeof(RecordSeqlock*));
+    if (stripes == NULL) return -1;
+    int log_fd = lock_transfer_log(shard, log_path);
+    if (log_fd == -1) { free(stripes); return -1; }
+    account_file_path(shard, account_shard_count(), account_path);
+
+    off_t log_end = lseek(log_fd, 0, SEEK_END);
+    log_entry->transferId = next_transfer_id(log_fd, shard);
+    TransferLog commit_entry = *log_entry;
+    commit_entry.status = LOG_COMMIT;
+    group[0] = *log_entry;
+    fill_undo_entries(&group[1], log_entry, before, written, written_count);
+    size_t group_size = (written_count + 1) * sizeof(TransferLog);
+
+    IoBatch chain;
+    io_batch_init(&chain);
+    int queued = io_batch_write(&chain, log_fd, group, group_size, log_end) == 0;
+    for (int i = 0; i < written_count && queued; i++) {
+        const Account* account = &accounts[written[i]];
+        queued = io_batch_write(&chain, fd, account, sizeof(Account), record_offset(recs[written[i]], sizeof(Account))) == 0;
+        stripes[i] = account_stripe(account->accountId, recs[written[i]]);
+    }
+    if (queued) queued = io_batch_write(&chain, log_fd, &commit_entry, sizeof(TransferLog), log_end + group_size) == 0;
+
+    int status = -1;
+    if (queued) {
+        int held = begin_stripe_writes(stripes, written_count);
+        io_batch_submit(&chain, 1);
+        int started = chain.ops[0].result == (ssize_t)chain.ops[0].len;
+        int committed = chain.ops[chain.count - 1].result == (ssize_t)chain.ops[chain.count - 1].len;
+        int unrestored = 0;
+        if (started && !committed) {
+            // Links 1..written_count are the accounts; a short write landed in part
+            for (int i = 1; i <= written_count; i++) {
+                if (chain.ops[i].result <= 0) continue;
+                if (pwrite(fd, &before[written[i - 1]], sizeof(Account), chain.ops[i].offset) == sizeof(Account)) chain.ops[i].result = 0;
+                else unrestored++;
+            }
+        }
+        end_stripe_writes(stripes, held);
+        // Standbys get every link that landed and stayed, in chain order
+        for (int i = 0; i < chain.count; i++) {
+            if (chain.ops[i].result != (ssize_t)chain.ops[i].len) continue;
+            const char* path = (chain.ops[i].fd == log_fd) ? log_path : account_path;
+            replicate_write(path, chain.ops[i].offset, chain.ops[i].buf, chain.ops[i].len);
+        }
+        if (committed) {
+            status = 0;
+        } else if (started) {
+            if (unrestored > 0) write_string(STDOUT_FILENO, "FATAL: Transfer could not be fully undone; run reconcile.\n");
+            // Drop any torn COMMIT, then close the group so recovery refunds nothing
+            TransferLog abort_entry = *log_entry;
+            abort_entry.status = LOG_ABORT;
+            off_t abort_at = log_end + group_size;
+            if (ftruncate(log_fd, abort_at) != 0 || write(log_fd, &abort_entry, sizeof(TransferLog)) != sizeof(TransferLog)) {
+                perror("FATAL: Failed to write to transfer log");
+            } else {
+                replicate_write(log_path, abort_at, &abort_entry, sizeof(TransferLog));
+            }
+            status = -2;
+        } else if (chain.ops[0].result > 0) {
+            // A torn START group: nothing after it ran, so drop it whole
+            if (ftruncate(log_fd, log_end) != 0) perror("FATAL: Failed to trim the transfer log");
         }
-        
-        set_record_lock(acct_fd, sender_rec_num, sizeof(Account), F_UNLCK);
     }
-    close(acct_fd);
+    io_batch_free(&chain);
+    unlock_transfer_log(log_fd);
+    free(stripes);
+    return status;
+}
+
+// Debits 'fromAccountId' once and credits every recipient in one atomic unit:
+// one scan per shard involved, record locks taken in ascending (shard,
+// record) order, one WAL group and one transaction-log append. Recipients on
+// the sender's shard are credited with the debit; the rest are prepared in
+// their own shard's log and credited after the COMMIT decision. Returns 0 on
+// success. Validation failures apply nothing; a failed write before the
+// decision puts back every record already written and closes the group with
+// an ABORT. Either way a client-facing result is written to 'message'.
+static int run_transfer(int fromAccountId, const BatchCredit* credits, int count, int single, char* message) {
+    const char* kind = single ? "Transfer" : "Batch transfer";
+    char fatal[100];
+    if (count <= 0 || count > MAX_BATCH_CREDITS) {
+        sprintf(message, "Batch must contain 1 to %d recipients.\n", MAX_BATCH_CREDITS);
+        return -1;
+    }
+
+    // --- Step 1: Resolve every account with one scan per shard ---
+    int* ids = (int*)malloc((count + 1) * sizeof(int));
+    int* recs = (int*)malloc((count + 1) * sizeof(int));
+    int* shards = (int*)malloc((count + 1) * sizeof(int));
+    LockedRecord* lock_order = (LockedRecord*)malloc((count + 1) * sizeof(LockedRecord));
+    Account* accounts = (Account*)malloc((count + 1) * sizeof(Account));
+    Account* before = (Account*)malloc((count + 1) * sizeof(Account)); // Pre-transfer images
+    int* touched = (int*)malloc((count + 1) * sizeof(int)); // Slots written before the decision
+    TransferLog* group = (TransferLog*)malloc((count + 2) * sizeof(TransferLog)); // START and its LOG_UNDOs
+    double* credited = (double*)calloc(count + 1, sizeof(double));
+    Transaction* txns = (Transaction*)malloc(2 * count * sizeof(Transaction));
+    IntMap first_slot; // account ID -> first position in 'accounts'
+    if (!ids || !recs || !shards || !lock_order || !accounts || !before || !touched || !group || !credited || !txns || intmap_init(&first_slot, count) == -1) {
+        free(ids); free(recs); free(shards); free(lock_order); free(accounts); free(before); free(touched); free(group); free(credited); free(txns);
+        strcpy(message, "Error: Out of memory.\n");
+        return -1;
+    }
+
+    int result = -1;
+    double total = 0.0;
+    int fds[MAX_ACCOUNT_SHARDS];
+    for (int s = 0; s < MAX_ACCOUNT_SHARDS; s++) fds[s] = -1;
+    int lock_count = 0;
+
+    ids[0] = fromAccountId;
+    for (int i = 0; i < count; i++) {
+        ids[i + 1] = credits[i].toAccountId;
+        total += credits[i].amount;
+        if (credits[i].toAccountId == fromAccountId) {
+            strcpy(message, "Cannot transfer funds to your own account.\n");
+            goto cleanup;
+        }
+    }
+    if (find_account_records(ids, recs, count + 1) == -1) {
+        strcpy(message, "Error accessing account data.\n");
+        goto cleanup;
+    }
+    if (recs[0] == -1) {
+        strcpy(message, "Error: Your account could not be found.\n");
+        goto cleanup;
+    }
+    for (int i = 1; i <= count; i++) {
+        if (recs[i] == -1) {
+            if (single) strcpy(message, "Error: Recipient User ID not found.\n");
+            else sprintf(message, "Error: Recipient User ID %d not found.\n", ids[i]);
+            goto cleanup;
+        }
+    }
+    for (int i = 0; i <= count; i++) {
+        shards[i] = account_shard_of(ids[i]);
+        if (fds[shards[i]] == -1 && (fds[shards[i]] = open_account_shard(shards[i], O_RDWR)) == -1) {
+            strcpy(message, "Error accessing account data.\n");
+            goto unlock;
+        }
+    }
+
+    // --- Step 2: Lock each distinct record in ascending order ---
+    for (int i = 0; i <= count; i++) {
+        lock_order[i].shard = shards[i];
+        lock_order[i].rec = recs[i];
+    }
+    qsort(lock_order, count + 1, sizeof(LockedRecord), compare_locked);
+    for (int i = 0; i <= count; i++) {
+        if (i > 0 && compare_locked(&lock_order[i], &lock_order[i - 1]) == 0) continue;
+        lock_order[lock_count++] = lock_order[i];
+    }
+    for (int i = 0; i < lock_count; i++) {
+        if (set_record_lock(fds[lock_order[i].shard], lock_order[i].rec, sizeof(Account), F_WRLCK) == -1) {
+            strcpy(message, LOCK_BUSY_MESSAGE);
+            goto unlock; // Releasing ranges we never got is harmless
+        }
+    }
+
+    // --- Step 3: Read and validate under the locks ---
+    IoBatch reads;
+    io_batch_init(&reads);
+    int read_status = 0;
+    for (int i = 0; i <= count && read_status == 0; i++) {
+        read_status = io_batch_read(&reads, fds[shards[i]], &accounts[i], sizeof(Account), record_offset(recs[i], sizeof(Account)));
+    }
+    if (read_status == 0) read_status = io_batch_submit(&reads, 0);
+    io_batch_free(&reads);
+    if (read_status != 0) {
+        strcpy(message, "Error: Failed to read account data.\n");
+        goto unlock;
+    }
+    for (int i = 0; i <= count; i++) {
+        if (accounts[i].accountId != ids[i]) { // The compactor moved it before we locked it
+            strcpy(message, LOCK_BUSY_MESSAGE);
+            goto unlock;
+        }
+    }
+    if (accounts[0].balance < total) {
+        if (single) strcpy(message, "Insufficient funds.\n");
+        else sprintf(message, "Insufficient funds. Batch total is ₹%.2f.\n", total);
+        goto unlock;
+    }
+    for (int i = 1; i <= count; i++) {
+        if (!accounts[i].isActive) {
+            if (single) strcpy(message, "Error: The recipient's account is deactivated.\n");
+            else sprintf(message, "Error: Recipient account %s is deactivated.\n", accounts[i].accountNumber);
+            goto unlock;
+        }
+    }
+
+    // --- Step 4: Work out every balance; duplicates share one record ---
+    memcpy(before, accounts, (count + 1) * sizeof(Account));
+    int txn_count = 0;
+    double sender_balance = accounts[0].balance;
+    for (int i = 1; i <= count; i++) {
+        long first = i;
+        if (intmap_get(&first_slot, ids[i], &first) == 0) intmap_put(&first_slot, ids[i], i);
+        Account* receiver = &accounts[first];
+        sender_balance -= credits[i - 1].amount;
+        receiver->balance += credits[i - 1].amount;
+        credited[first] += credits[i - 1].amount;
+
+        Transaction* out = &txns[txn_count++];
+        out->accountId = accounts[0].accountId;
+        out->userId = accounts[0].ownerUserId;
+        out->type = TRANSFER_OUT;
+        out->amount = credits[i - 1].amount;
+        out->newBalance = sender_balance;
+        strcpy(out->otherPartyAccountNumber, receiver->accountNumber);
+
+        Transaction* in = &txns[txn_count++];
+        in->accountId = receiver->accountId;
+        in->userId = receiver->ownerUserId;
+        in->type = TRANSFER_IN;
+        in->amount = credits[i - 1].amount;
+        in->newBalance = receiver->balance;
+        strcpy(in->otherPartyAccountNumber, accounts[0].accountNumber);
+    }
+    accounts[0].balance = sender_balance;
+
+    // The sender's shard coordinates
+    int coordinator = shards[0];
+    TransferLog log_entry;
+    log_entry.transferId = 0;
+    log_entry.fromAccountId = fromAccountId;
+    log_entry.toAccountId = single ? credits[0].toAccountId : BATCH_TRANSFER_TARGET;
+    log_entry.amount = total;
+    log_entry.status = LOG_START;
+
+    // The slots written before the decision, duplicates once: the debit and
+    // every credit on the sender's shard. Each gets a LOG_UNDO.
+    int touched_count = 0, remote = 0;
+    for (int i = 0; i <= count; i++) {
+        long first;
+        if (i > 0 && intmap_get(&first_slot, ids[i], &first) && first != i) continue;
+        if (shards[i] == coordinator) touched[touched_count++] = i;
+        else remote = 1;
+    }
+
+    // --- Step 5: One shard only: the whole group is one linked chain ---
+    if (!remote) {
+        int chain = run_transfer_chain(coordinator, fds[coordinator], &log_entry, group, recs, accounts, before, touched, touched_count);
+        if (chain != 0) {
+            sprintf(fatal, chain == -2 ? "FATAL: %s write failed; it was undone.\n" : "FATAL: %s could not be logged.\n", kind);
+            write_string(STDOUT_FILENO, fatal);
+            strcpy(message, "Transfer failed. Please check logs or try again.\n");
+            goto unlock;
+        }
+        result = 0;
+        goto unlock;
+    }
+
+    // --- Step 6: Log intent, only once the transfer can apply ---
+    // The START and its LOG_UNDO entries go out in one append, and each
+    // remote recipient is prepared in its own shard's log, before any money
+    // moves.
+    group[0] = log_entry;
+    fill_undo_entries(&group[1], &log_entry, before, touched, touched_count);
+    append_transfer_log(coordinator, group, touched_count + 1);
+    log_entry.transferId = group[0].transferId;
+
+    TransferLog participant = log_entry;
+    participant.status = LOG_PREPARED;
+    for (int i = 1; i <= count; i++) {
+        long first;
+        if (shards[i] == coordinator || (intmap_get(&first_slot, ids[i], &first) && first != i)) continue;
+        participant.toAccountId = ids[i];
+        participant.amount = credited[i];
+        write_transfer_log(shards[i], &participant);
+    }
+
+    // --- Step 7: Debit and the sender-shard credits ---
+    // A failed write may still have landed part of the record, so it is
+    // undone along with everything written before it.
+    for (int t = 0; t < touched_count; t++) {
+        int i = touched[t];
+        if (write_account_record(fds[shards[i]], recs[i], &accounts[i]) == 0) continue;
+
+        sprintf(fatal, "FATAL: %s %s write failed; undoing it.\n", kind, i == 0 ? "debit" : "credit");
+        write_string(STDOUT_FILENO, fatal);
+        if (undo_account_writes(fds, shards, recs, before, touched, t + 1) > 0) {
+            sprintf(fatal, "FATAL: %s could not be fully undone; run reconcile.\n", kind);
+            write_string(STDOUT_FILENO, fatal);
+        }
+        // Close the group so recovery neither refunds the sender nor applies a credit
+        log_entry.status = LOG_ABORT;
+        write_transfer_log(coordinator, &log_entry);
+        participant.status = LOG_ABORT;
+        for (int j = 1; j <= count; j++) {
+            long first;
+            if (shards[j] == coordinator || (intmap_get(&first_slot, ids[j], &first) && first != j)) continue;
+            participant.toAccountId = ids[j];
+            participant.amount = credited[j];
+            write_transfer_log(shards[j], &participant);
+        }
+        strcpy(message, "Transfer failed. Please check logs or try again.\n");
+        goto unlock;
+    }
+
+    // --- Step 8: Decide, then credit the other shards ---
+    log_entry.status = LOG_COMMIT;
+    write_transfer_log(coordinator, &log_entry);
+    result = 0;
+    for (int i = 1; i <= count; i++) {
+        long first;
+        if (shards[i] == coordinator || (intmap_get(&first_slot, ids[i], &first) && first != i)) continue;
+        if (write_account_record(fds[shards[i]], recs[i], &accounts[i]) != 0) {
+            // Committed: the PREPARED stays open and recovery applies the credit
+            sprintf(fatal, "FATAL: %s credit to shard %d failed; recovery will apply it.\n", kind, shards[i]);
+            write_string(STDOUT_FILENO, fatal);
+            continue;
+        }
+        participant.toAccountId = ids[i];
+        participant.amount = credited[i];
+        participant.status = LOG_COMMIT;
+        write_transfer_log(shards[i], &participant);
+    }
+
+unlock:
+    unlock_records(fds, lock_order, lock_count);
+    for (int s = 0; s < MAX_ACCOUNT_SHARDS; s++) {
+        if (fds[s] != -1) close(fds[s]);
+    }
+
+    if (result == 0) {
+        log_transactions(txns, txn_count);
+        if (single) strcpy(message, "Transfer successful.\n");
+        else sprintf(message, "Batch transfer successful. ₹%.2f sent to %d recipients.\n", total, count);
+    }
+
+cleanup:
+    intmap_free(&first_slot);
+    free(ids); free(recs); free(shards); free(lock_order); free(accounts); free(before); free(touched); free(group); free(credited); free(txns);
+    return result;
+}
+
+int execute_transfer(int fromAccountId, int toAccountId, double amount, char* message) {
+    BatchCredit credit;
+    credit.toAccountId = toAccountId;
+    credit.amount = amount;
+    return run_transfer(fromAccountId, &credit, 1, 1, message);
+}
+
+int execute_batch_transfer(int fromAccountId, const BatchCredit* credits, int count, char* message) {
+    return run_transfer(fromAccountId, credits, count, 0, message);
 }
-// --- END ADDED ---
\ No newline at end of file
@@ -0,0 +1,298 @@
+// src/reconcile.c
+// Offline ledger reconciliation: verifies that every account balance in
+// accounts.dat matches the running total of its rows in transactions.dat
+// (sealed history included). Every account opens at zero (an opening deposit
+// is logged as a row), so the expected balance is the net of its rows alone.
+#include "common.h"
+#include "utils.h"
+#include "hashmap.h"
+#include "model.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX_RECONCILE_THREADS 64
+#define BALANCE_EPSILON 0.005
+
+// --- Per-Account Ledger Totals ---
+typedef struct {
+    int accountId;
+    int txnCount;
+    int firstTxnId;
+    double openingBalance; // Balance the first logged transaction started from; 0 if nothing is missing
+    int lastTxnId;
+    double lastBalance;    // newBalance of the latest logged transaction
+    double netAmount;      // Sum of signed transaction amounts
+} LedgerTotal;
+
+typedef struct {
+    IntMap index;          // accountId -> position in 'totals'
+    LedgerTotal* totals;
+    int count;
+    int capacity;
+} LedgerTable;
+
+typedef struct {
+    const Transaction* rows;
+    size_t start;
+    size_t end;
+    LedgerTable table;
+} ScanTask;
+
+// --- Ledger Table Helpers ---
+
+static double signed_amount(const Transaction* txn) {
+    switch (txn->type) {
+        case DEPOSIT:
+        case TRANSFER_IN: return txn->amount;
+        case WITHDRAWAL:
+        case TRANSFER_OUT: return -txn->amount;
+        default: return 0.0;
+    }
+}
+
+static int ledger_init(LedgerTable* table) {
+    table->count = 0;
+    table->capacity = 1024;
+    table->totals = (LedgerTotal*)malloc(table->capacity * sizeof(LedgerTotal));
+    if (table->totals == NULL) return -1;
+    return intmap_init(&table->index, table->capacity);
+}
+
+static void ledger_free(LedgerTable* table) {
+    free(table->totals);
+    intmap_free(&table->index);
+}
+
+static LedgerTotal* ledger_slot(LedgerTable* table, int accountId) {
+    long pos;
+    if (intmap_get(&table->index, accountId, &pos)) return &table->totals[pos];
+
+    if (table->count == table->capacity) {
+        LedgerTotal* bigger = (LedgerTotal*)realloc(table->totals, table->capacity * 2 * sizeof(LedgerTotal));
+        if (bigger == NULL) return NULL;
+        table->totals = bigger;
+        table->capacity *= 2;
+    }
+    LedgerTotal* slot = &table->totals[table->count];
+    memset(slot, 0, sizeof(LedgerTotal));
+    slot->accountId = accountId;
+    if (intmap_put(&table->index, accountId, table->count) == -1) return NULL;
+    table->count++;
+    return slot;
+}
+
+static int ledger_merge(LedgerTable* into, const LedgerTotal* part) {
+    LedgerTotal* slot = ledger_slot(into, part->accountId);
+    if (slot == NULL) return -1;
+    if (slot->txnCount == 0 || part->firstTxnId < slot->firstTxnId) {
+        slot->firstTxnId = part->firstTxnId;
+        slot->openingBalance = part->openingBalance;
+    }
+    if (slot->txnCount == 0 || part->lastTxnId > slot->lastTxnId) {
+        slot->lastTxnId = part->lastTxnId;
+        slot->lastBalance = part->lastBalance;
+    }
+    slot->netAmount += part->netAmount;
+    slot->txnCount += part->txnCount;
+    return 0;
+}
+
+// --- Worker Thread ---
+
+static void* scan_worker(void* arg) {
+    ScanTask* task = (ScanTask*)arg;
+    LedgerTable* table = &task->table;
+
+    for (size_t i = task->start; i < task->end; i++) {
+        const Transaction* txn = &task->rows[i];
+        LedgerTotal* slot = ledger_slot(table, txn->accountId);
+        if (slot == NULL) return (void*)-1;
+
+        double delta = signed_amount(txn);
+        if (slot->txnCount == 0 || txn->transactionId < slot->firstTxnId) {
+            slot->firstTxnId = txn->transactionId;
+            slot->openingBalance = txn->newBalance - delta;
+        }
+        if (slot->txnCount == 0 || txn->transactionId > slot->lastTxnId) {
+            slot->lastTxnId = txn->transactionId;
+            slot->lastBalance = txn->newBalance;
+        }
+        slot->netAmount += delta;
+        slot->txnCount++;
+    }
+    return NULL;
+}
+
+// --- Main ---
+
+int main(int argc, char* argv[]) {
+    char buffer[256];
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 1) thread_count = atoi(argv[1]);
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > MAX_RECONCILE_THREADS) thread_count = MAX_RECONCILE_THREADS;
+
+    if (data_files_need_headers()) {
+        write_string(STDOUT_FILENO, DAT_HEADERS_NEEDED_MESSAGE);
+        return 1;
+    }
+
+    // Every account shard is checked against the one shared ledger
+    int shard_count = account_shard_count();
+    int fd_accts[MAX_ACCOUNT_SHARDS];
+    for (int shard = 0; shard < shard_count; shard++) {
+        fd_accts[shard] = open_account_shard(shard, O_RDONLY);
+        if (fd_accts[shard] == -1) { perror("open account file"); return 1; }
+    }
+    int fd_txn = open(TRANSACTION_FILE, O_RDONLY);
+    if (fd_txn == -1) { perror("open transaction file"); return 1; }
+
+    // Lock order matches the server (account before transaction file), so a
+    // handler holding an account record while logging cannot deadlock with us.
+    for (int shard = 0; shard < shard_count; shard++) set_file_lock(fd_accts[shard], F_RDLCK);
+    set_file_lock(fd_txn, F_RDLCK);
+
+    struct stat st;
+    if (fstat(fd_txn, &st) == -1) { perror("fstat transaction file"); return 1; }
+    size_t row_count = record_count(st.st_size, sizeof(Transaction));
+    size_t map_size = record_offset(row_count, sizeof(Transaction));
+
+    char* map = NULL;
+    const Transaction* rows = NULL;
+    if (row_count > 0) {
+        // Writable but private: sealed blocks are decoded over the rows they replaced
+        map = (char*)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_txn, 0);
+        if (map == MAP_FAILED) { perror("mmap transaction file"); return 1; }
+        madvise(map, map_size, MADV_SEQUENTIAL);
+        rows = (const Transaction*)(map + DAT_HEADER_SIZE);
+        int sealed = sealed_transaction_blocks();
+        for (int block = 0; block < sealed && (size_t)(block + 1) * TXN_BLOCK_ROWS <= row_count; block++) {
+            if (read_transaction_block(block, (Transaction*)rows + (size_t)block * TXN_BLOCK_ROWS) == -1) {
+                sprintf(buffer, "ERROR: Sealed transaction block %d is unreadable.\n", block);
+                write_string(STDOUT_FILENO, buffer);
+                return 1;
+            }
+        }
+    }
+    if ((size_t)thread_count > row_count && row_count > 0) thread_count = row_count;
+
+    // --- Step 1: Aggregate the transaction log in parallel ---
+    ScanTask tasks[MAX_RECONCILE_THREADS];
+    pthread_t threads[MAX_RECONCILE_THREADS];
+    size_t chunk = (row_count + thread_count - 1) / thread_count;
+    for (long t = 0; t < thread_count; t++) {
+        tasks[t].rows = rows;
+        tasks[t].start = t * chunk;
+        tasks[t].end = (t + 1) * chunk < row_count ? (t + 1) * chunk : row_count;
+        if (tasks[t].start > tasks[t].end) tasks[t].start = tasks[t].end;
+        if (ledger_init(&tasks[t].table) == -1) { write_string(STDOUT_FILENO, "Out of memory.\n"); return 1; }
+        if (pthread_create(&threads[t], NULL, scan_worker, &tasks[t]) != 0) {
+            perror("pthread_create"); return 1;
+        }
+    }
+
+    LedgerTable ledger;
+    if (ledger_init(&ledger) == -1) { write_string(STDOUT_FILENO, "Out of memory.\n"); return 1; }
+    int failed = 0;
+    for (long t = 0; t < thread_count; t++) {
+        void* status;
+        pthread_join(threads[t], &status);
+        if (status != NULL) failed = 1;
+        for (int i = 0; i < tasks[t].table.count && !failed; i++) {
+            if (ledger_merge(&ledger, &tasks[t].table.totals[i]) == -1) failed = 1;
+        }
+        ledger_free(&tasks[t].table);
+    }
+    if (failed) { write_string(STDOUT_FILENO, "Out of memory while aggregating ledger.\n"); return 1; }
+
+    // --- Step 2: Compare every account against its ledger total ---
+    Account account;
+    int accounts_checked = 0, accounts_without_history = 0, mismatches = 0;
+    IntMap seen;
+    intmap_init(&seen, ledger.count);
+
+    for (int shard = 0; shard < shard_count; shard++) {
+        lseek(fd_accts[shard], DAT_HEADER_SIZE, SEEK_SET);
+        while (read(fd_accts[shard], &account, sizeof(Account)) == sizeof(Account)) {
+            if (account.accountId == FREE_SLOT_ID) continue;
+            accounts_checked++;
+            long pos;
+            if (!intmap_get(&ledger.index, account.accountId, &pos)) {
+                accounts_without_history++;
+                if (account.balance > BALANCE_EPSILON || account.balance < -BALANCE_EPSILON) {
+                    // Money that no row accounts for
+                    mismatches++;
+                    sprintf(buffer, "MISMATCH %s (ID %d): balance ₹%.2f with no transactions\n",
+                        account.accountNumber, account.accountId, account.balance);
+                    write_string(STDOUT_FILENO, buffer);
+                }
+                continue;
+            }
+            intmap_put(&seen, account.accountId, 1);
+            LedgerTotal* total = &ledger.totals[pos];
+            double expected = total->netAmount;
+
+            if (expected - account.balance > BALANCE_EPSILON || account.balance - expected > BALANCE_EPSILON) {
+                mismatches++;
+                sprintf(buffer, "MISMATCH %s (ID %d): balance ₹%.2f, ledger expects ₹%.2f (%d txns, diff ₹%.2f)\n",
+                    account.accountNumber, account.accountId, account.balance, expected,
+                    total->txnCount, account.balance - expected);
+                write_string(STDOUT_FILENO, buffer);
+            } else if (total->openingBalance > BALANCE_EPSILON || total->openingBalance < -BALANCE_EPSILON) {
+                // The net agrees only because later rows cancel out a change no row recorded
+                mismatches++;
+                sprintf(buffer, "MISMATCH %s (ID %d): first logged row (TXN %d) starts from ₹%.2f, not ₹0.00\n",
+                    account.accountNumber, account.accountId, total->firstTxnId, total->openingBalance);
+                write_string(STDOUT_FILENO, buffer);
+            } else if (total->lastBalance - account.balance > BALANCE_EPSILON || account.balance - total->lastBalance > BALANCE_EPSILON) {
+                // Totals agree but the recorded running balance does not: a row was lost or reordered
+                mismatches++;
+                sprintf(buffer, "MISMATCH %s (ID %d): last logged balance ₹%.2f (TXN %d) != balance ₹%.2f\n",
+                    account.accountNumber, account.accountId, total->lastBalance, total->lastTxnId, account.balance);
+                write_string(STDOUT_FILENO, buffer);
+            }
+        }
+    }
+
+    // Transactions that reference accounts missing from every account file.
+    // A removed account had to be emptied first, so a ledger that settles at
+    // zero belongs to a closed account.
+    int orphans = 0, closed = 0;
+    for (int i = 0; i < ledger.count; i++) {
+        if (!intmap_get(&seen, ledger.totals[i].accountId, NULL)) {
+            LedgerTotal* total = &ledger.totals[i];
+            double expected = total->netAmount;
+            if (expected < BALANCE_EPSILON && expected > -BALANCE_EPSILON &&
+                total->lastBalance < BALANCE_EPSILON && total->lastBalance > -BALANCE_EPSILON) {
+                closed++;
+                continue;
+            }
+            orphans++;
+            sprintf(buffer, "ORPHAN: %d transactions for unknown account ID %d\n",
+                ledger.totals[i].txnCount, ledger.totals[i].accountId);
+            write_string(STDOUT_FILENO, buffer);
+        }
+    }
+
+    set_file_lock(fd_txn, F_UNLCK);
+    if (map != NULL) munmap(map, map_size);
+    close(fd_txn);
+    for (int shard = 0; shard < shard_count; shard++) {
+        set_file_lock(fd_accts[shard], F_UNLCK);
+        close(fd_accts[shard]);
+    }
+
+    sprintf(buffer, "\nReconciled %zu transactions across %d accounts using %ld threads.\n",
+        row_count, accounts_checked, thread_count);
+    write_string(STDOUT_FILENO, buffer);
+    sprintf(buffer, "Mismatches: %d | Orphaned accounts: %d | Closed accounts: %d | Accounts without history: %d\n",
+        mismatches, orphans, closed, accounts_without_history);
+    write_string(STDOUT_FILENO, buffer);
+    if (mismatches > 0) {
+        write_string(STDOUT_FILENO, "Note: run while the server is idle; an in-flight deposit can appear as a transient mismatch.\n");
+    }
+
+    intmap_free(&seen);
+    ledger_free(&ledger);
+    return (mismatches > 0 || orphans > 0) ? 2 : 0;
+}
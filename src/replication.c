@@ -0,0 +1,409 @@
+// src/replication.c
+#include "replication.h"
+#include "model.h"
+#include "utils.h"
+#include <sys/un.h>
+#include <sys/stat.h>
+
+// --- Change Stream ---
+// Every change travels as a ReplicationHeader followed by 'size' bytes. The
+// primary appends these frames to one in-memory ring, and each standby's
+// shipper thread sends the ring's bytes unchanged, so the ring is already
+// the wire format.
+typedef enum {
+    REPL_WRITE,  // 'size' bytes written at 'offset' in 'path'
+    REPL_FILE,   // The whole of 'path' ('size' bytes; -1 if it does not exist)
+    REPL_SYNCED  // The base copy is complete
+} ReplicationFrameType;
+
+typedef struct {
+    int type;
+    char path[64];
+    off_t offset;
+    off_t size;
+} ReplicationHeader;
+
+#define REPLICATION_RING_BYTES (16 * 1024 * 1024)
+#define SHIP_CHUNK (64 * 1024)
+
+static char* ring = NULL;
+static long long ring_head = 0; // Bytes ever appended; a standby's position is an offset into this
+static int standbys = 0;
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_grew = PTHREAD_COND_INITIALIZER;
+static int read_only = 0;
+
+static int send_all(int sock, const void* data, size_t size) {
+    const char* next = (const char*)data;
+    while (size > 0) {
+        ssize_t sent = send(sock, next, size, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR) continue;
+        if (sent <= 0) return -1;
+        next += sent;
+        size -= sent;
+    }
+    return 0;
+}
+
+static int recv_all(int sock, void* data, size_t size) {
+    char* next = (char*)data;
+    while (size > 0) {
+        ssize_t got = recv(sock, next, size, 0);
+        if (got == -1 && errno == EINTR) continue;
+        if (got <= 0) return -1;
+        next += got;
+        size -= got;
+    }
+    return 0;
+}
+
+// --- Primary: Change Ring (caller holds ring_mutex) ---
+
+static void ring_put(const void* data, size_t size) {
+    // A frame bigger than the ring overruns every standby, which then recopies
+    if (size <= REPLICATION_RING_BYTES) {
+        size_t start = ring_head % REPLICATION_RING_BYTES;
+        size_t first = size < REPLICATION_RING_BYTES - start ? size : REPLICATION_RING_BYTES - start;
+        memcpy(ring + start, data, first);
+        memcpy(ring, (const char*)data + first, size - first);
+    }
+    ring_head += size;
+}
+
+static void ring_get(long long position, char* out, size_t size) {
+    size_t start = position % REPLICATION_RING_BYTES;
+    size_t first = size < REPLICATION_RING_BYTES - start ? size : REPLICATION_RING_BYTES - start;
+    memcpy(out, ring + start, first);
+    memcpy(out + first, ring, size - first);
+}
+
+// The model's replication hook. With no standby attached nothing is kept:
+// one that attaches later copies the files after this write reached them.
+static void publish_write(const char* path, off_t offset, const void* data, size_t size) {
+    ReplicationHeader header;
+    memset(&header, 0, sizeof(header));
+    header.type = REPL_WRITE;
+    strncpy(header.path, path, sizeof(header.path) - 1);
+    header.offset = offset;
+    header.size = size;
+
+    pthread_mutex_lock(&ring_mutex);
+    if (standbys > 0) {
+        ring_put(&header, sizeof(header));
+        ring_put(data, size);
+        pthread_cond_broadcast(&ring_grew);
+    }
+    pthread_mutex_unlock(&ring_mutex);
+}
+
+// --- Primary: Shipping ---
+
+static int ship_file(int sock, const char* path, char* chunk) {
+    ReplicationHeader header;
+    memset(&header, 0, sizeof(header));
+    header.type = REPL_FILE;
+    strncpy(header.path, path, sizeof(header.path) - 1);
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+    header.size = (fd != -1 && fstat(fd, &info) == 0) ? info.st_size : -1;
+
+    int status = send_all(sock, &header, sizeof(header));
+    off_t sent = 0, length = header.size;
+    while (status == 0 && sent < header.size) {
+        size_t want = header.size - sent < SHIP_CHUNK ? header.size - sent : SHIP_CHUNK;
+        ssize_t got = sent < length ? pread(fd, chunk, want, sent) : 0;
+        if (got == -1) { status = -1; break; }
+        if (got == 0) {
+            // The compactor truncated the file mid-copy. The frame still owes
+            // 'size' bytes, so the rest goes as zeros and is cut off below.
+            if (length == header.size) length = sent;
+            memset(chunk, 0, want);
+            got = want;
+        }
+        status = send_all(sock, chunk, got);
+        sent += got;
+    }
+    if (status == 0 && length < header.size) {
+        ReplicationHeader truncate;
+        memset(&truncate, 0, sizeof(truncate));
+        truncate.type = REPL_WRITE; // Of no bytes: see replicate_truncate
+        strncpy(truncate.path, path, sizeof(truncate.path) - 1);
+        truncate.offset = length;
+        status = send_all(sock, &truncate, sizeof(truncate));
+    }
+    if (fd != -1) close(fd);
+    return status;
+}
+
+// Files are copied while clients keep writing. Every write that lands after
+// the stream position was taken is also in the ring, so the standby ends up
+// with the last image of each record either way.
+static int ship_base_copy(int sock, char* chunk) {
+    char path[64];
+    int shard_count = account_shard_count();
+    const char* fixed[] = { SHARD_CONFIG_FILE, USER_PROFILE_FILE, USER_FILE, LOAN_FILE, FEEDBACK_FILE,
+                            TRANSACTION_BLOCK_FILE, TRANSACTION_BLOCK_INDEX_FILE, TRANSACTION_FILE, TRANSACTION_INDEX_FILE };
+    for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+        if (ship_file(sock, fixed[i], chunk) == -1) return -1;
+    }
+    for (int shard = 0; shard < shard_count; shard++) {
+        account_file_path(shard, shard_count, path);
+        if (ship_file(sock, path, chunk) == -1) return -1;
+        transfer_log_path(shard, shard_count, path);
+        if (ship_file(sock, path, chunk) == -1) return -1;
+    }
+    ReplicationHeader synced;
+    memset(&synced, 0, sizeof(synced));
+    synced.type = REPL_SYNCED;
+    return send_all(sock, &synced, sizeof(synced));
+}
+
+static int standby_hung_up(int sock) {
+    char byte;
+    ssize_t got = recv(sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return got == 0 || (got == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+static void* ship_to_standby(void* arg) {
+    int sock = *(int*)arg;
+    free(arg);
+    char* chunk = (char*)malloc(SHIP_CHUNK);
+    int status = chunk == NULL ? -1 : 0;
+
+    pthread_mutex_lock(&ring_mutex);
+    standbys++;
+    pthread_mutex_unlock(&ring_mutex);
+    write_string(STDOUT_FILENO, "Standby attached. Sending it a copy of the data files...\n");
+
+    pthread_mutex_lock(&ring_mutex);
+    long long position = ring_head;
+    pthread_mutex_unlock(&ring_mutex);
+    if (status == 0) status = ship_base_copy(sock, chunk);
+
+    // Chunks may end mid-frame, so a standby the ring has lapped cannot be
+    // resynced in place: it is dropped, and re-attaches for a fresh copy
+    while (status == 0) {
+        pthread_mutex_lock(&ring_mutex);
+        while (ring_head == position && status == 0) {
+            struct timespec wake;
+            clock_gettime(CLOCK_REALTIME, &wake);
+            wake.tv_sec += 1;
+            if (pthread_cond_timedwait(&ring_grew, &ring_mutex, &wake) == ETIMEDOUT && standby_hung_up(sock)) status = -1;
+        }
+        if (status == 0 && ring_head - position > REPLICATION_RING_BYTES) {
+            write_string(STDOUT_FILENO, "Standby fell too far behind the change ring. Dropping it so it re-attaches.\n");
+            status = -1;
+        }
+        if (status == -1) { pthread_mutex_unlock(&ring_mutex); break; }
+        size_t size = ring_head - position < SHIP_CHUNK ? ring_head - position : SHIP_CHUNK;
+        ring_get(position, chunk, size);
+        pthread_mutex_unlock(&ring_mutex);
+        position += size;
+        status = send_all(sock, chunk, size);
+    }
+
+    pthread_mutex_lock(&ring_mutex);
+    standbys--;
+    pthread_mutex_unlock(&ring_mutex);
+    free(chunk);
+    close(sock);
+    write_string(STDOUT_FILENO, "Standby detached.\n");
+    return NULL;
+}
+
+static void* accept_standbys(void* arg) {
+    int listen_fd = *(int*)arg;
+    free(arg);
+    while (1) {
+        int sock = accept(listen_fd, NULL, NULL);
+        if (sock == -1) {
+            if (errno != EINTR) perror("accept standby");
+            continue;
+        }
+        int* sock_ptr = (int*)malloc(sizeof(int));
+        pthread_t thread_id;
+        if (sock_ptr == NULL) { close(sock); continue; }
+        *sock_ptr = sock;
+        if (pthread_create(&thread_id, NULL, ship_to_standby, sock_ptr) != 0) {
+            perror("pthread_create failed");
+            close(sock);
+            free(sock_ptr);
+        } else {
+            pthread_detach(thread_id);
+        }
+    }
+    return NULL;
+}
+
+int start_replication_source() {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, REPLICATION_SOCKET, sizeof(address.sun_path) - 1);
+
+    ring = (char*)malloc(REPLICATION_RING_BYTES);
+    int* fd_ptr = (int*)malloc(sizeof(int));
+    if (ring == NULL || fd_ptr == NULL) { free(fd_ptr); return -1; }
+    unlink(REPLICATION_SOCKET); // Left by a previous run; we hold PORT, so no primary owns it
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd == -1 || bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(listen_fd, 4) == -1) {
+        perror("replication socket");
+        if (listen_fd != -1) close(listen_fd);
+        free(fd_ptr);
+        return -1;
+    }
+
+    *fd_ptr = listen_fd;
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, accept_standbys, fd_ptr) != 0) {
+        close(listen_fd);
+        free(fd_ptr);
+        return -1;
+    }
+    pthread_detach(thread_id);
+    set_replication_hook(publish_write);
+    return 0;
+}
+
+// --- Standby: Applying the Stream ---
+
+// Only paths under data/ are written; anything else is a corrupt frame.
+static int valid_data_path(const char* path) {
+    return memchr(path, '\0', 64) != NULL && strncmp(path, "data/", 5) == 0 && strstr(path, "..") == NULL;
+}
+
+// One descriptor per file, dropped whenever a base copy replaces the file.
+#define MAX_STANDBY_FILES (2 * MAX_ACCOUNT_SHARDS + 10)
+static char open_paths[MAX_STANDBY_FILES][64];
+static int open_fds[MAX_STANDBY_FILES];
+static int open_count = 0;
+
+static int standby_fd(const char* path, int* cached) {
+    *cached = 1;
+    for (int i = 0; i < open_count; i++) {
+        if (my_strcmp(open_paths[i], path) == 0) return open_fds[i];
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1 || open_count == MAX_STANDBY_FILES) {
+        *cached = 0; // Table full: the caller closes it
+        return fd;
+    }
+    strcpy(open_paths[open_count], path);
+    open_fds[open_count++] = fd;
+    return fd;
+}
+
+static void forget_standby_fd(const char* path) {
+    for (int i = 0; i < open_count; i++) {
+        if (my_strcmp(open_paths[i], path) == 0) {
+            close(open_fds[i]);
+            open_count--;
+            strcpy(open_paths[i], open_paths[open_count]);
+            open_fds[i] = open_fds[open_count];
+            return;
+        }
+    }
+}
+
+// Rewrites a file in place rather than replacing it, so read-only sessions
+// holding it open keep seeing the current contents.
+static int apply_file(int sock, const ReplicationHeader* header, char* chunk) {
+    forget_standby_fd(header->path);
+    if (header->size < 0) {
+        if (unlink(header->path) == -1 && errno != ENOENT) return -1;
+        return 0;
+    }
+    int fd = open(header->path, O_WRONLY | O_CREAT, 0644);
+    if (fd == -1) { perror("open standby file"); return -1; }
+    int status = 0;
+    for (off_t done = 0; status == 0 && done < header->size; ) {
+        size_t want = header->size - done < SHIP_CHUNK ? header->size - done : SHIP_CHUNK;
+        status = recv_all(sock, chunk, want);
+        if (status == 0 && pwrite(fd, chunk, want, done) != (ssize_t)want) status = -1;
+        done += want;
+    }
+    if (status == 0 && ftruncate(fd, header->size) == -1) status = -1;
+    close(fd);
+    return status;
+}
+
+static int apply_write(int sock, const ReplicationHeader* header, char** buffer, size_t* capacity) {
+    if (header->size < 0 || header->offset < 0) return -1;
+    if ((size_t)header->size > *capacity) {
+        char* bigger = (char*)realloc(*buffer, header->size);
+        if (bigger == NULL) return -1;
+        *buffer = bigger;
+        *capacity = header->size;
+    }
+    if (recv_all(sock, *buffer, header->size) == -1) return -1;
+    int cached;
+    int fd = standby_fd(header->path, &cached);
+    if (fd == -1) { perror("open standby file"); return -1; }
+    int status = apply_replicated_write(fd, header->path, header->offset, *buffer, header->size);
+    if (!cached) close(fd);
+    return status;
+}
+
+// Applies frames until the base copy is complete (returns 0) or the stream
+// ends (returns -1).
+static int apply_frames(int sock) {
+    ReplicationHeader header;
+    char* chunk = (char*)malloc(SHIP_CHUNK);
+    size_t capacity = SHIP_CHUNK;
+    int status = chunk == NULL ? -1 : 0;
+    while (status == 0) {
+        if (recv_all(sock, &header, sizeof(header)) == -1) { status = -1; break; }
+        if (header.type == REPL_SYNCED) break;
+        if (!valid_data_path(header.path)) {
+            write_string(STDOUT_FILENO, "ERROR: The primary sent a change for an unknown file.\n");
+            status = -1;
+        } else if (header.type == REPL_FILE) {
+            status = apply_file(sock, &header, chunk);
+        } else {
+            status = apply_write(sock, &header, &chunk, &capacity);
+        }
+    }
+    free(chunk);
+    return status;
+}
+
+int attach_to_primary(const char* socket_path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1) return -1;
+    if (connect(sock, (struct sockaddr*)&address, sizeof(address)) == -1) {
+        close(sock);
+        return -1;
+    }
+    if (mkdir("data", 0755) == -1 && errno != EEXIST) {
+        perror("mkdir data");
+        close(sock);
+        return -1;
+    }
+    __atomic_store_n(&read_only, 1, __ATOMIC_RELEASE);
+    write_string(STDOUT_FILENO, "Attached to the primary. Copying its data files...\n");
+    if (apply_frames(sock) == -1) {
+        write_string(STDOUT_FILENO, "ERROR: The primary went away during the copy.\n");
+        close(sock);
+        return -1;
+    }
+    write_string(STDOUT_FILENO, "Standby copy is in sync. Following the primary's changes.\n");
+    return sock;
+}
+
+void follow_primary_stream(int primary_socket) {
+    apply_frames(primary_socket); // Only one REPL_SYNCED is ever sent
+    close(primary_socket);
+}
+
+int standby_read_only() {
+    return __atomic_load_n(&read_only, __ATOMIC_ACQUIRE);
+}
+
+void promote_standby() {
+    __atomic_store_n(&read_only, 0, __ATOMIC_RELEASE);
+}
@@ -3,54 +3,475 @@
 #include "controller.h" // For handle_client
 #include "utils.h"      // For write_string
 #include "model.h"      // --- ADDED: For recovery check ---
+#include "loan_index.h" // Pending-loan queue is rebuilt at startup
+#include "feedback_index.h"
+#include "account_index.h"
+#include "customer_search.h"
+#include "session.h"      // Session token lifetime and idle reaper
+#include "worker.h"       // ./server --workers N
+#include "replication.h"  // ./server --standby DIR
+#include "uring.h"        // Batched transfer I/O
+#include "coroutine.h"    // Session threads
+#include <signal.h>
+#include <limits.h>
+#include <sys/stat.h>
 
-// --- Main Server Setup (Threaded) ---
-int main() {
-    int server_fd, new_socket;
+#define DEFAULT_LOCK_TIMEOUT_MS 2000
+#define DEFAULT_STATS_INTERVAL_S 60
+
+static int idle_timeout_s = DEFAULT_IDLE_TIMEOUT_S;
+static int session_threads = DEFAULT_SESSION_THREADS;
+static int seal_interval_s = DEFAULT_SEAL_INTERVAL_S;
+static int compact_interval_s = DEFAULT_COMPACT_INTERVAL_S;
+static int stats_interval_s = DEFAULT_STATS_INTERVAL_S;
+
+// --- Listening Socket ---
+// Worker processes each bind their own socket with SO_REUSEPORT; the kernel
+// then spreads incoming connections across them. SO_REUSEADDR lets a
+// restarted server, or a standby taking over, bind past connections still in
+// TIME_WAIT; it never lets two servers listen on one port. Returns -1, with
+// errno set, if the port is taken.
+static int open_listener(int port, int reuse_port, int do_listen) {
+    int server_fd;
     struct sockaddr_in address;
-    int addrlen = sizeof(address);
-    pthread_t thread_id;
+    int one = 1;
 
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
         perror("socket failed"); exit(EXIT_FAILURE);
     }
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1) {
+        perror("setsockopt SO_REUSEADDR"); exit(EXIT_FAILURE);
+    }
+    if (reuse_port && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) {
+        perror("setsockopt SO_REUSEPORT"); exit(EXIT_FAILURE);
+    }
 
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    address.sin_port = htons(port);
 
     if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
-        perror("bind failed"); exit(EXIT_FAILURE);
+        int bind_errno = errno;
+        close(server_fd);
+        errno = bind_errno;
+        return -1;
     }
 
-    if (listen(server_fd, 3) < 0) {
+    if (do_listen && listen(server_fd, SOMAXCONN) < 0) {
         perror("listen"); exit(EXIT_FAILURE);
     }
+    return server_fd;
+}
 
-    // --- MODIFIED: Run recovery check before listening ---
-    write_string(STDOUT_FILENO, "Server starting... running crash recovery check...\n");
-    perform_recovery_check();
-    write_string(STDOUT_FILENO, "Recovery complete. Server listening on port 8080 (Threaded Mode)...\n");
-    // --- END MODIFIED ---
+// --- Per-Process Startup ---
+// The in-memory indexes and the idle reaper belong to the process serving
+// the sessions, so a worker builds its own after the fork.
+static void build_indexes() {
+    if (loan_queue_init() == -1 || workload_init() == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Could not build the loan assignment indexes.\n");
+    }
+    if (feedback_index_init() == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Could not build the feedback indexes.\n");
+    }
+    if (account_index_init() == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Could not build the account number index.\n");
+    }
+    // Only staff search customers, so only the process serving them pays for it
+    if ((worker_index() == -1 || worker_index() == STAFF_WORKER) && customer_search_init() == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Could not build the customer search index.\n");
+    }
+}
+
+// Lookups of IDs that do not exist are answered from memory
+static void start_id_filters() {
+    if (init_id_filters() == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Could not build the ID filters; every failed lookup scans.\n");
+    }
+}
+
+static void start_reaper() {
+    if (start_idle_reaper(idle_timeout_s) == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Could not start the idle reaper; idle connections stay open.\n");
+    }
+}
+
+static void start_sessions() {
+    if (start_session_threads(session_threads) == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Could not start the session threads.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Packs old transaction history into compressed blocks. Only one process
+// needs to: the primary, or worker 0 in --workers mode.
+static void* sealer_loop(void* arg) {
+    char message[100];
+    while (1) {
+        int sealed = seal_transaction_history();
+        if (sealed > 0) {
+            sprintf(message, "Sealed %d block(s) of transaction history.\n", sealed);
+            write_string(STDOUT_FILENO, message);
+        }
+        sleep(seal_interval_s);
+    }
+    return NULL;
+}
+
+static void start_sealer() {
+    pthread_t thread_id;
+    if (seal_interval_s <= 0) return;
+    if (pthread_create(&thread_id, NULL, sealer_loop, NULL) != 0) {
+        write_string(STDOUT_FILENO, "ERROR: Could not start the history sealer; history stays unsealed.\n");
+        return;
+    }
+    pthread_detach(thread_id);
+}
+
+static void* compactor_loop(void* arg) {
+    char message[100];
+    while (1) {
+        sleep(compact_interval_s);
+        int reclaimed = compact_record_files();
+        if (reclaimed > 0) {
+            sprintf(message, "Compaction reclaimed %d record slot(s).\n", reclaimed);
+            write_string(STDOUT_FILENO, message);
+        } else if (reclaimed == -1) {
+            write_string(STDOUT_FILENO, "ERROR: Compaction failed; it will be retried.\n");
+        }
+    }
+    return NULL;
+}
+
+static void start_compactor() {
+    pthread_t thread_id;
+    if (compact_interval_s <= 0) return;
+    if (pthread_create(&thread_id, NULL, compactor_loop, NULL) != 0) {
+        write_string(STDOUT_FILENO, "ERROR: Could not start the compactor; freed slots are only reused.\n");
+        return;
+    }
+    pthread_detach(thread_id);
+}
+
+// Reports lock wait timeouts and reaped idle sessions once per interval,
+// and only when there were some, so a contended server logs one line a
+// minute rather than one per event. Each worker reports its own.
+static void* stats_loop(void* arg) {
+    char message[200], prefix[32] = "";
+    long last_timeouts = 0, last_reaped = 0;
+    if (worker_index() != -1) sprintf(prefix, "Worker %d: ", worker_index());
+    while (1) {
+        sleep(stats_interval_s);
+        long timeouts = get_lock_timeout_count();
+        long reaped = get_reaped_count();
+        if (timeouts == last_timeouts && reaped == last_reaped) continue;
+        sprintf(message, "%sLast %d s: %ld lock wait timeout(s), %ld idle connection(s) reaped (totals %ld, %ld).\n",
+            prefix, stats_interval_s, timeouts - last_timeouts, reaped - last_reaped, timeouts, reaped);
+        write_string(STDOUT_FILENO, message);
+        last_timeouts = timeouts;
+        last_reaped = reaped;
+    }
+    return NULL;
+}
+
+static void start_stats() {
+    pthread_t thread_id;
+    if (stats_interval_s <= 0) return;
+    if (pthread_create(&thread_id, NULL, stats_loop, NULL) != 0) {
+        write_string(STDOUT_FILENO, "ERROR: Could not start the stats reporter.\n");
+        return;
+    }
+    pthread_detach(thread_id);
+}
+
+static void start_serving() {
+    build_indexes();
+    start_reaper();
+    start_sessions();
+    start_stats();
+}
+
+// Returns only once the listening socket is shut down.
+static void accept_clients(int server_fd) {
+    int new_socket;
+    struct sockaddr_in address;
+    int addrlen = sizeof(address);
 
     while (1) {
         if ((new_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t*)&addrlen)) < 0) {
+            if (errno == EINVAL) return;
             perror("accept"); continue;
         }
 
         int* client_sock_ptr = (int*)malloc(sizeof(int));
         *client_sock_ptr = new_socket;
 
-        if (pthread_create(&thread_id, NULL, handle_client, (void*)client_sock_ptr) < 0) {
-            perror("pthread_create failed");
+        if (spawn_session(new_socket, handle_client, (void*)client_sock_ptr) == -1) {
+            perror("spawn_session failed");
             close(new_socket);
             free(client_sock_ptr);
         } else {
-            pthread_detach(thread_id);
-            write_string(STDOUT_FILENO, "New client connected, thread created.\n");
+            write_string(STDOUT_FILENO, session_thread_count() > 0 ? "New client connected.\n" : "New client connected, thread created.\n");
         }
     }
-    
+}
+
+static void* accept_clients_thread(void* server_fd_ptr) {
+    accept_clients(*(int*)server_fd_ptr);
+    close(*(int*)server_fd_ptr);
+    return NULL;
+}
+
+static void worker_main(int index) {
+    char message[100];
+    int server_fd = open_listener(PORT, 1, 1);
+    if (server_fd == -1) {
+        perror("bind failed"); exit(EXIT_FAILURE);
+    }
+    start_serving();
+    if (index == 0) {
+        start_sealer();
+        start_compactor();
+    }
+    if (start_worker_channel() == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Could not start the worker channel.\n");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(message, "Worker %d (pid %d) listening on port %d.\n", index, getpid(), PORT);
+    write_string(STDOUT_FILENO, message);
+    accept_clients(server_fd);
+}
+
+// --- Server Settings (environment) ---
+static void read_settings() {
+    // Client handlers wait at most this long for a record or file lock
+    // (0 = wait forever). The offline tools never set it and always wait.
+    int lock_timeout_ms = DEFAULT_LOCK_TIMEOUT_MS;
+    const char* timeout_env = getenv("BANK_LOCK_TIMEOUT_MS");
+    if (timeout_env != NULL) lock_timeout_ms = atoi(timeout_env);
+    set_lock_timeout(lock_timeout_ms);
+    char timeout_msg[100];
+    sprintf(timeout_msg, "Lock wait timeout: %d ms.\n", lock_timeout_ms);
+    write_string(STDOUT_FILENO, timeout_msg);
+
+    // Lock timeouts and reaped sessions are summed up this often (0 = never)
+    const char* stats_env = getenv("BANK_STATS_INTERVAL_S");
+    if (stats_env != NULL && atoi(stats_env) >= 0) stats_interval_s = atoi(stats_env);
+    if (stats_interval_s > 0) sprintf(timeout_msg, "Stats report: every %d s.\n", stats_interval_s);
+    else sprintf(timeout_msg, "Stats report: off.\n");
+    write_string(STDOUT_FILENO, timeout_msg);
+
+    // How long an unused session token stays valid for resuming
+    int session_ttl_s = DEFAULT_SESSION_TTL_S;
+    const char* ttl_env = getenv("BANK_SESSION_TTL_S");
+    if (ttl_env != NULL && atoi(ttl_env) > 0) session_ttl_s = atoi(ttl_env);
+    set_session_ttl(session_ttl_s);
+    sprintf(timeout_msg, "Session token lifetime: %d s.\n", session_ttl_s);
+    write_string(STDOUT_FILENO, timeout_msg);
+
+    // Connections idle at a prompt longer than this are closed (0 = never)
+    const char* idle_env = getenv("BANK_IDLE_TIMEOUT_S");
+    if (idle_env != NULL) idle_timeout_s = atoi(idle_env);
+    if (idle_timeout_s > 0) {
+        sprintf(timeout_msg, "Idle connection timeout: %d s.\n", idle_timeout_s);
+        write_string(STDOUT_FILENO, timeout_msg);
+    }
+
+    // Client dialogues are multiplexed over this many threads (0 = one
+    // thread per client)
+    const char* threads_env = getenv("BANK_SESSION_THREADS");
+    if (threads_env != NULL && atoi(threads_env) >= 0) session_threads = atoi(threads_env);
+    if (session_threads > MAX_SESSION_THREADS) session_threads = MAX_SESSION_THREADS;
+    if (session_threads > 0) sprintf(timeout_msg, "Session threads: %d.\n", session_threads);
+    else sprintf(timeout_msg, "Session threads: off (one thread per client).\n");
+    write_string(STDOUT_FILENO, timeout_msg);
+
+    // Transfers batch their record I/O through io_uring unless this is 0
+    const char* uring_env = getenv("BANK_IO_URING");
+    if (uring_env != NULL && atoi(uring_env) == 0) set_io_uring_enabled(0);
+    sprintf(timeout_msg, "Transfer I/O: %s.\n", io_uring_available() ? "io_uring" : "pread/pwrite");
+    write_string(STDOUT_FILENO, timeout_msg);
+
+    // Full blocks of old history are sealed this often (0 = never)
+    const char* seal_env = getenv("BANK_SEAL_INTERVAL_S");
+    if (seal_env != NULL && atoi(seal_env) >= 0) seal_interval_s = atoi(seal_env);
+    if (seal_interval_s > 0) sprintf(timeout_msg, "History sealing: every %d s.\n", seal_interval_s);
+    else sprintf(timeout_msg, "History sealing: off.\n");
+    write_string(STDOUT_FILENO, timeout_msg);
+
+    // Removed users' and accounts' slots are compacted away this often (0 = never)
+    const char* compact_env = getenv("BANK_COMPACT_INTERVAL_S");
+    if (compact_env != NULL && atoi(compact_env) >= 0) compact_interval_s = atoi(compact_env);
+    if (compact_interval_s > 0) sprintf(timeout_msg, "Record compaction: every %d s.\n", compact_interval_s);
+    else sprintf(timeout_msg, "Record compaction: off.\n");
+    write_string(STDOUT_FILENO, timeout_msg);
+}
+
+// Straight from the file headers, so a large store costs no scan.
+static void report_record_counts() {
+    char message[200], path[64];
+    int accounts = 0;
+    for (int shard = 0; shard < account_shard_count(); shard++) {
+        account_file_path(shard, account_shard_count(), path);
+        accounts += live_record_count(path);
+    }
+    sprintf(message, "Records: %d users, %d accounts, %d loans, %d feedback, %d transactions.\n",
+        live_record_count(USER_FILE), accounts, live_record_count(LOAN_FILE),
+        live_record_count(FEEDBACK_FILE), live_record_count(TRANSACTION_FILE));
+    write_string(STDOUT_FILENO, message);
+}
+
+// The primary feeds standbys; a failure here costs only the standby.
+static void start_primary(int server_fd) {
+    if (start_replication_source() == 0) {
+        write_string(STDOUT_FILENO, "Standbys can attach at " REPLICATION_SOCKET ".\n");
+    } else {
+        write_string(STDOUT_FILENO, "ERROR: Could not open " REPLICATION_SOCKET "; no standby can attach.\n");
+    }
+    start_sealer();
+    start_compactor();
+    write_string(STDOUT_FILENO, "Server listening on port 8080 (Threaded Mode)...\n");
+    accept_clients(server_fd);
+}
+
+// --- Hot Standby ---
+// Applies the primary's stream until it ends, then probes PORT. A primary
+// that is still listening keeps the port, so the standby re-attaches; once
+// the port is free the primary is gone and the standby returns the bound
+// socket to take over with.
+static int follow_primary(const char* socket_path, int primary) {
+    while (1) {
+        follow_primary_stream(primary);
+        write_string(STDOUT_FILENO, "Lost the primary's change stream.\n");
+        do {
+            int server_fd = open_listener(PORT, 0, 1);
+            if (server_fd != -1) return server_fd;
+            sleep(1);
+        } while ((primary = attach_to_primary(socket_path)) == -1);
+    }
+}
+
+static int run_standby(const char* dir) {
+    char here[PATH_MAX], there[PATH_MAX], socket_path[PATH_MAX + 32], message[PATH_MAX + 160];
+    if (getcwd(here, sizeof(here)) == NULL) {
+        perror("getcwd"); return 1;
+    }
+    if ((mkdir(dir, 0755) == -1 && errno != EEXIST) || realpath(dir, there) == NULL) {
+        perror("standby directory"); return 1;
+    }
+    if (my_strcmp(here, there) == 0) {
+        write_string(STDOUT_FILENO, "ERROR: The standby needs its own directory, not the primary's.\n");
+        return 1;
+    }
+    sprintf(socket_path, "%s/%s", here, REPLICATION_SOCKET);
+    if (chdir(there) == -1) {
+        perror("chdir"); return 1;
+    }
+
+    int primary = attach_to_primary(socket_path);
+    if (primary == -1) {
+        sprintf(message, "ERROR: Could not attach to a primary at %s. Start ./server there first.\n", socket_path);
+        write_string(STDOUT_FILENO, message);
+        return 1;
+    }
+
+    // Read-only sessions are served while the stream is applied
+    pthread_t thread_id;
+    int read_only_fd = open_listener(STANDBY_PORT, 0, 1);
+    if (read_only_fd == -1) {
+        perror("bind failed"); return 1;
+    }
+    start_id_filters(); // Catches up with the copy as lookups need it
+    start_reaper();
+    start_sessions();
+    if (pthread_create(&thread_id, NULL, accept_clients_thread, &read_only_fd) != 0) {
+        perror("pthread_create failed"); return 1;
+    }
+    pthread_detach(thread_id);
+    sprintf(message, "Standby serving read-only sessions on port %d.\n", STANDBY_PORT);
+    write_string(STDOUT_FILENO, message);
+
+    int server_fd = follow_primary(socket_path, primary);
+
+    // --- Takeover ---
+    write_string(STDOUT_FILENO, "The primary is gone. Taking over...\n");
+    init_record_locks();
+    perform_recovery_check();
+    build_indexes();
+    promote_standby();
+    shutdown(read_only_fd, SHUT_RDWR); // Frees STANDBY_PORT for the next standby
+    write_string(STDOUT_FILENO, "Recovery complete. This standby is now the primary.\n");
+    start_primary(server_fd);
+    return 0;
+}
+
+// --- Main Server Setup (Threaded, optionally one process per shard) ---
+int main(int argc, char* argv[]) {
+    int workers = 0;
+    const char* standby_dir = NULL;
+    if (argc == 3 && my_strcmp(argv[1], "--workers") == 0) {
+        workers = atoi(argv[2]);
+    } else if (argc == 3 && my_strcmp(argv[1], "--standby") == 0) {
+        standby_dir = argv[2];
+    }
+    if (argc != 1 && standby_dir == NULL && (workers < 1 || workers > MAX_ACCOUNT_SHARDS)) {
+        write_string(STDOUT_FILENO, "Usage: ./server [--workers N | --standby DIR]\n");
+        return 1;
+    }
+
+    // A client that vanishes mid-reply must cost us an EPIPE, not the process
+    signal(SIGPIPE, SIG_IGN);
+
+    // A standby touches only its own copy, so it skips the checks below
+    if (standby_dir != NULL) {
+        read_settings();
+        return run_standby(standby_dir);
+    }
+
+    // Single-process mode listens right away; worker mode only checks that
+    // the port is free, since each worker binds its own socket
+    int server_fd = open_listener(PORT, workers > 0, workers == 0);
+    if (server_fd == -1) {
+        perror("bind failed"); exit(EXIT_FAILURE);
+    }
+    if (workers > 0) close(server_fd);
+
+    if (user_store_needs_split()) {
+        write_string(STDOUT_FILENO, USER_SPLIT_NEEDED_MESSAGE);
+        return 1;
+    }
+    if (data_files_need_headers()) {
+        write_string(STDOUT_FILENO, DAT_HEADERS_NEEDED_MESSAGE);
+        return 1;
+    }
+
+    if (workers > 0 && workers != account_shard_count()) {
+        char message[160];
+        sprintf(message, "ERROR: Accounts are split into %d shard(s). Run ./migrate_data shard-accounts %d first.\n", account_shard_count(), workers);
+        write_string(STDOUT_FILENO, message);
+        return 1;
+    }
+
+    // --- MODIFIED: Run recovery check before listening ---
+    write_string(STDOUT_FILENO, "Server starting... running crash recovery check...\n");
+    init_record_locks(); // Shared with the workers, so it must precede the fork
+    perform_recovery_check();
+    write_string(STDOUT_FILENO, "Recovery complete.\n");
+    // --- END MODIFIED ---
+    report_record_counts();
+    start_id_filters(); // Also shared with the workers
+
+    read_settings();
+
+    if (workers > 0) {
+        char message[100];
+        sprintf(message, "Starting %d worker processes, one per account shard...\n", workers);
+        write_string(STDOUT_FILENO, message);
+        return run_workers(workers, worker_main) == 0 ? 0 : 1;
+    }
+
+    start_serving();
+    start_primary(server_fd);
+
     close(server_fd);
     return 0;
-}
\ No newline at end of file
+}
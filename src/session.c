@@ -0,0 +1,314 @@
+// src/session.c
+#include "session.h"
+#include "hashmap.h"
+#include "utils.h"
+#include <sys/random.h>
+
+// --- Active Sessions ---
+// 'active' maps userId -> the socket currently serving that user.
+static IntMap active;
+static int active_ready = 0;
+static pthread_mutex_t active_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int session_acquire(int userId, int client_socket, int take_over) {
+    int result = SESSION_OK;
+    long old_socket;
+    pthread_mutex_lock(&active_mutex);
+    if (!active_ready && intmap_init(&active, 64) == 0) active_ready = 1;
+    if (!active_ready) {
+        result = SESSION_SERVER_FULL;
+    } else if (intmap_get(&active, userId, &old_socket)) {
+        if (take_over) {
+            // Wake the stale handler; its read returns 0 and it exits
+            // without releasing a slot it no longer owns.
+            shutdown((int)old_socket, SHUT_RDWR);
+            intmap_put(&active, userId, client_socket);
+        } else {
+            result = SESSION_ALREADY_ACTIVE;
+        }
+    } else if (active.count >= MAX_SESSIONS || intmap_put(&active, userId, client_socket) == -1) {
+        result = SESSION_SERVER_FULL;
+    }
+    pthread_mutex_unlock(&active_mutex);
+    return result;
+}
+
+void session_release(int userId, int client_socket) {
+    long owner;
+    pthread_mutex_lock(&active_mutex);
+    if (active_ready && intmap_get(&active, userId, &owner) && owner == client_socket) {
+        intmap_remove(&active, userId);
+        write_string(STDOUT_FILENO, "Session removed.\n");
+    }
+    pthread_mutex_unlock(&active_mutex);
+}
+
+// --- Token Storage ---
+// 'by_key' maps the first 32 bits of a token to its entry, so a resume is
+// one hash lookup plus one string compare. Issuing rerolls a token whose
+// key is already taken. 'by_user' holds each user's single token.
+typedef struct {
+    char token[SESSION_TOKEN_LEN + 1];
+    int key;
+    User user;
+    time_t expires;
+} SessionToken;
+
+static IntMap by_key;
+static IntMap by_user;
+static int tokens_ready = 0;
+static int session_ttl_s = DEFAULT_SESSION_TTL_S;
+static int token_tag = -1;                      // First token byte when >= 0
+static void (*revoke_hook)(int userId) = NULL;
+static pthread_mutex_t token_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// --- Internal Helpers (caller holds token_mutex) ---
+
+static int ensure_tokens_ready() {
+    if (tokens_ready) return 0;
+    if (intmap_init(&by_key, 64) == -1) return -1;
+    if (intmap_init(&by_user, 64) == -1) { intmap_free(&by_key); return -1; }
+    tokens_ready = 1;
+    return 0;
+}
+
+static void drop_token(SessionToken* entry) {
+    intmap_remove(&by_key, entry->key);
+    intmap_remove(&by_user, entry->user.userId);
+    free(entry);
+}
+
+static int random_token(char* token, int* key) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned char bytes[SESSION_TOKEN_LEN / 2];
+    if (getrandom(bytes, sizeof(bytes), 0) != (ssize_t)sizeof(bytes)) return -1;
+    if (token_tag >= 0) bytes[0] = (unsigned char)token_tag;
+    for (int i = 0; i < (int)sizeof(bytes); i++) {
+        token[2 * i] = hex[bytes[i] >> 4];
+        token[2 * i + 1] = hex[bytes[i] & 0x0f];
+    }
+    token[SESSION_TOKEN_LEN] = '\0';
+    memcpy(key, bytes, sizeof(int));
+    return 0;
+}
+
+static int decode_token_bytes(const char* token, unsigned char* bytes, int count) {
+    for (int i = 0; i < count; i++) {
+        int hi = token[2 * i], lo = token[2 * i + 1];
+        hi = (hi >= 'a' && hi <= 'f') ? hi - 'a' + 10 : (hi >= '0' && hi <= '9') ? hi - '0' : -1;
+        lo = (lo >= 'a' && lo <= 'f') ? lo - 'a' + 10 : (lo >= '0' && lo <= '9') ? lo - '0' : -1;
+        if (hi == -1 || lo == -1) return -1;
+        bytes[i] = (unsigned char)(hi << 4 | lo);
+    }
+    return 0;
+}
+
+// --- Public Functions ---
+
+void set_session_ttl(int seconds) {
+    pthread_mutex_lock(&token_mutex);
+    session_ttl_s = seconds > 0 ? seconds : DEFAULT_SESSION_TTL_S;
+    pthread_mutex_unlock(&token_mutex);
+}
+
+// Replaces any earlier token of the same user. 'token_out' must hold
+// SESSION_TOKEN_LEN + 1 bytes. Returns 0 on success, -1 on failure.
+int session_token_issue(const User* user, char* token_out) {
+    int status = -1;
+    long existing;
+    pthread_mutex_lock(&token_mutex);
+    SessionToken* entry = (ensure_tokens_ready() == 0) ? (SessionToken*)malloc(sizeof(SessionToken)) : NULL;
+    if (entry != NULL) {
+        if (intmap_get(&by_user, user->userId, &existing)) drop_token((SessionToken*)existing);
+        int rolled;
+        while ((rolled = random_token(entry->token, &entry->key)) == 0 && intmap_get(&by_key, entry->key, NULL)) {}
+
+        if (rolled == 0) {
+            entry->user = *user;
+            entry->expires = time(NULL) + session_ttl_s;
+            if (intmap_put(&by_key, entry->key, (long)entry) == 0) {
+                if (intmap_put(&by_user, user->userId, (long)entry) == 0) status = 0;
+                else intmap_remove(&by_key, entry->key);
+            }
+        }
+        if (status == 0) memcpy(token_out, entry->token, SESSION_TOKEN_LEN + 1);
+        else free(entry);
+    }
+    pthread_mutex_unlock(&token_mutex);
+    return status;
+}
+
+// Returns 1 and fills 'out' if the token is live, extending its expiry;
+// returns 0 if it is unknown or has expired (an expired token is dropped).
+int session_token_resume(const char* token, User* out) {
+    int key;
+    long entry_ptr;
+    int resumed = 0;
+    int len = 0;
+    while (token[len] != '\0') len++;
+    if (len != SESSION_TOKEN_LEN) return 0;
+
+    // The lookup key is the token's first four bytes, decoded from hex
+    unsigned char bytes[sizeof(int)];
+    if (decode_token_bytes(token, bytes, sizeof(int)) == -1) return 0;
+    memcpy(&key, bytes, sizeof(int));
+
+    pthread_mutex_lock(&token_mutex);
+    if (tokens_ready && intmap_get(&by_key, key, &entry_ptr)) {
+        SessionToken* entry = (SessionToken*)entry_ptr;
+        time_t now = time(NULL);
+        if (my_strcmp(entry->token, token) != 0) {
+            // Same key, different token: not ours
+        } else if (entry->expires <= now) {
+            drop_token(entry);
+        } else {
+            entry->expires = now + session_ttl_s;
+            *out = entry->user;
+            resumed = 1;
+        }
+    }
+    pthread_mutex_unlock(&token_mutex);
+    return resumed;
+}
+
+void session_token_revoke(int userId) {
+    session_token_revoke_local(userId);
+    if (revoke_hook != NULL) revoke_hook(userId);
+}
+
+void session_token_revoke_local(int userId) {
+    long entry_ptr;
+    pthread_mutex_lock(&token_mutex);
+    if (tokens_ready && intmap_get(&by_user, userId, &entry_ptr)) drop_token((SessionToken*)entry_ptr);
+    pthread_mutex_unlock(&token_mutex);
+}
+
+void set_session_token_tag(int tag, void (*on_revoke)(int userId)) {
+    token_tag = tag;
+    revoke_hook = on_revoke;
+}
+
+// Returns the tag a token was issued under, or -1 if it is malformed.
+int session_token_tag(const char* token) {
+    unsigned char first;
+    int len = 0;
+    while (token[len] != '\0') len++;
+    if (len != SESSION_TOKEN_LEN || decode_token_bytes(token, &first, 1) == -1) return -1;
+    return first;
+}
+
+// --- Idle Reaper ---
+// Watches hang off a timer wheel of one-second slots, each in the slot of
+// the second it is next due. The reaper only inspects the slots whose
+// second has come; a watch whose client was busy or typed since it was
+// scheduled is simply moved to its new due slot, so handlers never take
+// the wheel lock to record activity.
+#define IDLE_WHEEL_SLOTS 64
+
+struct IdleWatch {
+    int socket;
+    time_t idle_since;  // Set by read_client_input; 0 while not waiting for input
+    time_t due;
+    int linked;
+    struct IdleWatch* prev;
+    struct IdleWatch* next;
+};
+
+static IdleWatch* wheel[IDLE_WHEEL_SLOTS];
+static int idle_timeout_s = 0;
+static long reaped_connections = 0;
+static pthread_mutex_t wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// --- Wheel Helpers (caller holds wheel_mutex) ---
+
+static void wheel_insert(IdleWatch* watch, time_t due) {
+    int slot = due % IDLE_WHEEL_SLOTS;
+    watch->due = due;
+    watch->prev = NULL;
+    watch->next = wheel[slot];
+    if (wheel[slot] != NULL) wheel[slot]->prev = watch;
+    wheel[slot] = watch;
+    watch->linked = 1;
+}
+
+static void wheel_remove(IdleWatch* watch) {
+    if (!watch->linked) return;
+    int slot = watch->due % IDLE_WHEEL_SLOTS;
+    if (watch->prev != NULL) watch->prev->next = watch->next; else wheel[slot] = watch->next;
+    if (watch->next != NULL) watch->next->prev = watch->prev;
+    watch->linked = 0;
+}
+
+static void expire_slot(time_t second, time_t now) {
+    IdleWatch* watch = wheel[second % IDLE_WHEEL_SLOTS];
+    while (watch != NULL) {
+        IdleWatch* next = watch->next;
+        if (watch->due <= now) {
+            time_t idle_since = __atomic_load_n(&watch->idle_since, __ATOMIC_RELAXED);
+            wheel_remove(watch);
+            if (idle_since != 0 && now - idle_since >= idle_timeout_s) {
+                // Still open: handlers unwatch before they close the socket
+                const char* notice = "\nSession closed after inactivity.\n";
+                send(watch->socket, notice, strlen(notice), MSG_DONTWAIT | MSG_NOSIGNAL);
+                shutdown(watch->socket, SHUT_RDWR);
+                __atomic_add_fetch(&reaped_connections, 1, __ATOMIC_RELAXED); // Reported by the stats line
+            } else {
+                wheel_insert(watch, (idle_since == 0 ? now : idle_since) + idle_timeout_s);
+            }
+        }
+        watch = next;
+    }
+}
+
+static void* reaper_loop(void* arg) {
+    time_t last = time(NULL);
+    while (1) {
+        sleep(1);
+        time_t now = time(NULL);
+        pthread_mutex_lock(&wheel_mutex);
+        // Catch up on every second that passed, but never lap the wheel twice
+        time_t from = (now - last > IDLE_WHEEL_SLOTS) ? now - IDLE_WHEEL_SLOTS : last;
+        for (time_t second = from + 1; second <= now; second++) expire_slot(second, now);
+        pthread_mutex_unlock(&wheel_mutex);
+        last = now;
+    }
+    return NULL;
+}
+
+// --- Public Functions ---
+
+int start_idle_reaper(int timeout_s) {
+    if (timeout_s <= 0) return 0;
+    idle_timeout_s = timeout_s;
+    pthread_t reaper;
+    if (pthread_create(&reaper, NULL, reaper_loop, NULL) != 0) { idle_timeout_s = 0; return -1; }
+    pthread_detach(reaper);
+    return 0;
+}
+
+// Registers the calling handler's socket. Returns NULL when reaping is off.
+IdleWatch* idle_watch(int client_socket) {
+    if (idle_timeout_s <= 0) return NULL;
+    IdleWatch* watch = (IdleWatch*)calloc(1, sizeof(IdleWatch));
+    if (watch == NULL) return NULL;
+    watch->socket = client_socket;
+    pthread_mutex_lock(&wheel_mutex);
+    wheel_insert(watch, time(NULL) + idle_timeout_s);
+    pthread_mutex_unlock(&wheel_mutex);
+    track_client_idle(&watch->idle_since);
+    return watch;
+}
+
+// Must run before the handler closes its socket.
+void idle_unwatch(IdleWatch* watch) {
+    if (watch == NULL) return;
+    track_client_idle(NULL);
+    pthread_mutex_lock(&wheel_mutex);
+    wheel_remove(watch);
+    pthread_mutex_unlock(&wheel_mutex);
+    free(watch);
+}
+
+long get_reaped_count() {
+    return __atomic_load_n(&reaped_connections, __ATOMIC_RELAXED);
+}
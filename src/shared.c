@@ -2,6 +2,10 @@
 #include "shared.h"
 #include "model.h"
 #include "utils.h"
+#include "loan_index.h"
+#include "account_index.h"
+#include "customer_search.h"
+#include "session.h"
 
 // --- FIX: NEW VALIDATION HELPERS ---
 
@@ -13,23 +17,25 @@ int is_email_valid(const char* email) {
     return 0;
 }
 
-// Helper to check if email is unique (Fixes Uniqueness Validation)
-int is_email_unique(const char* email) {
-    int fd = open(USER_FILE, O_RDONLY);
-    if (fd == -1) return 1; // File doesn't exist, so it's unique
-    
-    set_file_lock(fd, F_RDLCK);
-    User user;
-    while(read(fd, &user, sizeof(User)) == sizeof(User)) {
-        if (my_strcmp(user.email, email) == 0) {
-            set_file_lock(fd, F_UNLCK);
-            close(fd);
-            return 0; // Found a duplicate
+// Helper to check that an amount is a plain decimal number (digits, at most one '.')
+int is_valid_amount(const char* str) {
+    int dots = 0;
+    if (my_strcmp(str, "") == 0) return 0; // Empty
+    for (int i = 0; str[i] != '\0'; i++) {
+        if (str[i] == '.') {
+            dots++;
+        } else if (str[i] < '0' || str[i] > '9') {
+            return 0; // Not a digit
         }
+        if (dots > 1) return 0; // More than one dot
     }
-    set_file_lock(fd, F_UNLCK);
-    close(fd);
-    return 1; // No duplicates
+    return 1;
+}
+
+// Helper to check if email is unique (Fixes Uniqueness Validation)
+// Lock-free, so callers may already hold a lock on the user file.
+int is_email_unique(const char* email) {
+    return find_user_record_by_email(email) == -1;
 }
 
 // Helper to read a string and validate it
@@ -81,10 +87,59 @@ int get_valid_email(int client_socket, char* dest, int max_len) {
     }
 }
 
+// --- Transaction Table Helpers (history and statement views) ---
+
+void write_transaction_header(int client_socket) {
+    char buffer[256];
+    sprintf(buffer, "%-16s | %-7s | %-15s | %-12s | %-15s | %-15s\n",
+            "DATE", "TXN ID", "TYPE", "RECIVER ACC", "AMOUNT", "BALANCE");
+    write_string(client_socket, buffer);
+    write_string(client_socket, "---------------------------------------------------------------------------------------------\n");
+}
+
+void write_transaction_row(int client_socket, const Transaction* txn) {
+    char buffer[256];
+    char date_str[20], type_str[16], other_user_str[20], amount_str[16], balance_str[16];
+    struct tm tm_info;
+    localtime_r(&txn->timestamp, &tm_info);
+    strftime(date_str, sizeof(date_str), "%Y-%m-%d %H:%M", &tm_info);
+
+    switch (txn->type) {
+        case DEPOSIT:
+            strcpy(type_str, "CREDITED");
+            strcpy(other_user_str, "---");
+            break;
+        case WITHDRAWAL:
+            strcpy(type_str, "DEBITED");
+            strcpy(other_user_str, "---");
+            break;
+        case TRANSFER_OUT:
+            strcpy(type_str, "DEBITED");
+            sprintf(other_user_str, "%s", txn->otherPartyAccountNumber);
+            break;
+        case TRANSFER_IN:
+            strcpy(type_str, "CREDITED");
+            sprintf(other_user_str, "%s", txn->otherPartyAccountNumber);
+            break;
+        default:
+            strcpy(type_str, "UNKNOWN");
+            strcpy(other_user_str, "---");
+    }
+    sprintf(amount_str, "₹%.2f", txn->amount);
+    sprintf(balance_str, "₹%.2f", txn->newBalance);
+    sprintf(buffer, "%-16s | %-7d | %-15s | %-12s | %-15s | %-15s\n",
+        date_str, txn->transactionId, type_str, other_user_str, amount_str, balance_str);
+    write_string(client_socket, buffer);
+}
+
 // --- Shared Handler Functions ---
 
 void handle_view_my_details(int client_socket, User user) {
     char buffer[512];
+    // Show the current record rather than the copy taken at login
+    User current;
+    if (read_user_by_id(user.userId, &current) != -1) user = current;
+
     write_string(client_socket, "\n--- Your Personal Details ---\n");
     sprintf(buffer, "User ID: %d\n", user.userId); write_string(client_socket, buffer);
     sprintf(buffer, "Name: %s %s\n", user.firstName, user.lastName); write_string(client_socket, buffer);
@@ -101,33 +156,27 @@ void handle_change_password(int client_socket, int userId) {
     // --- FIX: Use get_valid_string to check for empty/long passwords ---
     if (get_valid_string(client_socket, buffer, 50) == -1) return; // Disconnected
     
-    int record_num = find_user_record(userId);
-    if (record_num == -1) { write_string(client_socket, "Error: User not found.\n"); return; }
-    
     int fd = open(USER_FILE, O_RDWR);
     if (fd == -1) { write_string(client_socket, "Error: Could not access user data.\n"); return; }
     
-    set_record_lock(fd, record_num, sizeof(User), F_WRLCK);
     User user;
-    lseek(fd, record_num * sizeof(User), SEEK_SET);
-
-    // --- FIX: Check read() failure ---
-    if (read(fd, &user, sizeof(User)) != sizeof(User)) {
-        write_string(client_socket, "Error: Failed to read user record.\n");
-        set_record_lock(fd, record_num, sizeof(User), F_UNLCK);
+    int record_num = lock_user_by_id(fd, userId, &user);
+    if (record_num == -1) {
+        write_string(client_socket, errno == ENOENT ? "Error: User not found.\n" : LOCK_BUSY_MESSAGE);
         close(fd);
         return;
     }
 
     strcpy(user.password, buffer);
-    lseek(fd, record_num * sizeof(User), SEEK_SET);
 
     // --- FIX: Check write() failure ---
-    if (write(fd, &user, sizeof(User)) != sizeof(User)) {
+    if (write_user_record(fd, record_num, &user) != 0) {
         write_string(STDOUT_FILENO, "FATAL: Failed to write password to disk.\n");
+    } else {
+        session_token_revoke(userId); // The old token must not outlive the old password
     }
     
-    set_record_lock(fd, record_num, sizeof(User), F_UNLCK);
+    set_record_lock(fd, record_num, sizeof(UserAuth), F_UNLCK);
     close(fd);
     write_string(client_socket, "Password changed successfully.\n");
 }
@@ -138,49 +187,47 @@ void handle_add_user(int client_socket, UserRole role_to_add) {
     new_user.role = role_to_add;
     new_user.isActive = 1;
 
-    // --- FIX: Lock file *before* getting ID to prevent race condition ---
-    int fd_user = open(USER_FILE, O_RDWR | O_CREAT | O_APPEND, 0644);
-    if (fd_user == -1) { 
-        perror("Error opening user file");
-        write_string(client_socket, "Error opening user file.\n"); 
-        return; 
-    }
-    set_file_lock(fd_user, F_WRLCK); // Lock the *entire file*
-    
-    new_user.userId = get_next_user_id();
-
+    // --- Step 1: Collect all details before touching the user file ---
     write_string(client_socket, "Enter new user's password: ");
-    if (get_valid_string(client_socket, new_user.password, 50) == -1) {
-        set_file_lock(fd_user, F_UNLCK); close(fd_user); return; // Disconnected
-    }
+    if (get_valid_string(client_socket, new_user.password, 50) == -1) return; // Disconnected
     
     write_string(client_socket, "Enter user's First Name: ");
-    if (get_valid_string(client_socket, new_user.firstName, 50) == -1) {
-        set_file_lock(fd_user, F_UNLCK); close(fd_user); return;
-    }
+    if (get_valid_string(client_socket, new_user.firstName, 50) == -1) return;
     
     write_string(client_socket, "Enter user's Last Name: ");
-    if (get_valid_string(client_socket, new_user.lastName, 50) == -1) {
-        set_file_lock(fd_user, F_UNLCK); close(fd_user); return;
-    }
+    if (get_valid_string(client_socket, new_user.lastName, 50) == -1) return;
     
     write_string(client_socket, "Enter user's Phone: ");
-    if (get_valid_string(client_socket, new_user.phone, 15) == -1) {
-        set_file_lock(fd_user, F_UNLCK); close(fd_user); return;
-    }
+    if (get_valid_string(client_socket, new_user.phone, 15) == -1) return;
     
     write_string(client_socket, "Enter user's Email: ");
-    if (get_valid_email(client_socket, new_user.email, 100) == -1) {
-        set_file_lock(fd_user, F_UNLCK); close(fd_user); return;
-    }
+    if (get_valid_email(client_socket, new_user.email, 100) == -1) return;
     
     write_string(client_socket, "Enter user's Address: ");
-    if (get_valid_string(client_socket, new_user.address, 256) == -1) {
+    if (get_valid_string(client_socket, new_user.address, 256) == -1) return;
+
+    // --- Step 2: Lock the file only to assign the ID and store the record ---
+    int fd_user = open(USER_FILE, O_RDWR | O_CREAT, 0644);
+    if (fd_user == -1) { 
+        perror("Error opening user file");
+        write_string(client_socket, "Error opening user file.\n"); 
+        return; 
+    }
+    if (set_file_lock(fd_user, F_WRLCK) == -1) { // Lock the *entire file*
+        write_string(client_socket, LOCK_BUSY_MESSAGE); close(fd_user); return;
+    }
+
+    // The email was free when typed; re-check now that no one else can append
+    if (!is_email_unique(new_user.email)) {
+        write_string(client_socket, "Email was taken while you were typing. User not created.\n");
         set_file_lock(fd_user, F_UNLCK); close(fd_user); return;
     }
+    new_user.userId = get_next_user_id();
 
-    if (write(fd_user, &new_user, sizeof(User)) != sizeof(User)) {
+    if (insert_user_record(fd_user, &new_user) == -1) {
         write_string(client_socket, "FATAL: Failed to write new user to disk.\n");
+    } else {
+        customer_search_put(&new_user);
     }
     set_file_lock(fd_user, F_UNLCK); // Release the lock
     close(fd_user);
@@ -193,12 +240,16 @@ void handle_add_user(int client_socket, UserRole role_to_add) {
         new_account.isActive = 1;
         sprintf(new_account.accountNumber, "SB-%d", new_user.userId); 
 
-        int fd_acct = open(ACCOUNT_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        int fd_acct = open_account_file(new_account.accountId, O_RDWR | O_CREAT);
         if (fd_acct == -1) { write_string(client_socket, "Error opening account file.\n"); return; }
         
-        set_file_lock(fd_acct, F_WRLCK);
-        if (write(fd_acct, &new_account, sizeof(Account)) != sizeof(Account)) {
+        // The user record already exists, so its account must be stored too
+        lock_range(fd_acct, 0, 0, F_WRLCK, LOCK_WAIT_FOREVER);
+        int acct_rec_num = insert_account_record(fd_acct, &new_account);
+        if (acct_rec_num == -1) {
              write_string(client_socket, "FATAL: Failed to write new account to disk.\n");
+        } else {
+            account_index_put(&new_account, acct_rec_num);
         }
         set_file_lock(fd_acct, F_UNLCK);
         close(fd_acct);
@@ -206,11 +257,20 @@ void handle_add_user(int client_socket, UserRole role_to_add) {
         sprintf(buffer, "User created successfully. New User ID: %d, Account No: SB-%d\n", new_user.userId, new_user.userId);
         write_string(client_socket, buffer);
     } else {
+        if (role_to_add == EMPLOYEE) workload_set_employee(new_user.userId, 1);
         sprintf(buffer, "User created successfully. New User ID: %d\n", new_user.userId);
         write_string(client_socket, buffer);
     }
 }
 
+// Prompts for an optional field. Returns -1 on disconnect, 0 if the user
+// skipped it, 1 if 'buffer' holds a new value.
+static int read_optional_field(int client_socket, const char* prompt, char* buffer) {
+    write_string(client_socket, prompt);
+    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) return -1;
+    return my_strcmp(buffer, "skip") != 0 && my_strcmp(buffer, "") != 0;
+}
+
 void handle_modify_user_details(int client_socket, int admin_mode) {
     char buffer[MAX_BUFFER];
     write_string(client_socket, "Enter User ID to modify: ");
@@ -219,89 +279,92 @@ void handle_modify_user_details(int client_socket, int admin_mode) {
     int target_user_id = atoi(buffer);
     if(target_user_id <= 0) { write_string(client_socket, "Invalid User ID.\n"); return; }
     
-    int record_num = find_user_record(target_user_id);
-    if (record_num == -1) { write_string(client_socket, "User not found.\n"); return; }
-
-    int fd = open(USER_FILE, O_RDWR);
-    if (fd == -1) { write_string(client_socket, "Error accessing user data.\n"); return; }
-    
-    set_record_lock(fd, record_num, sizeof(User), F_WRLCK);
-    lseek(fd, record_num * sizeof(User), SEEK_SET);
-    User user;
-    
-    if (read(fd, &user, sizeof(User)) != sizeof(User)) {
-        write_string(client_socket, "Error: Failed to read user record.\n");
-        set_record_lock(fd, record_num, sizeof(User), F_UNLCK);
-        close(fd);
+    // --- Step 1: Collect every change against an unlocked snapshot ---
+    User original;
+    if (read_user_by_id(target_user_id, &original) == -1) {
+        write_string(client_socket, errno == ENOENT ? "User not found.\n" : "Error: Failed to read user record.\n");
         return;
     }
-
-    if (!admin_mode && user.role != CUSTOMER) {
+    if (!admin_mode && original.role != CUSTOMER) {
         write_string(client_socket, "Permission denied. Employees can only modify customers.\n");
-        set_record_lock(fd, record_num, sizeof(User), F_UNLCK); close(fd); return;
+        return;
     }
+    User user = original;
+    int entered;
 
-    write_string(client_socket, "Enter new password (or 'skip'): ");
-    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) { set_record_lock(fd, record_num, sizeof(User), F_UNLCK); close(fd); return; }
-    if (my_strcmp(buffer, "skip") != 0 && my_strcmp(buffer, "") != 0) {
+    if ((entered = read_optional_field(client_socket, "Enter new password (or 'skip'): ", buffer)) == -1) return;
+    if (entered) {
         if(strlen(buffer) >= 50) { write_string(client_socket, "Password too long. Skipped.\n"); }
         else { strcpy(user.password, buffer); }
     }
     
-    write_string(client_socket, "Enter new First Name (or 'skip'): ");
-    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) { set_record_lock(fd, record_num, sizeof(User), F_UNLCK); close(fd); return; }
-    if (my_strcmp(buffer, "skip") != 0 && my_strcmp(buffer, "") != 0) {
+    if ((entered = read_optional_field(client_socket, "Enter new First Name (or 'skip'): ", buffer)) == -1) return;
+    if (entered) {
         if(strlen(buffer) >= 50) { write_string(client_socket, "Name too long. Skipped.\n"); }
         else { strcpy(user.firstName, buffer); }
     }
     
-    write_string(client_socket, "Enter new Last Name (or 'skip'): ");
-    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) { set_record_lock(fd, record_num, sizeof(User), F_UNLCK); close(fd); return; }
-    if (my_strcmp(buffer, "skip") != 0 && my_strcmp(buffer, "") != 0) {
+    if ((entered = read_optional_field(client_socket, "Enter new Last Name (or 'skip'): ", buffer)) == -1) return;
+    if (entered) {
         if(strlen(buffer) >= 50) { write_string(client_socket, "Name too long. Skipped.\n"); }
         else { strcpy(user.lastName, buffer); }
     }
     
-    write_string(client_socket, "Enter new Phone (or 'skip'): ");
-    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) { set_record_lock(fd, record_num, sizeof(User), F_UNLCK); close(fd); return; }
-    if (my_strcmp(buffer, "skip") != 0 && my_strcmp(buffer, "") != 0) {
+    if ((entered = read_optional_field(client_socket, "Enter new Phone (or 'skip'): ", buffer)) == -1) return;
+    if (entered) {
         if(strlen(buffer) >= 15) { write_string(client_socket, "Phone too long. Skipped.\n"); }
         else { strcpy(user.phone, buffer); }
     }
     
-    write_string(client_socket, "Enter new Email (or 'skip'): ");
-    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) { set_record_lock(fd, record_num, sizeof(User), F_UNLCK); close(fd); return; }
-    if (my_strcmp(buffer, "skip") != 0 && my_strcmp(buffer, "") != 0) {
+    if ((entered = read_optional_field(client_socket, "Enter new Email (or 'skip'): ", buffer)) == -1) return;
+    if (entered) {
         if(strlen(buffer) >= 100) { write_string(client_socket, "Email too long. Skipped.\n"); }
         else if (!is_email_valid(buffer)) { write_string(client_socket, "Invalid email format. Skipped.\n"); }
         else if (!is_email_unique(buffer)) { write_string(client_socket, "Email already in use. Skipped.\n"); }
         else { strcpy(user.email, buffer); }
     }
     
-    write_string(client_socket, "Enter new Address (or 'skip'): ");
-    if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) { set_record_lock(fd, record_num, sizeof(User), F_UNLCK); close(fd); return; }
-    if (my_strcmp(buffer, "skip") != 0 && my_strcmp(buffer, "") != 0) {
+    if ((entered = read_optional_field(client_socket, "Enter new Address (or 'skip'): ", buffer)) == -1) return;
+    if (entered) {
         if(strlen(buffer) >= 256) { write_string(client_socket, "Address too long. Skipped.\n"); }
         else { strcpy(user.address, buffer); }
     }
 
     if (admin_mode) {
-        write_string(client_socket, "Enter new role (0=CUST, 1=EMP, 2=MAN, 3=ADMIN) (or 'skip'): ");
-        if (read_client_input(client_socket, buffer, MAX_BUFFER) <= 0) { set_record_lock(fd, record_num, sizeof(User), F_UNLCK); close(fd); return; }
-        if (my_strcmp(buffer, "skip") != 0 && my_strcmp(buffer, "") != 0) {
+        if ((entered = read_optional_field(client_socket, "Enter new role (0=CUST, 1=EMP, 2=MAN, 3=ADMIN) (or 'skip'): ", buffer)) == -1) return;
+        if (entered) {
             int new_role = atoi(buffer);
             if(new_role >= 0 && new_role <= 3) { user.role = new_role; }
             else { write_string(client_socket, "Invalid role. Skipped.\n"); }
         }
     }
 
-    lseek(fd, record_num * sizeof(User), SEEK_SET);
-    if (write(fd, &user, sizeof(User)) != sizeof(User)) {
+    // --- Step 2: Lock, confirm the record is unchanged, write ---
+    // The snapshot itself is the version: any write since then (or a torn
+    // snapshot read) makes the bytes differ.
+    int fd = open(USER_FILE, O_RDWR);
+    if (fd == -1) { write_string(client_socket, "Error accessing user data.\n"); return; }
+    User current;
+    int record_num = lock_user_by_id(fd, target_user_id, &current);
+    if (record_num == -1) {
+        write_string(client_socket, errno == ENOENT ? "This user was removed while you were editing. No changes saved.\n" : LOCK_BUSY_MESSAGE);
+        close(fd); return;
+    }
+
+    if (memcmp(&current, &original, sizeof(User)) != 0) {
+        write_string(client_socket, "This user was changed by someone else while you were editing. No changes saved; please try again.\n");
+    } else if (my_strcmp(user.email, original.email) != 0 && !is_email_unique(user.email)) {
+        write_string(client_socket, "Email was taken while you were editing. No changes saved.\n");
+    } else if (write_user_record(fd, record_num, &user) != 0) {
         write_string(STDOUT_FILENO, "FATAL: Failed to write modified user to disk.\n");
+    } else {
+        if (user.role != original.role) workload_set_employee(user.userId, user.role == EMPLOYEE && user.isActive);
+        customer_search_put(&user);
+        session_token_revoke(user.userId); // A resume would restore the stale details
+        write_string(client_socket, "User details modified successfully.\n");
     }
-    set_record_lock(fd, record_num, sizeof(User), F_UNLCK);
+    set_record_lock(fd, record_num, sizeof(UserAuth), F_UNLCK);
     close(fd);
-    write_string(client_socket, "User details modified successfully.\n");
 }
 
 void handle_set_account_status(int client_socket, int admin_mode) {
@@ -319,55 +382,50 @@ void handle_set_account_status(int client_socket, int admin_mode) {
         return;
     }
 
-    int user_rec_num = find_user_record(target_user_id);
-    if (user_rec_num == -1) { write_string(client_socket, "User not found.\n"); return; }
-    
     int fd_user = open(USER_FILE, O_RDWR);
     if(fd_user == -1) { write_string(client_socket, "Error accessing user data.\n"); return; }
 
-    set_record_lock(fd_user, user_rec_num, sizeof(User), F_WRLCK);
-    lseek(fd_user, user_rec_num * sizeof(User), SEEK_SET);
     User user; 
-    
-    if(read(fd_user, &user, sizeof(User)) != sizeof(User)) {
-        write_string(client_socket, "Error reading user record.\n");
-        set_record_lock(fd_user, user_rec_num, sizeof(User), F_UNLCK);
+    int user_rec_num = lock_user_by_id(fd_user, target_user_id, &user);
+    if (user_rec_num == -1) {
+        write_string(client_socket, errno == ENOENT ? "User not found.\n" : LOCK_BUSY_MESSAGE);
         close(fd_user);
         return;
     }
 
     if (!admin_mode && user.role != CUSTOMER) {
         write_string(client_socket, "Permission denied. Managers can only modify customers.\n");
-        set_record_lock(fd_user, user_rec_num, sizeof(User), F_UNLCK); close(fd_user); return;
+        set_record_lock(fd_user, user_rec_num, sizeof(UserAuth), F_UNLCK); close(fd_user); return;
     }
     user.isActive = new_status;
-    lseek(fd_user, user_rec_num * sizeof(User), SEEK_SET);
 
-    if(write(fd_user, &user, sizeof(User)) != sizeof(User)) {
+    if (write_user_record(fd_user, user_rec_num, &user) != 0) {
         write_string(STDOUT_FILENO, "FATAL: Failed to write user status.\n");
+    } else {
+        if (user.role == EMPLOYEE) workload_set_employee(user.userId, new_status);
+        if (!new_status) session_token_revoke(user.userId);
     }
-    set_record_lock(fd_user, user_rec_num, sizeof(User), F_UNLCK);
+    set_record_lock(fd_user, user_rec_num, sizeof(UserAuth), F_UNLCK);
     close(fd_user);
 
-    int acct_rec_num = find_account_record_by_id(target_user_id);
-    if (acct_rec_num != -1) {
-        int fd_acct = open(ACCOUNT_FILE, O_RDWR);
+    if (find_account_record_by_id(target_user_id) != -1) {
+        int fd_acct = open_account_file(target_user_id, O_RDWR);
         if (fd_acct == -1) { write_string(client_socket, "User status updated, but couldn't open account file.\n"); return; }
         
-        set_record_lock(fd_acct, acct_rec_num, sizeof(Account), F_WRLCK); 
         Account account;
-        lseek(fd_acct, acct_rec_num * sizeof(Account), SEEK_SET); 
-
-        if(read(fd_acct, &account, sizeof(Account)) != sizeof(Account)) {
-            write_string(client_socket, "Error reading account record.\n");
-        } else {
+        int acct_rec_num = lock_account_by_id(fd_acct, target_user_id, &account);
+        if (acct_rec_num == -1 && errno != ENOENT) {
+            write_string(client_socket, "User status updated, but the account is busy. Please apply the status again.\n");
+            close(fd_acct);
+            return;
+        }
+        if (acct_rec_num != -1) {
             account.isActive = new_status;
-            lseek(fd_acct, acct_rec_num * sizeof(Account), SEEK_SET);
-            if(write(fd_acct, &account, sizeof(Account)) != sizeof(Account)) {
+            if (write_account_record(fd_acct, acct_rec_num, &account) != 0) {
                 write_string(STDOUT_FILENO, "FATAL: Failed to write account status.\n");
             }
+            set_record_lock(fd_acct, acct_rec_num, sizeof(Account), F_UNLCK);
         }
-        set_record_lock(fd_acct, acct_rec_num, sizeof(Account), F_UNLCK);
         close(fd_acct);
     }
     
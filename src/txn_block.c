@@ -0,0 +1,198 @@
+// src/txn_block.c
+#include "txn_block.h"
+
+#define TXN_PARTY_LEN 20 // sizeof(Transaction.otherPartyAccountNumber)
+#define MAX_ROW_BYTES 50 // Tag, five varints and two 10-byte amounts
+
+// Row tag: type in bits 0-1, raw-double flags in bits 2-3, dictionary index above
+#define TAG_AMOUNT_RAW 4
+#define TAG_BALANCE_RAW 8
+#define TAG_INDEX_SHIFT 4
+
+// --- Varints ---
+// Little-endian base-128; signed values are zigzagged first so small
+// negative deltas stay short.
+
+static unsigned char* put_varint(unsigned char* out, unsigned long long value) {
+    while (value >= 0x80) {
+        *out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+    return out;
+}
+
+static unsigned char* put_svarint(unsigned char* out, long long value) {
+    return put_varint(out, ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63));
+}
+
+static const unsigned char* get_varint(const unsigned char* in, const unsigned char* end, unsigned long long* value) {
+    unsigned long long result = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        unsigned char byte = *in++;
+        result |= (unsigned long long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return in;
+        }
+    }
+    return NULL;
+}
+
+static const unsigned char* get_svarint(const unsigned char* in, const unsigned char* end, long long* value) {
+    unsigned long long raw;
+    in = get_varint(in, end, &raw);
+    if (in != NULL) *value = (long long)(raw >> 1) ^ -(long long)(raw & 1);
+    return in;
+}
+
+// --- Amounts ---
+
+// Money is almost always a whole number of paise; returns 1 and sets
+// *paise when 'value' round-trips exactly through that form.
+static int to_paise(double value, long long* paise) {
+    if (!(value > -9e15 && value < 9e15)) return 0; // Also rejects NaN
+    long long rounded = (long long)(value * 100.0 + (value >= 0 ? 0.5 : -0.5));
+    if ((double)rounded / 100.0 != value) return 0;
+    *paise = rounded;
+    return 1;
+}
+
+static unsigned char* put_amount(unsigned char* out, double value, long long paise, int raw) {
+    if (!raw) return put_svarint(out, paise);
+    memcpy(out, &value, sizeof(double));
+    return out + sizeof(double);
+}
+
+static const unsigned char* get_amount(const unsigned char* in, const unsigned char* end, int raw, double* value) {
+    if (raw) {
+        if ((size_t)(end - in) < sizeof(double)) return NULL;
+        memcpy(value, in, sizeof(double));
+        return in + sizeof(double);
+    }
+    long long paise;
+    in = get_svarint(in, end, &paise);
+    if (in != NULL) *value = (double)paise / 100.0;
+    return in;
+}
+
+// --- Public Functions ---
+
+size_t txn_block_max_size(int count) {
+    return sizeof(TxnBlockHeader) + (size_t)count * (TXN_PARTY_LEN + MAX_ROW_BYTES);
+}
+
+size_t encode_txn_block(const Transaction* rows, int count, unsigned char* out) {
+    // Dictionary first: one entry per distinct counterparty, in first-seen
+    // order. Most rows name "---" or one of a handful of accounts, so a
+    // linear search stays short.
+    int* party_of = (int*)malloc(count * sizeof(int));
+    int* entries = (int*)malloc(count * sizeof(int)); // Row that introduced each entry
+    if (party_of == NULL || entries == NULL) { free(party_of); free(entries); return 0; }
+    int dictionary_size = 0;
+    for (int i = 0; i < count; i++) {
+        int found = -1;
+        for (int d = dictionary_size - 1; d >= 0 && found == -1; d--) {
+            if (strncmp(rows[entries[d]].otherPartyAccountNumber, rows[i].otherPartyAccountNumber, TXN_PARTY_LEN) == 0) found = d;
+        }
+        if (found == -1) {
+            found = dictionary_size;
+            entries[dictionary_size++] = i;
+        }
+        party_of[i] = found;
+    }
+
+    TxnBlockHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TXN_BLOCK_MAGIC;
+    header.rowCount = count;
+    header.firstTransactionId = count > 0 ? rows[0].transactionId : 0;
+    header.firstTimestamp = count > 0 ? rows[0].timestamp : 0;
+    header.dictionarySize = dictionary_size;
+    memcpy(out, &header, sizeof(header));
+    unsigned char* next = out + sizeof(header);
+
+    for (int d = 0; d < dictionary_size; d++) {
+        const char* party = rows[entries[d]].otherPartyAccountNumber;
+        size_t length = strnlen(party, TXN_PARTY_LEN - 1);
+        *next++ = (unsigned char)length;
+        memcpy(next, party, length);
+        next += length;
+    }
+
+    int previous_id = header.firstTransactionId;
+    time_t previous_time = header.firstTimestamp;
+    for (int i = 0; i < count; i++) {
+        const Transaction* txn = &rows[i];
+        if ((unsigned)txn->type > TRANSFER_IN) { next = NULL; break; }
+        long long amount = 0, balance = 0;
+        int amount_raw = !to_paise(txn->amount, &amount);
+        int balance_raw = !to_paise(txn->newBalance, &balance);
+        unsigned long long tag = (unsigned long long)txn->type
+                               | (amount_raw ? TAG_AMOUNT_RAW : 0)
+                               | (balance_raw ? TAG_BALANCE_RAW : 0)
+                               | ((unsigned long long)party_of[i] << TAG_INDEX_SHIFT);
+        next = put_varint(next, tag);
+        next = put_svarint(next, (long long)txn->transactionId - previous_id);
+        next = put_svarint(next, txn->accountId);
+        next = put_svarint(next, txn->userId);
+        next = put_amount(next, txn->amount, amount, amount_raw);
+        next = put_amount(next, txn->newBalance, balance, balance_raw);
+        next = put_svarint(next, (long long)txn->timestamp - previous_time);
+        previous_id = txn->transactionId;
+        previous_time = txn->timestamp;
+    }
+    free(party_of);
+    free(entries);
+    return next == NULL ? 0 : (size_t)(next - out);
+}
+
+int decode_txn_block(const unsigned char* data, size_t size, Transaction* rows, int max_rows) {
+    TxnBlockHeader header;
+    if (size < sizeof(header)) return -1;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != TXN_BLOCK_MAGIC || header.rowCount < 0 || header.rowCount > max_rows ||
+        header.dictionarySize < 0 || header.dictionarySize > header.rowCount) return -1;
+
+    const unsigned char* next = data + sizeof(header);
+    const unsigned char* end = data + size;
+
+    // Entries point into 'data'; each is copied into its rows below
+    const unsigned char* parties[TXN_BLOCK_ROWS];
+    unsigned char lengths[TXN_BLOCK_ROWS];
+    if (header.dictionarySize > TXN_BLOCK_ROWS) return -1;
+    for (int d = 0; d < header.dictionarySize; d++) {
+        if (next >= end || *next >= TXN_PARTY_LEN || end - next - 1 < *next) return -1;
+        lengths[d] = *next++;
+        parties[d] = next;
+        next += lengths[d];
+    }
+
+    long long id = header.firstTransactionId;
+    long long timestamp = header.firstTimestamp;
+    for (int i = 0; i < header.rowCount; i++) {
+        Transaction* txn = &rows[i];
+        unsigned long long tag;
+        long long delta, account, user;
+        memset(txn, 0, sizeof(Transaction));
+        if ((next = get_varint(next, end, &tag)) == NULL) return -1;
+        if ((next = get_svarint(next, end, &delta)) == NULL) return -1;
+        id += delta;
+        if ((next = get_svarint(next, end, &account)) == NULL) return -1;
+        if ((next = get_svarint(next, end, &user)) == NULL) return -1;
+        if ((next = get_amount(next, end, tag & TAG_AMOUNT_RAW, &txn->amount)) == NULL) return -1;
+        if ((next = get_amount(next, end, tag & TAG_BALANCE_RAW, &txn->newBalance)) == NULL) return -1;
+        if ((next = get_svarint(next, end, &delta)) == NULL) return -1;
+        timestamp += delta;
+
+        unsigned long long party = tag >> TAG_INDEX_SHIFT;
+        if (party >= (unsigned long long)header.dictionarySize) return -1;
+        txn->transactionId = (int)id;
+        txn->accountId = (int)account;
+        txn->userId = (int)user;
+        txn->type = (TransactionType)(tag & 3);
+        memcpy(txn->otherPartyAccountNumber, parties[party], lengths[party]);
+        txn->timestamp = (time_t)timestamp;
+    }
+    return header.rowCount;
+}
@@ -0,0 +1,225 @@
+// src/uring.c
+#include "uring.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// --- Per-Thread Ring ---
+// The submission and completion queues are shared with the kernel through
+// mmap. We own the SQ tail and the CQ head; the kernel owns the other two.
+typedef struct {
+    int fd;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map; // Same as sq_map when the kernel offers IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_size;
+    size_t sqes_size;
+} Ring;
+
+static int uring_enabled = 1;
+static int uring_broken = 0; // Set once a setup fails; later batches skip straight to pread/pwrite
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static void free_ring(void* ptr) {
+    Ring* ring = (Ring*)ptr;
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_size);
+    munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+    free(ring);
+}
+
+static void make_ring_key() {
+    pthread_key_create(&ring_key, free_ring);
+}
+
+static Ring* setup_ring() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &params);
+    if (fd == -1) return NULL;
+
+    Ring* ring = (Ring*)calloc(1, sizeof(Ring));
+    if (ring == NULL) { close(fd); return NULL; }
+    ring->fd = fd;
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring->cq_map_size > ring->sq_map_size) ring->sq_map_size = ring->cq_map_size;
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) { close(fd); free(ring); return NULL; }
+    ring->cq_map = single ? ring->sq_map
+                          : mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) {
+        munmap(ring->sq_map, ring->sq_map_size); close(fd); free(ring); return NULL;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (!single) munmap(ring->cq_map, ring->cq_map_size);
+        munmap(ring->sq_map, ring->sq_map_size); close(fd); free(ring); return NULL;
+    }
+
+    char* sq = (char*)ring->sq_map;
+    char* cq = (char*)ring->cq_map;
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+// This thread's ring, set up on first use, or NULL to fall back.
+static Ring* thread_ring() {
+    if (!__atomic_load_n(&uring_enabled, __ATOMIC_RELAXED) || __atomic_load_n(&uring_broken, __ATOMIC_RELAXED)) return NULL;
+    pthread_once(&ring_key_once, make_ring_key);
+    Ring* ring = (Ring*)pthread_getspecific(ring_key);
+    if (ring != NULL) return ring;
+    ring = setup_ring();
+    if (ring == NULL) {
+        __atomic_store_n(&uring_broken, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+// --- Submission ---
+
+// Submits ops[0..count) (count <= IO_RING_ENTRIES) and waits for all of
+// them. Returns -1 only if the ring itself failed.
+static int ring_run(Ring* ring, IoOp* ops, int count, int linked) {
+    unsigned tail = *ring->sq_tail; // Only this thread moves the tail
+    unsigned mask = *ring->sq_mask;
+    for (int i = 0; i < count; i++) {
+        unsigned slot = tail & mask;
+        struct io_uring_sqe* sqe = &ring->sqes[slot];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = ops[i].is_write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe->fd = ops[i].fd;
+        sqe->addr = (unsigned long)ops[i].buf;
+        sqe->len = ops[i].len;
+        sqe->off = ops[i].offset;
+        sqe->user_data = i;
+        if (linked && i < count - 1) sqe->flags = IOSQE_IO_LINK;
+        ring->sq_array[slot] = slot;
+        tail++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    int to_submit = count, reaped = 0;
+    while (reaped < count) {
+        int rc = syscall(__NR_io_uring_enter, ring->fd, to_submit, count - reaped, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (rc == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        to_submit -= rc < to_submit ? rc : to_submit;
+        unsigned head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            if (cqe->user_data < (unsigned long)count) ops[cqe->user_data].result = cqe->res;
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// The fallback: one pread/pwrite at a time, a chain stopping where io_uring would.
+static void run_plain(IoOp* ops, int count, int linked) {
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (failed) { ops[i].result = -ECANCELED; continue; }
+        ssize_t moved = ops[i].is_write ? pwrite(ops[i].fd, ops[i].buf, ops[i].len, ops[i].offset)
+                                        : pread(ops[i].fd, ops[i].buf, ops[i].len, ops[i].offset);
+        ops[i].result = moved == -1 ? -errno : moved;
+        if (linked && moved != (ssize_t)ops[i].len) failed = 1;
+    }
+}
+
+// --- Public Functions ---
+
+void io_batch_init(IoBatch* batch) {
+    batch->ops = NULL;
+    batch->count = 0;
+    batch->capacity = 0;
+}
+
+void io_batch_free(IoBatch* batch) {
+    free(batch->ops);
+    io_batch_init(batch);
+}
+
+static int queue_op(IoBatch* batch, int fd, int is_write, void* buf, size_t len, off_t offset) {
+    if (batch->count == batch->capacity) {
+        int bigger_capacity = batch->capacity == 0 ? 8 : batch->capacity * 2;
+        IoOp* bigger = (IoOp*)realloc(batch->ops, bigger_capacity * sizeof(IoOp));
+        if (bigger == NULL) return -1;
+        batch->ops = bigger;
+        batch->capacity = bigger_capacity;
+    }
+    IoOp* op = &batch->ops[batch->count++];
+    op->fd = fd;
+    op->is_write = is_write;
+    op->buf = buf;
+    op->len = len;
+    op->offset = offset;
+    op->result = -ECANCELED;
+    return 0;
+}
+
+int io_batch_read(IoBatch* batch, int fd, void* buf, size_t len, off_t offset) {
+    return queue_op(batch, fd, 0, buf, len, offset);
+}
+
+int io_batch_write(IoBatch* batch, int fd, const void* buf, size_t len, off_t offset) {
+    return queue_op(batch, fd, 1, (void*)buf, len, offset);
+}
+
+// A batch longer than the ring goes in ring-sized pieces; a chain only
+// moves on to its next piece once every op in this one succeeded.
+int io_batch_submit(IoBatch* batch, int linked) {
+    Ring* ring = thread_ring();
+    int status = 0;
+    for (int start = 0; start < batch->count; start += IO_RING_ENTRIES) {
+        int count = batch->count - start < IO_RING_ENTRIES ? batch->count - start : IO_RING_ENTRIES;
+        IoOp* ops = batch->ops + start;
+        if (ring != NULL && ring_run(ring, ops, count, linked) == -1) {
+            // Completions may still be owed to this ring, so it is never reused
+            perror("io_uring_enter");
+            pthread_setspecific(ring_key, NULL);
+            free_ring(ring);
+            __atomic_store_n(&uring_broken, 1, __ATOMIC_RELAXED);
+            ring = NULL;
+        }
+        if (ring == NULL) run_plain(ops, count, linked);
+        for (int i = 0; i < count; i++) {
+            if (ops[i].result != (ssize_t)ops[i].len) status = -1;
+        }
+        if (status == -1 && linked) break; // The rest stay -ECANCELED
+    }
+    return status;
+}
+
+void set_io_uring_enabled(int enabled) {
+    __atomic_store_n(&uring_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+int io_uring_available() {
+    return thread_ring() != NULL;
+}
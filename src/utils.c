@@ -1,14 +1,31 @@
 // src/utils.c
+#define _GNU_SOURCE // For F_OFD_SETLK (open file description locks)
 #include "utils.h"
 
 // --- I/O and String Functions ---
 
+static int (*client_io_wait)(int fd, int for_write) = NULL;
+
+// Loops over short writes; a non-blocking client socket that fills up
+// waits through the client I/O hook instead of dropping the rest.
 void write_string(int fd, const char* str) {
     int len = 0;
     while (str[len] != '\0') {
         len++;
     }
-    write(fd, str, len);
+    while (len > 0) {
+        ssize_t written = write(fd, str, len);
+        if (written > 0) {
+            str += written;
+            len -= written;
+        } else if (written == -1 && errno == EINTR) {
+            continue;
+        } else if (written == -1 && errno == EAGAIN && client_io_wait != NULL && client_io_wait(fd, 1) == 0) {
+            continue;
+        } else {
+            break;
+        }
+    }
 }
 
 int my_strcmp(const char* s1, const char* s2) {
@@ -19,9 +36,38 @@ int my_strcmp(const char* s1, const char* s2) {
     return *(const unsigned char*)s1 - *(const unsigned char*)s2;
 }
 
+// 'gone' is set once a read on the session's client sees EOF or an error,
+// so the session layer can tell a dropped connection from a menu logout.
+static __thread ClientIoState thread_client_state;
+static __thread ClientIoState* client_state = NULL;
+
+static ClientIoState* client_io() {
+    return client_state != NULL ? client_state : &thread_client_state;
+}
+
+void set_client_io_state(ClientIoState* state) {
+    client_state = state;
+}
+
+void set_client_io_wait(int (*wait)(int fd, int for_write)) {
+    client_io_wait = wait;
+}
+
+void track_client_idle(time_t* idle_since) {
+    client_io()->idle_since = idle_since;
+}
+
 // --- FIX: Returns the read_size to detect disconnects (0) or errors (-1)
 int read_client_input(int client_socket, char* buffer, int size) {
-    int read_size = read(client_socket, buffer, size - 1);
+    ClientIoState* state = client_io();
+    if (state->idle_since != NULL) __atomic_store_n(state->idle_since, time(NULL), __ATOMIC_RELAXED);
+    int read_size;
+    while ((read_size = read(client_socket, buffer, size - 1)) == -1) {
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN || client_io_wait == NULL || client_io_wait(client_socket, 0) == -1) break;
+    }
+    if (state->idle_since != NULL) __atomic_store_n(state->idle_since, 0, __ATOMIC_RELAXED);
+    if (read_size <= 0) state->gone = 1;
     if (read_size > 0) {
         buffer[read_size] = '\0';
         if (buffer[read_size - 1] == '\n') {
@@ -32,34 +78,91 @@ int read_client_input(int client_socket, char* buffer, int size) {
     return read_size;
 }
 
+int client_disconnected() {
+    return client_io()->gone;
+}
+
 // --- Locking Functions ---
-// (Unchanged)
-int set_file_lock(int fd, int lock_type) {
+// Locks are open-file-description (OFD) locks: they belong to the fd that
+// took them, so two threads with their own open() of a file exclude each
+// other exactly as two processes do. A thread must not lock a range through
+// one fd while holding a conflicting lock on it through another.
+
+#define LOCK_BACKOFF_START_US 50
+#define LOCK_BACKOFF_MAX_US 10000
+
+static int lock_timeout_ms = LOCK_WAIT_FOREVER;
+static long lock_timeouts = 0;
+
+void set_lock_timeout(int timeout_ms) {
+    lock_timeout_ms = timeout_ms < 0 ? LOCK_WAIT_FOREVER : timeout_ms;
+}
+
+long get_lock_timeout_count() {
+    return __atomic_load_n(&lock_timeouts, __ATOMIC_RELAXED);
+}
+
+static long elapsed_ms(const struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+int lock_range(int fd, off_t start, off_t len, int lock_type, int timeout_ms) {
     struct flock fl;
     fl.l_type = lock_type;
     fl.l_whence = SEEK_SET;
-    fl.l_start = 0;
-    fl.l_len = 0;
-    fl.l_pid = getpid();
+    fl.l_start = start;
+    fl.l_len = len;
+    fl.l_pid = 0; // Required for OFD locks
 
-    if (fcntl(fd, F_SETLKW, &fl) == -1) {
-        perror("fcntl file lock");
-        return -1;
+    if (lock_type == F_UNLCK || timeout_ms == LOCK_WAIT_FOREVER) {
+        while (fcntl(fd, F_OFD_SETLKW, &fl) == -1) {
+            if (errno != EINTR) { perror("fcntl lock"); return -1; }
+        }
+        return 0;
+    }
+
+    // Bounded wait: try, then back off exponentially until the deadline
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    long backoff_us = LOCK_BACKOFF_START_US;
+    while (fcntl(fd, F_OFD_SETLK, &fl) == -1) {
+        if (errno != EAGAIN && errno != EACCES && errno != EINTR) {
+            perror("fcntl lock");
+            return -1;
+        }
+        long waited = elapsed_ms(&started);
+        if (waited >= timeout_ms) {
+            // Counted, not logged: the server's stats line reports them
+            __atomic_add_fetch(&lock_timeouts, 1, __ATOMIC_RELAXED);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        long remaining_us = (timeout_ms - waited) * 1000;
+        struct timespec pause;
+        pause.tv_sec = 0;
+        pause.tv_nsec = (backoff_us < remaining_us ? backoff_us : remaining_us) * 1000;
+        nanosleep(&pause, NULL);
+        if (backoff_us < LOCK_BACKOFF_MAX_US) backoff_us *= 2;
     }
     return 0;
 }
 
+int set_file_lock(int fd, int lock_type) {
+    return lock_range(fd, 0, 0, lock_type, lock_timeout_ms);
+}
+
 int set_record_lock(int fd, int record_num, int record_size, int lock_type) {
-    struct flock fl;
-    fl.l_type = lock_type;
-    fl.l_whence = SEEK_SET;
-    fl.l_start = record_num * record_size;
-    fl.l_len = record_size;
-    fl.l_pid = getpid();
+    return lock_range(fd, record_offset(record_num, record_size), record_size, lock_type, lock_timeout_ms);
+}
 
-    if (fcntl(fd, F_SETLKW, &fl) == -1) {
-        perror("fcntl record lock");
-        return -1;
-    }
-    return 0;
-}
\ No newline at end of file
+// --- Record Files ---
+
+off_t record_offset(int record_num, size_t record_size) {
+    return DAT_HEADER_SIZE + (off_t)record_num * record_size;
+}
+
+int record_count(off_t file_size, size_t record_size) {
+    return file_size > DAT_HEADER_SIZE ? (int)((file_size - DAT_HEADER_SIZE) / (off_t)record_size) : 0;
+}
@@ -0,0 +1,243 @@
+// src/worker.c
+#include "worker.h"
+#include "controller.h"
+#include "model.h"
+#include "utils.h"
+#include "loan_index.h"
+#include "feedback_index.h"
+#include "coroutine.h"
+#include <sys/wait.h>
+
+// --- Worker Channels ---
+// One SOCK_DGRAM socketpair per worker: the worker reads end 0 and every
+// process sends on end 1. The parent keeps both ends open, so messages
+// queued for a worker that crashed wait for its replacement.
+typedef enum {
+    MSG_HAND_OFF,  // Carries the client socket as SCM_RIGHTS
+    MSG_LOAN,
+    MSG_FEEDBACK,
+    MSG_REVOKE
+} WorkerMessageType;
+
+typedef struct {
+    WorkerMessageType type;
+    int recordNum;
+    union {
+        HandedOffClient client;
+        Loan loan;
+        Feedback feedback;
+        int userId;
+    } body;
+} WorkerMessage;
+
+static int channels[MAX_ACCOUNT_SHARDS][2];
+static int worker_count = 0;
+static int self = -1;
+
+// Sends without blocking: a full channel means its worker is down or
+// swamped, and the caller reports that instead of stalling a session.
+static int send_message(int worker, const WorkerMessage* msg, int fd) {
+    struct iovec iov;
+    iov.iov_base = (void*)msg;
+    iov.iov_len = sizeof(WorkerMessage);
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    if (fd != -1) {
+        hdr.msg_control = control.buf;
+        hdr.msg_controllen = sizeof(control.buf);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    return sendmsg(channels[worker][1], &hdr, MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(WorkerMessage) ? 0 : -1;
+}
+
+static void* channel_loop(void* arg) {
+    while (1) {
+        WorkerMessage msg;
+        struct iovec iov;
+        iov.iov_base = &msg;
+        iov.iov_len = sizeof(WorkerMessage);
+        union {
+            char buf[CMSG_SPACE(sizeof(int))];
+            struct cmsghdr align;
+        } control;
+        struct msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = control.buf;
+        hdr.msg_controllen = sizeof(control.buf);
+
+        ssize_t got = recvmsg(channels[self][0], &hdr, 0);
+        if (got != sizeof(WorkerMessage)) {
+            if (got == -1 && errno != EINTR) perror("recvmsg worker channel");
+            continue;
+        }
+        int fd = -1;
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+        if (cmsg != NULL && cmsg->cmsg_type == SCM_RIGHTS) memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+        switch (msg.type) {
+            case MSG_HAND_OFF: {
+                if (fd == -1) break;
+                HandedOffClient* client = (HandedOffClient*)malloc(sizeof(HandedOffClient));
+                if (client == NULL) { close(fd); break; }
+                *client = msg.body.client;
+                client->client_socket = fd;
+                if (spawn_session(fd, handle_handed_off_client, client) == -1) {
+                    perror("spawn_session failed");
+                    close(fd);
+                    free(client);
+                }
+                break;
+            }
+            case MSG_LOAN: loan_queue_push(&msg.body.loan, msg.recordNum); break;
+            case MSG_FEEDBACK: feedback_index_add(&msg.body.feedback, msg.recordNum); break;
+            case MSG_REVOKE: session_token_revoke_local(msg.body.userId); break;
+        }
+        if (fd != -1 && msg.type != MSG_HAND_OFF) close(fd);
+    }
+    return NULL;
+}
+
+// Tells every other worker to drop its copy of a user's token.
+static void broadcast_revoke(int userId) {
+    WorkerMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = MSG_REVOKE;
+    msg.body.userId = userId;
+    for (int worker = 0; worker < worker_count; worker++) {
+        if (worker != self && send_message(worker, &msg, -1) == -1) {
+            write_string(STDOUT_FILENO, "ERROR: Could not forward a token revocation.\n");
+        }
+    }
+}
+
+// --- Supervisor ---
+
+static pid_t spawn_worker(int index, int restarted, void (*worker_main)(int index)) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    self = index;
+    set_session_token_tag(index, broadcast_revoke);
+    // This shard's sessions died with the old worker, so none of the
+    // transfers it coordinated can still be in flight
+    if (restarted) recover_shard_transfers(index);
+    worker_main(index);
+    _exit(EXIT_FAILURE);
+}
+
+int run_workers(int count, void (*worker_main)(int index)) {
+    char buffer[128];
+    pid_t pids[MAX_ACCOUNT_SHARDS];
+    time_t started[MAX_ACCOUNT_SHARDS];
+    worker_count = count;
+    for (int i = 0; i < count; i++) {
+        if (socketpair(AF_UNIX, SOCK_DGRAM, 0, channels[i]) == -1) {
+            perror("socketpair"); return -1;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        pids[i] = spawn_worker(i, 0, worker_main);
+        started[i] = time(NULL);
+        if (pids[i] == -1) { perror("fork"); return -1; }
+    }
+
+    while (1) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            perror("waitpid"); return -1;
+        }
+        int index = 0;
+        while (index < count && pids[index] != pid) index++;
+        if (index == count) continue;
+
+        if (WIFSIGNALED(status)) sprintf(buffer, "Worker %d (pid %d) killed by signal %d. Restarting it.\n", index, pid, WTERMSIG(status));
+        else sprintf(buffer, "Worker %d (pid %d) exited with status %d. Restarting it.\n", index, pid, WEXITSTATUS(status));
+        write_string(STDOUT_FILENO, buffer);
+        if (time(NULL) - started[index] < 1) sleep(1); // Don't spin on a worker that dies at startup
+
+        pids[index] = spawn_worker(index, 1, worker_main);
+        started[index] = time(NULL);
+        if (pids[index] == -1) { perror("fork"); return -1; }
+    }
+}
+
+// Called by each worker once its indexes are built, so forwarded loans and
+// feedback land in a queue that is already populated.
+int start_worker_channel() {
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, channel_loop, NULL) != 0) return -1;
+    pthread_detach(thread_id);
+    return 0;
+}
+
+int worker_index() {
+    return self;
+}
+
+// --- Session Ownership ---
+
+int session_owner(const User* user) {
+    if (self == -1) return -1;
+    int owner = (user->role == CUSTOMER) ? account_shard_of(user->userId) : STAFF_WORKER;
+    return owner == self ? -1 : owner;
+}
+
+int resume_owner(const char* token) {
+    if (self == -1) return -1;
+    int owner = session_token_tag(token);
+    return (owner < 0 || owner >= worker_count || owner == self) ? -1 : owner;
+}
+
+// Passes the client to 'owner'. On success the caller closes only its own
+// descriptor; the owner now serves the connection.
+int hand_off_client(int owner, const HandedOffClient* client) {
+    WorkerMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = MSG_HAND_OFF;
+    msg.body.client = *client;
+    return send_message(owner, &msg, client->client_socket);
+}
+
+// --- Staff Queues ---
+
+void publish_loan(const Loan* loan, int record_num) {
+    if (self == -1 || self == STAFF_WORKER) { loan_queue_push(loan, record_num); return; }
+    WorkerMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = MSG_LOAN;
+    msg.recordNum = record_num;
+    msg.body.loan = *loan;
+    if (send_message(STAFF_WORKER, &msg, -1) == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Could not queue a loan with the staff worker; the server picks it up on its next restart.\n");
+    }
+}
+
+// The customer's own worker keeps their per-user index; the staff worker
+// queues the entry for review.
+void publish_feedback(const Feedback* feedback, int record_num) {
+    feedback_index_add(feedback, record_num);
+    if (self == -1 || self == STAFF_WORKER) return;
+    WorkerMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = MSG_FEEDBACK;
+    msg.recordNum = record_num;
+    msg.body.feedback = *feedback;
+    if (send_message(STAFF_WORKER, &msg, -1) == -1) {
+        write_string(STDOUT_FILENO, "ERROR: Could not queue feedback with the staff worker; the server picks it up on its next restart.\n");
+    }
+}